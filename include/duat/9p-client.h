@@ -63,6 +63,23 @@ void multiplex_add_d9c_io
          void (*on_close)  (struct d9r_io *, void *),
          void *aux);
 
+/**\brief Open Client Connection (on an open 9P Connection)
+ * \param[in,out] io        The connection to use.
+ * \param[in,out] on_attach Callback when the connection is established.
+ * \param[in,out] on_error  Callback when an error occured.
+ * \param[in,out] on_close  Callback when the connection is terminated.
+ * \param[in]     aux       Auxiliary data to pass to the callbacks.
+ *
+ * For connections opened in some other way, such as the client end of
+ * d9r_open_loopback().
+ */
+void multiplex_add_d9c_d9r
+        (struct d9r_io *io,
+         void (*on_attach) (struct d9r_io *, void *),
+         void (*on_error)  (struct d9r_io *, const char *, void *),
+         void (*on_close)  (struct d9r_io *, void *),
+         void *aux);
+
 /**\brief Open Client Connection (on a Socket)
  * \param[in]     socket    The socket to serve on.
  * \param[in,out] on_attach Callback when the connection is established.
@@ -96,10 +113,34 @@ void multiplex_add_d9c_stdio
  *
  * You should always use the multiplexer to handle the resulting I/O structure,
  * direct methods may not work properly.
+ *
+ * The file is read ahead only while the consumer keeps up: once 64KiB are
+ * waiting in the returned structure, no further data is requested until the
+ * consumer has brought that down to 16KiB. multiplex_d9c() must have been
+ * called for reading to resume.
  */
 struct io *io_open_read_9p
         (struct d9r_io *io, const char *path);
 
+/**\brief Open File for Reading over several 9P Connections.
+ * \param[in,out] ios   The 9P connections to read the file over.
+ * \param[in]     count The number of connections in ios.
+ * \param[in]     path  The file to open.
+ * \return New File I/O structure.
+ *
+ * Like io_open_read_9p(), but the file is opened once per entry in ios, and
+ * the ranges of the file are read over all of them at the same time. The
+ * data is written to the returned structure in order. The same connection
+ * may appear in ios more than once, to read through several FIDs on it.
+ *
+ * The file is stat'ed first, so this is only suitable for files with a
+ * proper length. Read-ahead stops while the consumer falls behind, as with
+ * io_open_read_9p(). Errors are reported to the error callback of the
+ * connection they occured on.
+ */
+struct io *io_open_striped_read_9p
+        (struct d9r_io **ios, int_32 count, const char *path);
+
 /**\brief Open File for Writing over 9P.
  * \param[in,out] io   The 9P connection to open a file on.
  * \param[in]     path The file to open.
@@ -124,17 +165,489 @@ struct io *io_open_write_9p
 struct io *io_open_create_9p
         (struct d9r_io *io, const char *path, const char *file, int mode);
 
-#if 0
+/**\brief Flush a 9P Write Stream
+ * \param[in,out] io9      The 9P connection the stream was opened on.
+ * \param[in]     io       A stream returned by io_open_write_9p() or
+ *                          io_open_create_9p().
+ * \param[in]     on_flush Called once everything written to the stream so
+ *                          far has been acknowledged by the server.
+ * \param[in]     aux      Auxiliary data to pass to the callback.
+ *
+ * Data written to these streams is buffered and only sent once there is
+ * enough of it to fill a whole Twrite, or when the stream is closed. This
+ * function forces out whatever is buffered. The callback receives the first
+ * error that occured on the stream, if any, or a null pointer if all the data
+ * was written successfully. Errors are also reported to the connection's
+ * error callback as they happen. A pending callback is replaced by a new call
+ * to this function.
+ */
+void d9c_flush_9p
+        (struct d9r_io *io9, struct io *io,
+         void (*on_flush) (struct d9r_io *, const char *, void *), void *aux);
 
-/* not implemented */
+/**\brief Enable the Client Data Cache
+ * \param[in,out] io    The 9P connection to cache file data for.
+ * \param[in]     limit Maximum amount of memory to use for the cache, in
+ *                      bytes.
+ *
+ * With the cache enabled, the contents of files read with io_open_read_9p()
+ * are kept in memory, keyed by the files' qid paths and tagged with their qid
+ * versions. Opening a file again still walks to it, but if the qid returned
+ * by the walk has the same version as the cached copy then the data is served
+ * from memory instead of being read again. Least recently used files are
+ * evicted once the limit is exceeded; files larger than the limit are not
+ * cached at all.
+ *
+ * Calling this function again changes the limit. The cache is freed when the
+ * connection is closed.
+ */
+void d9c_enable_cache (struct d9r_io *io, int_64 limit);
 
-struct io *d9c_stat
-        (struct d9r_io *io, const char *,
-         void (*Rstat) (int_16, int_32, struct d9r_qid, int_32, int_32, int_32,
-                        int_64, char *, char *, char *, char *, char *, void *),
-         void *);
+/**\brief Set the Directory FID Cache Size
+ * \param[in,out] io    The 9P connection to configure.
+ * \param[in]     limit Maximum number of directory FIDs to keep; 0 disables
+ *                      the cache.
+ *
+ * Walks to files in subdirectories keep a FID for the file's parent directory
+ * around, so that later walks to that directory, or to anything below it,
+ * only need to walk the remaining path elements instead of starting at the
+ * root. Directory FIDs are clunked once they are the least recently used ones
+ * beyond the limit and are not being walked from. The cache is enabled by
+ * default with a small limit.
+ *
+ * The cached FIDs keep referring to the same directories, even if these are
+ * later renamed or removed and recreated by another client.
+ */
+void d9c_set_directory_cache (struct d9r_io *io, int_32 limit);
 
-#endif
+/**\brief Client Cache Statistics
+ *
+ * Hit and miss counters for the client caches of a connection; see
+ * d9c_get_cache_statistics().
+ */
+struct d9c_cache_statistics
+{
+    /**\brief Reads served from the data cache */
+    int_64 data_hits;
+    /**\brief Reads that had to go to the server */
+    int_64 data_misses;
+    /**\brief Stats and opens that did not need a walk */
+    int_64 metadata_hits;
+    /**\brief Stats and opens that had to walk */
+    int_64 metadata_misses;
+    /**\brief Lookups answered by a cached "does not exist" */
+    int_64 negative_hits;
+};
+
+/**\brief Enable the Client Metadata Cache
+ * \param[in,out] io           The 9P connection to cache metadata for.
+ * \param[in]     ttl          Seconds to trust a successful walk or stat.
+ * \param[in]     negative_ttl Seconds to trust a failed walk.
+ * \param[in]     limit        Maximum number of paths to remember.
+ *
+ * With this cache enabled, the results of walks and stats are remembered per
+ * path. A cached stat is returned by d9c_stat() without contacting the server,
+ * and the fid it was obtained with is kept so that a subsequent open of the
+ * same path can skip the walk. Paths that failed to walk with "No such file or
+ * directory" are remembered as well, so that repeated lookups of missing files
+ * fail immediately: read streams of them just end, and write streams report
+ * the error when flushed; the connection's error callback is left out of it.
+ * Entries are dropped once their TTL expires, when the
+ * limit is exceeded (oldest first), and when this client writes to or creates
+ * in the path; changes by other clients are only noticed after the TTL.
+ *
+ * Calling this function again changes the parameters. The cache is freed when
+ * the connection is closed.
+ */
+void d9c_enable_metadata_cache
+        (struct d9r_io *io, int_32 ttl, int_32 negative_ttl, int_32 limit);
+
+/**\brief Query Client Cache Statistics
+ * \param[in]  io The 9P connection to query.
+ * \param[out] st Where to store the counters.
+ */
+void d9c_get_cache_statistics
+        (struct d9r_io *io, struct d9c_cache_statistics *st);
+
+/**\brief Stat a File over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     path     The file to stat.
+ * \param[in]     on_stat  Called with the file's stat.
+ * \param[in]     on_error Called instead if the file can't be stat'ed.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ *
+ * If the metadata cache is enabled, the callbacks may be invoked before this
+ * function returns.
+ */
+void d9c_stat
+        (struct d9r_io *io, const char *path,
+         void (*on_stat) (struct d9r_io *, int_16, int_32, struct d9r_qid,
+                          int_32, int_32, int_32, int_64, char *, char *,
+                          char *, char *, char *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Walk to a File over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      The FID to walk from, or NO_FID_9P for the root.
+ * \param[in]     path     The path to walk, relative to fid.
+ * \param[in]     on_walk  Called with the new FID and the qid of the file it
+ *                          refers to.
+ * \param[in]     on_error Called instead if the walk fails.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ * \return The new FID, or NO_FID_9P if the request could not be sent.
+ *
+ * This and the following functions send a single 9P request and call one of
+ * their callbacks once the reply arrives. The returned FID may be used with
+ * other requests right away, since the server processes requests in order;
+ * if the walk fails, those requests fail as well. An empty path clones fid,
+ * in which case the qid passed to on_walk is all zeroes.
+ *
+ * Any number of requests may be in flight on a connection at the same time,
+ * up to the 65535 tags 9P allows. The completion contexts come from a memory
+ * pool, so there is no allocation per request once the pool is warm.
+ */
+int_32 d9c_walk
+        (struct d9r_io *io, int_32 fid, const char *path,
+         void (*on_walk) (struct d9r_io *, int_32, struct d9r_qid, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Open a FID over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      The FID to open.
+ * \param[in]     mode     The P9_O* mode to open the FID with.
+ * \param[in]     on_open  Called with the file's qid and iounit.
+ * \param[in]     on_error Called instead if the file can't be opened.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ */
+void d9c_open
+        (struct d9r_io *io, int_32 fid, int_8 mode,
+         void (*on_open) (struct d9r_io *, struct d9r_qid, int_32, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Create a File over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      A FID for the directory to create the file in; it
+ *                          refers to the new, open file afterwards.
+ * \param[in]     name     The name of the new file.
+ * \param[in]     perm     The new file's permissions.
+ * \param[in]     mode     The P9_O* mode to open the file with.
+ * \param[in]     on_open  Called with the file's qid and iounit.
+ * \param[in]     on_error Called instead if the file can't be created.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ */
+void d9c_create
+        (struct d9r_io *io, int_32 fid, const char *name, int_32 perm,
+         int_8 mode,
+         void (*on_open) (struct d9r_io *, struct d9r_qid, int_32, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Read from a FID over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      An open FID to read from.
+ * \param[in]     offset   Where to start reading.
+ * \param[in]     count    How much to read at most; larger counts are cut
+ *                          down to what fits in a single message.
+ * \param[in]     on_read  Called with the data; a count of 0 means EOF. The
+ *                          data is only valid during the callback.
+ * \param[in]     on_error Called instead if the read fails.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ */
+void d9c_read
+        (struct d9r_io *io, int_32 fid, int_64 offset, int_32 count,
+         void (*on_read) (struct d9r_io *, int_32, int_8 *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Write to a FID over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      An open FID to write to.
+ * \param[in]     offset   Where to start writing.
+ * \param[in]     count    How much to write; larger counts are cut down to
+ *                          what fits in a single message.
+ * \param[in]     data     The data to write; it is copied right away.
+ * \param[in]     on_write Called with the number of bytes written.
+ * \param[in]     on_error Called instead if the write fails.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ */
+void d9c_write
+        (struct d9r_io *io, int_32 fid, int_64 offset, int_32 count,
+         int_8 *data,
+         void (*on_write) (struct d9r_io *, int_32, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Stat a FID over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      The FID to stat.
+ * \param[in]     on_stat  Called with the file's stat.
+ * \param[in]     on_error Called instead if the stat fails.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ *
+ * Unlike d9c_stat(), this never uses the metadata cache.
+ */
+void d9c_stat_fid
+        (struct d9r_io *io, int_32 fid,
+         void (*on_stat) (struct d9r_io *, int_16, int_32, struct d9r_qid,
+                          int_32, int_32, int_32, int_64, char *, char *,
+                          char *, char *, char *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Change a File's Stat over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      The FID to change the stat of.
+ * \param[in]     on_done  Called once the stat has been changed.
+ * \param[in]     on_error Called instead if it could not be changed.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ *
+ * The remaining parameters are the stat fields, as for d9r_wstat(); use ~0
+ * and empty strings for fields that should stay the same.
+ */
+void d9c_wstat
+        (struct d9r_io *io, int_32 fid, int_16 type, int_32 dev,
+         struct d9r_qid qid, int_32 mode, int_32 atime, int_32 mtime,
+         int_64 length, char *name, char *uid, char *gid, char *muid,
+         char *ex,
+         void (*on_done) (struct d9r_io *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Remove a File over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      The FID of the file to remove; it is clunked in
+ *                          any case.
+ * \param[in]     on_done  Called once the file has been removed.
+ * \param[in]     on_error Called instead if it could not be removed.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ */
+void d9c_remove
+        (struct d9r_io *io, int_32 fid,
+         void (*on_done) (struct d9r_io *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Clunk a FID over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      The FID to clunk.
+ * \param[in]     on_done  Called once the server has acknowledged the clunk.
+ * \param[in]     on_error Called instead if the server complained.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ */
+void d9c_clunk
+        (struct d9r_io *io, int_32 fid,
+         void (*on_done) (struct d9r_io *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Find the Host File behind a FID
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      A FID opened for reading.
+ * \param[in]     on_local Called with the path of the host file; it is only
+ *                          valid during the callback.
+ * \param[in]     on_error Called instead if the file has no host file, or if
+ *                          the server doesn't support D9R_EXTENSION_LOCAL.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ *
+ * Lets clients on the same host as the server read a file directly. The
+ * extension is requested on all client connections, and io_open_read_9p()
+ * uses it by itself whenever the server agreed to it, the file has a host
+ * file and the data cache is disabled; the data is then read from the host
+ * file while the FID is held open, and only the walk, open and clunk go over
+ * the connection. Whether a file has a host file is told by QTLOCAL in the
+ * qid that opening it returns, so it's only worth calling this for those.
+ *
+ * As the path tells the client where the server keeps its files, the duat
+ * server only answers this on loopbacks, and on connections whose
+ * d9r_io.peer_uid it has been told, e.g. from the credentials of the unix
+ * socket they came in on, and then only for files owned by that host user.
+ * Everywhere else, QTLOCAL isn't set and on_error is called.
+ */
+void d9c_local
+        (struct d9r_io *io, int_32 fid,
+         void (*on_local) (struct d9r_io *, const char *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Read part of a File by Path over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     path     The file to read.
+ * \param[in]     offset   Where to start reading.
+ * \param[in]     count    How much to read at most, as for d9c_read().
+ * \param[in]     on_read  Called with the data, as for d9c_read().
+ * \param[in]     on_error Called instead if any of the steps fail.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ *
+ * Walks to the file, opens it, reads from it and clunks it again. If the
+ * server supports D9R_EXTENSION_COMPOUND, all of that is sent as a single
+ * compound request, which takes one round trip instead of four; otherwise
+ * each step waits for the previous one. Meant for small files, or the start
+ * of them. io_open_read_9p() sends its walk, open and first read in the same
+ * way, and reads the rest of files with a host file behind them from that, as
+ * described for d9c_local().
+ */
+void d9c_fetch
+        (struct d9r_io *io, const char *path, int_64 offset, int_32 count,
+         void (*on_read) (struct d9r_io *, int_32, int_8 *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Look up many Paths over 9P
+ * \param[in,out] io      The 9P connection to use.
+ * \param[in]     fid     The FID to walk from, or NO_FID_9P for the root.
+ * \param[in]     count   The number of paths.
+ * \param[in]     paths   The paths to look up, relative to fid.
+ * \param[in]     on_path Called once per path with its index, the number of
+ *                        path elements that could be walked, the number of
+ *                        elements in the path and the qid of the last one.
+ * \param[in]     on_done Called after on_path has been called for each path.
+ * \param[in]     aux     Auxiliary data to pass to the callbacks.
+ *
+ * Meant for checking whether a lot of files exist. If the server supports
+ * D9R_EXTENSION_MULTIWALK, the paths are sent as few Tmultiwalk messages as
+ * the message size allows, all at once, and no FIDs are used; otherwise each
+ * path is walked and clunked by itself. A path exists if it could be walked
+ * all the way. The on_path calls need not be in order.
+ */
+void d9c_multiwalk
+        (struct d9r_io *io, int_32 fid, int_32 count, const char **paths,
+         void (*on_path) (struct d9r_io *, int_32, int_16, int_16,
+                          struct d9r_qid, void *),
+         void (*on_done) (struct d9r_io *, void *),
+         void *aux);
+
+/**\brief Hash a File's Contents over 9P
+ * \param[in,out] io        The 9P connection to use.
+ * \param[in]     fid       A FID for the file, opened for reading.
+ * \param[in]     offset    Where to start hashing.
+ * \param[in]     length    How much to hash, or ~0 for the rest of the file.
+ * \param[in]     blocksize The size of the blocks to hash as well, or 0.
+ * \param[in]     on_hash   Called with the SHA-256 hash of the range, the
+ *                          number of blocks and their weak checksums and
+ *                          SHA-256 hashes, the latter one after another.
+ * \param[in]     on_error  Called instead if the file can't be hashed.
+ * \param[in]     aux       Auxiliary data to pass to the callbacks.
+ *
+ * The hashes are computed on the server, which needs to support
+ * D9R_EXTENSION_HASH, and cached there until the file changes, so comparing
+ * the hash with that of a local copy is a lot cheaper than reading the file.
+ * The reply may have fewer blocks than the range has if they don't all fit
+ * into a message; ask for the rest with another call. A range of just the
+ * blocks that fit avoids hashing the rest of it for nothing.
+ */
+void d9c_hash
+        (struct d9r_io *io, int_32 fid, int_64 offset, int_64 length,
+         int_32 blocksize,
+         void (*on_hash) (struct d9r_io *, int_8 *, int_16, int_32 *, int_8 *,
+                          void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Update a File over 9P with only the Blocks that differ
+ * \param[in,out] io        The 9P connection to use.
+ * \param[in]     fid       A FID for the file, opened for reading and
+ *                          writing.
+ * \param[in]     data      What the file should contain.
+ * \param[in]     length    Length of data.
+ * \param[in]     blocksize The size of the blocks to compare, or 0 for a
+ *                          default of 4 KiB.
+ * \param[in]     on_done   Called once the file matches data, with the
+ *                          number of bytes that had to be written.
+ * \param[in]     on_error  Called instead if the update fails.
+ * \param[in]     aux       Auxiliary data to pass to the callbacks.
+ *
+ * The server's weak checksums and SHA-256 hashes of the file's blocks are
+ * fetched with d9c_hash(), and a window the size of a block is rolled over
+ * data to look for them at any offset, with the weak checksum first so that
+ * only likely matches get hashed. Blocks found where they already are cost
+ * nothing, so a small change to a large file only costs a few writes on top
+ * of the signatures. With D9R_EXTENSION_COPY, blocks found further on in the
+ * file are moved into place with a Tcopy instead of being written, which
+ * takes care of data that has been cut out of the middle; if the server
+ * refuses one of those, the block is written instead, and so are the blocks
+ * after it. Everything else is written, and the file is cut down to length
+ * with a Twstat if it was longer; on_error is called if the server won't.
+ * Without D9R_EXTENSION_HASH, all of data is written. The data must not
+ * change until either callback is called.
+ */
+void d9c_sync
+        (struct d9r_io *io, int_32 fid, const int_8 *data, int_64 length,
+         int_32 blocksize,
+         void (*on_done) (struct d9r_io *, int_64, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Copy Data between Files on a 9P Server
+ * \param[in,out] io        The 9P connection to use.
+ * \param[in]     fid       The file to copy to, opened for writing.
+ * \param[in]     offset    Where to write the data.
+ * \param[in]     srcfid    The file to copy from, opened for reading.
+ * \param[in]     srcoffset Where to start reading.
+ * \param[in]     length    How much to copy, or ~0 for the rest of srcfid.
+ * \param[in]     on_copy   Called with the number of bytes copied.
+ * \param[in]     on_error  Called instead if the copy fails.
+ * \param[in]     aux       Auxiliary data to pass to the callbacks.
+ *
+ * With D9R_EXTENSION_COPY, the server copies the data itself, which takes a
+ * single round trip however much there is. Otherwise it's read and written
+ * back one message at a time.
+ */
+void d9c_copy
+        (struct d9r_io *io, int_32 fid, int_64 offset, int_32 srcfid,
+         int_64 srcoffset, int_64 length,
+         void (*on_copy) (struct d9r_io *, int_64, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Search a Tree over 9P
+ * \param[in,out] io        The 9P connection to use.
+ * \param[in]     fid       The directory to search, or NO_FID_9P for the root.
+ * \param[in]     pattern   Glob the names need to match, or "" for any name.
+ * \param[in]     types     D9R_FIND_* flags of the node types to find, or 0.
+ * \param[in]     minlength Smallest length to find.
+ * \param[in]     maxlength Largest length to find, or ~0 for no limit.
+ * \param[in]     after     Earliest modification time to find.
+ * \param[in]     before    Latest modification time to find, or ~0.
+ * \param[in]     on_entry  Called with the stat of each match; the name is
+ *                          the path relative to fid.
+ * \param[in]     on_done   Called after the last match.
+ * \param[in]     on_error  Called instead of on_done if the search fails.
+ * \param[in]     aux       Auxiliary data to pass to the callbacks.
+ *
+ * The search runs on the server, which needs to support D9R_EXTENSION_FIND;
+ * the matches are read back like a directory listing, with as many of them
+ * in each reply as fit, so searching a large tree takes a handful of round
+ * trips rather than a walk and a listing for each directory in it.
+ */
+void d9c_find
+        (struct d9r_io *io, int_32 fid, const char *pattern, int_32 types,
+         int_64 minlength, int_64 maxlength, int_32 after, int_32 before,
+         void (*on_entry) (struct d9r_io *, int_16, int_32, struct d9r_qid,
+                           int_32, int_32, int_32, int_64, char *, char *,
+                           char *, char *, char *, void *),
+         void (*on_done) (struct d9r_io *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
+
+/**\brief Read a Directory over 9P
+ * \param[in,out] io       The 9P connection to use.
+ * \param[in]     fid      A FID for the directory, opened for reading.
+ * \param[in]     on_entry Called with the stat of each directory entry.
+ * \param[in]     on_done  Called after the last entry.
+ * \param[in]     on_error Called instead of on_done if reading fails.
+ * \param[in]     aux      Auxiliary data to pass to the callbacks.
+ */
+void d9c_readdir
+        (struct d9r_io *io, int_32 fid,
+         void (*on_entry) (struct d9r_io *, int_16, int_32, struct d9r_qid,
+                           int_32, int_32, int_32, int_64, char *, char *,
+                           char *, char *, char *, void *),
+         void (*on_done) (struct d9r_io *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,744 @@
+/**\defgroup Duat9PCoroutines 9P2000 Client Coroutines
+ * \ingroup Duat9PClient
+ *
+ * @{
+ */
+
+/**\file
+ * \brief Duat 9P2000 Client Coroutine Bindings
+ *
+ * Header-only C++20 bindings for the asynchronous client requests declared in
+ * duat/9p-client.h. Every request becomes an awaitable, so that a sequence of
+ * requests can be written as a coroutine instead of a chain of callbacks.
+ * Coroutine frames are allocated from a pool, and any number of coroutines
+ * may share one connection.
+ *
+ * Like the rest of duat, all of this is meant to be driven by the Curie
+ * multiplexer in a single thread.
+ *
+ * \copyright
+ * Copyright (c) 2008-2014, Kyuba Project Members
+ * \copyright
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * \copyright
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * \copyright
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \see Project Documentation: http://ef.gy/documentation/duat
+ * \see Project Source Code: http://git.becquerel.org/kyuba/duat.git
+ */
+
+#if !defined(DUAT_9P_CLIENT_HPP)
+#define DUAT_9P_CLIENT_HPP
+
+#include <duat/9p-client.h>
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace duat
+{
+    /**\brief 9P Error
+     *
+     * Thrown when awaiting a request that the server answered with an Rerror,
+     * or that could not be sent in the first place.
+     */
+    class error : public std::runtime_error
+    {
+        public:
+            explicit error (const char *message)
+                : std::runtime_error (message) {}
+    };
+
+    /**\brief File Stat
+     *
+     * The fields of a 9P stat, with the strings copied out of the message.
+     */
+    struct stat
+    {
+        int_16         type;
+        int_32         dev;
+        struct d9r_qid qid;
+        int_32         mode;
+        int_32         atime;
+        int_32         mtime;
+        int_64         length;
+        std::string    name;
+        std::string    uid;
+        std::string    gid;
+        std::string    muid;
+        std::string    ex;
+    };
+
+    /**\brief Result of an Open or Create */
+    struct opened
+    {
+        struct d9r_qid qid;
+        int_32         iounit;
+    };
+
+    namespace detail
+    {
+        /**\brief Coroutine frame pool
+         *
+         * Keeps freed frames on per-size free lists, in 64 byte steps, so that
+         * starting a coroutine does not normally hit the general allocator.
+         * Frames larger than 4KiB are not pooled.
+         */
+        class frame_pool
+        {
+            public:
+                static void *allocate (std::size_t size)
+                {
+                    std::size_t b = bucket (size);
+
+                    if (b >= buckets)
+                    {
+                        return ::operator new (size);
+                    }
+
+                    block *&h = head (b);
+
+                    if (h != nullptr)
+                    {
+                        block *r = h;
+                        h = r->next;
+                        return r;
+                    }
+
+                    return ::operator new (b * granularity);
+                }
+
+                static void deallocate (void *p, std::size_t size)
+                {
+                    std::size_t b = bucket (size);
+
+                    if (b >= buckets)
+                    {
+                        ::operator delete (p);
+                        return;
+                    }
+
+                    block *r = static_cast<block *> (p);
+                    r->next = head (b);
+                    head (b) = r;
+                }
+
+            private:
+                struct block
+                {
+                    block *next;
+                };
+
+                static constexpr std::size_t granularity = 64;
+                static constexpr std::size_t buckets     = 65;
+
+                static std::size_t bucket (std::size_t size)
+                {
+                    return (size + granularity - 1) / granularity;
+                }
+
+                static block *&head (std::size_t b)
+                {
+                    static block *heads[buckets] = {};
+
+                    return heads[b];
+                }
+        };
+
+        struct promise_base
+        {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr      exception;
+            bool                    detached = false;
+
+            static void *operator new (std::size_t size)
+            {
+                return frame_pool::allocate (size);
+            }
+
+            static void operator delete (void *p, std::size_t size)
+            {
+                frame_pool::deallocate (p, size);
+            }
+
+            std::suspend_always initial_suspend () noexcept { return {}; }
+
+            struct final_awaiter
+            {
+                bool await_ready () noexcept { return false; }
+
+                template <typename P>
+                std::coroutine_handle<> await_suspend
+                    (std::coroutine_handle<P> h) noexcept
+                {
+                    promise_base &p = h.promise ();
+
+                    if (p.detached)
+                    {
+                        h.destroy ();
+                        return std::noop_coroutine ();
+                    }
+
+                    if (p.continuation)
+                    {
+                        return p.continuation;
+                    }
+
+                    return std::noop_coroutine ();
+                }
+
+                void await_resume () noexcept {}
+            };
+
+            final_awaiter final_suspend () noexcept { return {}; }
+
+            void unhandled_exception ()
+            {
+                if (detached)
+                {
+                    std::terminate ();
+                }
+
+                exception = std::current_exception ();
+            }
+        };
+
+        template <typename T> struct promise;
+    }
+
+    /**\brief Coroutine Task
+     *
+     * The return type of coroutines that use the awaitables below. Tasks start
+     * when they are awaited, or when they are handed to spawn(); awaiting a
+     * task yields its result, or rethrows the exception it ended with.
+     */
+    template <typename T = void>
+    class task
+    {
+        public:
+            using promise_type = detail::promise<T>;
+            using handle_type  = std::coroutine_handle<promise_type>;
+
+            explicit task (handle_type h) : handle (h) {}
+            task (task &&t) noexcept : handle (std::exchange (t.handle, {})) {}
+            task (const task &) = delete;
+            task &operator = (const task &) = delete;
+
+            ~task ()
+            {
+                if (handle)
+                {
+                    handle.destroy ();
+                }
+            }
+
+            bool await_ready () const noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend
+                (std::coroutine_handle<> c) noexcept
+            {
+                handle.promise ().continuation = c;
+
+                return handle;
+            }
+
+            T await_resume ()
+            {
+                promise_type &p = handle.promise ();
+
+                if (p.exception)
+                {
+                    std::rethrow_exception (p.exception);
+                }
+
+                if constexpr (!std::is_void_v<T>)
+                {
+                    return std::move (*p.value);
+                }
+            }
+
+            /**\brief Start the task without awaiting it
+             *
+             * The task's frame is freed when it finishes. Exceptions that leave
+             * a detached task terminate the programme.
+             */
+            void detach ()
+            {
+                handle_type h = std::exchange (handle, {});
+
+                h.promise ().detached = true;
+                h.resume ();
+            }
+
+        private:
+            handle_type handle;
+    };
+
+    namespace detail
+    {
+        template <typename T>
+        struct promise : promise_base
+        {
+            std::optional<T> value;
+
+            task<T> get_return_object ()
+            {
+                return task<T>
+                    (std::coroutine_handle<promise>::from_promise (*this));
+            }
+
+            void return_value (T v) { value = std::move (v); }
+        };
+
+        template <>
+        struct promise<void> : promise_base
+        {
+            task<void> get_return_object ()
+            {
+                return task<void>
+                    (std::coroutine_handle<promise>::from_promise (*this));
+            }
+
+            void return_void () {}
+        };
+
+        /**\brief Request awaitable
+         *
+         * Common part of the awaitables: start() sends the request, and one of
+         * the callbacks completes it. The callbacks may run before start()
+         * returns, e.g. when a result comes from a cache, in which case the
+         * awaiting coroutine simply isn't suspended.
+         */
+        template <typename D>
+        struct request
+        {
+            std::coroutine_handle<> handle;
+            bool                    suspended = false;
+            bool                    done      = false;
+            std::optional<error>    failure;
+
+            bool await_ready () const noexcept { return false; }
+
+            bool await_suspend (std::coroutine_handle<> h)
+            {
+                handle = h;
+
+                static_cast<D *> (this)->start ();
+
+                if (done)
+                {
+                    return false;
+                }
+
+                suspended = true;
+
+                return true;
+            }
+
+            void check ()
+            {
+                if (failure)
+                {
+                    throw *failure;
+                }
+            }
+
+            void complete ()
+            {
+                done = true;
+
+                if (suspended)
+                {
+                    handle.resume ();
+                }
+            }
+
+            static D *self (void *aux) { return static_cast<D *> (aux); }
+
+            static void on_error (struct d9r_io *, const char *e, void *aux)
+            {
+                self (aux)->failure.emplace (e);
+                self (aux)->complete ();
+            }
+
+            static void on_done (struct d9r_io *, void *aux)
+            {
+                self (aux)->complete ();
+            }
+
+            static void on_stat
+                (struct d9r_io *, int_16 type, int_32 dev, struct d9r_qid qid,
+                 int_32 mode, int_32 atime, int_32 mtime, int_64 length,
+                 char *name, char *uid, char *gid, char *muid, char *ex,
+                 void *aux)
+            {
+                self (aux)->add_stat
+                    (duat::stat { type, dev, qid, mode, atime, mtime, length,
+                                  name ? name : "", uid ? uid : "",
+                                  gid ? gid : "", muid ? muid : "",
+                                  ex ? ex : "" });
+            }
+        };
+
+        struct walk : request<walk>
+        {
+            struct d9r_io *io;
+            int_32         fid;
+            std::string    path;
+            int_32         newfid = NO_FID_9P;
+
+            void start ()
+            {
+                d9c_walk (io, fid, path.c_str (), on_walk, on_error, this);
+            }
+
+            static void on_walk
+                (struct d9r_io *, int_32 f, struct d9r_qid, void *aux)
+            {
+                self (aux)->newfid = f;
+                self (aux)->complete ();
+            }
+
+            int_32 await_resume () { check (); return newfid; }
+        };
+
+        struct open : request<open>
+        {
+            struct d9r_io *io;
+            int_32         fid;
+            int_8          mode;
+            const char    *name = nullptr;
+            int_32         perm = 0;
+            opened         result {};
+
+            void start ()
+            {
+                if (name != nullptr)
+                {
+                    d9c_create (io, fid, name, perm, mode, on_open, on_error,
+                                this);
+                }
+                else
+                {
+                    d9c_open (io, fid, mode, on_open, on_error, this);
+                }
+            }
+
+            static void on_open
+                (struct d9r_io *, struct d9r_qid q, int_32 iounit, void *aux)
+            {
+                self (aux)->result = opened { q, iounit };
+                self (aux)->complete ();
+            }
+
+            opened await_resume () { check (); return result; }
+        };
+
+        struct read : request<read>
+        {
+            struct d9r_io     *io;
+            int_32             fid;
+            int_64             offset;
+            int_32             count;
+            std::vector<int_8> data;
+
+            void start ()
+            {
+                d9c_read (io, fid, offset, count, on_read, on_error, this);
+            }
+
+            static void on_read
+                (struct d9r_io *, int_32 c, int_8 *d, void *aux)
+            {
+                self (aux)->data.assign (d, d + c);
+                self (aux)->complete ();
+            }
+
+            std::vector<int_8> await_resume ()
+            {
+                check ();
+                return std::move (data);
+            }
+        };
+
+        struct write : request<write>
+        {
+            struct d9r_io *io;
+            int_32         fid;
+            int_64         offset;
+            int_32         count;
+            const int_8   *data;
+            int_32         written = 0;
+
+            void start ()
+            {
+                d9c_write (io, fid, offset, count, const_cast<int_8 *> (data),
+                           on_write, on_error, this);
+            }
+
+            static void on_write (struct d9r_io *, int_32 c, void *aux)
+            {
+                self (aux)->written = c;
+                self (aux)->complete ();
+            }
+
+            int_32 await_resume () { check (); return written; }
+        };
+
+        struct stat : request<stat>
+        {
+            struct d9r_io *io;
+            int_32         fid;
+            std::string    path;
+            duat::stat     result {};
+
+            void start ()
+            {
+                if (fid == NO_FID_9P)
+                {
+                    d9c_stat (io, path.c_str (), on_stat, on_error, this);
+                }
+                else
+                {
+                    d9c_stat_fid (io, fid, on_stat, on_error, this);
+                }
+            }
+
+            void add_stat (duat::stat &&s)
+            {
+                result = std::move (s);
+                complete ();
+            }
+
+            duat::stat await_resume () { check (); return std::move (result); }
+        };
+
+        struct readdir : request<readdir>
+        {
+            struct d9r_io          *io;
+            int_32                  fid;
+            std::vector<duat::stat> entries;
+
+            void start ()
+            {
+                d9c_readdir (io, fid, on_stat, on_done, on_error, this);
+            }
+
+            void add_stat (duat::stat &&s) { entries.push_back (std::move (s)); }
+
+            std::vector<duat::stat> await_resume ()
+            {
+                check ();
+                return std::move (entries);
+            }
+        };
+
+        struct simple : request<simple>
+        {
+            enum { wstat, remove, clunk } op;
+            struct d9r_io *io;
+            int_32         fid;
+            duat::stat     s {};
+
+            void start ()
+            {
+                switch (op)
+                {
+                    case wstat:
+                        d9c_wstat (io, fid, s.type, s.dev, s.qid, s.mode,
+                                   s.atime, s.mtime, s.length, s.name.data (),
+                                   s.uid.data (), s.gid.data (),
+                                   s.muid.data (), s.ex.data (),
+                                   on_done, on_error, this);
+                        break;
+                    case remove:
+                        d9c_remove (io, fid, on_done, on_error, this);
+                        break;
+                    case clunk:
+                        d9c_clunk (io, fid, on_done, on_error, this);
+                        break;
+                }
+            }
+
+            void await_resume () { check (); }
+        };
+    }
+
+    /**\brief 9P Client Connection
+     *
+     * A thin wrapper around a connection set up with one of the
+     * multiplex_add_d9c_*() functions; the connection is not owned. Each
+     * member function returns an awaitable that sends one request when it is
+     * awaited and throws duat::error if the request fails.
+     */
+    class connection
+    {
+        public:
+            explicit connection (struct d9r_io *io) : io (io) {}
+
+            /**\brief Walk from fid, or from the root, to path
+             * \return Awaitable yielding the new FID. */
+            detail::walk walk (std::string path, int_32 fid = NO_FID_9P)
+            {
+                detail::walk w;
+                w.io   = io;
+                w.fid  = fid;
+                w.path = std::move (path);
+                return w;
+            }
+
+            /**\brief Open a FID
+             * \return Awaitable yielding the qid and iounit. */
+            detail::open open (int_32 fid, int_8 mode)
+            {
+                detail::open o;
+                o.io   = io;
+                o.fid  = fid;
+                o.mode = mode;
+                return o;
+            }
+
+            /**\brief Create a file in the directory fid refers to
+             * \note name must stay valid until the request has been sent,
+             *       i.e. until it is first awaited.
+             * \return Awaitable yielding the qid and iounit. */
+            detail::open create
+                (int_32 fid, const char *name, int_32 perm, int_8 mode)
+            {
+                detail::open o;
+                o.io   = io;
+                o.fid  = fid;
+                o.mode = mode;
+                o.name = name;
+                o.perm = perm;
+                return o;
+            }
+
+            /**\brief Read from an open FID
+             * \return Awaitable yielding the data; empty at EOF. */
+            detail::read read (int_32 fid, int_64 offset, int_32 count)
+            {
+                detail::read r;
+                r.io     = io;
+                r.fid    = fid;
+                r.offset = offset;
+                r.count  = count;
+                return r;
+            }
+
+            /**\brief Write to an open FID
+             * \note data must stay valid until the request has been sent.
+             * \return Awaitable yielding the number of bytes written. */
+            detail::write write
+                (int_32 fid, int_64 offset, const int_8 *data, int_32 count)
+            {
+                detail::write w;
+                w.io     = io;
+                w.fid    = fid;
+                w.offset = offset;
+                w.data   = data;
+                w.count  = count;
+                return w;
+            }
+
+            /**\brief Stat a FID
+             * \return Awaitable yielding the stat. */
+            detail::stat stat (int_32 fid)
+            {
+                detail::stat s;
+                s.io  = io;
+                s.fid = fid;
+                return s;
+            }
+
+            /**\brief Stat a path, using the metadata cache if enabled
+             * \return Awaitable yielding the stat. */
+            detail::stat stat (std::string path)
+            {
+                detail::stat s;
+                s.io   = io;
+                s.fid  = NO_FID_9P;
+                s.path = std::move (path);
+                return s;
+            }
+
+            /**\brief Change the stat of a FID */
+            detail::simple wstat (int_32 fid, duat::stat s)
+            {
+                detail::simple r;
+                r.op  = detail::simple::wstat;
+                r.io  = io;
+                r.fid = fid;
+                r.s   = std::move (s);
+                return r;
+            }
+
+            /**\brief Remove the file a FID refers to */
+            detail::simple remove (int_32 fid)
+            {
+                detail::simple r;
+                r.op  = detail::simple::remove;
+                r.io  = io;
+                r.fid = fid;
+                return r;
+            }
+
+            /**\brief Clunk a FID */
+            detail::simple clunk (int_32 fid)
+            {
+                detail::simple r;
+                r.op  = detail::simple::clunk;
+                r.io  = io;
+                r.fid = fid;
+                return r;
+            }
+
+            /**\brief Read all entries of a directory opened for reading
+             * \return Awaitable yielding the entries' stats. */
+            detail::readdir readdir (int_32 fid)
+            {
+                detail::readdir r;
+                r.io  = io;
+                r.fid = fid;
+                return r;
+            }
+
+            struct d9r_io *io;
+    };
+
+    /**\brief Run a task in the background
+     * \param[in] t The task to run.
+     *
+     * The task starts right away and runs until its first suspension point;
+     * the multiplexer drives it from there.
+     */
+    inline void spawn (task<void> &&t)
+    {
+        t.detach ();
+    }
+}
+
+#endif
+
+/** @} */
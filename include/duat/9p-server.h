@@ -54,17 +54,38 @@ void multiplex_d9s ();
  * \param[in]     in     The input structure.
  * \param[in]     out    The output structure.
  * \param[in,out] root   The filesystem root to serve.
+ *
+ * These may lead to another host, maybe over a slow link, so clients are
+ * offered D9R_EXTENSION_COMPRESS.
  */
 void multiplex_add_d9s_io (struct io *in, struct io *out, struct dfs *root);
 
+/**\brief Serve a VFS Tree on an open 9P Connection
+ * \param[in,out] io     The connection to serve on, such as the server end of
+ *                       d9r_open_loopback().
+ * \param[in,out] root   The filesystem root to serve.
+ *
+ * Clients on these connections are taken to be on the same host, so they're
+ * offered D9R_EXTENSION_LOCAL; host paths are only given out if the
+ * connection's d9r_io.peer_uid is set, though.
+ */
+void multiplex_add_d9s_d9r (struct d9r_io *io, struct dfs *root);
+
 /**\brief Serve a VFS Tree on a Socket
  * \param[in]     socket The socket to serve on.
  * \param[in,out] root   The filesystem root to serve.
+ *
+ * This is a Unix socket, so clients connecting to it are offered
+ * D9R_EXTENSION_LOCAL. Who they are isn't known, however, so they aren't
+ * told any host paths; accept the connections yourself, set their
+ * d9r_io.peer_uid and pass them to multiplex_add_d9s_d9r() for that.
  */
 void multiplex_add_d9s_socket (char *socket, struct dfs *root);
 
 /**\brief Serve a VFS Tree on Standard I/O
  * \param[in,out] root   The filesystem root to serve.
+ *
+ * Like multiplex_add_d9s_io(), this offers D9R_EXTENSION_COMPRESS.
  */
 void multiplex_add_d9s_stdio (struct dfs *root);
 
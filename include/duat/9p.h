@@ -92,6 +92,10 @@ extern "C" {
 #define QTTMP       ((int_8) 0x04)
 /**\brief File is a Symlink */
 #define QTLINK      ((int_8) 0x02)
+/**\brief File has a Host File behind it
+ *
+ * Only set in Ropen replies on connections with D9R_EXTENSION_LOCAL. */
+#define QTLOCAL     ((int_8) 0x01)
 /**\brief File is a regular File */
 #define QTFILE      ((int_8) 0x00)
 
@@ -171,6 +175,172 @@ extern "C" {
 /**\brief 9p2000.u Dummy Error Code */
 #define P9_EDONTCARE   0
 
+/**\defgroup P9Extensions Duat Protocol Extensions
+ * \brief Extensions negotiated with Tversion
+ *
+ * Extensions are requested by appending their names to the version string
+ * of a Tversion message, each preceded by a '+', as in "9P2000+local". The
+ * server replies with the ones it agrees to use, in the same way. Servers
+ * that don't know about extensions see an unknown version suffix and answer
+ * with plain "9P2000", so none of them are used with those.
+ *
+ * @{
+ */
+
+/**\brief Extension: Local File Access ("local")
+ *
+ * Adds the Tlocal and Rlocal messages: Tlocal[fid] asks for the host path of
+ * the file backing an open fid, so that a client on the same host can read it
+ * directly instead of having the data sent over the connection. Ropen sets
+ * QTLOCAL in the type of the qid of files opened for reading that have such a
+ * path, so that clients don't have to ask about the others. The duat server
+ * only gives out paths to clients it knows the host user of; see
+ * d9r_io.peer_uid.
+ */
+#define D9R_EXTENSION_LOCAL ((int_32)0x00000001)
+
+/**rief Peer: Unknown
+ *
+ * d9r_io.peer_uid of connections whose other end could be anyone.
+ */
+#define D9R_PEER_UNKNOWN ((int_32)-1)
+
+/**rief Peer: Same Process
+ *
+ * d9r_io.peer_uid of loopback connections, which both ends of are in the same
+ * process.
+ */
+#define D9R_PEER_SELF ((int_32)-2)
+
+/**\brief Extension: Compound Requests ("compound")
+ *
+ * Adds the Tcompound and Rcompound messages: Tcompound[count[2] messages]
+ * carries a number of complete T-messages, which the server runs in order
+ * as if they had arrived one after another, and replies to individually.
+ * After the first one that fails, with an Rerror or a partial Rwalk, the
+ * remaining ones are answered with an Rerror without being run, except for
+ * Tclunks, which are always run so that no fids are leaked. Rcompound[count[2]]
+ * follows the replies, with the number of messages that were run.
+ *
+ * This lets a client send dependent requests, such as a walk to a new fid
+ * and an open, read and clunk of that fid, in a single round trip.
+ */
+#define D9R_EXTENSION_COMPOUND ((int_32)0x00000002)
+
+/**\brief Extension: Walks of many Paths ("multiwalk")
+ *
+ * Adds the Tmultiwalk and Rmultiwalk messages, which walk any number of
+ * paths from the same fid at once, without creating new fids:
+ *
+ * Tmultiwalk[fid[4] count[2] count*(nwname[2] nwname*(wname[s]))]
+ *
+ * Rmultiwalk[count[2] count*(nwqid[2] nwqid*(wqid[13]))]
+ *
+ * Each path gets the qids of the names that could be walked, in order, so a
+ * path exists if it gets as many qids as it has names. The reply needs to
+ * fit into a message just like the request, which is up to the client.
+ */
+#define D9R_EXTENSION_MULTIWALK ((int_32)0x00000004)
+
+/**\brief Extension: Searches ("find")
+ *
+ * Adds the Tfind and Rfind messages, which start a search of the tree below
+ * a directory on the server:
+ *
+ * Tfind[fid[4] newfid[4] pattern[s] types[4] minlength[8] maxlength[8]
+ *       after[4] before[4]]
+ *
+ * Rfind[]
+ *
+ * Reading newfid afterwards returns a stat structure for each node that
+ * matches, as many as fit into each Rread, like reading a directory does;
+ * the names in them are paths relative to fid. A read at offset 0 starts the
+ * search over. A node matches if its name matches the pattern, which is a
+ * glob with '*', '?' and '[...]' and may be empty to match anything, if its
+ * type is one of the D9R_FIND_* flags in types, or types is 0, if its length
+ * is between minlength and maxlength, and if it was last modified between
+ * after and before, inclusive. A maxlength or before of ~0 means there is no
+ * upper limit.
+ */
+#define D9R_EXTENSION_FIND ((int_32)0x00000008)
+
+/**\brief Extension: Content Hashes ("hash")
+ *
+ * Adds the Thash and Rhash messages, which return SHA-256 hashes of a file's
+ * contents computed on the server, so that a client can tell whether its copy
+ * is up to date without reading the file:
+ *
+ * Thash[fid[4] offset[8] length[8] blocksize[4]]
+ *
+ * Rhash[hash[32] count[2] count*(weak[4] strong[32])]
+ *
+ * The fid has to be open for reading. The hash covers length bytes from
+ * offset, or up to the end of the file if there are fewer or length is ~0.
+ * With a nonzero blocksize, the range is also split into blocks of that size,
+ * and each gets a weak checksum, as computed by dhash_weak(), and a SHA-256
+ * hash. Only as many blocks as fit into the reply are returned; the client
+ * asks again for the rest.
+ */
+#define D9R_EXTENSION_HASH ((int_32)0x00000010)
+
+/**\brief Size of the Hashes in Rhash Messages */
+#define D9R_HASH_SIZE 32
+
+/**\brief Extension: Server-side Copies ("copy")
+ *
+ * Adds the Tcopy and Rcopy messages, which copy a range of one file into
+ * another on the server, so the data doesn't have to go to the client and
+ * back:
+ *
+ * Tcopy[fid[4] offset[8] srcfid[4] srcoffset[8] length[8]]
+ *
+ * Rcopy[count[8]]
+ *
+ * The length bytes at srcoffset in srcfid, or as many as there are up to the
+ * end of it if there are fewer or length is ~0, are written to fid at offset.
+ * Both fids need to be open, srcfid for reading and fid for writing; count is
+ * the number of bytes that were copied. Negative offsets get an Rerror, as
+ * does a copy that the server can't carry out.
+ */
+#define D9R_EXTENSION_COPY ((int_32)0x00000020)
+
+/**\brief Extension: Payload Compression ("compress")
+ *
+ * Lets either end compress the data in Twrite and Rread messages it sends, if
+ * there's enough of it and it gets smaller. A compressed payload is marked by
+ * the top bit of the count, whose other bits are the size of what follows:
+ *
+ * count[4] length[4] data[count - 4]
+ *
+ * where data is the length bytes of the payload in the LZ4 block format, as
+ * produced by dcompress(). The callbacks only ever see the decompressed data.
+ * Worth it on slow links; connections on the same host don't offer it.
+ */
+#define D9R_EXTENSION_COMPRESS ((int_32)0x00000040)
+
+/** @} */
+
+/**\defgroup P9FindTypes Search Node Types
+ * \brief Node Types to search for with Tfind
+ *
+ * @{
+ */
+
+/**\brief Search for Directories */
+#define D9R_FIND_DIRECTORY ((int_32)0x00000001)
+/**\brief Search for regular Files */
+#define D9R_FIND_FILE      ((int_32)0x00000002)
+/**\brief Search for Symbolic Links */
+#define D9R_FIND_SYMLINK   ((int_32)0x00000004)
+/**\brief Search for Device Files */
+#define D9R_FIND_DEVICE    ((int_32)0x00000008)
+/**\brief Search for Named Pipes */
+#define D9R_FIND_PIPE      ((int_32)0x00000010)
+/**\brief Search for Sockets */
+#define D9R_FIND_SOCKET    ((int_32)0x00000020)
+
+/** @} */
+
 /** @} */
 
 /**\brief A 9P2000 QID */
@@ -215,15 +385,52 @@ struct d9r_io {
     /**\brief The negotiated Protocol Version */
     version;
 
+    /**\brief Protocol Extensions
+     *
+     * Before the version has been negotiated, the D9R_EXTENSION_* flags this
+     * end is willing to use; afterwards, the ones both ends agreed on. */
+    int_32 extensions;
+
     /**\brief Maximum Size for any single Message.
      * \note It is an error to generate a message that exceeds this size. */
     int_16 max_message_size;
 
+    /**\brief Host User at the other End
+     *
+     * The user ID of the process at the other end, D9R_PEER_SELF for
+     * loopbacks, or D9R_PEER_UNKNOWN, which is what all other connections
+     * start out with. Curie can't tell who is at the other end of a socket,
+     * so whoever accepted the connection has to set this, e.g. from the
+     * socket's SO_PEERCRED credentials, before the server sees a Tlocal. */
+    int_32 peer_uid;
+
     /**\brief Active FIDs in this Connection. */
     struct tree *fids;
     /**\brief Active Tags in this Connection. */
     struct tree *tags;
 
+    /**\brief Where to start looking for an unused Tag.
+     * \internal */
+    int_16 next_tag;
+    /**\brief Where to start looking for an unused FID.
+     * \internal */
+    int_32 next_fid;
+
+    /**\brief The Loopback this Connection is an End of, if any.
+     * \internal */
+    struct d9r_loopback *loopback;
+
+    /**\brief The Shared Memory Ring this Connection uses, if any.
+     * \internal */
+    struct d9r_ring *ring;
+
+    /**\brief Whether a Tcompound is being run, and whether it failed.
+     * \internal */
+    int_8 compound;
+    /**\brief Number of Names in the Twalk a Tcompound is running.
+     * \internal */
+    int_16 compound_walk;
+
     /**\brief Callback for an incoming Tauth Message */
     void (*Tauth)   (struct d9r_io *, int_16, int_32, char *, char *);
     /**\brief Callback for an incoming Tattach Message */
@@ -251,6 +458,22 @@ struct d9r_io {
     void (*Twstat)  (struct d9r_io *, int_16, int_32, int_16, int_32,
                      struct d9r_qid, int_32, int_32, int_32, int_64, char *,
                      char *, char *, char *, char *);
+    /**\brief Callback for an incoming Tlocal Message */
+    void (*Tlocal)  (struct d9r_io *, int_16, int_32);
+    /**\brief Callback for an incoming Tmultiwalk Message
+     *
+     * The paths' names are passed one after another in a single array,
+     * preceded by an array with the number of names in each path. */
+    void (*Tmultiwalk) (struct d9r_io *, int_16, int_32, int_16, int_16 *,
+                        char **);
+    /**\brief Callback for an incoming Thash Message */
+    void (*Thash)   (struct d9r_io *, int_16, int_32, int_64, int_64, int_32);
+    /**\brief Callback for an incoming Tcopy Message */
+    void (*Tcopy)   (struct d9r_io *, int_16, int_32, int_64, int_32, int_64,
+                     int_64);
+    /**\brief Callback for an incoming Tfind Message */
+    void (*Tfind)   (struct d9r_io *, int_16, int_32, int_32, char *, int_32,
+                     int_64, int_64, int_32, int_32);
 
     /**\brief Callback for an incoming Rauth Message */
     void (*Rauth)   (struct d9r_io *, int_16, struct d9r_qid);
@@ -280,6 +503,26 @@ struct d9r_io {
                      char *, char *, char *, char *);
     /**\brief Callback for an incoming Rwstat Message */
     void (*Rwstat)  (struct d9r_io *, int_16);
+    /**\brief Callback for an incoming Rlocal Message */
+    void (*Rlocal)  (struct d9r_io *, int_16, char *);
+    /**\brief Callback for an incoming Rcompound Message */
+    void (*Rcompound) (struct d9r_io *, int_16, int_16);
+    /**\brief Callback for an incoming Rmultiwalk Message
+     *
+     * The qids are passed one after another in a single array, preceded by
+     * an array with the number of qids for each path. */
+    void (*Rmultiwalk) (struct d9r_io *, int_16, int_16, int_16 *,
+                        struct d9r_qid *);
+    /**\brief Callback for an incoming Rhash Message
+     *
+     * The blocks' weak checksums and hashes are passed in two arrays, the
+     * hashes one after another. */
+    void (*Rhash)   (struct d9r_io *, int_16, int_8 *, int_16, int_32 *,
+                     int_8 *);
+    /**\brief Callback for an incoming Rcopy Message */
+    void (*Rcopy)   (struct d9r_io *, int_16, int_64);
+    /**\brief Callback for an incoming Rfind Message */
+    void (*Rfind)   (struct d9r_io *, int_16);
 
     /**\brief Callback for when the 9P connection is closed */
     void (*close)   (struct d9r_io *);
@@ -327,6 +570,87 @@ void multiplex_add_d9r (struct d9r_io *io, void *data);
  */
 void multiplex_del_d9r (struct d9r_io *io);
 
+/**\brief Open an In-Process Loopback Connection
+ * \param[out] client Where to store the client end.
+ * \param[out] server Where to store the server end.
+ *
+ * Creates a pair of connections that are wired to each other in memory:
+ * messages sent on one end are parsed straight out of its output buffer by
+ * the other end, without any system calls. Either end is then set up like
+ * any other connection, and messages are only delivered to ends that have
+ * been passed to multiplex_add_d9r(). Both are set to null if there's not
+ * enough memory.
+ */
+void d9r_open_loopback (struct d9r_io **client, struct d9r_io **server);
+
+/**\brief Deliver Loopback Messages
+ * \return The number of messages delivered.
+ *
+ * Hands the messages waiting on all loopback connections to their other ends,
+ * once; replies sent in the process are left for the next call. The 9P
+ * multiplexer does this whenever multiplex() runs, but programmes that use
+ * nothing but loopback connections would have multiplex() wait forever, so
+ * these should call this function until it returns zero instead.
+ */
+int_32 d9r_run_loopback ();
+
+/**\brief Count the Bytes sent over a Loopback Connection
+ * \param[in] io Either end of the loopback connection.
+ * \return The number of bytes delivered so far, both ways, or 0 if io is not
+ *         a loopback connection.
+ *
+ * Lets benchmarks see how much a link would have had to carry, and limit it.
+ */
+int_64 d9r_loopback_bytes (struct d9r_io *io);
+
+/**\brief Count the Messages sent over a Loopback Connection
+ * \param[in] io Either end of the loopback connection.
+ * \return The number of messages delivered so far, both ways, or 0 if io is
+ *         not a loopback connection.
+ */
+int_64 d9r_loopback_messages (struct d9r_io *io);
+
+/**\brief Minimum Size of Shared Memory for a Ring Connection
+ *
+ * Each direction gets half of the memory, and needs to be able to hold at
+ * least two messages of the maximum size.
+ */
+#define D9R_RING_MINIMUM 0x8040
+
+/**\brief Open a Shared Memory Ring Connection
+ * \param[in] in     Doorbell input, or null.
+ * \param[in] out    Doorbell output, or null.
+ * \param[in] memory Memory shared with the other side.
+ * \param[in] size   Size of the shared memory.
+ * \param[in] side   0 for the client, 1 for the server.
+ * \return A new connection, or null if the memory is too small or there's not
+ *         enough memory.
+ *
+ * Messages are passed through a pair of single-producer, single-consumer
+ * rings in memory shared by both sides, which need to agree on its size and
+ * have it zeroed before either of them opens it. How the memory is shared is
+ * up to the caller; a memfd mapped by both processes works, as does plain
+ * memory for two connections in the same process.
+ *
+ * The doorbell is only used to wake up a side that's waiting in multiplex()
+ * with nothing to do, by sending it a byte; a pipe pair or the Unix socket the
+ * memory was set up over will do. Without a doorbell, d9r_run_rings() needs to
+ * be called to move messages. Pass the connection to multiplex_add_d9r() like
+ * any other.
+ */
+/*@null@*/ struct d9r_io *d9r_open_ring
+        (struct io *in, struct io *out, void *memory, int_32 size,
+         int_8 side);
+
+/**\brief Move Ring Messages
+ * \return The number of messages sent and received.
+ *
+ * Sends the messages waiting on all ring connections and parses what the
+ * other sides have sent, once. The 9P multiplexer does this whenever
+ * multiplex() runs.
+ */
+int_32 d9r_run_rings ();
+
 /** @} */
 
 /**\defgroup P9Messages 9p Messages
@@ -344,7 +668,9 @@ void multiplex_del_d9r (struct d9r_io *io);
  */
 
 /**\brief Send a Tversion Message
- * \return The tag the request was sent with. */
+ * \return The tag the request was sent with.
+ *
+ * The extensions set in d9r_io.extensions are appended to the version. */
 int_16 d9r_version (struct d9r_io *, int_32, char *);
 /**\brief Send a Tauth Message
  * \return The tag the request was sent with. */
@@ -385,6 +711,39 @@ int_16 d9r_stat    (struct d9r_io *, int_32);
 int_16 d9r_wstat   (struct d9r_io *, int_32, int_16, int_32,
                         struct d9r_qid, int_32, int_32, int_32, int_64,
                         char *, char *, char *, char *, char *);
+/**\brief Send a Tlocal Message
+ * \return The tag the request was sent with. */
+int_16 d9r_local   (struct d9r_io *, int_32);
+
+/**\brief Send a Tmultiwalk Message
+ * \return The tag the request was sent with. */
+int_16 d9r_multiwalk (struct d9r_io *, int_32, int_16, int_16 *, char **);
+
+/**\brief Send a Thash Message
+ * \return The tag the request was sent with. */
+int_16 d9r_hash    (struct d9r_io *, int_32, int_64, int_64, int_32);
+
+/**\brief Send a Tcopy Message
+ * \return The tag the request was sent with. */
+int_16 d9r_copy    (struct d9r_io *, int_32, int_64, int_32, int_64, int_64);
+
+/**\brief Send a Tfind Message
+ * \return The tag the request was sent with. */
+int_16 d9r_find    (struct d9r_io *, int_32, int_32, const char *, int_32,
+                    int_64, int_64, int_32, int_32);
+
+/**\brief Start a Tcompound Message
+ * \return Where the message starts, for d9r_end_compound().
+ *
+ * Requests sent with the other functions until d9r_end_compound() is called
+ * become part of the compound message, which must not end up exceeding the
+ * connection's maximum message size. Only use this if the connection has
+ * D9R_EXTENSION_COMPOUND.
+ */
+int_32 d9r_begin_compound (struct d9r_io *);
+/**\brief Finish a Tcompound Message
+ * \return The tag the compound message was sent with. */
+int_16 d9r_end_compound   (struct d9r_io *, int_32);
 
 /**\brief Send an Rversion Message */
 void d9r_reply_version (struct d9r_io *, int_16, int_32, char *);
@@ -415,6 +774,20 @@ void d9r_reply_stat    (struct d9r_io *, int_16, int_16, int_32,
                             char *, char *, char *, char *, char *);
 /**\brief Send an Rwstat Message */
 void d9r_reply_wstat   (struct d9r_io *, int_16);
+/**\brief Send an Rlocal Message */
+void d9r_reply_local   (struct d9r_io *, int_16, char *);
+/**\brief Send an Rmultiwalk Message */
+void d9r_reply_multiwalk (struct d9r_io *, int_16, int_16, int_16 *,
+                          struct d9r_qid *);
+/**\brief Send an Rhash Message */
+void d9r_reply_hash    (struct d9r_io *, int_16, int_8 *, int_16, int_32 *,
+                        int_8 *);
+/**\brief Send an Rcopy Message */
+void d9r_reply_copy    (struct d9r_io *, int_16, int_64);
+/**\brief Send an Rfind Message */
+void d9r_reply_find    (struct d9r_io *, int_16);
+/**\brief Send an Rcompound Message */
+void d9r_reply_compound (struct d9r_io *, int_16, int_16);
 
 /**\brief Send an Rerror Message */
 void d9r_reply_error   (struct d9r_io *, int_16, const char *, int_16);
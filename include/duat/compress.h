@@ -0,0 +1,79 @@
+/**\defgroup DuatCompress Payload Compression
+ *
+ * A fast codec for the data in Rread and Twrite messages.
+ *
+ * @{
+ */
+
+/**\file
+ * \brief Duat Compression Header
+ *
+ * Compresses data into the LZ4 block format: literals and matches of four or
+ * more bytes at most 64 KiB back, which is cheap enough to run on every
+ * message and does well on text and other repetitive data.
+ *
+ * \copyright
+ * Copyright (c) 2008-2014, Kyuba Project Members
+ * \copyright
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * \copyright
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * \copyright
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \see Project Documentation: http://ef.gy/documentation/duat
+ * \see Project Source Code: http://git.becquerel.org/kyuba/duat.git
+ */
+
+#if !defined(DUAT_COMPRESS_H)
+#define DUAT_COMPRESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <curie/int.h>
+
+/**\brief Compress a Buffer
+ * \param[in]  data     The data to compress.
+ * \param[in]  length   The number of bytes to compress.
+ * \param[out] out      Where to put the compressed data.
+ * \param[in]  capacity The size of out.
+ * \return The size of the compressed data, or 0 if it didn't fit into out.
+ *
+ * Pass a capacity smaller than length to only get data back that was worth
+ * compressing.
+ */
+int_32 dcompress (const int_8 *data, int_32 length, int_8 *out,
+                  int_32 capacity);
+
+/**\brief Decompress a Buffer
+ * \param[in]  data     The compressed data.
+ * \param[in]  length   The size of the compressed data.
+ * \param[out] out      Where to put the decompressed data.
+ * \param[in]  capacity The size of out.
+ * \return The size of the decompressed data, or 0 if the compressed data
+ *         is broken, would not fit into out, or either size is negative.
+ */
+int_32 ddecompress (const int_8 *data, int_32 length, int_8 *out,
+                    int_32 capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*! @} */
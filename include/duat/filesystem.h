@@ -65,22 +65,40 @@ extern "C" {
 /**\brief VFS Flag: Others are allowed to execute */
 #define DFSOEXEC     ((int_32)0x00000001)
 
-/**\brief Common Node Items */
+/**\brief VFS Node Types */
+enum dfs_node_type {
+    dft_directory, /**< File Type: Directory */
+    dft_file,      /**< File Type: Regular File */
+    dft_symlink,   /**< File Type: Symbolic Link */
+    dft_device,    /**< File Type: Device File */
+    dft_pipe,      /**< File Type: Named Pipe */
+    dft_socket     /**< File Type: Socket */
+};
+
+/**\brief Common Node Items
+ *
+ * This structure is embedded in every VFS node, so it is kept as small as
+ * possible: the type and mode share a single word, and owners are stored as
+ * ids into a table of interned names (see dfs_owner() and dfs_owner_name()).
+ */
 struct dfs_node_common {
-    /**\brief File Type Code */
-    enum {
-        dft_directory, /**< File Type: Directory */
-        dft_file,      /**< File Type: Regular File */
-        dft_symlink,   /**< File Type: Symbolic Link */
-        dft_device,    /**< File Type: Device File */
-        dft_pipe,      /**< File Type: Named Pipe */
-        dft_socket     /**< File Type: Socket */
-    }
-    /**\brief File Type */
-    type;
+    /**\brief File Type (one of enum dfs_node_type) */
+    unsigned int type : 8;
 
     /**\brief File Mode */
-    int_32 mode;
+    unsigned int mode : 24;
+
+    /**\brief Owner ID */
+    int_16 uid;
+
+    /**\brief Group ID */
+    int_16 gid;
+
+    /**\brief ID of the last user to modify the file */
+    int_16 muid;
+
+    /**\brief QID Version; bumped whenever the node changes */
+    int_32 version;
 
     /**\brief Time of last access */
     int_32 atime;
@@ -91,29 +109,108 @@ struct dfs_node_common {
     /**\brief Length of the file */
     int_64 length;
 
+    /**\brief QID Path
+     *
+     * Unique for the lifetime of the process; never reused, even after the
+     * node is gone. */
+    int_64 path;
+
     /**\brief Name of the file */
     char *name;
+};
 
-    /**\brief Owner name */
-    char *uid;
+/**\brief Hash Index Slot
+ *
+ * A single slot in a dfs_hash_index. Slots with a null node pointer are
+ * empty.
+ */
+struct dfs_hash_entry {
+    /**\brief Precomputed Hash of the Node's Name */
+    int_32 hash;
 
-    /**\brief Group name */
-    char *gid;
+    /**\brief The Node stored in this Slot */
+    struct dfs_node_common *node;
+};
 
-    /**\brief Last user to modify the file */
-    char *muid;
+/**\brief Directory Hash Index
+ *
+ * Open-addressing hash table over the names of a directory's nodes. The
+ * nodes are also kept in the order they were added in, so that directory
+ * listings can index into them directly instead of walking the table.
+ */
+struct dfs_hash_index {
+    /**\brief Number of Slots in dfs_hash_index.slots (a power of two) */
+    int_32 size;
+
+    /**\brief Number of Nodes in the Index */
+    int_32 count;
+
+    /**\brief Hash Slots */
+    struct dfs_hash_entry *slots;
+
+    /**\brief Number of Elements allocated in dfs_hash_index.order */
+    int_32 order_size;
+
+    /**\brief Nodes, in the Order they were added in */
+    struct dfs_node_common **order;
 };
 
+/**\brief Directory Index Types */
+enum dfs_index_type {
+    dfs_index_vector, /**< Unsorted array; used for small directories */
+    dfs_index_tree,   /**< Curie string tree */
+    dfs_index_hash    /**< Open-addressing hash table */
+};
+
+/**\brief Maximum Size of a Vector Index
+ *
+ * Directories start out with their nodes in a small array, which is cheaper
+ * than a tree for the handful of nodes most directories have. Once a
+ * directory grows past this many nodes it is switched to a tree.
+ */
+#define DFS_SMALL_DIRECTORY 8
+
 /**\brief VFS Node: Directory */
 struct dfs_directory {
     /**\brief Common VFS Node Attributes */
     struct dfs_node_common c;
 
-    /**\brief Directory Nodes */
-    struct tree *nodes;
-
     /**\brief Parent Directory Link */
     struct dfs_directory *parent;
+
+    /**\brief Directory Nodes
+     *
+     * Which of the members is valid depends on dfs_directory.index. */
+    union {
+        /**\brief Node Array for dfs_index_vector */
+        struct dfs_node_common **vector;
+        /**\brief String Tree for dfs_index_tree */
+        struct tree *tree;
+        /**\brief Hash Index for dfs_index_hash */
+        struct dfs_hash_index *hash;
+    } nodes;
+
+    /**\brief Number of Nodes in a Vector Index */
+    int_16 count;
+
+    /**\brief Index Type (one of enum dfs_index_type) */
+    int_8 index;
+};
+
+/**\brief Shared File Contents
+ *
+ * Contents that the VFS allocated itself, for files that dfs_copy_contents()
+ * copied to. They never change, so copies of them just add a reference.
+ */
+struct dfs_extent {
+    /**\brief Number of Files using the Contents */
+    int_32 references;
+
+    /**\brief Size of dfs_extent.data */
+    int_64 size;
+
+    /**\brief The Contents */
+    int_8 *data;
 };
 
 /**\brief VFS Node: Regular File */
@@ -121,19 +218,32 @@ struct dfs_file {
     /**\brief Common VFS Node Attributes */
     struct dfs_node_common c;
 
-    /**\brief File Path */
+    /**\brief Host File backing the Node, or null
+     *
+     * Handed to clients on the same host that use D9R_EXTENSION_LOCAL, so
+     * they can read the file directly. It must have the same contents as
+     * the node. */
     char *path;
 
     /**\brief File Data Contents */
     int_8 *data;
 
+    /**\brief Contents owned by the VFS, or null
+     *
+     * Set by dfs_copy_contents(), in which case dfs_file.data points into
+     * it. */
+    struct dfs_extent *extent;
+
     /**\brief Auxiliary Data */
     void *aux;
 
     /**\brief Callback on File Reads */
     void (*on_read)(struct d9r_io *, int_16, struct dfs_file *, int_64, int_32);
 
-    /**\brief Callback on File Writes */
+    /**\brief Callback on File Writes
+     *
+     * Returns the number of bytes it took. Writes to files without one are
+     * acknowledged but discarded, and leave the file's version as it is. */
     int_32 (*on_write)(struct dfs_file *, int_64, int_32, int_8 *);
 };
 
@@ -201,7 +311,7 @@ struct dfs *dfs_create (void (*close)(struct d9r_io *, void *), void *aux);
 /**\brief Create Directory
  * \param[in] parent The parent directory to create the node in.
  * \param[in] name   The name of the node to create.
- * \return The created VFS node.
+ * \return The created VFS node, or null if there was not enough memory.
  */
 struct dfs_directory *dfs_mk_directory
         (struct dfs_directory *parent, char *name);
@@ -209,13 +319,14 @@ struct dfs_directory *dfs_mk_directory
 /**\brief Create File
  * \param[in] parent   The parent directory to create the node in.
  * \param[in] name     The name of the node to create.
- * \param[in] tname    Target file name (not supported yet).
+ * \param[in] tname    Host file with the same contents, or null; see
+ *                     dfs_file.path.
  * \param[in] tbuffer  Data buffer.
  * \param[in] tlength  Data buffer length.
  * \param[in] aux      Auxiliary data for the callbacks.
  * \param[in] on_read  Callbacks for file reads.
  * \param[in] on_write Callbacks for file writes.
- * \return The created VFS node.
+ * \return The created VFS node, or null if there was not enough memory.
  */
 struct dfs_file *dfs_mk_file
         (struct dfs_directory *parent, char *name, char *tname, int_8 *tbuffer,
@@ -228,7 +339,7 @@ struct dfs_file *dfs_mk_file
  * \param[in] parent The parent directory to create the node in.
  * \param[in] name   The name of the node to create.
  * \param[in] target Symbolic link target.
- * \return The created VFS node.
+ * \return The created VFS node, or null if there was not enough memory.
  */
 struct dfs_symlink *dfs_mk_symlink
         (struct dfs_directory *parent, char *name, char *target);
@@ -239,7 +350,7 @@ struct dfs_symlink *dfs_mk_symlink
  * \param[in] type   Device file type.
  * \param[in] majour Device file majour number.
  * \param[in] minor  Device file minor number.
- * \return The created VFS node.
+ * \return The created VFS node, or null if there was not enough memory.
  */
 struct dfs_device *dfs_mk_device
         (struct dfs_directory *parent, char *name, enum dfs_device_type type,
@@ -248,7 +359,7 @@ struct dfs_device *dfs_mk_device
 /**\brief Create Socket
  * \param[in] parent The parent directory to create the node in.
  * \param[in] name   The name of the node to create.
- * \return The created VFS node.
+ * \return The created VFS node, or null if there was not enough memory.
  */
 struct dfs_socket *dfs_mk_socket
         (struct dfs_directory *parent, char *name);
@@ -256,11 +367,235 @@ struct dfs_socket *dfs_mk_socket
 /**\brief Create Named Pipe
  * \param[in] parent The parent directory to create the node in.
  * \param[in] name   The name of the node to create.
- * \return The created VFS node.
+ * \return The created VFS node, or null if there was not enough memory.
  */
 struct dfs_socket *dfs_mk_pipe
         (struct dfs_directory *parent, char *name);
 
+/**\brief Retrieve a Node's QID
+ * \param[in]  c   The node.
+ * \param[out] qid The node's QID.
+ *
+ * The QID path is unique to the node and the version changes whenever the
+ * node's data or metadata changes, so clients can use it to validate cached
+ * data.
+ */
+void dfs_qid (struct dfs_node_common *c, struct d9r_qid *qid);
+
+/**\brief Mark a Node as modified
+ * \param[in,out] c The node that was modified.
+ *
+ * Bumps the node's QID version. The server does this for changes that go
+ * through 9P; code that changes a node's data or attributes directly, such as
+ * a synthetic file whose contents are generated, must call this to let
+ * clients know their cached copies are stale.
+ */
+void dfs_touch (struct dfs_node_common *c);
+
+/**\brief Copy File Contents
+ * \param[in,out] file   The file to copy to; it must not have callbacks.
+ * \param[in]     source The file to copy from; its contents must be in
+ *                       memory.
+ * \param[in]     offset Where in source to start copying.
+ * \param[in]     length How much to copy; at most what source has from
+ *                       offset on.
+ * \return 1 if file now has the copied contents, 0 if there was not enough
+ *         memory.
+ *
+ * Replaces the contents of file with those of source. Contents that this
+ * function copied before are shared instead of being copied again; any other
+ * contents are copied, as they belong to whoever created the file.
+ */
+int dfs_copy_contents
+        (struct dfs_file *file, struct dfs_file *source, int_64 offset,
+         int_64 length);
+
+/**\brief VFS Memory Statistics
+ *
+ * Filled in by dfs_get_statistics().
+ */
+struct dfs_statistics {
+    /**\brief Number of Nodes, including the Root */
+    int_64 nodes;
+
+    /**\brief Number of Directories, including the Root */
+    int_64 directories;
+
+    /**\brief Bytes used by Node Structures */
+    int_64 node_bytes;
+
+    /**\brief Bytes used by Directory Indices */
+    int_64 index_bytes;
+};
+
+/**\brief Collect VFS Memory Statistics
+ * \param[in]  fs The VFS to examine.
+ * \param[out] st The statistics.
+ *
+ * Walks the whole VFS and adds up the memory used by the node structures and
+ * the directory indices. Interned names and owners are shared between nodes
+ * and are not counted. Tree index sizes are estimates, as the tree node layout
+ * is private to curie.
+ */
+void dfs_get_statistics (struct dfs *fs, struct dfs_statistics *st);
+
+/**\brief No Owner
+ *
+ * Returned by dfs_owner() if a name could not be interned. No name is stored
+ * for it, so dfs_owner_name() returns null for it.
+ */
+#define DFS_NO_OWNER ((int_16)-1)
+
+/**\brief Intern an Owner Name
+ * \param[in] name The user or group name.
+ * \return The owner ID for the name, or DFS_NO_OWNER if the table is full or
+ *         there is not enough memory to add the name.
+ *
+ * Nodes store their owners as small integer IDs into a table of names; this
+ * function returns the ID for a name, adding it to the table if needed.
+ */
+int_16 dfs_owner (const char *name);
+
+/**\brief Retrieve an Owner Name
+ * \param[in] id The owner ID, as returned by dfs_owner().
+ * \return The owner's name, or null for DFS_NO_OWNER.
+ */
+char *dfs_owner_name (int_16 id);
+
+/**\brief Switch a Directory to a Hash Index
+ * \param[in,out] dir The directory to convert.
+ * \return 1 if the directory now uses a hash index, 0 if there was not enough
+ *         memory to build it (the directory is left unchanged).
+ *
+ * By default, directory nodes are kept in a small array and then in a curie
+ * string tree, which is compact but costs a string-compare descent per lookup.
+ * Very large directories should use a hash index instead, which resolves names
+ * in constant time and lets directory reads index into the node list directly.
+ * Existing nodes are moved over to the new index.
+ */
+int dfs_hash_directory (struct dfs_directory *dir);
+
+/**\brief Look up a Directory Node by Name
+ * \param[in] dir  The directory to search.
+ * \param[in] name The name of the node.
+ * \return The node, or null if there is no such node.
+ */
+struct dfs_node_common *dfs_get_node
+        (struct dfs_directory *dir, const char *name);
+
+/**\brief Look up a Directory Node by Position
+ * \param[in] dir   The directory to search.
+ * \param[in] index The position of the node.
+ * \return The node, or null if the index is past the last node.
+ *
+ * Used for directory listings. This is a direct lookup for vector and hash
+ * indices and a linear scan for tree indices.
+ */
+struct dfs_node_common *dfs_get_node_index
+        (struct dfs_directory *dir, int_32 index);
+
+/**\brief VFS Search
+ *
+ * The state of a search of the tree below a directory, as started with
+ * dfs_find_create(). Nodes are visited in the same order directory listings
+ * would return them, each directory right before its contents.
+ */
+struct dfs_find {
+    /**\brief Directory the Search started at */
+    struct dfs_directory *root;
+
+    /**\brief Glob to match Node Names against; empty matches anything */
+    char *pattern;
+
+    /**\brief Size of dfs_find.pattern, including the Terminator */
+    int_32 pattern_size;
+
+    /**\brief D9R_FIND_* Flags of the Node Types to return, or 0 for any */
+    int_32 types;
+
+    /**\brief Smallest Length to return */
+    int_64 min_length;
+
+    /**\brief Largest Length to return, or ~0 for no Limit */
+    int_64 max_length;
+
+    /**\brief Earliest Modification Time to return */
+    int_32 after;
+
+    /**\brief Latest Modification Time to return, or ~0 for no Limit */
+    int_32 before;
+
+    /**\brief Directories being searched, from dfs_find.root down */
+    struct dfs_directory **directories;
+
+    /**\brief Position of the next Node in each of the Directories */
+    int_32 *positions;
+
+    /**\brief Nodes of each tree-indexed Directory, as of when the Search
+     *        got to it; null for the other Directories */
+    struct dfs_node_common ***listings;
+
+    /**\brief Number of Nodes in each of dfs_find.listings */
+    int_32 *listing_sizes;
+
+    /**\brief Number of Directories being searched */
+    int_32 depth;
+
+    /**\brief Number of Elements allocated in dfs_find.directories,
+     *        dfs_find.positions, dfs_find.listings and
+     *        dfs_find.listing_sizes */
+    int_32 size;
+
+    /**\brief Path of the last Node returned, relative to dfs_find.root */
+    char *path;
+
+    /**\brief Size of dfs_find.path */
+    int_32 path_size;
+};
+
+/**\brief Match a Name against a Glob
+ * \param[in] pattern The glob, with '*', '?', '[...]' and '\\' escapes.
+ * \param[in] name    The name to match.
+ * \return 1 if the name matches, 0 otherwise.
+ */
+int dfs_glob (const char *pattern, const char *name);
+
+/**\brief Start a Search
+ * \param[in] root       The directory to search the tree below of.
+ * \param[in] pattern    Glob the node names need to match, or "".
+ * \param[in] types      D9R_FIND_* flags of the node types to return, or 0.
+ * \param[in] min_length Smallest length to return.
+ * \param[in] max_length Largest length to return, or ~0.
+ * \param[in] after      Earliest modification time to return.
+ * \param[in] before     Latest modification time to return, or ~0.
+ * \return The search, or null if there is not enough memory.
+ *
+ * Only the nodes below root are considered, not root itself.
+ */
+struct dfs_find *dfs_find_create
+        (struct dfs_directory *root, const char *pattern, int_32 types,
+         int_64 min_length, int_64 max_length, int_32 after, int_32 before);
+
+/**\brief Find the next matching Node
+ * \param[in,out] f The search.
+ * \return The next node that matches, or null once there are none left.
+ *
+ * dfs_find.path holds the node's path until the next call. Searches can be
+ * continued for as long as needed; nodes added in the meantime may or may
+ * not be found, like with directory listings.
+ */
+struct dfs_node_common *dfs_find_next (struct dfs_find *f);
+
+/**\brief Start a Search over
+ * \param[in,out] f The search.
+ */
+void dfs_find_rewind (struct dfs_find *f);
+
+/**\brief End a Search
+ * \param[in] f The search to free.
+ */
+void dfs_find_destroy (struct dfs_find *f);
+
 /**\brief Set a User's UID
  * \param[in] user The user whose ID to update.
  * \param[in] uid  The new user ID.
@@ -0,0 +1,115 @@
+/**\defgroup DuatHash Content Hashes
+ *
+ * Hashes used to compare file contents without transferring them.
+ *
+ * @{
+ */
+
+/**\file
+ * \brief Duat Content Hash Header
+ *
+ * SHA-256, for telling whether two pieces of data are the same, and a weak
+ * rolling checksum in the style of rsync's, for finding blocks of one file in
+ * another cheaply before comparing their SHA-256 hashes.
+ *
+ * \copyright
+ * Copyright (c) 2008-2014, Kyuba Project Members
+ * \copyright
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * \copyright
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * \copyright
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \see Project Documentation: http://ef.gy/documentation/duat
+ * \see Project Source Code: http://git.becquerel.org/kyuba/duat.git
+ */
+
+#if !defined(DUAT_HASH_H)
+#define DUAT_HASH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <curie/int.h>
+
+/**\brief Size of a SHA-256 Hash, in Bytes */
+#define DHASH_SIZE 32
+
+/**\brief SHA-256 State */
+struct dhash {
+    /**\brief Intermediate Hash Value */
+    unsigned int state[8];
+
+    /**\brief Number of Bytes hashed so far */
+    int_64 length;
+
+    /**\brief Data that doesn't fill a Block yet */
+    unsigned char buffer[64];
+};
+
+/**\brief Start a SHA-256 Hash
+ * \param[out] h The state to initialise.
+ */
+void dhash_init (struct dhash *h);
+
+/**\brief Add Data to a SHA-256 Hash
+ * \param[in,out] h      The state.
+ * \param[in]     data   The data to add.
+ * \param[in]     length The number of bytes to add.
+ */
+void dhash_update (struct dhash *h, const int_8 *data, int_64 length);
+
+/**\brief Finish a SHA-256 Hash
+ * \param[in,out] h      The state.
+ * \param[out]    digest Where to put the DHASH_SIZE bytes of the hash.
+ */
+void dhash_final (struct dhash *h, int_8 *digest);
+
+/**\brief Hash a Buffer with SHA-256
+ * \param[in]  data   The data to hash.
+ * \param[in]  length The number of bytes to hash.
+ * \param[out] digest Where to put the DHASH_SIZE bytes of the hash.
+ */
+void dhash (const int_8 *data, int_64 length, int_8 *digest);
+
+/**\brief Weak Checksum of a Block
+ * \param[in] data   The block.
+ * \param[in] length The size of the block.
+ * \return The checksum.
+ *
+ * The low half is the sum of the bytes, the high half the sum of those sums,
+ * both modulo 2^16, so the checksum of a block one byte further along can be
+ * had with dhash_roll() instead of going over the whole block again.
+ */
+int_32 dhash_weak (const int_8 *data, int_32 length);
+
+/**\brief Move a Weak Checksum along by one Byte
+ * \param[in] weak   The checksum of the block so far.
+ * \param[in] length The size of the block.
+ * \param[in] out    The byte that drops out at the start.
+ * \param[in] in     The byte that is added at the end.
+ * \return The checksum of the block that starts one byte later.
+ */
+int_32 dhash_roll (int_32 weak, int_32 length, int_8 out, int_8 in);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*! @} */
@@ -32,7 +32,9 @@
 #include <curie/multiplex.h>
 #include <curie/network.h>
 #include <curie/io.h>
+#include <curie/time.h>
 #include <duat/9p-client.h>
+#include <duat/hash.h>
 
 /**\brief Filesystem root FID
  *
@@ -40,6 +42,41 @@
  */
 #define ROOT_FID 1
 
+/**\brief Read chunk size
+ *
+ * Files are read in chunks of this size; the data cache stores them in pages
+ * of the same size.
+ */
+#define READ_SIZE 0x1000
+
+/**\brief Read-ahead high-water mark
+ *
+ * Reading from a file stops while this many bytes are waiting to be consumed
+ * in the stream returned by io_open_read_9p().
+ */
+#define READ_HIGH_WATER (16 * READ_SIZE)
+
+/**\brief Read-ahead low-water mark
+ *
+ * A stalled read resumes once the consumer has brought the amount of data
+ * waiting in its stream down to this many bytes.
+ */
+#define READ_LOW_WATER (4 * READ_SIZE)
+
+/**\brief Default directory FID cache size
+ *
+ * How many walked directory FIDs a connection keeps around by default; see
+ * d9c_set_directory_cache().
+ */
+#define DIRECTORY_FIDS 32
+
+/**\brief Maximum I/O size
+ *
+ * The most data a single Rread or Twrite can carry with the message size this
+ * client negotiates; 24 bytes are needed for the message header.
+ */
+#define IO_SIZE (0x2000 - 24)
+
 /**\brief 9P multiplexer status
  *
  * Used to specify the status of a connection managed by Duat's multiplexer.
@@ -49,7 +86,9 @@ enum d9c_status_code
     d9c_attaching,           /**< Currently attaching.*/
     d9c_walking_read,        /**< Currently walking; will read afterwards. */
     d9c_opening_read,        /**< Done walking, now opening file to read. */
+    d9c_locating_read,       /**< Asking for the file's host path. */
     d9c_ready_read,          /**< Currently able to read from file. */
+    d9c_closing_read,        /**< Closing FID after reading. */
     d9c_walking_create,      /**< Currently walking; will create afterwards. */
     d9c_walking_write,       /**< Currently walking; will write afterwards. */
     d9c_opening_write,       /**< Done walking, now opening file to write. */
@@ -57,9 +96,135 @@ enum d9c_status_code
     d9c_ready,               /**< Connection is ready for additional data. */
     d9c_ready_write_working, /**< Currently trying to write data. */
     d9c_closing_write,       /**< Closing FID after writing. */
+    d9c_walking_stat,        /**< Currently walking; will stat afterwards. */
+    d9c_stating,             /**< Done walking, now retrieving the stat. */
+    d9c_walking_directory,   /**< Walking a FID for the directory cache. */
+    d9c_request,             /**< Generic request; see struct d9c_request. */
+    d9c_multiwalking,        /**< Part of a d9c_multiwalk(). */
     d9c_error                /**< An error occured. */
 };
 
+/**\brief Cached directory FID
+ *
+ * A FID that has been walked to a directory, so that walks to paths below it
+ * can start there instead of at the root. Entries are only usable once their
+ * walk has completed, and are only clunked when nothing references them.
+ */
+struct d9c_directory
+{
+    char                  *path;
+    int_32                 path_size;
+    int_32                 fid;
+    int_32                 references;
+    char                   ready;
+    struct d9c_directory  *previous;
+    struct d9c_directory  *next;
+};
+
+/**\brief Directory FID cache
+ *
+ * Per-connection set of directory FIDs, keyed by path and kept in order of
+ * use for LRU eviction.
+ */
+struct d9c_directory_cache
+{
+    int_32                 limit;
+    int_32                 count;
+    struct tree           *paths;
+    struct d9c_directory  *head;
+    struct d9c_directory  *tail;
+};
+
+/**\brief Cached file data page
+ *
+ * One chunk of file data, as returned by a single Rread.
+ */
+struct d9c_cache_page
+{
+    struct d9c_cache_page *next;
+    int_32                 version;
+    int_32                 length;
+    int_8                  data[READ_SIZE];
+};
+
+/**\brief Cached file
+ *
+ * All the pages read from one file, keyed by its qid path. Files are kept in
+ * a doubly linked list in order of use, for LRU eviction.
+ */
+struct d9c_cache_file
+{
+    int_64                 path;
+    int_32                 version;
+    char                   complete;
+    char                   filling;
+    int_64                 size;
+    struct d9c_cache_page *pages;
+    struct d9c_cache_page *last;
+    struct d9c_cache_file *previous;
+    struct d9c_cache_file *next;
+};
+
+/**\brief Cached path metadata
+ *
+ * What is known about a path: either that it does not exist, or its qid and,
+ * optionally, its stat and a walked fid that has not been used yet.
+ */
+struct d9c_metadata
+{
+    char                  *path;
+    int_32                 path_size;
+    char                   negative;
+    int_64                 expires;
+    struct d9r_qid         qid;
+    int_32                 fid;
+    char                   has_stat;
+    int_16                 type;
+    int_32                 dev;
+    int_32                 mode;
+    int_32                 atime;
+    int_32                 mtime;
+    int_64                 length;
+    char                  *strings;
+    int_32                 strings_size;
+    char                  *name;
+    char                  *uid;
+    char                  *gid;
+    char                  *muid;
+    char                  *ex;
+    struct d9c_metadata   *previous;
+    struct d9c_metadata   *next;
+};
+
+/**\brief Client metadata cache
+ *
+ * Per-connection cache of walk and stat results; see
+ * d9c_enable_metadata_cache().
+ */
+struct d9c_metadata_cache
+{
+    int_32                 ttl;
+    int_32                 negative_ttl;
+    int_32                 limit;
+    int_32                 count;
+    struct tree           *paths;
+    struct d9c_metadata   *head;
+    struct d9c_metadata   *tail;
+};
+
+/**\brief Client data cache
+ *
+ * Per-connection cache of file contents; see d9c_enable_cache().
+ */
+struct d9c_cache
+{
+    int_64                 limit;
+    int_64                 size;
+    struct tree           *files;
+    struct d9c_cache_file *head;
+    struct d9c_cache_file *tail;
+};
+
 struct d9c_status
 {
     enum d9c_status_code   code;
@@ -67,6 +232,11 @@ struct d9c_status
     void                 (*error)  (struct d9r_io *, const char *, void *);
     void                 (*close)  (struct d9r_io *, void *);
     void                  *aux;
+    struct d9c_cache      *cache;
+    struct d9c_metadata_cache *metadata;
+    struct d9c_directory_cache directories;
+    struct d9c_cache_statistics statistics;
+    struct tree           *writers;
 };
 
 struct d9c_tag_status
@@ -77,303 +247,4407 @@ struct d9c_tag_status
     struct io             *io;
     const char            *npath;
     int_64                 offset;
+    struct d9c_cache_file *cache;
+    char                  *path;
+    int_32                 path_size;
+    struct d9c_directory  *directory;
+    int_32                 iounit;
+    char                   flushing;
+    char                   closing;
+    char                   failed;
+    char                   compound;
+    char                   local;
+    int_8                 *buffer;
+    int_32                 buffer_size;
+    int_32                 buffer_position;
+    int_32                 buffer_length;
+    char                  *failure;
+    int_32                 failure_size;
+    void                 (*on_flush) (struct d9r_io *, const char *, void *);
+    void                 (*on_stat)
+                               (struct d9r_io *, int_16, int_32,
+                                struct d9r_qid, int_32, int_32, int_32, int_64,
+                                char *, char *, char *, char *, char *, void *);
+    void                 (*on_error) (struct d9r_io *, const char *, void *);
+    void                  *aux;
 };
 
-struct d9c_wx
-{
-    struct d9r_io         *io;
-    struct d9c_tag_status *status;
-};
+static struct memory_pool d9c_cache_page_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_cache_page));
+static struct memory_pool d9c_cache_file_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_cache_file));
+static struct memory_pool d9c_tag_status_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_tag_status));
+static struct memory_pool d9c_metadata_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_metadata));
 
-static void invoke_write
-        (struct d9r_io *io, struct d9c_tag_status *status, int_32 count)
+static int_32 d9c_strlen (const char *s)
 {
-    status->offset += (int_64)count;
-    int_64 noff = status->offset;
-    struct io *sio = status->io;
+    int_32 l = 0;
+
+    if (s != (const char *)0) while (s[l]) l++;
 
-    sio->position += count;
+    return l;
+}
 
-    int_32 xlen = sio->length - sio->position;
+/* counts the names in path; a run of slashes separates two names just like
+ * a single one does, and slashes at either end don't separate anything */
+static int_32 d9c_elements (const char *path)
+{
+    int_32 n = 0;
 
-    if (xlen == 0)
+    for (int_32 i = 0; path[i]; i++)
     {
-        status->code = d9c_ready_write;
+        if ((path[i] != '/') && ((i == 0) || (path[i - 1] == '/'))) n++;
     }
-    else
-    {
-        if (xlen > 0x1000) xlen = 0x1000;
 
-        struct d9r_tag_metadata *md =
-                d9r_tag_metadata
-                (io, d9r_write (io, status->fid, noff, xlen,
-                 (int_8 *)(sio->buffer + sio->position)));
+    return n;
+}
+
+/* copies the names in path to pathn, each terminated by a 0 instead of the
+ * slashes, and points pathx at them; pathn needs as much room as path, and
+ * pathx room for d9c_elements (path) names. Returns the number of names. */
+static int_16 d9c_split (const char *path, char *pathn, char **pathx)
+{
+    int_16 n = 0;
+    int_32 j = 0;
+
+    for (int_32 i = 0; path[i]; i++)
+    {
+        if (path[i] == '/') continue;
 
-        if (md != (struct d9r_tag_metadata *)0)
+        if ((i == 0) || (path[i - 1] == '/'))
         {
-            md->aux = (void *)status;
+            if (n > 0)
+            {
+                pathn[j] = (char)0;
+                j++;
+            }
+
+            pathx[n] = pathn + j;
+            n++;
         }
 
-        status->code = d9c_ready_write_working;
+        pathn[j] = path[i];
+        j++;
     }
+
+    pathn[j] = (char)0;
+
+    return n;
 }
 
-static void d9c_write_on_read (struct io *f, void *aux)
+/* turns the first n names that d9c_split() put in pathn back into a path in
+ * prefix, with single slashes between them */
+static void d9c_join (char *prefix, const char *pathn, char **pathx, int_16 n)
 {
-    struct d9c_wx *wx = (struct d9c_wx *)aux;
+    int_32 l = 0;
 
-    if (wx->status->code == d9c_ready_write)
+    if (n > 0)
     {
-        invoke_write (wx->io, wx->status, 0);
+        l = (int_32)(pathx[n - 1] - pathn) + d9c_strlen (pathx[n - 1]);
     }
+
+    for (int_32 i = 0; i < l; i++)
+    {
+        prefix[i] = (pathn[i] == (char)0) ? '/' : pathn[i];
+    }
+
+    prefix[l] = (char)0;
 }
 
-static void d9c_write_on_close (struct io *f, void *aux)
+static char d9c_strequal (const char *a, const char *b)
 {
-    struct d9c_wx *wx = (struct d9c_wx *)aux;
-    struct d9c_tag_status *status = wx->status;
-    struct d9r_io *io = wx->io;
+    while ((*a) && (*a == *b))
+    {
+        a++;
+        b++;
+    }
 
-    status->code = d9c_closing_write;
+    return (char)(*a == *b);
+}
 
-    struct d9r_tag_metadata *md =
-            d9r_tag_metadata (io, d9r_clunk (io, status->fid));
+static struct d9c_tag_status *get_tag_status
+        (enum d9c_status_code code, const char *path)
+{
+    struct d9c_tag_status *status = get_pool_mem (&d9c_tag_status_pool);
+    int_32 l = d9c_strlen (path);
 
-    if (md != (struct d9r_tag_metadata *)0)
+    if (status == (struct d9c_tag_status *)0)
     {
-        md->aux = (void *)status;
+        return (struct d9c_tag_status *)0;
+    }
+
+    if ((status->path = aalloc (l + 1)) == (char *)0)
+    {
+        free_pool_mem (status);
+        return (struct d9c_tag_status *)0;
+    }
+
+    for (int_32 i = 0; i <= l; i++)
+    {
+        status->path[i] = path[i];
     }
+
+    status->path_size = l + 1;
+    status->code      = code;
+    status->fid       = NO_FID_9P;
+    status->mode      = 0;
+    status->io        = (struct io *)0;
+    status->npath     = (const char *)0;
+    status->offset    = (int_64)0;
+    status->cache     = (struct d9c_cache_file *)0;
+    status->directory = (struct d9c_directory *)0;
+    status->iounit    = IO_SIZE;
+    status->flushing  = (char)0;
+    status->closing   = (char)0;
+    status->failed    = (char)0;
+    status->compound  = (char)0;
+    status->local     = (char)0;
+    status->buffer    = (int_8 *)0;
+    status->buffer_size     = 0;
+    status->buffer_position = 0;
+    status->buffer_length   = 0;
+    status->failure      = (char *)0;
+    status->failure_size = 0;
+    status->on_flush  = (void *)0;
+    status->on_stat   = (void *)0;
+    status->on_error  = (void *)0;
+    status->aux       = (void *)0;
+
+    return status;
 }
 
-static void Rattach (struct d9r_io *io, int_16 tag, struct d9r_qid qid)
+static void free_tag_status (struct d9c_tag_status *status)
 {
-    struct d9c_status *status = (struct d9c_status *)(io->aux);
+    if (status->buffer != (int_8 *)0)
+    {
+        afree (status->buffer_size, status->buffer);
+    }
 
-    status->code = d9c_ready;
+    if (status->failure_size > 0)
+    {
+        afree (status->failure_size, status->failure);
+    }
 
-    if (status->attach != (void *)0)
+    afree (status->path_size, status->path);
+    free_pool_mem (status);
+}
+
+/* data cache */
+
+static void cache_unlink (struct d9c_cache *cache, struct d9c_cache_file *f)
+{
+    if (f->previous != (struct d9c_cache_file *)0)
     {
-        status->attach (io, status->aux);
+        f->previous->next = f->next;
+    }
+    else
+    {
+        cache->head = f->next;
+    }
+
+    if (f->next != (struct d9c_cache_file *)0)
+    {
+        f->next->previous = f->previous;
+    }
+    else
+    {
+        cache->tail = f->previous;
     }
+
+    f->previous = (struct d9c_cache_file *)0;
+    f->next     = (struct d9c_cache_file *)0;
 }
 
-static void Rwalk   (struct d9r_io *io, int_16 tag, int_16 qidn,
-                     struct d9r_qid *qid)
+static void cache_push (struct d9c_cache *cache, struct d9c_cache_file *f)
 {
-    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    f->previous = (struct d9c_cache_file *)0;
+    f->next     = cache->head;
 
-    if (md->aux != (void *)0)
+    if (cache->head != (struct d9c_cache_file *)0)
     {
-        struct d9c_tag_status *status = (struct d9c_tag_status *)(md->aux);
+        cache->head->previous = f;
+    }
+    else
+    {
+        cache->tail = f;
+    }
 
-        switch (status->code)
-        {
-            case d9c_walking_read:
-            {
-                struct d9r_tag_metadata *md =
-                        d9r_tag_metadata (io, d9r_open (io, status->fid,
-                                                        P9_OREAD));
+    cache->head = f;
+}
 
-                if (md != (struct d9r_tag_metadata *)0)
-                {
-                    status->code = d9c_opening_read;
-                    md->aux = (void *)status;
-                }
+static void cache_drop_pages (struct d9c_cache *cache, struct d9c_cache_file *f)
+{
+    struct d9c_cache_page *p = f->pages;
 
-                break;
-            }
-            case d9c_walking_create:
-            {
-                struct d9r_tag_metadata *md =
-                        d9r_tag_metadata
-                            (io, d9r_create 
-                                     (io, status->fid, status->npath,
-                                      status->mode, P9_OWRITE, (char *)0));
+    while (p != (struct d9c_cache_page *)0)
+    {
+        struct d9c_cache_page *n = p->next;
 
-                if (md != (struct d9r_tag_metadata *)0)
-                {
-                    status->code = d9c_opening_write;
-                    md->aux = (void *)status;
-                }
+        free_pool_mem (p);
+        p = n;
+    }
 
-                break;
-            }
-            case d9c_walking_write:
-            {
-                struct d9r_tag_metadata *md =
-                        d9r_tag_metadata (io, d9r_open (io, status->fid,
-                                                        P9_OWRITE));
+    cache->size -= f->size;
 
-                if (md != (struct d9r_tag_metadata *)0)
-                {
-                    status->code = d9c_opening_write;
-                    md->aux = (void *)status;
-                }
+    f->pages    = (struct d9c_cache_page *)0;
+    f->last     = (struct d9c_cache_page *)0;
+    f->size     = 0;
+    f->complete = (char)0;
+}
 
-                break;
-            }
+static void cache_drop (struct d9c_cache *cache, struct d9c_cache_file *f)
+{
+    cache_drop_pages (cache, f);
+    cache_unlink (cache, f);
+    tree_remove_node (cache->files, (int_pointer)f->path);
+    free_pool_mem (f);
+}
 
-            default:
-                break;
+/* evicts least recently used files until the cache is within its limit */
+static void cache_shrink (struct d9c_cache *cache)
+{
+    struct d9c_cache_file *f = cache->tail;
+
+    while ((cache->size > cache->limit) && (f != (struct d9c_cache_file *)0))
+    {
+        struct d9c_cache_file *p = f->previous;
+
+        if (f->filling == (char)0)
+        {
+            cache_drop (cache, f);
         }
+
+        f = p;
     }
 }
 
-static void Rread   (struct d9r_io *io, int_16 tag, int_32 count, int_8 *data)
+static struct d9c_cache_file *cache_lookup
+        (struct d9c_cache *cache, struct d9r_qid *qid)
 {
-    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct tree_node *n =
+            tree_get_node (cache->files, (int_pointer)qid->path);
+    struct d9c_cache_file *f;
 
-    if (md->aux != (void *)0)
+    if (n == (struct tree_node *)0) return (struct d9c_cache_file *)0;
+
+    f = (struct d9c_cache_file *)node_get_value (n);
+
+    return (f->path == qid->path) ? f : (struct d9c_cache_file *)0;
+}
+
+/* returns the cache entry to fill for the file, or 0 if it can't be cached */
+static struct d9c_cache_file *cache_begin
+        (struct d9c_cache *cache, struct d9r_qid *qid)
+{
+    struct d9c_cache_file *f = cache_lookup (cache, qid);
+
+    if (f != (struct d9c_cache_file *)0)
     {
-        struct d9c_tag_status *status = (struct d9c_tag_status *)(md->aux);
-        int_64 noff = status->offset + (int_64)count;
+        if (f->filling) return (struct d9c_cache_file *)0;
 
-        if (count == 0)
+        cache_drop_pages (cache, f);
+    }
+    else
+    {
+        if (tree_get_node (cache->files, (int_pointer)qid->path)
+                != (struct tree_node *)0)
         {
-            multiplex_del_io (status->io);
+            return (struct d9c_cache_file *)0;
         }
-        else
+
+        if ((f = get_pool_mem (&d9c_cache_file_pool))
+                == (struct d9c_cache_file *)0)
         {
-            io_write (status->io, (const char *)data, count);
+            return (struct d9c_cache_file *)0;
         }
 
-        struct d9r_tag_metadata *md =
-                d9r_tag_metadata (io, d9r_read (io, status->fid, noff,
-                                                0x1000));
+        f->path     = qid->path;
+        f->pages    = (struct d9c_cache_page *)0;
+        f->last     = (struct d9c_cache_page *)0;
+        f->size     = 0;
+        f->complete = (char)0;
 
-        if (md != (struct d9r_tag_metadata *)0)
-        {
-            status->offset = noff;
-            md->aux = (void *)status;
-        }
+        tree_add_node_value (cache->files, (int_pointer)qid->path, (void *)f);
+        cache_push (cache, f);
     }
+
+    f->version = qid->version;
+    f->filling = (char)1;
+
+    return f;
 }
 
-static void Rwrite  (struct d9r_io *io, int_16 tag, int_32 count)
+static void cache_append
+        (struct d9c_cache *cache, struct d9c_tag_status *status, int_32 count,
+         int_8 *data)
 {
-    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_cache_file *f = status->cache;
+    struct d9c_cache_page *p;
 
-    if (md->aux != (void *)0)
+    if (((cache->size + (int_64)sizeof (struct d9c_cache_page)) > cache->limit)
+        || ((p = get_pool_mem (&d9c_cache_page_pool))
+                == (struct d9c_cache_page *)0))
     {
-        invoke_write (io, (struct d9c_tag_status *)(md->aux), count);
+        /* too big to cache; forget about the file */
+        cache_drop (cache, f);
+        status->cache = (struct d9c_cache_file *)0;
+        return;
+    }
+
+    p->next    = (struct d9c_cache_page *)0;
+    p->version = f->version;
+    p->length  = count;
+
+    for (int_32 i = 0; i < count; i++)
+    {
+        p->data[i] = data[i];
+    }
+
+    if (f->last == (struct d9c_cache_page *)0)
+    {
+        f->pages = p;
+    }
+    else
+    {
+        f->last->next = p;
+    }
+
+    f->last      = p;
+    f->size     += sizeof (struct d9c_cache_page);
+    cache->size += sizeof (struct d9c_cache_page);
+}
+
+static void cache_finish (struct d9c_cache *cache, struct d9c_tag_status *status)
+{
+    struct d9c_cache_file *f = status->cache;
+
+    if (f == (struct d9c_cache_file *)0) return;
+
+    f->filling    = (char)0;
+    f->complete   = (char)1;
+    status->cache = (struct d9c_cache_file *)0;
+
+    cache_shrink (cache);
+}
+
+static void cache_abort (struct d9c_cache *cache, struct d9c_tag_status *status)
+{
+    if (status->cache == (struct d9c_cache_file *)0) return;
+
+    cache_drop (cache, status->cache);
+    status->cache = (struct d9c_cache_file *)0;
+}
+
+/* serves a file from the cache, if there is an up to date copy */
+static char cache_serve
+        (struct d9c_cache *cache, struct d9c_tag_status *status,
+         struct d9r_qid *qid)
+{
+    struct d9c_cache_file *f = cache_lookup (cache, qid);
+    struct d9c_cache_page *p;
+
+    if ((f == (struct d9c_cache_file *)0) || (f->complete == (char)0) ||
+        (f->version != qid->version))
+    {
+        return (char)0;
+    }
+
+    for (p = f->pages; p != (struct d9c_cache_page *)0; p = p->next)
+    {
+        if (p->version != qid->version) return (char)0;
+    }
+
+    for (p = f->pages; p != (struct d9c_cache_page *)0; p = p->next)
+    {
+        io_write (status->io, (const char *)p->data, p->length);
+    }
+
+    cache_unlink (cache, f);
+    cache_push (cache, f);
+
+    return (char)1;
+}
+
+void d9c_enable_cache (struct d9r_io *io, int_64 limit)
+{
+    static struct memory_pool pool =
+            MEMORY_POOL_INITIALISER (sizeof (struct d9c_cache));
+    struct d9c_status *status = (struct d9c_status *)(io->aux);
+    struct d9c_cache *cache = status->cache;
+
+    if (cache == (struct d9c_cache *)0)
+    {
+        if ((cache = get_pool_mem (&pool)) == (struct d9c_cache *)0)
+        {
+            return;
+        }
+
+        if ((cache->files = tree_create ()) == (struct tree *)0)
+        {
+            free_pool_mem (cache);
+            return;
+        }
+
+        cache->size = 0;
+        cache->head = (struct d9c_cache_file *)0;
+        cache->tail = (struct d9c_cache_file *)0;
+
+        status->cache = cache;
+    }
+
+    cache->limit = limit;
+
+    cache_shrink (cache);
+}
+
+static void cache_close (struct d9c_cache *cache)
+{
+    while (cache->head != (struct d9c_cache_file *)0)
+    {
+        cache_drop (cache, cache->head);
+    }
+
+    tree_destroy (cache->files);
+    free_pool_mem (cache);
+}
+
+/* metadata cache */
+
+static int_64 d9c_time ()
+{
+    return dt_to_unix (dt_get ());
+}
+
+static void metadata_drop_stat (struct d9c_metadata *m)
+{
+    if (m->strings != (char *)0)
+    {
+        afree (m->strings_size, m->strings);
+        m->strings = (char *)0;
+    }
+
+    m->has_stat = (char)0;
+}
+
+static void metadata_drop_fid (struct d9r_io *io, struct d9c_metadata *m)
+{
+    if (m->fid != NO_FID_9P)
+    {
+        d9r_clunk (io, m->fid);
+        m->fid = NO_FID_9P;
+    }
+}
+
+static void metadata_drop
+        (struct d9r_io *io, struct d9c_metadata_cache *cache,
+         struct d9c_metadata *m)
+{
+    if (m->previous != (struct d9c_metadata *)0)
+    {
+        m->previous->next = m->next;
+    }
+    else
+    {
+        cache->head = m->next;
+    }
+
+    if (m->next != (struct d9c_metadata *)0)
+    {
+        m->next->previous = m->previous;
+    }
+    else
+    {
+        cache->tail = m->previous;
+    }
+
+    tree_remove_node_string (cache->paths, m->path);
+    cache->count--;
+
+    metadata_drop_fid (io, m);
+    metadata_drop_stat (m);
+    afree (m->path_size, m->path);
+    free_pool_mem (m);
+}
+
+/* returns the entry for a path, if there is one that has not expired */
+static struct d9c_metadata *metadata_lookup
+        (struct d9r_io *io, struct d9c_metadata_cache *cache, const char *path)
+{
+    struct tree_node *n = tree_get_node_string (cache->paths, (char *)path);
+    struct d9c_metadata *m;
+
+    if (n == (struct tree_node *)0) return (struct d9c_metadata *)0;
+
+    m = (struct d9c_metadata *)node_get_value (n);
+
+    if (!d9c_strequal (m->path, path)) return (struct d9c_metadata *)0;
+
+    if (m->expires <= d9c_time ())
+    {
+        metadata_drop (io, cache, m);
+        return (struct d9c_metadata *)0;
+    }
+
+    return m;
+}
+
+/* returns a fresh entry for a path, replacing any previous one */
+static struct d9c_metadata *metadata_record
+        (struct d9r_io *io, struct d9c_metadata_cache *cache, const char *path,
+         char negative)
+{
+    struct tree_node *n = tree_get_node_string (cache->paths, (char *)path);
+    struct d9c_metadata *m;
+    int_32 l = d9c_strlen (path);
+
+    if (n != (struct tree_node *)0)
+    {
+        m = (struct d9c_metadata *)node_get_value (n);
+
+        if (!d9c_strequal (m->path, path)) return (struct d9c_metadata *)0;
+
+        metadata_drop (io, cache, m);
+    }
+
+    if ((m = get_pool_mem (&d9c_metadata_pool)) == (struct d9c_metadata *)0)
+    {
+        return (struct d9c_metadata *)0;
+    }
+
+    if ((m->path = aalloc (l + 1)) == (char *)0)
+    {
+        free_pool_mem (m);
+        return (struct d9c_metadata *)0;
+    }
+
+    for (int_32 i = 0; i <= l; i++)
+    {
+        m->path[i] = path[i];
+    }
+
+    m->path_size = l + 1;
+    m->negative  = negative;
+    m->expires   = d9c_time () +
+                   (negative ? cache->negative_ttl : cache->ttl);
+    m->fid       = NO_FID_9P;
+    m->has_stat  = (char)0;
+    m->strings   = (char *)0;
+
+    m->previous  = (struct d9c_metadata *)0;
+    m->next      = cache->head;
+
+    if (cache->head != (struct d9c_metadata *)0)
+    {
+        cache->head->previous = m;
+    }
+    else
+    {
+        cache->tail = m;
+    }
+
+    cache->head = m;
+    cache->count++;
+
+    tree_add_node_string_value (cache->paths, m->path, (void *)m);
+
+    while ((cache->count > cache->limit) &&
+           (cache->tail != (struct d9c_metadata *)0) && (cache->tail != m))
+    {
+        metadata_drop (io, cache, cache->tail);
+    }
+
+    return m;
+}
+
+static void metadata_record_stat
+        (struct d9c_metadata *m, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex)
+{
+    char *fields[5] = { name, uid, gid, muid, ex };
+    char **targets[5] = { &(m->name), &(m->uid), &(m->gid), &(m->muid),
+                          &(m->ex) };
+    int_32 size = 0, p = 0;
+
+    metadata_drop_stat (m);
+
+    for (int i = 0; i < 5; i++)
+    {
+        size += d9c_strlen (fields[i]) + 1;
+    }
+
+    if ((m->strings = aalloc (size)) == (char *)0) return;
+
+    m->strings_size = size;
+
+    for (int i = 0; i < 5; i++)
+    {
+        int_32 l = d9c_strlen (fields[i]);
+
+        *(targets[i]) = m->strings + p;
+
+        for (int_32 j = 0; j < l; j++)
+        {
+            m->strings[p] = fields[i][j];
+            p++;
+        }
+
+        m->strings[p] = (char)0;
+        p++;
+    }
+
+    m->has_stat = (char)1;
+    m->qid      = qid;
+    m->type     = type;
+    m->dev      = dev;
+    m->mode     = mode;
+    m->atime    = atime;
+    m->mtime    = mtime;
+    m->length   = length;
+}
+
+/* forgets about a path, e.g. because this client is about to change it */
+static void metadata_invalidate
+        (struct d9r_io *io, struct d9c_metadata_cache *cache, const char *path)
+{
+    struct d9c_metadata *m = metadata_lookup (io, cache, path);
+
+    if (m != (struct d9c_metadata *)0)
+    {
+        metadata_drop (io, cache, m);
+    }
+}
+
+void d9c_enable_metadata_cache
+        (struct d9r_io *io, int_32 ttl, int_32 negative_ttl, int_32 limit)
+{
+    static struct memory_pool pool =
+            MEMORY_POOL_INITIALISER (sizeof (struct d9c_metadata_cache));
+    struct d9c_status *status = (struct d9c_status *)(io->aux);
+    struct d9c_metadata_cache *cache = status->metadata;
+
+    if (cache == (struct d9c_metadata_cache *)0)
+    {
+        if ((cache = get_pool_mem (&pool)) == (struct d9c_metadata_cache *)0)
+        {
+            return;
+        }
+
+        if ((cache->paths = tree_create ()) == (struct tree *)0)
+        {
+            free_pool_mem (cache);
+            return;
+        }
+
+        cache->count = 0;
+        cache->head  = (struct d9c_metadata *)0;
+        cache->tail  = (struct d9c_metadata *)0;
+
+        status->metadata = cache;
+    }
+
+    cache->ttl          = ttl;
+    cache->negative_ttl = negative_ttl;
+    cache->limit        = limit;
+
+    while ((cache->count > cache->limit) &&
+           (cache->tail != (struct d9c_metadata *)0))
+    {
+        metadata_drop (io, cache, cache->tail);
+    }
+}
+
+static void metadata_close (struct d9c_metadata_cache *cache)
+{
+    struct d9c_metadata *m = cache->head;
+
+    /* the connection is gone, so there is no point in clunking the fids */
+    while (m != (struct d9c_metadata *)0)
+    {
+        struct d9c_metadata *n = m->next;
+
+        metadata_drop_stat (m);
+        afree (m->path_size, m->path);
+        free_pool_mem (m);
+
+        m = n;
+    }
+
+    tree_destroy (cache->paths);
+    free_pool_mem (cache);
+}
+
+/* directory fid cache */
+
+static struct memory_pool d9c_directory_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_directory));
+
+static struct d9c_directory *directory_get
+        (struct d9c_directory_cache *cache, const char *path)
+{
+    struct tree_node *n;
+    struct d9c_directory *d;
+
+    if (cache->paths == (struct tree *)0) return (struct d9c_directory *)0;
+
+    n = tree_get_node_string (cache->paths, (char *)path);
+
+    if (n == (struct tree_node *)0) return (struct d9c_directory *)0;
+
+    d = (struct d9c_directory *)node_get_value (n);
+
+    return d9c_strequal (d->path, path) ? d : (struct d9c_directory *)0;
+}
+
+static void directory_unlink
+        (struct d9c_directory_cache *cache, struct d9c_directory *d)
+{
+    if (d->previous != (struct d9c_directory *)0)
+    {
+        d->previous->next = d->next;
+    }
+    else
+    {
+        cache->head = d->next;
+    }
+
+    if (d->next != (struct d9c_directory *)0)
+    {
+        d->next->previous = d->previous;
+    }
+    else
+    {
+        cache->tail = d->previous;
+    }
+}
+
+static void directory_push
+        (struct d9c_directory_cache *cache, struct d9c_directory *d)
+{
+    d->previous = (struct d9c_directory *)0;
+    d->next     = cache->head;
+
+    if (cache->head != (struct d9c_directory *)0)
+    {
+        cache->head->previous = d;
+    }
+    else
+    {
+        cache->tail = d;
+    }
+
+    cache->head = d;
+}
+
+/* forgets about an entry; its fid is clunked if the server knows about it */
+static void directory_drop
+        (struct d9r_io *io, struct d9c_directory_cache *cache,
+         struct d9c_directory *d)
+{
+    directory_unlink (cache, d);
+    tree_remove_node_string (cache->paths, d->path);
+    cache->count--;
+
+    if (d->ready)
+    {
+        d9r_clunk (io, d->fid);
+    }
+    else
+    {
+        kill_fid (io, d->fid);
+    }
+
+    afree (d->path_size, d->path);
+    free_pool_mem (d);
+}
+
+static void directory_shrink
+        (struct d9r_io *io, struct d9c_directory_cache *cache)
+{
+    struct d9c_directory *d = cache->tail;
+
+    while ((cache->count > cache->limit) && (d != (struct d9c_directory *)0))
+    {
+        struct d9c_directory *p = d->previous;
+
+        if (d->ready && (d->references == 0))
+        {
+            directory_drop (io, cache, d);
+        }
+
+        d = p;
+    }
+}
+
+static void directory_release
+        (struct d9r_io *io, struct d9c_directory_cache *cache,
+         struct d9c_directory *d)
+{
+    if (d != (struct d9c_directory *)0)
+    {
+        d->references--;
+        directory_shrink (io, cache);
+    }
+}
+
+/* adds a new entry, referenced by the walk that is about to create it */
+static struct d9c_directory *directory_add
+        (struct d9c_directory_cache *cache, const char *path, int_32 fid)
+{
+    struct d9c_directory *d;
+    int_32 l = d9c_strlen (path);
+
+    if (cache->paths == (struct tree *)0)
+    {
+        if ((cache->paths = tree_create ()) == (struct tree *)0)
+        {
+            return (struct d9c_directory *)0;
+        }
+    }
+
+    if ((d = get_pool_mem (&d9c_directory_pool)) == (struct d9c_directory *)0)
+    {
+        return (struct d9c_directory *)0;
+    }
+
+    if ((d->path = aalloc (l + 1)) == (char *)0)
+    {
+        free_pool_mem (d);
+        return (struct d9c_directory *)0;
+    }
+
+    for (int_32 i = 0; i <= l; i++)
+    {
+        d->path[i] = path[i];
+    }
+
+    d->path_size  = l + 1;
+    d->fid        = fid;
+    d->references = 1;
+    d->ready      = (char)0;
+
+    directory_push (cache, d);
+    cache->count++;
+
+    tree_add_node_string_value (cache->paths, d->path, (void *)d);
+
+    return d;
+}
+
+static void directory_close (struct d9c_directory_cache *cache)
+{
+    struct d9c_directory *d = cache->head;
+
+    while (d != (struct d9c_directory *)0)
+    {
+        struct d9c_directory *n = d->next;
+
+        afree (d->path_size, d->path);
+        free_pool_mem (d);
+
+        d = n;
+    }
+
+    if (cache->paths != (struct tree *)0)
+    {
+        tree_destroy (cache->paths);
+    }
+
+    cache->count = 0;
+    cache->paths = (struct tree *)0;
+    cache->head  = (struct d9c_directory *)0;
+    cache->tail  = (struct d9c_directory *)0;
+}
+
+void d9c_set_directory_cache (struct d9r_io *io, int_32 limit)
+{
+    struct d9c_status *status = (struct d9c_status *)(io->aux);
+
+    status->directories.limit = limit;
+
+    directory_shrink (io, &(status->directories));
+}
+
+void d9c_get_cache_statistics
+        (struct d9r_io *io, struct d9c_cache_statistics *st)
+{
+    *st = ((struct d9c_status *)(io->aux))->statistics;
+}
+
+struct d9c_wx
+{
+    struct d9r_io         *io;
+    struct d9c_tag_status *status;
+};
+
+static struct memory_pool d9c_wx_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_wx));
+
+static void track (struct d9r_io *io, int_16 tag, struct d9c_tag_status *status)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+
+    if (md != (struct d9r_tag_metadata *)0)
+    {
+        md->aux = (void *)status;
+    }
+}
+
+/* write-behind */
+
+/* makes room for size more bytes at the end of a write buffer */
+static char write_reserve (struct d9c_tag_status *status, int_32 size)
+{
+    int_32 pending = status->buffer_length - status->buffer_position;
+
+    if ((status->buffer_length + size) <= status->buffer_size) return (char)1;
+
+    if ((pending + size) <= status->buffer_size)
+    {
+        for (int_32 i = 0; i < pending; i++)
+        {
+            status->buffer[i] = status->buffer[status->buffer_position + i];
+        }
+    }
+    else
+    {
+        int_8 *buffer = aalloc (pending + size);
+
+        if (buffer == (int_8 *)0) return (char)0;
+
+        for (int_32 i = 0; i < pending; i++)
+        {
+            buffer[i] = status->buffer[status->buffer_position + i];
+        }
+
+        if (status->buffer != (int_8 *)0)
+        {
+            afree (status->buffer_size, status->buffer);
+        }
+
+        status->buffer      = buffer;
+        status->buffer_size = pending + size;
+    }
+
+    status->buffer_position = 0;
+    status->buffer_length   = pending;
+
+    return (char)1;
+}
+
+/* moves as much data from the source io into the write buffer as fits */
+static void write_fill (struct d9c_tag_status *status)
+{
+    struct io *sio = status->io;
+    int_32 n;
+
+    if (sio == (struct io *)0) return;
+
+    n = sio->length - sio->position;
+
+    if ((status->buffer_length + n) > status->buffer_size)
+    {
+        write_reserve (status, 0);
+
+        if ((status->buffer_length + n) > status->buffer_size)
+        {
+            n = status->buffer_size - status->buffer_length;
+        }
+    }
+
+    for (int_32 i = 0; i < n; i++)
+    {
+        status->buffer[status->buffer_length + i] =
+                (int_8)sio->buffer[sio->position + i];
+    }
+
+    status->buffer_length += n;
+    sio->position         += n;
+}
+
+static void close_write (struct d9r_io *io, struct d9c_tag_status *status)
+{
+    status->code = d9c_closing_write;
+
+    if (status->fid == NO_FID_9P)
+    {
+        free_tag_status (status);
+    }
+    else
+    {
+        track (io, d9r_clunk (io, status->fid), status);
+    }
+}
+
+/* sends buffered data once there's a full message's worth of it, or any of
+ * it when flushing or closing */
+static void invoke_write
+        (struct d9r_io *io, struct d9c_tag_status *status, int_32 count)
+{
+    int_32 pending;
+
+    status->offset          += (int_64)count;
+    status->buffer_position += count;
+
+    if (status->failed)
+    {
+        status->buffer_position = status->buffer_length;
+
+        if (status->io != (struct io *)0)
+        {
+            status->io->position = status->io->length;
+        }
+    }
+
+    if (status->buffer_position == status->buffer_length)
+    {
+        status->buffer_position = 0;
+        status->buffer_length   = 0;
+    }
+
+    write_fill (status);
+
+    pending = status->buffer_length - status->buffer_position;
+
+    if ((pending > 0) &&
+        ((pending >= status->iounit) || status->flushing || status->closing))
+    {
+        if (pending > status->iounit) pending = status->iounit;
+
+        track (io, d9r_write (io, status->fid, status->offset, pending,
+                              status->buffer + status->buffer_position),
+               status);
+
+        status->code = d9c_ready_write_working;
+        return;
+    }
+
+    status->code = d9c_ready_write;
+
+    if (pending == 0)
+    {
+        if (status->flushing)
+        {
+            status->flushing = (char)0;
+
+            if (status->on_flush != (void *)0)
+            {
+                status->on_flush (io, status->failure, status->aux);
+            }
+        }
+
+        if (status->closing)
+        {
+            close_write (io, status);
+        }
+    }
+}
+
+static void d9c_write_on_read (struct io *f, void *aux)
+{
+    struct d9c_wx *wx = (struct d9c_wx *)aux;
+
+    if (wx->status->code == d9c_ready_write)
+    {
+        invoke_write (wx->io, wx->status, 0);
+    }
+}
+
+static void d9c_write_on_close (struct io *f, void *aux)
+{
+    struct d9c_wx *wx = (struct d9c_wx *)aux;
+    struct d9c_tag_status *status = wx->status;
+    struct d9r_io *io = wx->io;
+    struct d9c_status *cs = (struct d9c_status *)(io->aux);
+
+    /* the source io is going away, so whatever is left in it has to be
+     * copied out now */
+    if ((status->io != (struct io *)0) && !status->failed)
+    {
+        write_reserve (status, f->length - f->position);
+        write_fill (status);
+    }
+
+    if (cs->writers != (struct tree *)0)
+    {
+        tree_remove_node (cs->writers, (int_pointer)f);
+    }
+
+    status->io      = (struct io *)0;
+    status->closing = (char)1;
+
+    if (status->code == d9c_ready_write)
+    {
+        invoke_write (io, status, 0);
+    }
+
+    free_pool_mem (wx);
+}
+
+void d9c_flush_9p
+        (struct d9r_io *io9, struct io *io,
+         void (*on_flush) (struct d9r_io *, const char *, void *), void *aux)
+{
+    struct d9c_status *cs = (struct d9c_status *)(io9->aux);
+    struct d9c_tag_status *status;
+    struct tree_node *n = (struct tree_node *)0;
+
+    if (cs->writers != (struct tree *)0)
+    {
+        n = tree_get_node (cs->writers, (int_pointer)io);
+    }
+
+    if (n == (struct tree_node *)0)
+    {
+        if (on_flush != (void *)0)
+        {
+            on_flush (io9, "Not a 9P write stream.", aux);
+        }
+
+        return;
+    }
+
+    status           = (struct d9c_tag_status *)node_get_value (n);
+    status->flushing = (char)1;
+    status->on_flush = on_flush;
+    status->aux      = aux;
+
+    if (status->code == d9c_ready_write)
+    {
+        invoke_write (io9, status, 0);
+    }
+}
+
+/* remembers the first error on a write stream, to be reported by flushes */
+static void write_failed
+        (struct d9r_io *io, struct d9c_tag_status *status, const char *string)
+{
+    int_32 l = d9c_strlen (string);
+
+    if (status->failed) return;
+
+    status->failed = (char)1;
+
+    if ((status->failure = aalloc (l + 1)) != (char *)0)
+    {
+        for (int_32 i = 0; i <= l; i++)
+        {
+            status->failure[i] = string[i];
+        }
+
+        status->failure_size = l + 1;
+    }
+    else
+    {
+        status->failure = "Write failed.";
+    }
+
+    if (status->io != (struct io *)0)
+    {
+        io_finish (status->io);
+    }
+}
+
+/* generic requests */
+
+/**\brief Generic request
+ *
+ * Completion context for the d9c_walk() family of functions. Its first member
+ * lines up with that of struct d9c_tag_status, so the reply handlers can tell
+ * the two apart by the code, which is always d9c_request.
+ */
+struct d9c_request
+{
+    enum d9c_status_code   code;
+    int_32                 fid;
+    char                   walk;
+    char                   clunk;
+    int_16                 elements;
+    int_64                 offset;
+    union
+    {
+        void (*walk)  (struct d9r_io *, int_32, struct d9r_qid, void *);
+        void (*open)  (struct d9r_io *, struct d9r_qid, int_32, void *);
+        void (*read)  (struct d9r_io *, int_32, int_8 *, void *);
+        void (*write) (struct d9r_io *, int_32, void *);
+        void (*stat)  (struct d9r_io *, int_16, int_32, struct d9r_qid,
+                       int_32, int_32, int_32, int_64, char *, char *,
+                       char *, char *, char *, void *);
+        void (*done)  (struct d9r_io *, void *);
+        void (*local) (struct d9r_io *, const char *, void *);
+        void (*hash)  (struct d9r_io *, int_8 *, int_16, int_32 *, int_8 *,
+                       void *);
+        void (*copy)  (struct d9r_io *, int_64, void *);
+    } on;
+    void                 (*on_entry)
+                               (struct d9r_io *, int_16, int_32,
+                                struct d9r_qid, int_32, int_32, int_32, int_64,
+                                char *, char *, char *, char *, char *, void *);
+    void                 (*on_error) (struct d9r_io *, const char *, void *);
+    void                  *aux;
+};
+
+static struct memory_pool d9c_request_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_request));
+
+static struct d9c_request *get_request
+        (struct d9r_io *io, int_32 fid,
+         void (*on_error) (struct d9r_io *, const char *, void *), void *aux)
+{
+    struct d9c_request *r = get_pool_mem (&d9c_request_pool);
+
+    if (r == (struct d9c_request *)0)
+    {
+        if (on_error != (void *)0)
+        {
+            on_error (io, "Out of memory.", aux);
+        }
+
+        return (struct d9c_request *)0;
+    }
+
+    r->code     = d9c_request;
+    r->fid      = fid;
+    r->walk     = (char)0;
+    r->clunk    = (char)0;
+    r->elements = 0;
+    r->offset   = 0;
+    r->on.done  = (void *)0;
+    r->on_entry = (void *)0;
+    r->on_error = on_error;
+    r->aux      = aux;
+
+    return r;
+}
+
+/* returns the generic request a tag belongs to, if it belongs to one */
+static struct d9c_request *tag_request (struct d9r_tag_metadata *md)
+{
+    if ((md == (struct d9r_tag_metadata *)0) || (md->aux == (void *)0) ||
+        (*((enum d9c_status_code *)(md->aux)) != d9c_request))
+    {
+        return (struct d9c_request *)0;
+    }
+
+    return (struct d9c_request *)(md->aux);
+}
+
+static void request_track
+        (struct d9r_io *io, int_16 tag, struct d9c_request *r)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+
+    if (md != (struct d9r_tag_metadata *)0)
+    {
+        md->aux = (void *)r;
+    }
+}
+
+static void request_error
+        (struct d9r_io *io, struct d9c_request *r, const char *string)
+{
+    if (r->clunk)
+    {
+        d9r_clunk (io, r->fid);
+    }
+
+    if (r->on_error != (void *)0)
+    {
+        r->on_error (io, string, r->aux);
+    }
+
+    free_pool_mem (r);
+}
+
+int_32 d9c_walk
+        (struct d9r_io *io, int_32 fid, const char *path,
+         void (*on_walk) (struct d9r_io *, int_32, struct d9r_qid, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r;
+    int_32 newfid;
+    int_16 n;
+
+    while (path[0] == '/')
+    {
+        path++;
+    }
+
+    if ((r = get_request (io, NO_FID_9P, on_error, aux))
+        == (struct d9c_request *)0)
+    {
+        return NO_FID_9P;
+    }
+
+    char  pathn[d9c_strlen (path) + 1];
+    char *pathx[d9c_elements (path) + 1];
+
+    n = d9c_split (path, pathn, pathx);
+
+    newfid      = find_free_fid (io);
+    r->fid      = newfid;
+    r->walk     = (char)1;
+    r->elements = n;
+    r->on.walk  = on_walk;
+
+    request_track (io, d9r_walk (io, (fid == NO_FID_9P) ? ROOT_FID : fid,
+                                 newfid, n, pathx),
+                   r);
+
+    return newfid;
+}
+
+void d9c_open
+        (struct d9r_io *io, int_32 fid, int_8 mode,
+         void (*on_open) (struct d9r_io *, struct d9r_qid, int_32, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r = get_request (io, fid, on_error, aux);
+
+    if (r == (struct d9c_request *)0) return;
+
+    r->on.open = on_open;
+
+    request_track (io, d9r_open (io, fid, mode), r);
+}
+
+void d9c_create
+        (struct d9r_io *io, int_32 fid, const char *name, int_32 perm,
+         int_8 mode,
+         void (*on_open) (struct d9r_io *, struct d9r_qid, int_32, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r = get_request (io, fid, on_error, aux);
+
+    if (r == (struct d9c_request *)0) return;
+
+    r->on.open = on_open;
+
+    request_track (io, d9r_create (io, fid, name, perm, mode, (char *)0), r);
+}
+
+void d9c_read
+        (struct d9r_io *io, int_32 fid, int_64 offset, int_32 count,
+         void (*on_read) (struct d9r_io *, int_32, int_8 *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r = get_request (io, fid, on_error, aux);
+
+    if (r == (struct d9c_request *)0) return;
+
+    if (count > IO_SIZE) count = IO_SIZE;
+
+    r->on.read = on_read;
+
+    request_track (io, d9r_read (io, fid, offset, count), r);
+}
+
+void d9c_write
+        (struct d9r_io *io, int_32 fid, int_64 offset, int_32 count,
+         int_8 *data,
+         void (*on_write) (struct d9r_io *, int_32, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r = get_request (io, fid, on_error, aux);
+
+    if (r == (struct d9c_request *)0) return;
+
+    if (count > IO_SIZE) count = IO_SIZE;
+
+    r->on.write = on_write;
+
+    request_track (io, d9r_write (io, fid, offset, count, data), r);
+}
+
+void d9c_stat_fid
+        (struct d9r_io *io, int_32 fid,
+         void (*on_stat) (struct d9r_io *, int_16, int_32, struct d9r_qid,
+                          int_32, int_32, int_32, int_64, char *, char *,
+                          char *, char *, char *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r = get_request (io, fid, on_error, aux);
+
+    if (r == (struct d9c_request *)0) return;
+
+    r->on.stat = on_stat;
+
+    request_track (io, d9r_stat (io, fid), r);
+}
+
+void d9c_wstat
+        (struct d9r_io *io, int_32 fid, int_16 type, int_32 dev,
+         struct d9r_qid qid, int_32 mode, int_32 atime, int_32 mtime,
+         int_64 length, char *name, char *uid, char *gid, char *muid,
+         char *ex,
+         void (*on_done) (struct d9r_io *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r = get_request (io, fid, on_error, aux);
+
+    if (r == (struct d9c_request *)0) return;
+
+    r->on.done = on_done;
+
+    request_track (io, d9r_wstat (io, fid, type, dev, qid, mode, atime, mtime,
+                                  length, name, uid, gid, muid, ex),
+                   r);
+}
+
+void d9c_remove
+        (struct d9r_io *io, int_32 fid,
+         void (*on_done) (struct d9r_io *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r = get_request (io, fid, on_error, aux);
+
+    if (r == (struct d9c_request *)0) return;
+
+    r->on.done = on_done;
+
+    request_track (io, d9r_remove (io, fid), r);
+}
+
+void d9c_clunk
+        (struct d9r_io *io, int_32 fid,
+         void (*on_done) (struct d9r_io *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r = get_request (io, fid, on_error, aux);
+
+    if (r == (struct d9c_request *)0) return;
+
+    r->on.done = on_done;
+
+    request_track (io, d9r_clunk (io, fid), r);
+}
+
+void d9c_readdir
+        (struct d9r_io *io, int_32 fid,
+         void (*on_entry) (struct d9r_io *, int_16, int_32, struct d9r_qid,
+                           int_32, int_32, int_32, int_64, char *, char *,
+                           char *, char *, char *, void *),
+         void (*on_done) (struct d9r_io *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r = get_request (io, fid, on_error, aux);
+
+    if (r == (struct d9c_request *)0) return;
+
+    r->on.done  = on_done;
+    r->on_entry = on_entry;
+
+    request_track (io, d9r_read (io, fid, 0, IO_SIZE), r);
+}
+
+void d9c_local
+        (struct d9r_io *io, int_32 fid,
+         void (*on_local) (struct d9r_io *, const char *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r;
+
+    if (!(io->extensions & D9R_EXTENSION_LOCAL))
+    {
+        if (on_error != (void *)0)
+        {
+            on_error (io, "Local file access not supported by the server.",
+                      aux);
+        }
+
+        return;
+    }
+
+    if ((r = get_request (io, fid, on_error, aux)) == (struct d9c_request *)0)
+    {
+        return;
+    }
+
+    r->on.local = on_local;
+
+    request_track (io, d9r_local (io, fid), r);
+}
+
+void d9c_hash
+        (struct d9r_io *io, int_32 fid, int_64 offset, int_64 length,
+         int_32 blocksize,
+         void (*on_hash) (struct d9r_io *, int_8 *, int_16, int_32 *, int_8 *,
+                          void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r;
+
+    if (!(io->extensions & D9R_EXTENSION_HASH))
+    {
+        if (on_error != (void *)0)
+        {
+            on_error (io, "Hashes not supported by the server.", aux);
+        }
+
+        return;
+    }
+
+    if ((r = get_request (io, fid, on_error, aux)) == (struct d9c_request *)0)
+    {
+        return;
+    }
+
+    r->on.hash = on_hash;
+
+    request_track (io, d9r_hash (io, fid, offset, length, blocksize), r);
+}
+
+/**\brief Streamed copy
+ *
+ * A d9c_copy() on a server without D9R_EXTENSION_COPY, which reads the data
+ * and writes it back one message at a time.
+ */
+struct d9c_stream_copy
+{
+    int_32                 fid;
+    int_64                 offset;
+    int_32                 srcfid;
+    int_64                 srcoffset;
+    int_64                 length;
+    int_64                 count;
+    void                 (*on_copy) (struct d9r_io *, int_64, void *);
+    void                 (*on_error) (struct d9r_io *, const char *, void *);
+    void                  *aux;
+};
+
+static struct memory_pool d9c_stream_copy_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_stream_copy));
+
+static void stream_copy_next (struct d9r_io *io, struct d9c_stream_copy *c);
+
+static void stream_copy_done (struct d9r_io *io, struct d9c_stream_copy *c)
+{
+    if (c->on_copy != (void *)0)
+    {
+        c->on_copy (io, c->count, c->aux);
+    }
+
+    free_pool_mem (c);
+}
+
+static void stream_copy_error
+        (struct d9r_io *io, const char *string, void *aux)
+{
+    struct d9c_stream_copy *c = (struct d9c_stream_copy *)aux;
+
+    if (c->on_error != (void *)0)
+    {
+        c->on_error (io, string, c->aux);
+    }
+
+    free_pool_mem (c);
+}
+
+static void stream_copy_written (struct d9r_io *io, int_32 count, void *aux)
+{
+    struct d9c_stream_copy *c = (struct d9c_stream_copy *)aux;
+
+    c->count += count;
+
+    if (count > 0)
+    {
+        stream_copy_next (io, c);
+    }
+    else
+    {
+        stream_copy_done (io, c);
+    }
+}
+
+static void stream_copy_read
+        (struct d9r_io *io, int_32 count, int_8 *data, void *aux)
+{
+    struct d9c_stream_copy *c = (struct d9c_stream_copy *)aux;
+
+    if (count == 0)
+    {
+        stream_copy_done (io, c);
+        return;
+    }
+
+    d9c_write (io, c->fid, c->offset + c->count, count, data,
+               stream_copy_written, stream_copy_error, aux);
+}
+
+static void stream_copy_next (struct d9r_io *io, struct d9c_stream_copy *c)
+{
+    int_64 count = c->length - c->count;
+
+    if (count == 0)
+    {
+        stream_copy_done (io, c);
+        return;
+    }
+
+    d9c_read (io, c->srcfid, c->srcoffset + c->count,
+              (count > IO_SIZE) ? IO_SIZE : (int_32)count, stream_copy_read,
+              stream_copy_error, (void *)c);
+}
+
+void d9c_copy
+        (struct d9r_io *io, int_32 fid, int_64 offset, int_32 srcfid,
+         int_64 srcoffset, int_64 length,
+         void (*on_copy) (struct d9r_io *, int_64, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r;
+
+    if (!(io->extensions & D9R_EXTENSION_COPY))
+    {
+        struct d9c_stream_copy *c = get_pool_mem (&d9c_stream_copy_pool);
+
+        if (c == (struct d9c_stream_copy *)0)
+        {
+            if (on_error != (void *)0)
+            {
+                on_error (io, "Out of memory.", aux);
+            }
+
+            return;
+        }
+
+        c->fid       = fid;
+        c->offset    = offset;
+        c->srcfid    = srcfid;
+        c->srcoffset = srcoffset;
+        c->length    = length;
+        c->count     = 0;
+        c->on_copy   = on_copy;
+        c->on_error  = on_error;
+        c->aux       = aux;
+
+        stream_copy_next (io, c);
+        return;
+    }
+
+    if ((r = get_request (io, fid, on_error, aux)) == (struct d9c_request *)0)
+    {
+        return;
+    }
+
+    r->on.copy = on_copy;
+
+    request_track (io, d9r_copy (io, fid, offset, srcfid, srcoffset, length),
+                   r);
+}
+
+void d9c_find
+        (struct d9r_io *io, int_32 fid, const char *pattern, int_32 types,
+         int_64 minlength, int_64 maxlength, int_32 after, int_32 before,
+         void (*on_entry) (struct d9r_io *, int_16, int_32, struct d9r_qid,
+                           int_32, int_32, int_32, int_64, char *, char *,
+                           char *, char *, char *, void *),
+         void (*on_done) (struct d9r_io *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_request *r;
+
+    if (!(io->extensions & D9R_EXTENSION_FIND))
+    {
+        if (on_error != (void *)0)
+        {
+            on_error (io, "Searches not supported by the server.", aux);
+        }
+
+        return;
+    }
+
+    if ((r = get_request (io, find_free_fid (io), on_error, aux))
+        == (struct d9c_request *)0)
+    {
+        return;
+    }
+
+    /* the new fid goes away again if the search can't be started */
+    r->walk     = (char)1;
+    r->on.done  = on_done;
+    r->on_entry = on_entry;
+
+    request_track (io, d9r_find (io, (fid == NO_FID_9P) ? ROOT_FID : fid,
+                                 r->fid, pattern, types, minlength, maxlength,
+                                 after, before), r);
+}
+
+/**\brief Fetch
+ *
+ * Shared by the requests d9c_fetch() sends. Exactly one of the callbacks is
+ * invoked, for the read or for the first error, and the context goes away
+ * once all of the requests have been answered.
+ */
+struct d9c_fetch
+{
+    int_32                 fid;
+    int_64                 offset;
+    int_32                 count;
+    int_32                 pending;
+    char                   compound;
+    char                   walked;
+    char                   done;
+    void                 (*on_read) (struct d9r_io *, int_32, int_8 *, void *);
+    void                 (*on_error) (struct d9r_io *, const char *, void *);
+    void                  *aux;
+};
+
+static struct memory_pool d9c_fetch_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_fetch));
+
+static void fetch_release (struct d9c_fetch *f)
+{
+    f->pending--;
+
+    if (f->pending == 0)
+    {
+        free_pool_mem (f);
+    }
+}
+
+static void fetch_clunked (struct d9r_io *io, void *aux)
+{
+    fetch_release ((struct d9c_fetch *)aux);
+}
+
+static void fetch_clunk_error (struct d9r_io *io, const char *string, void *aux)
+{
+    fetch_release ((struct d9c_fetch *)aux);
+}
+
+static void fetch_error (struct d9r_io *io, const char *string, void *aux)
+{
+    struct d9c_fetch *f = (struct d9c_fetch *)aux;
+
+    if (!f->done)
+    {
+        f->done = (char)1;
+
+        if (!f->compound && f->walked)
+        {
+            f->pending++;
+            d9c_clunk (io, f->fid, fetch_clunked, fetch_clunk_error, (void *)f);
+        }
+
+        if (f->on_error != (void *)0)
+        {
+            f->on_error (io, string, f->aux);
+        }
+    }
+
+    fetch_release (f);
+}
+
+static void fetch_read
+        (struct d9r_io *io, int_32 count, int_8 *data, void *aux)
+{
+    struct d9c_fetch *f = (struct d9c_fetch *)aux;
+
+    if (!f->done)
+    {
+        f->done = (char)1;
+
+        if (!f->compound)
+        {
+            f->pending++;
+            d9c_clunk (io, f->fid, fetch_clunked, fetch_clunk_error, (void *)f);
+        }
+
+        if (f->on_read != (void *)0)
+        {
+            f->on_read (io, count, data, f->aux);
+        }
+    }
+
+    fetch_release (f);
+}
+
+static void fetch_opened
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
+{
+    struct d9c_fetch *f = (struct d9c_fetch *)aux;
+
+    if (!f->compound)
+    {
+        f->pending++;
+        d9c_read (io, f->fid, f->offset, f->count, fetch_read, fetch_error,
+                  (void *)f);
+    }
+
+    fetch_release (f);
+}
+
+static void fetch_walked
+        (struct d9r_io *io, int_32 fid, struct d9r_qid qid, void *aux)
+{
+    struct d9c_fetch *f = (struct d9c_fetch *)aux;
+
+    f->walked = (char)1;
+
+    if (!f->compound)
+    {
+        f->pending++;
+        d9c_open (io, f->fid, P9_OREAD, fetch_opened, fetch_error, (void *)f);
+    }
+
+    fetch_release (f);
+}
+
+void d9c_fetch
+        (struct d9r_io *io, const char *path, int_64 offset, int_32 count,
+         void (*on_read) (struct d9r_io *, int_32, int_8 *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_fetch *f = get_pool_mem (&d9c_fetch_pool);
+
+    if (f == (struct d9c_fetch *)0)
+    {
+        if (on_error != (void *)0)
+        {
+            on_error (io, "Out of memory.", aux);
+        }
+
+        return;
+    }
+
+    f->offset   = offset;
+    f->count    = count;
+    f->compound = (char)((io->extensions & D9R_EXTENSION_COMPOUND) != 0);
+    f->walked   = (char)0;
+    f->done     = (char)0;
+    f->on_read  = on_read;
+    f->on_error = on_error;
+    f->aux      = aux;
+
+    if (f->compound)
+    {
+        /* each of the four requests answers once, even if an earlier one
+         * failed */
+        int_32 start = d9r_begin_compound (io);
+
+        f->pending = 4;
+        f->fid     = d9c_walk (io, NO_FID_9P, path, fetch_walked, fetch_error,
+                               (void *)f);
+
+        d9c_open  (io, f->fid, P9_OREAD, fetch_opened, fetch_error, (void *)f);
+        d9c_read  (io, f->fid, offset, count, fetch_read, fetch_error,
+                   (void *)f);
+        d9c_clunk (io, f->fid, fetch_clunked, fetch_clunk_error, (void *)f);
+
+        d9r_end_compound (io, start);
+    }
+    else
+    {
+        f->pending = 1;
+        f->fid     = d9c_walk (io, NO_FID_9P, path, fetch_walked, fetch_error,
+                               (void *)f);
+    }
+}
+
+/**\brief Multiwalk
+ *
+ * Shared by the messages or walks a d9c_multiwalk() is split into.
+ */
+struct d9c_multiwalk
+{
+    int_32                 pending;
+    void                 (*on_path)
+                               (struct d9r_io *, int_32, int_16, int_16,
+                                struct d9r_qid, void *);
+    void                 (*on_done) (struct d9r_io *, void *);
+    void                  *aux;
+};
+
+/**\brief Multiwalk part
+ *
+ * One Tmultiwalk, with the number of names in each of its paths, or a single
+ * walk if the server doesn't support those. Its first member lines up with
+ * that of struct d9c_tag_status, like that of struct d9c_request.
+ */
+struct d9c_multiwalk_part
+{
+    enum d9c_status_code   code;
+    struct d9c_multiwalk  *walk;
+    int_32                 first;
+    int_16                 count;
+    int_16                *elements;
+};
+
+static struct memory_pool d9c_multiwalk_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_multiwalk));
+static struct memory_pool d9c_multiwalk_part_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_multiwalk_part));
+
+static void multiwalk_release
+        (struct d9r_io *io, struct d9c_multiwalk_part *part)
+{
+    struct d9c_multiwalk *w = part->walk;
+
+    if (part->elements != (int_16 *)0)
+    {
+        afree (sizeof (int_16) * part->count, part->elements);
+    }
+
+    free_pool_mem (part);
+
+    w->pending--;
+
+    if (w->pending == 0)
+    {
+        if (w->on_done != (void *)0)
+        {
+            w->on_done (io, w->aux);
+        }
+
+        free_pool_mem (w);
+    }
+}
+
+static void Rmultiwalk
+        (struct d9r_io *io, int_16 tag, int_16 count, int_16 *qidc,
+         struct d9r_qid *qid)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_multiwalk_part *part;
+    int_32 q = 0;
+
+    if ((md == (struct d9r_tag_metadata *)0) || (md->aux == (void *)0) ||
+        (*((enum d9c_status_code *)(md->aux)) != d9c_multiwalking))
+    {
+        return;
+    }
+
+    part = (struct d9c_multiwalk_part *)(md->aux);
+
+    for (int_16 p = 0; (p < count) && (p < part->count); p++)
+    {
+        struct d9r_qid last = { 0, 0, 0 };
+
+        q += qidc[p];
+
+        if (qidc[p] > 0)
+        {
+            last = qid[q - 1];
+        }
+
+        if (part->walk->on_path != (void *)0)
+        {
+            part->walk->on_path (io, part->first + p, qidc[p],
+                                 part->elements[p], last, part->walk->aux);
+        }
+    }
+
+    multiwalk_release (io, part);
+}
+
+/* a failed Tmultiwalk means none of its paths could be walked */
+static void multiwalk_error
+        (struct d9r_io *io, struct d9c_multiwalk_part *part)
+{
+    struct d9r_qid none = { 0, 0, 0 };
+
+    for (int_16 p = 0; p < part->count; p++)
+    {
+        if (part->walk->on_path != (void *)0)
+        {
+            part->walk->on_path (io, part->first + p, 0, part->elements[p],
+                                 none, part->walk->aux);
+        }
+    }
+
+    multiwalk_release (io, part);
+}
+
+static void multiwalk_walked
+        (struct d9r_io *io, int_32 fid, struct d9r_qid qid, void *aux)
+{
+    struct d9c_multiwalk_part *part = (struct d9c_multiwalk_part *)aux;
+
+    d9r_clunk (io, fid);
+
+    if (part->walk->on_path != (void *)0)
+    {
+        part->walk->on_path (io, part->first, part->count, part->count, qid,
+                             part->walk->aux);
+    }
+
+    multiwalk_release (io, part);
+}
+
+static void multiwalk_walk_error
+        (struct d9r_io *io, const char *string, void *aux)
+{
+    struct d9c_multiwalk_part *part = (struct d9c_multiwalk_part *)aux;
+    struct d9r_qid none = { 0, 0, 0 };
+
+    if (part->walk->on_path != (void *)0)
+    {
+        part->walk->on_path (io, part->first, 0, part->count, none,
+                             part->walk->aux);
+    }
+
+    multiwalk_release (io, part);
+}
+
+/* sends paths[first] to paths[first + count - 1] as one Tmultiwalk */
+static void multiwalk_send
+        (struct d9r_io *io, struct d9c_multiwalk *w, int_32 fid,
+         const char **paths, int_32 first, int_16 count, int_32 names,
+         int_32 bytes)
+{
+    struct d9c_multiwalk_part *part = get_pool_mem (&d9c_multiwalk_part_pool);
+    struct d9r_tag_metadata *md;
+    char buffer[bytes + 1];
+    char *name[names + 1];
+    int_16 namec[count + 1];
+    int_32 b = 0, n = 0;
+
+    if ((part == (struct d9c_multiwalk_part *)0) ||
+        ((part->elements = aalloc (sizeof (int_16) * count)) == (int_16 *)0))
+    {
+        struct d9r_qid none = { 0, 0, 0 };
+
+        if (part != (struct d9c_multiwalk_part *)0)
+        {
+            free_pool_mem (part);
+        }
+
+        for (int_16 p = 0; p < count; p++)
+        {
+            if (w->on_path != (void *)0)
+            {
+                w->on_path (io, first + p, 0, d9c_elements (paths[first + p]),
+                            none, w->aux);
+            }
+        }
+
+        return;
+    }
+
+    part->code  = d9c_multiwalking;
+    part->walk  = w;
+    part->first = first;
+    part->count = count;
+
+    for (int_16 p = 0; p < count; p++)
+    {
+        const char *path = paths[first + p];
+
+        while (path[0] == '/') path++;
+
+        namec[p] = d9c_split (path, buffer + b, name + n);
+        n       += namec[p];
+        b       += d9c_strlen (path) + 1;
+
+        part->elements[p] = namec[p];
+    }
+
+    w->pending++;
+
+    md = d9r_tag_metadata
+            (io, d9r_multiwalk (io, (fid == NO_FID_9P) ? ROOT_FID : fid,
+                                count, namec, name));
+
+    if (md != (struct d9r_tag_metadata *)0)
+    {
+        md->aux = (void *)part;
+    }
+}
+
+void d9c_multiwalk
+        (struct d9r_io *io, int_32 fid, int_32 count, const char **paths,
+         void (*on_path) (struct d9r_io *, int_32, int_16, int_16,
+                          struct d9r_qid, void *),
+         void (*on_done) (struct d9r_io *, void *),
+         void *aux)
+{
+    struct d9c_multiwalk *w = get_pool_mem (&d9c_multiwalk_pool);
+    int_32 limit = io->max_message_size - (4 + 1 + 2);
+    int_32 first = 0, request = 4 + 2, reply = 2, names = 0, bytes = 0;
+
+    if (w == (struct d9c_multiwalk *)0)
+    {
+        struct d9r_qid none = { 0, 0, 0 };
+
+        for (int_32 p = 0; p < count; p++)
+        {
+            if (on_path != (void *)0)
+            {
+                on_path (io, p, 0, d9c_elements (paths[p]), none, aux);
+            }
+        }
+
+        if (on_done != (void *)0)
+        {
+            on_done (io, aux);
+        }
+
+        return;
+    }
+
+    /* held until all the parts have been sent */
+    w->pending = 1;
+    w->on_path = on_path;
+    w->on_done = on_done;
+    w->aux     = aux;
+
+    for (int_32 p = 0; p < count; p++)
+    {
+        const char *path = paths[p];
+        int_32 length, elements;
+
+        while (path[0] == '/') path++;
+
+        length   = d9c_strlen (path);
+        elements = d9c_elements (path);
+
+        if (!(io->extensions & D9R_EXTENSION_MULTIWALK))
+        {
+            struct d9c_multiwalk_part *part =
+                    get_pool_mem (&d9c_multiwalk_part_pool);
+            struct d9r_qid none = { 0, 0, 0 };
+
+            if (part == (struct d9c_multiwalk_part *)0)
+            {
+                if (on_path != (void *)0)
+                {
+                    on_path (io, p, 0, elements, none, aux);
+                }
+
+                continue;
+            }
+
+            part->code     = d9c_multiwalking;
+            part->walk     = w;
+            part->first    = p;
+            part->count    = elements;
+            part->elements = (int_16 *)0;
+
+            w->pending++;
+
+            d9c_walk (io, fid, path, multiwalk_walked, multiwalk_walk_error,
+                      (void *)part);
+
+            continue;
+        }
+
+        /* each name takes up two bytes more than its characters in the
+         * request, and each path two bytes plus a qid per name in the
+         * reply */
+        if ((p > first) &&
+            (((request + 2 + length + elements) > limit) ||
+             ((reply + 2 + (elements * 13)) > limit) ||
+             ((p - first) >= 0x7fff)))
+        {
+            multiwalk_send (io, w, fid, paths, first, p - first, names,
+                            bytes);
+
+            first   = p;
+            request = 4 + 2;
+            reply   = 2;
+            names   = 0;
+            bytes   = 0;
+        }
+
+        request += 2 + length + elements;
+        reply   += 2 + (elements * 13);
+        names   += elements;
+        bytes   += length + 1;
+    }
+
+    if ((io->extensions & D9R_EXTENSION_MULTIWALK) && (count > first))
+    {
+        multiwalk_send (io, w, fid, paths, first, count - first, names,
+                        bytes);
+    }
+
+    w->pending--;
+
+    if (w->pending == 0)
+    {
+        if (on_done != (void *)0)
+        {
+            on_done (io, aux);
+        }
+
+        free_pool_mem (w);
+    }
+}
+
+/* delta sync */
+
+/**\brief Sync depth
+ *
+ * Number of Thash requests a d9c_sync() keeps in flight.
+ */
+#define SYNC_DEPTH 8
+
+/**\brief Sync window
+ *
+ * Number of Twrite and Tcopy requests a d9c_sync() keeps in flight.
+ */
+#define SYNC_WINDOW 32
+
+/**\brief Default sync block size */
+#define SYNC_BLOCK_SIZE 0x1000
+
+/**\brief Sync block
+ *
+ * The signature of one of the file's blocks, chained to the other blocks
+ * whose weak checksums land in the same slot of the lookup table.
+ */
+struct d9c_sync_block
+{
+    int_32                 weak;
+    int_32                 next;
+    int_8                  strong[DHASH_SIZE];
+};
+
+/**\brief Sync
+ *
+ * Fetches the signatures of all of a file's blocks, then slides a window
+ * over the local data to find them again, wherever they are, and writes
+ * the rest.
+ */
+struct d9c_sync
+{
+    int_32                 fid;
+    const int_8           *data;
+    int_64                 length;
+    int_32                 blocksize;
+    int_32                 blocks;
+    int_64                 next;
+    struct d9c_sync_block *signature;
+    int_32                 signatures;
+    int_32                 capacity;
+    int_32                *table;
+    int_32                 table_size;
+    int_64                 position;
+    int_64                 literal;
+    int_64                 from;
+    int_64                 to;
+    int_64                 copy_offset;
+    int_64                 copy_source;
+    int_32                 rolling;
+    int_64                 written;
+    int_32                 pending;
+    int_32                 hashing;
+    char                   hashed;
+    char                   indexed;
+    char                   rolled;
+    char                   copy;
+    char                   copying;
+    char                   scanned;
+    char                   truncate;
+    char                   failed;
+    void                 (*on_done) (struct d9r_io *, int_64, void *);
+    void                 (*on_error) (struct d9r_io *, const char *, void *);
+    void                  *aux;
+};
+
+/**\brief Sync part
+ *
+ * One Thash, Twrite, Tcopy or Twstat of a d9c_sync(), with the range it
+ * covers.
+ */
+struct d9c_sync_part
+{
+    struct d9c_sync       *sync;
+    int_64                 offset;
+    int_32                 length;
+};
+
+static struct memory_pool d9c_sync_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_sync));
+static struct memory_pool d9c_sync_part_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_sync_part));
+
+static void sync_hashed
+        (struct d9r_io *io, int_8 *hash, int_16 count, int_32 *weak,
+         int_8 *strong, void *aux);
+static void sync_written (struct d9r_io *io, int_32 count, void *aux);
+static void sync_copied (struct d9r_io *io, int_64 count, void *aux);
+static void sync_copy_error (struct d9r_io *io, const char *string, void *aux);
+static void sync_truncated (struct d9r_io *io, void *aux);
+static void sync_part_error (struct d9r_io *io, const char *string, void *aux);
+
+static void sync_fail (struct d9r_io *io, struct d9c_sync *s,
+                       const char *string)
+{
+    if (!s->failed)
+    {
+        s->failed = (char)1;
+
+        if (s->on_error != (void *)0)
+        {
+            s->on_error (io, string, s->aux);
+        }
+    }
+}
+
+static struct d9c_sync_part *sync_part
+        (struct d9r_io *io, struct d9c_sync *s, int_64 offset, int_32 length)
+{
+    struct d9c_sync_part *p = get_pool_mem (&d9c_sync_part_pool);
+
+    if (p == (struct d9c_sync_part *)0)
+    {
+        sync_fail (io, s, "Out of memory.");
+        return (struct d9c_sync_part *)0;
+    }
+
+    p->sync   = s;
+    p->offset = offset;
+    p->length = length;
+
+    s->pending++;
+
+    return p;
+}
+
+static void sync_free (struct d9c_sync *s)
+{
+    if (s->signature != (struct d9c_sync_block *)0)
+    {
+        afree (s->capacity * sizeof (struct d9c_sync_block), s->signature);
+    }
+
+    if (s->table != (int_32 *)0)
+    {
+        afree (s->table_size * sizeof (int_32), s->table);
+    }
+
+    free_pool_mem (s);
+}
+
+/* asks for the signatures of the next range of blocks, until the end of the
+ * file has turned up */
+static void sync_hash_next (struct d9r_io *io, struct d9c_sync *s)
+{
+    int_64 length = (int_64)s->blocks * s->blocksize;
+    struct d9c_sync_part *p;
+
+    if (s->hashed || s->failed ||
+        ((p = sync_part (io, s, s->next, 0)) == (struct d9c_sync_part *)0))
+    {
+        return;
+    }
+
+    s->next += length;
+    s->hashing++;
+
+    d9c_hash (io, s->fid, p->offset, length, s->blocksize, sync_hashed,
+              sync_part_error, (void *)p);
+}
+
+/* makes room for the signatures of the first blocks blocks */
+static char sync_reserve (struct d9c_sync *s, int_32 blocks)
+{
+    struct d9c_sync_block *signature;
+    int_32 capacity = (s->capacity > 0) ? s->capacity : 0x100;
+
+    if (blocks <= s->capacity)
+    {
+        return (char)1;
+    }
+
+    while (capacity < blocks)
+    {
+        capacity *= 2;
+    }
+
+    signature = aalloc (capacity * sizeof (struct d9c_sync_block));
+
+    if (signature == (struct d9c_sync_block *)0)
+    {
+        return (char)0;
+    }
+
+    for (int_32 i = 0; i < s->capacity; i++)
+    {
+        signature[i] = s->signature[i];
+    }
+
+    if (s->signature != (struct d9c_sync_block *)0)
+    {
+        afree (s->capacity * sizeof (struct d9c_sync_block), s->signature);
+    }
+
+    s->signature = signature;
+    s->capacity  = capacity;
+
+    return (char)1;
+}
+
+static int_32 sync_slot (struct d9c_sync *s, int_32 weak)
+{
+    unsigned int w = (unsigned int)weak;
+
+    return (int_32)((w ^ (w >> 16) ^ (w >> 7)) & (s->table_size - 1));
+}
+
+/* builds the lookup table from weak checksums to blocks, with at least two
+ * slots per block so that chains stay short */
+static char sync_index (struct d9c_sync *s)
+{
+    int_32 size = 0x10;
+
+    while (size < (s->signatures * 2))
+    {
+        size *= 2;
+    }
+
+    if ((s->table = aalloc (size * sizeof (int_32))) == (int_32 *)0)
+    {
+        return (char)0;
+    }
+
+    s->table_size = size;
+
+    for (int_32 i = 0; i < size; i++)
+    {
+        s->table[i] = 0;
+    }
+
+    /* backwards, so that chains list earlier blocks first */
+    for (int_32 i = s->signatures - 1; i >= 0; i--)
+    {
+        int_32 slot = sync_slot (s, s->signature[i].weak);
+
+        s->signature[i].next = s->table[slot];
+        s->table[slot]       = i + 1;
+    }
+
+    s->indexed = (char)1;
+
+    return (char)1;
+}
+
+static char sync_same (const int_8 *digest, const int_8 *strong)
+{
+    for (int i = 0; i < DHASH_SIZE; i++)
+    {
+        if (digest[i] != strong[i])
+        {
+            return (char)0;
+        }
+    }
+
+    return (char)1;
+}
+
+/* finds a block of the file that matches the window at s->position; the
+ * block that is already there wins, and blocks elsewhere are only any use
+ * if they can be copied into place, which means the server has to support
+ * Tcopy and the block must lie past the window, where nothing has been
+ * written yet. The last block may be shorter than a window, so it is only
+ * ever matched in place. */
+static int_32 sync_match (struct d9c_sync *s)
+{
+    const int_8 *window = s->data + s->position;
+    int_8 digest[DHASH_SIZE];
+    char hashed = (char)0;
+    int_32 found = -1;
+
+    for (int_32 i = s->table[sync_slot (s, s->rolling)]; i != 0;
+         i = s->signature[i - 1].next)
+    {
+        struct d9c_sync_block *b = &(s->signature[i - 1]);
+        int_64 offset = (int_64)(i - 1) * s->blocksize;
+
+        if ((b->weak != s->rolling) ||
+            ((offset != s->position) &&
+             (!s->copy || (found >= 0) || (i == s->signatures) ||
+              (offset < (s->position + s->blocksize)))))
+        {
+            continue;
+        }
+
+        if (!hashed)
+        {
+            dhash (window, s->blocksize, digest);
+            hashed = (char)1;
+        }
+
+        if (sync_same (digest, b->strong))
+        {
+            if (offset == s->position)
+            {
+                return i - 1;
+            }
+
+            found = i - 1;
+        }
+    }
+
+    return found;
+}
+
+/* moves the window on until something has to be sent: data the file
+ * doesn't have, a block to copy, or both; at the end, the part of the data
+ * that is shorter than a window is compared with the file's last block */
+static void sync_scan (struct d9c_sync *s)
+{
+    int_64 bs = s->blocksize;
+    int_64 tail;
+
+    while ((s->signatures > 0) && ((s->position + bs) <= s->length))
+    {
+        const int_8 *window = s->data + s->position;
+        int_32 block;
+
+        if (!s->rolled)
+        {
+            s->rolling = dhash_weak (window, s->blocksize);
+            s->rolled  = (char)1;
+        }
+
+        if ((block = sync_match (s)) >= 0)
+        {
+            s->from = s->literal;
+            s->to   = s->position;
+
+            if (((int_64)block * bs) != s->position)
+            {
+                s->copying     = (char)1;
+                s->copy_offset = s->position;
+                s->copy_source = (int_64)block * bs;
+            }
+
+            s->position += bs;
+            s->literal   = s->position;
+            s->rolled    = (char)0;
+            return;
+        }
+
+        if ((s->position + bs) < s->length)
+        {
+            s->rolling = dhash_roll (s->rolling, s->blocksize, window[0],
+                                     window[bs]);
+        }
+
+        s->position++;
+
+        if ((s->position - s->literal) >= IO_SIZE)
+        {
+            s->from     = s->literal;
+            s->to       = s->literal + IO_SIZE;
+            s->literal  = s->to;
+            return;
+        }
+    }
+
+    tail = (s->length / bs) * bs;
+
+    s->from    = s->literal;
+    s->to      = s->length;
+    s->scanned = (char)1;
+
+    if ((s->literal <= tail) && (tail < s->length) &&
+        ((tail / bs) == (s->signatures - 1)))
+    {
+        struct d9c_sync_block *b = &(s->signature[s->signatures - 1]);
+        int_32 length = (int_32)(s->length - tail);
+
+        if (b->weak == dhash_weak (s->data + tail, length))
+        {
+            int_8 digest[DHASH_SIZE];
+
+            dhash (s->data + tail, length, digest);
+
+            if (sync_same (digest, b->strong))
+            {
+                /* the file ends where the data does */
+                s->to       = tail;
+                s->truncate = (char)0;
+            }
+        }
+    }
+}
+
+/* sends whatever the scan comes up with, until the window is full */
+static void sync_send (struct d9r_io *io, struct d9c_sync *s)
+{
+    while (!s->failed && (s->pending < SYNC_WINDOW))
+    {
+        struct d9c_sync_part *p;
+
+        if (s->from < s->to)
+        {
+            int_32 length = ((s->to - s->from) > IO_SIZE)
+                          ? IO_SIZE : (int_32)(s->to - s->from);
+
+            if ((p = sync_part (io, s, s->from, length))
+                    == (struct d9c_sync_part *)0)
+            {
+                return;
+            }
+
+            s->from += length;
+
+            d9c_write (io, s->fid, p->offset, length,
+                       (int_8 *)(s->data + p->offset), sync_written,
+                       sync_part_error, (void *)p);
+        }
+        else if (s->copying)
+        {
+            if ((p = sync_part (io, s, s->copy_offset, s->blocksize))
+                    == (struct d9c_sync_part *)0)
+            {
+                return;
+            }
+
+            s->copying = (char)0;
+
+            d9c_copy (io, s->fid, s->copy_offset, s->fid, s->copy_source,
+                      s->blocksize, sync_copied, sync_copy_error, (void *)p);
+        }
+        else if (!s->scanned)
+        {
+            sync_scan (s);
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+/* keeps the writes going once all the signatures are in, then cuts the file
+ * down to size, if need be */
+static void sync_release (struct d9r_io *io, struct d9c_sync *s)
+{
+    s->pending--;
+
+    if (!s->failed && s->hashed && (s->hashing == 0))
+    {
+        if (!s->indexed && !sync_index (s))
+        {
+            sync_fail (io, s, "Out of memory.");
+        }
+
+        s->pending++;
+
+        sync_send (io, s);
+
+        s->pending--;
+    }
+
+    if (s->pending > 0)
+    {
+        return;
+    }
+
+    if (!s->failed && s->truncate)
+    {
+        struct d9c_sync_part *p = sync_part (io, s, s->length, 0);
+
+        s->truncate = (char)0;
+
+        if (p != (struct d9c_sync_part *)0)
+        {
+            struct d9r_qid keep = { (int_8)~0, ~(int_32)0, ~(int_64)0 };
+
+            d9c_wstat (io, s->fid, ~0, ~0, keep, ~0, ~0, ~0, s->length,
+                       "", "", "", "", "", sync_truncated, sync_part_error,
+                       (void *)p);
+            return;
+        }
+    }
+
+    if (!s->failed && (s->on_done != (void *)0))
+    {
+        s->on_done (io, s->written, s->aux);
+    }
+
+    sync_free (s);
+}
+
+/* keeps the signatures in a reply, and asks for more until the file has run
+ * out of blocks */
+static void sync_hashed
+        (struct d9r_io *io, int_8 *hash, int_16 count, int_32 *weak,
+         int_8 *strong, void *aux)
+{
+    struct d9c_sync_part *p = (struct d9c_sync_part *)aux;
+    struct d9c_sync *s = p->sync;
+    int_32 first = (int_32)(p->offset / s->blocksize);
+
+    s->hashing--;
+
+    if (!s->failed && (count > 0) && !sync_reserve (s, first + count))
+    {
+        sync_fail (io, s, "Out of memory.");
+    }
+
+    for (int_16 n = 0; (n < count) && !s->failed; n++)
+    {
+        struct d9c_sync_block *b = &(s->signature[first + n]);
+        int_8 *remote = strong + (n * D9R_HASH_SIZE);
+
+        b->weak = weak[n];
+        b->next = 0;
+
+        for (int i = 0; i < DHASH_SIZE; i++)
+        {
+            b->strong[i] = remote[i];
+        }
+    }
+
+    if (count < s->blocks)
+    {
+        if (!s->hashed || ((first + count) < s->signatures))
+        {
+            s->signatures = first + count;
+        }
+
+        s->hashed = (char)1;
+
+        /* the file may go on past the end of the data */
+        s->truncate = (char)
+            (((int_64)s->signatures * s->blocksize) > s->length);
+    }
+    else
+    {
+        sync_hash_next (io, s);
+    }
+
+    free_pool_mem (p);
+
+    sync_release (io, s);
+}
+
+static void sync_written (struct d9r_io *io, int_32 count, void *aux)
+{
+    struct d9c_sync_part *p = (struct d9c_sync_part *)aux;
+    struct d9c_sync *s = p->sync;
+
+    if (count != p->length)
+    {
+        sync_part_error (io, "Short write.", aux);
+        return;
+    }
+
+    free_pool_mem (p);
+
+    s->written += count;
+
+    sync_release (io, s);
+}
+
+static void sync_copied (struct d9r_io *io, int_64 count, void *aux)
+{
+    struct d9c_sync_part *p = (struct d9c_sync_part *)aux;
+    struct d9c_sync *s = p->sync;
+
+    if (count != p->length)
+    {
+        sync_part_error (io, "Short copy.", aux);
+        return;
+    }
+
+    free_pool_mem (p);
+
+    sync_release (io, s);
+}
+
+/* servers don't have to copy into every file they can write to, so a
+ * refused copy is written instead, and no more copies are asked for */
+static void sync_copy_error (struct d9r_io *io, const char *string, void *aux)
+{
+    struct d9c_sync_part *p = (struct d9c_sync_part *)aux;
+    struct d9c_sync *s = p->sync;
+    int_64 offset = p->offset + IO_SIZE;
+
+    if (s->failed)
+    {
+        sync_part_error (io, string, aux);
+        return;
+    }
+
+    s->copy = (char)0;
+
+    /* the block may be larger than a write */
+    for (; offset < (p->offset + p->length); offset += IO_SIZE)
+    {
+        int_32 length = ((p->offset + p->length - offset) > IO_SIZE)
+                      ? IO_SIZE : (int_32)(p->offset + p->length - offset);
+        struct d9c_sync_part *q = sync_part (io, s, offset, length);
+
+        if (q == (struct d9c_sync_part *)0)
+        {
+            break;
+        }
+
+        d9c_write (io, s->fid, offset, length, (int_8 *)(s->data + offset),
+                   sync_written, sync_part_error, (void *)q);
+    }
+
+    if (p->length > IO_SIZE)
+    {
+        p->length = IO_SIZE;
+    }
+
+    d9c_write (io, s->fid, p->offset, p->length,
+               (int_8 *)(s->data + p->offset), sync_written, sync_part_error,
+               (void *)p);
+}
+
+static void sync_truncated (struct d9r_io *io, void *aux)
+{
+    struct d9c_sync_part *p = (struct d9c_sync_part *)aux;
+    struct d9c_sync *s = p->sync;
+
+    free_pool_mem (p);
+
+    sync_release (io, s);
+}
+
+static void sync_part_error (struct d9r_io *io, const char *string, void *aux)
+{
+    struct d9c_sync_part *p = (struct d9c_sync_part *)aux;
+    struct d9c_sync *s = p->sync;
+
+    free_pool_mem (p);
+
+    sync_fail (io, s, string);
+
+    sync_release (io, s);
+}
+
+void d9c_sync
+        (struct d9r_io *io, int_32 fid, const int_8 *data, int_64 length,
+         int_32 blocksize,
+         void (*on_done) (struct d9r_io *, int_64, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_sync *s = get_pool_mem (&d9c_sync_pool);
+
+    if (s == (struct d9c_sync *)0)
+    {
+        if (on_error != (void *)0)
+        {
+            on_error (io, "Out of memory.", aux);
+        }
+
+        return;
+    }
+
+    s->fid         = fid;
+    s->data        = data;
+    s->length      = length;
+    s->blocksize   = (blocksize > 0) ? blocksize : SYNC_BLOCK_SIZE;
+    s->blocks      = (io->max_message_size - (4 + 1 + 2 + D9R_HASH_SIZE + 2))
+                   / (4 + D9R_HASH_SIZE);
+    s->next        = 0;
+    s->signature   = (struct d9c_sync_block *)0;
+    s->signatures  = 0;
+    s->capacity    = 0;
+    s->table       = (int_32 *)0;
+    s->table_size  = 0;
+    s->position    = 0;
+    s->literal     = 0;
+    s->from        = 0;
+    s->to          = 0;
+    s->copy_offset = 0;
+    s->copy_source = 0;
+    s->rolling     = 0;
+    s->written     = 0;
+    s->hashing     = 0;
+    s->hashed      = (char)0;
+    s->indexed     = (char)0;
+    s->rolled      = (char)0;
+    s->copy        = (char)((io->extensions & D9R_EXTENSION_COPY) != 0);
+    s->copying     = (char)0;
+    s->scanned     = (char)0;
+    s->truncate    = (char)0;
+    s->failed      = (char)0;
+    s->on_done     = on_done;
+    s->on_error    = on_error;
+    s->aux         = aux;
+
+    /* held until the first requests have been sent */
+    s->pending     = 1;
+
+    /* without signatures, all of it has to be written, and the file may
+     * have been longer */
+    if (!(io->extensions & D9R_EXTENSION_HASH))
+    {
+        s->hashed   = (char)1;
+        s->truncate = (char)1;
+    }
+
+    for (int i = 0; i < SYNC_DEPTH; i++)
+    {
+        sync_hash_next (io, s);
+    }
+
+    sync_release (io, s);
+}
+
+static void request_done (struct d9r_io *io, struct d9c_request *r)
+{
+    if (r->clunk)
+    {
+        d9r_clunk (io, r->fid);
+    }
+
+    if (r->on.done != (void *)0)
+    {
+        r->on.done (io, r->aux);
+    }
+
+    free_pool_mem (r);
+}
+
+static void request_Rwalk
+        (struct d9r_io *io, struct d9c_request *r, int_16 qidn,
+         struct d9r_qid *qid)
+{
+    struct d9r_qid q = { 0, 0, 0 };
+
+    /* a partial walk means one of the elements wasn't there */
+    if (qidn < r->elements)
+    {
+        kill_fid (io, r->fid);
+        request_error (io, r, "No such file or directory");
+        return;
+    }
+
+    if (qidn > 0)
+    {
+        q = qid[qidn-1];
+    }
+
+    if (r->on.walk != (void *)0)
+    {
+        r->on.walk (io, r->fid, q, r->aux);
+    }
+
+    free_pool_mem (r);
+}
+
+static void request_Rread
+        (struct d9r_io *io, struct d9c_request *r, int_32 count, int_8 *data)
+{
+    if (r->on_entry != (void *)0)
+    {
+        int_16 type;
+        struct d9r_qid qid;
+        int_32 dev, mode, atime, mtime, p = 0, rp;
+        int_64 length;
+        char *name, *uid, *gid, *muid, *ex;
+
+        if (count == 0)
+        {
+            request_done (io, r);
+            return;
+        }
+
+        while ((p < count) &&
+               ((rp = d9r_parse_stat_buffer
+                          (io, count - p, data + p, &type, &dev, &qid, &mode,
+                           &atime, &mtime, &length, &name, &uid, &gid, &muid,
+                           &ex)) > 0))
+        {
+            r->on_entry (io, type, dev, qid, mode, atime, mtime, length,
+                         name, uid, gid, muid, ex, r->aux);
+
+            p += rp;
+        }
+
+        r->offset += count;
+
+        request_track (io, d9r_read (io, r->fid, r->offset, IO_SIZE), r);
+        return;
+    }
+
+    if (r->on.read != (void *)0)
+    {
+        r->on.read (io, count, data, r->aux);
+    }
+
+    free_pool_mem (r);
+}
+
+/* striped reads */
+
+/**\brief Striped read depth
+ *
+ * How many reads each connection or FID of a striped read keeps in flight.
+ */
+#define STRIPE_DEPTH 4
+
+struct d9c_striped_read;
+
+/**\brief Striped read chunk
+ *
+ * One IO_SIZE range of the file, from the time it is requested until it has
+ * been written to the output in order.
+ */
+struct d9c_stripe_chunk
+{
+    struct d9c_stripe_worker *worker;
+    int_64                    index;
+    int_32                    size;
+    int_32                    length;
+    struct d9c_stripe_chunk  *next;
+    int_8                     data[IO_SIZE];
+};
+
+/**\brief Striped read worker
+ *
+ * One FID the file is read through; several workers may share a connection.
+ */
+struct d9c_stripe_worker
+{
+    struct d9c_striped_read  *read;
+    struct d9r_io            *io;
+    int_32                    fid;
+    char                      ready;
+    char                      dead;
+    int_32                    outstanding;
+};
+
+/**\brief Striped read
+ *
+ * State of a file read over several FIDs at once; chunks are handed out to
+ * whichever worker has room for more requests, and completed chunks are kept
+ * in order until all the chunks before them have been written out.
+ */
+struct d9c_striped_read
+{
+    struct io                *io;
+    int_32                    count;
+    struct d9c_stripe_worker *workers;
+    int_64                    length;
+    int_64                    chunks;
+    int_64                    next_chunk;
+    int_64                    next_output;
+    struct d9c_stripe_chunk  *pending;
+    int_32                    outstanding;
+    int_32                    alive;
+    char                      failed;
+    char                      stalled;
+    struct d9c_striped_read  *next_stalled;
+};
+
+static struct memory_pool d9c_stripe_chunk_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_stripe_chunk));
+
+static struct d9c_striped_read *stalled_stripes =
+        (struct d9c_striped_read *)0;
+
+static void stripe_fill (struct d9c_striped_read *s);
+
+static void stripe_unstall (struct d9c_striped_read *s)
+{
+    struct d9c_striped_read **p = &stalled_stripes;
+
+    while (*p != (struct d9c_striped_read *)0)
+    {
+        if (*p == s)
+        {
+            *p = s->next_stalled;
+            break;
+        }
+
+        p = &((*p)->next_stalled);
+    }
+
+    s->stalled = (char)0;
+}
+
+/* called from the multiplexer hook */
+static void resume_stripes ()
+{
+    struct d9c_striped_read *s = stalled_stripes, *n;
+
+    while (s != (struct d9c_striped_read *)0)
+    {
+        n = s->next_stalled;
+
+        if ((s->io->length - s->io->position) <= READ_LOW_WATER)
+        {
+            stripe_unstall (s);
+            stripe_fill (s);
+        }
+
+        s = n;
+    }
+}
+
+/* frees a striped read once it's done and nothing refers to it anymore */
+static void stripe_finish (struct d9c_striped_read *s)
+{
+    if (s->outstanding > 0) return;
+
+    if (!s->failed && ((s->chunks < 0) || (s->next_output < s->chunks)))
+    {
+        return;
+    }
+
+    if (s->stalled)
+    {
+        stripe_unstall (s);
+    }
+
+    for (int_32 i = 0; i < s->count; i++)
+    {
+        if (s->workers[i].fid != NO_FID_9P)
+        {
+            d9c_clunk (s->workers[i].io, s->workers[i].fid, (void *)0,
+                       (void *)0, (void *)0);
+        }
+    }
+
+    while (s->pending != (struct d9c_stripe_chunk *)0)
+    {
+        struct d9c_stripe_chunk *c = s->pending;
+
+        s->pending = c->next;
+        free_pool_mem (c);
+    }
+
+    multiplex_del_io (s->io);
+
+    afree (s->count * sizeof (struct d9c_stripe_worker), s->workers);
+    afree (sizeof (struct d9c_striped_read), s);
+}
+
+static void stripe_failed
+        (struct d9r_io *io, struct d9c_striped_read *s, const char *string)
+{
+    struct d9c_status *cs = (struct d9c_status *)(io->aux);
+
+    if (!s->failed)
+    {
+        s->failed = (char)1;
+
+        io_finish (s->io);
+
+        if (cs->error != (void *)0)
+        {
+            cs->error (io, string, cs->aux);
+        }
+    }
+}
+
+static void stripe_read (struct d9r_io *io, int_32 count, int_8 *data, void *aux);
+static void stripe_read_error (struct d9r_io *io, const char *string, void *aux);
+
+static void stripe_request (struct d9c_stripe_chunk *c)
+{
+    struct d9c_stripe_worker *w = c->worker;
+
+    d9c_read (w->io, w->fid, (c->index * IO_SIZE) + c->length,
+              c->size - c->length, stripe_read, stripe_read_error, (void *)c);
+}
+
+/* hands out chunks to workers with room for more requests */
+static void stripe_fill (struct d9c_striped_read *s)
+{
+    int_64 window = s->count * STRIPE_DEPTH * 2;
+
+    if (s->failed || (s->chunks < 0)) return;
+
+    if ((s->io->length - s->io->position) >= READ_HIGH_WATER)
+    {
+        if (!s->stalled)
+        {
+            s->stalled      = (char)1;
+            s->next_stalled = stalled_stripes;
+            stalled_stripes = s;
+        }
+
+        return;
+    }
+
+    for (int_32 i = 0; i < s->count; i++)
+    {
+        struct d9c_stripe_worker *w = &(s->workers[i]);
+
+        while (w->ready && !w->dead && (w->outstanding < STRIPE_DEPTH) &&
+               (s->next_chunk < s->chunks) &&
+               ((s->next_chunk - s->next_output) < window))
+        {
+            struct d9c_stripe_chunk *c = get_pool_mem (&d9c_stripe_chunk_pool);
+            int_64 rest = s->length - (s->next_chunk * IO_SIZE);
+
+            if (c == (struct d9c_stripe_chunk *)0) return;
+
+            c->worker = w;
+            c->index  = s->next_chunk;
+            c->size   = (rest < IO_SIZE) ? (int_32)rest : IO_SIZE;
+            c->length = 0;
+            c->next   = (struct d9c_stripe_chunk *)0;
+
+            s->next_chunk++;
+            s->outstanding++;
+            w->outstanding++;
+
+            stripe_request (c);
+        }
+    }
+}
+
+/* writes out all the chunks that are next in line */
+static void stripe_flush (struct d9c_striped_read *s)
+{
+    while ((s->pending != (struct d9c_stripe_chunk *)0) &&
+           (s->pending->index == s->next_output))
+    {
+        struct d9c_stripe_chunk *c = s->pending;
+
+        io_write (s->io, (const char *)c->data, c->length);
+
+        s->pending = c->next;
+        s->next_output++;
+
+        free_pool_mem (c);
+    }
+}
+
+static void stripe_read (struct d9r_io *io, int_32 count, int_8 *data, void *aux)
+{
+    struct d9c_stripe_chunk *c = (struct d9c_stripe_chunk *)aux;
+    struct d9c_stripe_worker *w = c->worker;
+    struct d9c_striped_read *s = w->read;
+    struct d9c_stripe_chunk **p;
+
+    for (int_32 i = 0; i < count; i++)
+    {
+        c->data[c->length + i] = data[i];
+    }
+
+    c->length += count;
+
+    /* short reads are allowed; ask for the rest */
+    if ((count > 0) && (c->length < c->size) && !s->failed)
+    {
+        stripe_request (c);
+        return;
+    }
+
+    w->outstanding--;
+    s->outstanding--;
+
+    if (s->failed)
+    {
+        free_pool_mem (c);
+        stripe_finish (s);
+        return;
+    }
+
+    /* the file got shorter while reading it */
+    if (c->length < c->size)
+    {
+        s->chunks = c->index + 1;
+    }
+
+    for (p = &(s->pending);
+         (*p != (struct d9c_stripe_chunk *)0) && ((*p)->index < c->index);
+         p = &((*p)->next));
+
+    c->next = *p;
+    *p = c;
+
+    stripe_flush (s);
+    stripe_fill (s);
+    stripe_finish (s);
+}
+
+static void stripe_read_error (struct d9r_io *io, const char *string, void *aux)
+{
+    struct d9c_stripe_chunk *c = (struct d9c_stripe_chunk *)aux;
+    struct d9c_stripe_worker *w = c->worker;
+    struct d9c_striped_read *s = w->read;
+
+    w->outstanding--;
+    s->outstanding--;
+
+    free_pool_mem (c);
+
+    stripe_failed (io, s, string);
+    stripe_finish (s);
+}
+
+static void stripe_error (struct d9r_io *io, const char *string, void *aux)
+{
+    struct d9c_stripe_worker *w = (struct d9c_stripe_worker *)aux;
+    struct d9c_striped_read *s = w->read;
+
+    w->dead = (char)1;
+    s->outstanding--;
+    s->alive--;
+
+    /* the file can still be read as long as one of the workers got it */
+    if ((s->alive == 0) ||
+        ((s->chunks < 0) && (w == &(s->workers[0]))))
+    {
+        stripe_failed (io, s, string);
+    }
+
+    stripe_finish (s);
+}
+
+static void stripe_stat
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
+{
+    struct d9c_stripe_worker *w = (struct d9c_stripe_worker *)aux;
+    struct d9c_striped_read *s = w->read;
+
+    s->outstanding--;
+    s->length = length;
+    s->chunks = (length + IO_SIZE - 1) / IO_SIZE;
+
+    stripe_fill (s);
+    stripe_finish (s);
+}
+
+static void stripe_opened
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
+{
+    struct d9c_stripe_worker *w = (struct d9c_stripe_worker *)aux;
+    struct d9c_striped_read *s = w->read;
+
+    w->ready = (char)1;
+
+    /* the first worker finds out how long the file is */
+    if (w == &(s->workers[0]))
+    {
+        d9c_stat_fid (io, w->fid, stripe_stat, stripe_error, (void *)w);
+    }
+    else
+    {
+        s->outstanding--;
+    }
+
+    stripe_fill (s);
+    stripe_finish (s);
+}
+
+static void stripe_walked
+        (struct d9r_io *io, int_32 fid, struct d9r_qid qid, void *aux)
+{
+    struct d9c_stripe_worker *w = (struct d9c_stripe_worker *)aux;
+
+    w->fid = fid;
+
+    d9c_open (io, fid, P9_OREAD, stripe_opened, stripe_error, (void *)w);
+}
+
+struct io *io_open_striped_read_9p
+        (struct d9r_io **ios, int_32 count, const char *path)
+{
+    struct io *io;
+    struct d9c_striped_read *s;
+
+    if (count < 1) return (struct io *)0;
+
+    if ((io = io_open_special ()) == (struct io *)0)
+    {
+        return (struct io *)0;
+    }
+
+    if ((s = aalloc (sizeof (struct d9c_striped_read)))
+        == (struct d9c_striped_read *)0)
+    {
+        io_close (io);
+        return (struct io *)0;
+    }
+
+    if ((s->workers = aalloc (count * sizeof (struct d9c_stripe_worker)))
+        == (struct d9c_stripe_worker *)0)
+    {
+        afree (sizeof (struct d9c_striped_read), s);
+        io_close (io);
+        return (struct io *)0;
+    }
+
+    s->io           = io;
+    s->count        = count;
+    s->length       = 0;
+    s->chunks       = -1;
+    s->next_chunk   = 0;
+    s->next_output  = 0;
+    s->pending      = (struct d9c_stripe_chunk *)0;
+    s->outstanding  = count;
+    s->alive        = count;
+    s->failed       = (char)0;
+    s->stalled      = (char)0;
+    s->next_stalled = (struct d9c_striped_read *)0;
+
+    for (int_32 i = 0; i < count; i++)
+    {
+        s->workers[i].read        = s;
+        s->workers[i].io          = ios[i];
+        s->workers[i].fid         = NO_FID_9P;
+        s->workers[i].ready       = (char)0;
+        s->workers[i].dead        = (char)0;
+        s->workers[i].outstanding = 0;
+    }
+
+    /* the walk callbacks may run right away, so don't start any before all
+     * the workers are set up */
+    for (int_32 i = 0; i < count; i++)
+    {
+        d9c_walk (ios[i], NO_FID_9P, path, stripe_walked, stripe_error,
+                  (void *)&(s->workers[i]));
+    }
+
+    return io;
+}
+
+static void Rattach (struct d9r_io *io, int_16 tag, struct d9r_qid qid)
+{
+    struct d9c_status *status = (struct d9c_status *)(io->aux);
+
+    status->code = d9c_ready;
+
+    if (status->attach != (void *)0)
+    {
+        status->attach (io, status->aux);
+    }
+}
+
+static void close_read (struct d9r_io *io, struct d9c_tag_status *status)
+{
+    status->code = d9c_closing_read;
+
+    track (io, d9r_clunk (io, status->fid), status);
+}
+
+/* continues an operation once its fid has been walked to the target */
+static void walked
+        (struct d9r_io *io, struct d9c_tag_status *status, struct d9r_qid *qid)
+{
+    struct d9c_status *cs = (struct d9c_status *)(io->aux);
+
+    switch (status->code)
+    {
+        case d9c_walking_read:
+            if (status->compound)
+            {
+                /* the open's already been sent */
+                status->code = d9c_opening_read;
+                break;
+            }
+
+            if ((cs->cache != (struct d9c_cache *)0) &&
+                (qid != (struct d9r_qid *)0) && !(qid->type & QTDIR))
+            {
+                if (cache_serve (cs->cache, status, qid))
+                {
+                    cs->statistics.data_hits++;
+                    close_read (io, status);
+                    break;
+                }
+
+                cs->statistics.data_misses++;
+                status->cache = cache_begin (cs->cache, qid);
+            }
+
+            status->code = d9c_opening_read;
+            track (io, d9r_open (io, status->fid, P9_OREAD), status);
+            break;
+
+        case d9c_walking_create:
+            status->code = d9c_opening_write;
+            track (io, d9r_create (io, status->fid, status->npath,
+                                   status->mode, P9_OWRITE, (char *)0),
+                   status);
+            break;
+
+        case d9c_walking_write:
+            status->code = d9c_opening_write;
+            track (io, d9r_open (io, status->fid, P9_OWRITE), status);
+            break;
+
+        case d9c_walking_stat:
+            status->code = d9c_stating;
+            track (io, d9r_stat (io, status->fid), status);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* finishes a walk for the directory fid cache */
+static void walked_directory
+        (struct d9r_io *io, struct d9c_tag_status *status, int_16 qidn,
+         struct d9r_qid *qid)
+{
+    struct d9c_directory_cache *cache =
+            &(((struct d9c_status *)(io->aux))->directories);
+    struct d9c_directory *d = directory_get (cache, status->path);
+    int_32 expected = d9c_elements (status->path);
+    char complete;
+
+    if (status->directory != (struct d9c_directory *)0)
+    {
+        expected -= d9c_elements (status->directory->path);
+    }
+
+    /* a partial walk does not create the new fid */
+    complete = (char)(qidn == expected);
+
+    directory_release (io, cache, status->directory);
+
+    if ((d != (struct d9c_directory *)0) && (d->fid == status->fid))
+    {
+        d->ready = complete;
+        d->references--;
+
+        if (complete && (qidn > 0) && (qid[qidn-1].type & QTDIR))
+        {
+            directory_shrink (io, cache);
+        }
+        else
+        {
+            directory_drop (io, cache, d);
+        }
+    }
+    else if (complete)
+    {
+        d9r_clunk (io, status->fid);
+    }
+    else
+    {
+        kill_fid (io, status->fid);
+    }
+
+    free_tag_status (status);
+}
+
+static void Rwalk   (struct d9r_io *io, int_16 tag, int_16 qidn,
+                     struct d9r_qid *qid)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        request_Rwalk (io, r, qidn, qid);
+        return;
+    }
+
+    if (md->aux != (void *)0)
+    {
+        struct d9c_tag_status *status = (struct d9c_tag_status *)(md->aux);
+        struct d9c_status *cs = (struct d9c_status *)(io->aux);
+
+        if (status->code == d9c_walking_directory)
+        {
+            walked_directory (io, status, qidn, qid);
+            return;
+        }
+
+        directory_release (io, &(cs->directories), status->directory);
+        status->directory = (struct d9c_directory *)0;
+
+        if ((cs->metadata != (struct d9c_metadata_cache *)0) && (qidn > 0))
+        {
+            struct d9c_metadata *m =
+                    metadata_record (io, cs->metadata, status->path, (char)0);
+
+            if (m != (struct d9c_metadata *)0)
+            {
+                m->qid = qid[qidn-1];
+            }
+        }
+
+        walked (io, status, (qidn > 0) ? &(qid[qidn-1]) : (struct d9r_qid *)0);
+    }
+}
+
+/**\brief Stalled read
+ *
+ * A read stream whose consumer has fallen behind; no Tread is outstanding for
+ * it until the consumer catches up.
+ */
+struct d9c_stalled_read
+{
+    struct d9r_io           *io;
+    struct d9c_tag_status   *status;
+    struct d9c_stalled_read *next;
+};
+
+static struct memory_pool d9c_stalled_read_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_stalled_read));
+
+static struct d9c_stalled_read *stalled_reads =
+        (struct d9c_stalled_read *)0;
+
+/**\brief Local read
+ *
+ * A read stream whose data comes straight from the host file backing it,
+ * which the server told us about with an Rlocal. The fid stays open until the
+ * file has been read, so the server still sees the file as being in use.
+ */
+struct d9c_local_read
+{
+    struct d9r_io          *io;
+    struct d9c_tag_status  *status;
+    struct io              *file;
+    int_64                  skip;
+    struct d9c_local_read  *next;
+};
+
+static struct memory_pool d9c_local_read_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct d9c_local_read));
+
+static struct d9c_local_read *local_reads = (struct d9c_local_read *)0;
+
+/* switches a read stream over to reading the file at path, or falls back to
+ * reading it over 9P if that can't be opened */
+static void read_local
+        (struct d9r_io *io, struct d9c_tag_status *status, const char *path)
+{
+    struct d9c_local_read *l = get_pool_mem (&d9c_local_read_pool);
+
+    status->code = d9c_ready_read;
+
+    if (l != (struct d9c_local_read *)0)
+    {
+        if ((l->file = io_open_read (path)) != (struct io *)0)
+        {
+            /* anything that already came over 9P is skipped */
+            l->io       = io;
+            l->status   = status;
+            l->skip     = status->offset;
+            l->next     = local_reads;
+            local_reads = l;
+
+            return;
+        }
+
+        free_pool_mem (l);
+    }
+
+    track (io, d9r_read (io, status->fid, status->offset, READ_SIZE), status);
+}
+
+/* copies data from local files to their streams, as long as the consumers
+ * keep up */
+static void pump_local_reads ()
+{
+    struct d9c_local_read **p = &local_reads;
+
+    while (*p != (struct d9c_local_read *)0)
+    {
+        struct d9c_local_read *l = *p;
+        struct io *sio = l->status->io, *f = l->file;
+        enum io_result r = io_no_change;
+
+        while ((sio->length - sio->position) < READ_HIGH_WATER)
+        {
+            r = io_read (f);
+
+            if ((l->skip > 0) && (f->length > f->position))
+            {
+                int_64 n = f->length - f->position;
+
+                if (n > l->skip) n = l->skip;
+
+                f->position += (unsigned int)n;
+                l->skip     -= n;
+            }
+
+            if (f->length > f->position)
+            {
+                io_write (sio, f->buffer + f->position,
+                          f->length - f->position);
+
+                l->status->offset += f->length - f->position;
+                f->position = f->length;
+            }
+
+            if (r != io_changes) break;
+        }
+
+        if ((r == io_end_of_file) || (r == io_unrecoverable_error))
+        {
+            struct d9c_status *cs = (struct d9c_status *)(l->io->aux);
+
+            *p = l->next;
+
+            io_close (f);
+
+            if ((r == io_unrecoverable_error) && (cs->error != (void *)0))
+            {
+                cs->error (l->io, "Could not read local file.", cs->aux);
+            }
+
+            close_read (l->io, l->status);
+
+            free_pool_mem (l);
+        }
+        else
+        {
+            p = &(l->next);
+        }
+    }
+}
+
+/* forgets about the local reads of a connection that is going away */
+static void drop_local_reads (struct d9r_io *io)
+{
+    struct d9c_local_read **p = &local_reads;
+
+    while (*p != (struct d9c_local_read *)0)
+    {
+        struct d9c_local_read *l = *p;
+
+        if (l->io == io)
+        {
+            *p = l->next;
+            io_close (l->file);
+            free_pool_mem (l);
+        }
+        else
+        {
+            p = &(l->next);
+        }
+    }
+}
+
+static void read_next (struct d9r_io *io, struct d9c_tag_status *status)
+{
+    struct io *sio = status->io;
+
+    if ((sio->length - sio->position) >= READ_HIGH_WATER)
+    {
+        struct d9c_stalled_read *r = get_pool_mem (&d9c_stalled_read_pool);
+
+        if (r != (struct d9c_stalled_read *)0)
+        {
+            r->io         = io;
+            r->status     = status;
+            r->next       = stalled_reads;
+            stalled_reads = r;
+
+            return;
+        }
+    }
+
+    track (io, d9r_read (io, status->fid, status->offset, READ_SIZE), status);
+}
+
+/* multiplexer callback: resumes stalled reads whose consumers caught up */
+static void resume_reads (int *rs, int r, int *ws, int w)
+{
+    struct d9c_stalled_read **p = &stalled_reads;
+
+    resume_stripes ();
+    pump_local_reads ();
+
+    while (*p != (struct d9c_stalled_read *)0)
+    {
+        struct d9c_stalled_read *s = *p;
+        struct io *sio = s->status->io;
+
+        if ((sio->length - sio->position) <= READ_LOW_WATER)
+        {
+            *p = s->next;
+
+            track (s->io, d9r_read (s->io, s->status->fid, s->status->offset,
+                                    READ_SIZE),
+                   s->status);
+
+            free_pool_mem (s);
+        }
+        else
+        {
+            p = &(s->next);
+        }
+    }
+}
+
+/* forgets about the stalled reads of a connection that is going away */
+static void drop_stalled_reads (struct d9r_io *io)
+{
+    struct d9c_stalled_read **p = &stalled_reads;
+
+    while (*p != (struct d9c_stalled_read *)0)
+    {
+        struct d9c_stalled_read *r = *p;
+
+        if (r->io == io)
+        {
+            *p = r->next;
+            free_pool_mem (r);
+        }
+        else
+        {
+            p = &(r->next);
+        }
+    }
+}
+
+static void Rread   (struct d9r_io *io, int_16 tag, int_32 count, int_8 *data)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        request_Rread (io, r, count, data);
+        return;
+    }
+
+    if (md->aux != (void *)0)
+    {
+        struct d9c_tag_status *status = (struct d9c_tag_status *)(md->aux);
+        struct d9c_cache *cache = ((struct d9c_status *)(io->aux))->cache;
+        int_64 noff = status->offset + (int_64)count;
+
+        if (count == 0)
+        {
+            if (status->cache != (struct d9c_cache_file *)0)
+            {
+                cache_finish (cache, status);
+            }
+
+            close_read (io, status);
+            return;
+        }
+
+        io_write (status->io, (const char *)data, count);
+
+        if (status->cache != (struct d9c_cache_file *)0)
+        {
+            cache_append (cache, status, count, data);
+        }
+
+        status->offset = noff;
+
+        /* the first read of a compound request told us there's more, which
+         * is better read from the host file */
+        if (status->local)
+        {
+            status->local = (char)0;
+
+            if (count >= READ_SIZE)
+            {
+                status->code = d9c_locating_read;
+                track (io, d9r_local (io, status->fid), status);
+                return;
+            }
+        }
+
+        read_next (io, status);
+    }
+}
+
+static void Rwrite  (struct d9r_io *io, int_16 tag, int_32 count)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        if (r->on.write != (void *)0)
+        {
+            r->on.write (io, count, r->aux);
+        }
+
+        free_pool_mem (r);
+        return;
+    }
+
+    if (md->aux != (void *)0)
+    {
+        invoke_write (io, (struct d9c_tag_status *)(md->aux), count);
+    }
+}
+
+static void Ropen   (struct d9r_io *io, int_16 tag, struct d9r_qid qid,
+                     int_32 iounit)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        if (r->on.open != (void *)0)
+        {
+            r->on.open (io, qid, iounit, r->aux);
+        }
+
+        free_pool_mem (r);
+        return;
+    }
+
+    if (md->aux != (void *)0)
+    {
+        struct d9c_tag_status *status = (struct d9c_tag_status *)(md->aux);
+
+        switch (status->code)
+        {
+            case d9c_opening_read:
+                if (status->compound)
+                {
+                    /* and so has the first read; the rest of a file with a
+                     * host file behind it is read from that */
+                    status->code     = d9c_ready_read;
+                    status->compound = (char)0;
+                    status->local    =
+                        (char)((io->extensions & D9R_EXTENSION_LOCAL) &&
+                               (qid.type & QTLOCAL));
+                    break;
+                }
+
+                /* the cache wants to see the data, so it has to come over 9P
+                 * if there's a cache; only files the server said have a host
+                 * file behind them are worth asking about */
+                if ((io->extensions & D9R_EXTENSION_LOCAL) &&
+                    (qid.type & QTLOCAL) &&
+                    (status->cache == (struct d9c_cache_file *)0))
+                {
+                    status->code = d9c_locating_read;
+                    track (io, d9r_local (io, status->fid), status);
+                    break;
+                }
+
+                status->code = d9c_ready_read;
+
+                md = d9r_tag_metadata (io, d9r_read (io, status->fid, 0,
+                                                        READ_SIZE));
+
+                if (md != (struct d9r_tag_metadata *)0)
+                {
+                    md->aux = (void *)status;
+                }
+
+/*                Rread (io, tag, 0, (int_8 *)0);*/
+
+                break;
+
+            case d9c_opening_write:
+                status->code = d9c_ready_write;
+
+                if ((iounit > 0) && (iounit < IO_SIZE))
+                {
+                    status->iounit = iounit;
+                }
+
+                if (!write_reserve (status, status->iounit))
+                {
+                    write_failed (io, status, "Out of memory.");
+                }
+
+                invoke_write (io, status, 0);
+
+            default:
+                break;
+        }
+    }
+}
+
+static void Rerror  (struct d9r_io *io, int_16 tag, const char *string, int_16 code)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        if (r->walk)
+        {
+            kill_fid (io, r->fid);
+        }
+
+        request_error (io, r, string);
+        return;
+    }
+
+    if ((md != (struct d9r_tag_metadata *)0) && (md->aux != (void *)0) &&
+        (*((enum d9c_status_code *)(md->aux)) == d9c_multiwalking))
+    {
+        multiwalk_error (io, (struct d9c_multiwalk_part *)(md->aux));
+        return;
+    }
+
+    if (md->aux != (void *)0)
+    {
+        struct d9c_tag_status *mds = (struct d9c_tag_status *)(md->aux);
+        struct d9c_status *status = (struct d9c_status *)(io->aux);
+        char done = (char)0;
+
+        if (mds->compound)
+        {
+            /* the rest of a compound request fails along with the first
+             * part that did; compound counts the replies still to come,
+             * and the status goes with the last of them */
+            if (mds->failed)
+            {
+                if (--(mds->compound) == 0)
+                {
+                    free_tag_status (mds);
+                }
+
+                return;
+            }
+
+            mds->failed   = (char)1;
+            mds->compound = (char)((mds->code == d9c_walking_read) ? 2 : 1);
+        }
+
+        if (mds->code == d9c_locating_read)
+        {
+            /* no local file, so read it the normal way */
+            mds->code = d9c_ready_read;
+            track (io, d9r_read (io, mds->fid, mds->offset, READ_SIZE), mds);
+            return;
+        }
+
+        if (mds->code == d9c_walking_directory)
+        {
+            struct d9c_directory *d =
+                    directory_get (&(status->directories), mds->path);
+
+            directory_release (io, &(status->directories), mds->directory);
+
+            if ((d != (struct d9c_directory *)0) && (d->fid == mds->fid))
+            {
+                directory_drop (io, &(status->directories), d);
+            }
+            else
+            {
+                kill_fid (io, mds->fid);
+            }
+
+            free_tag_status (mds);
+            return;
+        }
+
+        directory_release (io, &(status->directories), mds->directory);
+        mds->directory = (struct d9c_directory *)0;
+
+        switch (mds->code)
+        {
+            case d9c_walking_read:
+            case d9c_walking_create:
+            case d9c_walking_write:
+            case d9c_walking_stat:
+                if ((status->metadata != (struct d9c_metadata_cache *)0) &&
+                    ((code == 2) || /* ENOENT */
+                     d9c_strequal (string, "No such file or directory")))
+                {
+                    metadata_record (io, status->metadata, mds->path, (char)1);
+                }
+            default:
+                break;
+        }
+
+        switch (mds->code)
+        {
+            case d9c_attaching:
+                status->code = d9c_error;
+                break;
+            case d9c_walking_stat:
+            case d9c_stating:
+                if (mds->code == d9c_stating)
+                {
+                    d9r_clunk (io, mds->fid);
+                }
+                else
+                {
+                    kill_fid (io, mds->fid);
+                }
+
+                if (mds->on_error != (void *)0)
+                {
+                    mds->on_error (io, string, mds->aux);
+                }
+
+                free_tag_status (mds);
+                return;
+            case d9c_walking_read:
+            case d9c_opening_read:
+            case d9c_ready_read:
+            case d9c_closing_read:
+                if (status->cache != (struct d9c_cache *)0)
+                {
+                    cache_abort (status->cache, mds);
+                }
+                io_finish (mds->io);
+                kill_fid (io, mds->fid);
+                done = (char)!mds->compound;
+                break;
+            case d9c_walking_create:
+            case d9c_walking_write:
+                kill_fid (io, mds->fid);
+                mds->fid = NO_FID_9P;
+            case d9c_opening_write:
+            case d9c_ready_write:
+            case d9c_ready_write_working:
+                /* keep the stream around until it's closed, so that flushes
+                 * can report the error */
+                write_failed (io, mds, string);
+                invoke_write (io, mds, 0);
+                break;
+            case d9c_closing_write:
+                free_tag_status (mds);
+                break;
+
+            default:
+                break;
+        }
+
+        if (status->error != (void *)0)
+        {
+            status->error (io, string, status->aux);
+        }
+
+        if (done)
+        {
+            free_tag_status (mds);
+        }
+    }
+}
+
+static void Rlocal  (struct d9r_io *io, int_16 tag, char *path)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        if (r->on.local != (void *)0)
+        {
+            r->on.local (io, path, r->aux);
+        }
+
+        free_pool_mem (r);
+        return;
+    }
+
+    if ((md->aux != (void *)0) &&
+        (((struct d9c_tag_status *)(md->aux))->code == d9c_locating_read))
+    {
+        read_local (io, (struct d9c_tag_status *)(md->aux), path);
+    }
+}
+
+static void Rhash   (struct d9r_io *io, int_16 tag, int_8 *hash,
+                     int_16 count, int_32 *weak, int_8 *strong)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        if (r->on.hash != (void *)0)
+        {
+            r->on.hash (io, hash, count, weak, strong, r->aux);
+        }
+
+        free_pool_mem (r);
+    }
+}
+
+static void Rcopy   (struct d9r_io *io, int_16 tag, int_64 count)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        if (r->on.copy != (void *)0)
+        {
+            r->on.copy (io, count, r->aux);
+        }
+
+        free_pool_mem (r);
+    }
+}
+
+/* the search has started, so read the matches like a directory */
+static void Rfind   (struct d9r_io *io, int_16 tag)
+{
+    struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        r->walk  = (char)0;
+        r->clunk = (char)1;
+
+        request_track (io, d9r_read (io, r->fid, 0, IO_SIZE), r);
     }
 }
 
-static void Ropen   (struct d9r_io *io, int_16 tag, struct d9r_qid qid,
-                     int_32 fid)
+static void Rclunk  (struct d9r_io *io, int_16 tag)
 {
     struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        request_done (io, r);
+        return;
+    }
 
     if (md->aux != (void *)0)
     {
-        struct d9c_tag_status *status = (struct d9c_tag_status *)(md->aux);
+        struct d9c_tag_status *mds = (struct d9c_tag_status *)(md->aux);
 
-        switch (status->code)
+        switch (mds->code)
         {
-            case d9c_opening_read:
-                status->code = d9c_ready_read;
-
-                md = d9r_tag_metadata (io, d9r_read (io, status->fid, 0,
-                                                        0x1000));
-
-                if (md != (struct d9r_tag_metadata *)0)
-                {
-                    md->aux = (void *)status;
-                }
-
-/*                Rread (io, tag, 0, (int_8 *)0);*/
-
+            case d9c_closing_read:
+                multiplex_del_io (mds->io);
+                free_tag_status (mds);
                 break;
-
-            case d9c_opening_write:
-                status->code = d9c_ready_write;
-
-                struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
-
-                if (md->aux != (void *)0)
-                {
-                    invoke_write (io, status, 0);
-                }
-
+            case d9c_closing_write:
+                free_tag_status (mds);
             default:
                 break;
         }
     }
 }
 
-static void Rerror  (struct d9r_io *io, int_16 tag, const char *string, int_16 code)
+static void Rstat   (struct d9r_io *io, int_16 tag, int_16 type, int_32 dev,
+                     struct d9r_qid qid, int_32 mode, int_32 atime,
+                     int_32 mtime, int_64 length, char *name, char *uid,
+                     char *gid, char *muid, char *ex)
 {
     struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
+
+    if (r != (struct d9c_request *)0)
+    {
+        if (r->on.stat != (void *)0)
+        {
+            r->on.stat (io, type, dev, qid, mode, atime, mtime, length, name,
+                        uid, gid, muid, ex, r->aux);
+        }
+
+        free_pool_mem (r);
+        return;
+    }
 
     if (md->aux != (void *)0)
     {
         struct d9c_tag_status *mds = (struct d9c_tag_status *)(md->aux);
         struct d9c_status *status = (struct d9c_status *)(io->aux);
+        struct d9c_metadata *m = (struct d9c_metadata *)0;
 
-        switch (mds->code)
+        if (mds->code != d9c_stating) return;
+
+        if (status->metadata != (struct d9c_metadata_cache *)0)
         {
-            case d9c_attaching:
-                status->code = d9c_error;
-                break;
-            case d9c_walking_read:
-            case d9c_walking_create:
-            case d9c_walking_write:
-            case d9c_opening_read:
-            case d9c_opening_write:
-            case d9c_ready_read:
-            case d9c_ready_write:
-            case d9c_ready_write_working:
-                io_finish (mds->io);
-                kill_fid (io, mds->fid);
+            m = metadata_lookup (io, status->metadata, mds->path);
 
-            default:
-                break;
+            if ((m == (struct d9c_metadata *)0) || m->negative)
+            {
+                m = metadata_record (io, status->metadata, mds->path, (char)0);
+            }
+
+            if (m != (struct d9c_metadata *)0)
+            {
+                metadata_record_stat (m, type, dev, qid, mode, atime, mtime,
+                                      length, name, uid, gid, muid, ex);
+            }
         }
 
-        if (status->error != (void *)0)
+        if (mds->on_stat != (void *)0)
         {
-            status->error (io, string, status->aux);
+            mds->on_stat (io, type, dev, qid, mode, atime, mtime, length,
+                          name, uid, gid, muid, ex, mds->aux);
         }
+
+        /* keep the walked fid around so that an open can skip the walk */
+        if ((m != (struct d9c_metadata *)0) && (m->fid == NO_FID_9P))
+        {
+            m->fid = mds->fid;
+        }
+        else
+        {
+            d9r_clunk (io, mds->fid);
+        }
+
+        free_tag_status (mds);
     }
 }
 
-static void Rclunk  (struct d9r_io *io, int_16 tag)
+static void Rdone   (struct d9r_io *io, int_16 tag)
 {
     struct d9r_tag_metadata *md = d9r_tag_metadata (io, tag);
+    struct d9c_request *r = tag_request (md);
 
-    if (md->aux != (void *)0)
+    if (r != (struct d9c_request *)0)
     {
-        struct d9c_tag_status *mds = (struct d9c_tag_status *)(md->aux);
-
-        switch (mds->code)
-        {
-            case d9c_closing_write:
-                kill_fid (io, mds->fid);
-            default:
-                break;
-        }
+        request_done (io, r);
     }
 }
 
 /*
 static void Rflush  (struct d9r_io *, int_16);
-static void Rcreate (struct d9r_io *, int_16, struct d9r_qid, int_32);
-static void Rremove (struct d9r_io *, int_16);
-static void Rstat   (struct d9r_io *, int_16, int_16, int_32,
-           struct d9r_qid, int_32, int_32, int_32, int_64, char *,
-           char *, char *, char *, char *);
-static void Rwstat  (struct d9r_io *, int_16);
 */
 
+static void mx_count (int *r, int *w)
+{
+    for (struct d9c_local_read *l = local_reads;
+         l != (struct d9c_local_read *)0; l = l->next)
+    {
+        (*r)++;
+    }
+}
+
+/* local files are always readable, so this keeps multiplex() from waiting
+ * while there's room in their streams */
+static void mx_augment (int *rs, int *r, int *ws, int *w)
+{
+    for (struct d9c_local_read *l = local_reads;
+         l != (struct d9c_local_read *)0; l = l->next)
+    {
+        struct io *sio = l->status->io;
+
+        if ((sio->length - sio->position) < READ_HIGH_WATER)
+        {
+            rs[(*r)] = l->file->fd;
+            (*r)++;
+        }
+    }
+}
+
 void multiplex_d9c ()
 {
     static char initialised = 0;
+    static struct multiplex_functions mx_functions = {
+        mx_count, mx_augment, resume_reads,
+        (struct multiplex_functions *)0
+    };
 
     if (initialised == (char)0)
     {
         multiplex_io();
         multiplex_network();
         multiplex_d9r();
+        multiplex_add (&mx_functions);
 
         initialised = (char)1;
     }
@@ -383,6 +4657,28 @@ static void Cclose (struct d9r_io *io)
 {
     struct d9c_status *status = (struct d9c_status *)(io->aux);
 
+    if (status->cache != (struct d9c_cache *)0)
+    {
+        cache_close (status->cache);
+        status->cache = (struct d9c_cache *)0;
+    }
+
+    if (status->metadata != (struct d9c_metadata_cache *)0)
+    {
+        metadata_close (status->metadata);
+        status->metadata = (struct d9c_metadata_cache *)0;
+    }
+
+    directory_close (&(status->directories));
+    drop_stalled_reads (io);
+    drop_local_reads (io);
+
+    if (status->writers != (struct tree *)0)
+    {
+        tree_destroy (status->writers);
+        status->writers = (struct tree *)0;
+    }
+
     if (status->close != (void *)0)
     {
         status->close (io, status->aux);
@@ -413,6 +4709,21 @@ static void initialise_io
     status->error  = error;
     status->close  = close;
     status->aux    = aux;
+    status->cache  = (struct d9c_cache *)0;
+    status->metadata = (struct d9c_metadata_cache *)0;
+    status->writers  = (struct tree *)0;
+
+    status->directories.limit = DIRECTORY_FIDS;
+    status->directories.count = 0;
+    status->directories.paths = (struct tree *)0;
+    status->directories.head  = (struct d9c_directory *)0;
+    status->directories.tail  = (struct d9c_directory *)0;
+
+    status->statistics.data_hits       = 0;
+    status->statistics.data_misses     = 0;
+    status->statistics.metadata_hits   = 0;
+    status->statistics.metadata_misses = 0;
+    status->statistics.negative_hits   = 0;
 
     io->aux        = (void *)status;
 
@@ -423,12 +4734,22 @@ static void initialise_io
     io->Rread   = Rread;
     io->Rwrite  = Rwrite;
     io->Rclunk  = Rclunk;
-/*    io->Rstat   = Rstat;
-    io->Rcreate = Rcreate;
     io->Rstat   = Rstat;
-    io->Rwstat  = Rwstat;*/
+    io->Rcreate = Ropen;
+    io->Rremove = Rdone;
+    io->Rwstat  = Rdone;
+    io->Rlocal  = Rlocal;
+    io->Rmultiwalk = Rmultiwalk;
+    io->Rfind   = Rfind;
+    io->Rhash   = Rhash;
+    io->Rcopy   = Rcopy;
     io->close   = Cclose;
 
+    io->extensions = D9R_EXTENSION_LOCAL | D9R_EXTENSION_COMPOUND |
+                     D9R_EXTENSION_MULTIWALK | D9R_EXTENSION_FIND |
+                     D9R_EXTENSION_HASH | D9R_EXTENSION_COPY |
+                     D9R_EXTENSION_COMPRESS;
+
     multiplex_add_d9r (io, (void *)0);
 
     d9r_version (io, 0x2000, "9P2000");
@@ -491,6 +4812,16 @@ void multiplex_add_d9c_io
     initialise_io (io, attach, error, close, aux);
 }
 
+void multiplex_add_d9c_d9r
+        (struct d9r_io *io,
+         void (*attach) (struct d9r_io *, void *),
+         void (*error)  (struct d9r_io *, const char *, void *),
+         void (*close)  (struct d9r_io *, void *),
+         void *aux)
+{
+    initialise_io (io, attach, error, close, aux);
+}
+
 void multiplex_add_d9c_stdio
         (void (*attach) (struct d9r_io *, void *),
          void (*error)  (struct d9r_io *, const char *, void *),
@@ -504,17 +4835,177 @@ void multiplex_add_d9c_stdio
     initialise_io (io, attach, error, close, aux);
 }
 
+/* walks a new fid to path, which must not start with a '/'; the walk starts
+ * at the closest cached directory, and the path's parent directory is added
+ * to the cache along the way */
+static void walk_path
+        (struct d9r_io *io9, struct d9c_tag_status *status, const char *path)
+{
+    struct d9c_directory_cache *cache =
+            &(((struct d9c_status *)(io9->aux))->directories);
+    struct d9c_directory *source = (struct d9c_directory *)0;
+    int_32 length = d9c_strlen (path);
+    int_16 n, start = 0;
+    char  pathn[length + 1];
+    char *pathx[d9c_elements (path) + 1];
+
+    n = d9c_split (path, pathn, pathx);
+
+    if ((cache->limit > 0) && (n > 1))
+    {
+        /* the directories are cached by their paths with single slashes */
+        char prefix[length + 1];
+        char pending = (char)0;
+        int_16 k;
+
+        d9c_join (prefix, pathn, pathx, n);
+
+        /* cut the prefix down one element at a time, longest first */
+        for (k = n - 1; k > 0; k--)
+        {
+            struct d9c_directory *d;
+
+            prefix[(pathx[k] - pathn) - 1] = (char)0;
+
+            if ((d = directory_get (cache, prefix)) != (struct d9c_directory *)0)
+            {
+                if (d->ready)
+                {
+                    source = d;
+                    start  = k;
+                    break;
+                }
+
+                if (k == (n - 1)) pending = (char)1;
+            }
+        }
+
+        if ((start < (n - 1)) && !pending)
+        {
+            int_32 dfid = find_free_fid (io9);
+            struct d9c_tag_status *ds;
+            struct d9c_directory *d;
+
+            d9c_join (prefix, pathn, pathx, n - 1);
+
+            if ((ds = get_tag_status (d9c_walking_directory, prefix))
+                != (struct d9c_tag_status *)0)
+            {
+                if ((d = directory_add (cache, prefix, dfid))
+                    != (struct d9c_directory *)0)
+                {
+                    ds->fid       = dfid;
+                    ds->directory = source;
+
+                    if (source != (struct d9c_directory *)0)
+                    {
+                        source->references++;
+                    }
+
+                    track (io9,
+                           d9r_walk (io9,
+                                     (source != (struct d9c_directory *)0)
+                                         ? source->fid : ROOT_FID,
+                                     dfid, (n - 1) - start, pathx + start),
+                           ds);
+
+                    directory_shrink (io9, cache);
+                }
+                else
+                {
+                    free_tag_status (ds);
+                }
+            }
+        }
+    }
+
+    status->fid       = find_free_fid (io9);
+    status->directory = source;
+
+    if (source != (struct d9c_directory *)0)
+    {
+        source->references++;
+
+        directory_unlink (cache, source);
+        directory_push (cache, source);
+    }
+
+    /* reads send the open and the first read along with the walk if they
+     * can, unless the data cache needs to see the qid first; with a host file
+     * behind it, Ropen says so and the rest comes from there */
+    status->compound =
+        (char)((status->code == d9c_walking_read) &&
+               (io9->extensions & D9R_EXTENSION_COMPOUND) &&
+               (((struct d9c_status *)(io9->aux))->cache
+                    == (struct d9c_cache *)0));
+
+    if (status->compound)
+    {
+        int_32 start_compound = d9r_begin_compound (io9);
+
+        track (io9,
+               d9r_walk (io9,
+                         (source != (struct d9c_directory *)0) ? source->fid
+                                                               : ROOT_FID,
+                         status->fid, n - start, pathx + start),
+               status);
+        track (io9, d9r_open (io9, status->fid, P9_OREAD), status);
+        track (io9, d9r_read (io9, status->fid, 0, READ_SIZE), status);
+
+        d9r_end_compound (io9, start_compound);
+
+        return;
+    }
+
+    track (io9,
+           d9r_walk (io9,
+                     (source != (struct d9c_directory *)0) ? source->fid
+                                                           : ROOT_FID,
+                     status->fid, n - start, pathx + start),
+           status);
+}
+
 static struct io *io_open_9p
         (struct d9r_io *io9, const char *path, enum d9c_status_code code,
          const char *npath, int mode)
 {
+    struct d9c_status *cs = (struct d9c_status *)(io9->aux);
+    struct d9c_metadata *m = (struct d9c_metadata *)0;
     struct io *io = io_open_special();
+    char missing = (char)0;
 
     if (io == (struct io *)0) return (struct io *)0;
 
-    struct memory_pool pool
-            = MEMORY_POOL_INITIALISER (sizeof (struct d9c_tag_status));
-    struct d9c_tag_status *status = get_pool_mem (&pool);
+    while (path[0] == '/')
+    {
+        path++;
+    }
+
+    if (cs->metadata != (struct d9c_metadata_cache *)0)
+    {
+        m = metadata_lookup (io9, cs->metadata, path);
+
+        if ((m != (struct d9c_metadata *)0) && m->negative)
+        {
+            cs->statistics.negative_hits++;
+            missing = (char)1;
+        }
+        else if (code == d9c_walking_create)
+        {
+            int_32 l = d9c_strlen (path), k = d9c_strlen (npath);
+            char npathx[l + k + 2];
+            char *c = npathx;
+
+            for (int_32 i = 0; i < l; i++) *(c++) = path[i];
+            if (l > 0) *(c++) = '/';
+            for (int_32 i = 0; i < k; i++) *(c++) = npath[i];
+            *c = (char)0;
+
+            metadata_invalidate (io9, cs->metadata, npathx);
+        }
+    }
+
+    struct d9c_tag_status *status = get_tag_status (code, path);
 
     if (status == (struct d9c_tag_status *)0)
     {
@@ -523,91 +5014,79 @@ static struct io *io_open_9p
         return (struct io *)0;
     }
 
-    status->code   = code;
     status->mode   = mode;
     status->npath  = npath;
-    status->offset = (int_64)0;
-    int i = 0, j = 0;
-    int_32 fid = find_free_fid (io9);
-
-    while (path[0] == '/')
-    {
-        path++;
-    }
+    status->io     = io;
 
-    while (path[i])
+    /* only the stream fails, as it would with the reply the cache stands in
+     * for: reads just end, and writes report it when they're flushed */
+    if (missing)
     {
-        if (path[i] == '/') j++;
-        i++;
-    }
+        if (code == d9c_walking_read)
+        {
+            io_finish (io);
+            free_tag_status (status);
 
-    status->fid = fid;
-    status->io  = io;
+            return io;
+        }
 
-    if (j > 0)
+        status->code = d9c_ready_write;
+        write_failed (io9, status, "No such file or directory");
+    }
+    else if ((m != (struct d9c_metadata *)0) && (m->fid != NO_FID_9P))
     {
-        j++;
+        struct d9r_qid qid = m->qid;
 
-        char  pathn[i];
-        char *pathx[j];
+        cs->statistics.metadata_hits++;
 
-        pathx[0] = pathn;
+        status->fid = m->fid;
+        m->fid      = NO_FID_9P;
 
-        for (j = 0, i = 0; path[i]; i++)
+        if (code == d9c_walking_write)
         {
-            if (path[i] == '/')
-            {
-                pathn[i] = (char)0;
-                j++;
-                pathx[j] = pathn + i + 1;
-            }
-            else
-            {
-                pathn[i] = path[i];
-            }
+            metadata_drop_stat (m);
         }
-        j++;
-        pathn[i] = (char)0;
-
-        struct d9r_tag_metadata *md =
-                d9r_tag_metadata (io9, d9r_walk (io9, ROOT_FID, fid, j, pathx));
 
-        if (md != (struct d9r_tag_metadata *)0)
-        {
-            md->aux = (void *)status;
-        }
+        walked (io9, status, &qid);
     }
     else
     {
-        struct d9r_tag_metadata *md =
-            d9r_tag_metadata (io9,
-                ((path[0] == 0) ? d9r_walk (io9, ROOT_FID, fid, 0, (char **)0) :
-                                  d9r_walk (io9, ROOT_FID, fid, 1,
-                                            (char **)&path)));
-
-        if (md != (struct d9r_tag_metadata *)0)
+        if (cs->metadata != (struct d9c_metadata_cache *)0)
         {
-            md->aux = (void *)status;
+            cs->statistics.metadata_misses++;
         }
+
+        walk_path (io9, status, path);
     }
 
     switch (code)
     {
+        case d9c_walking_create:
         case d9c_walking_write:
             {
-                struct memory_pool pool
-                        = MEMORY_POOL_INITIALISER (sizeof(struct d9c_wx));
-
-                struct d9c_wx *wx = (struct d9c_wx *)get_pool_mem (&pool);
-                wx->io = io9;
-                wx->status = status;
+                struct d9c_wx *wx =
+                        (struct d9c_wx *)get_pool_mem (&d9c_wx_pool);
 
                 if (wx != (struct d9c_wx *)0)
                 {
+                    wx->io = io9;
+                    wx->status = status;
+
                     multiplex_add_io
                             (status->io, d9c_write_on_read,
                              d9c_write_on_close, (void *)wx);
                 }
+
+                if (cs->writers == (struct tree *)0)
+                {
+                    cs->writers = tree_create ();
+                }
+
+                if (cs->writers != (struct tree *)0)
+                {
+                    tree_add_node_value (cs->writers, (int_pointer)io,
+                                         (void *)status);
+                }
             }
 
             break;
@@ -617,6 +5096,89 @@ static struct io *io_open_9p
     return io;
 }
 
+void d9c_stat
+        (struct d9r_io *io, const char *path,
+         void (*on_stat) (struct d9r_io *, int_16, int_32, struct d9r_qid,
+                          int_32, int_32, int_32, int_64, char *, char *,
+                          char *, char *, char *, void *),
+         void (*on_error) (struct d9r_io *, const char *, void *),
+         void *aux)
+{
+    struct d9c_status *cs = (struct d9c_status *)(io->aux);
+    struct d9c_metadata *m = (struct d9c_metadata *)0;
+    struct d9c_tag_status *status;
+
+    while (path[0] == '/')
+    {
+        path++;
+    }
+
+    if (cs->metadata != (struct d9c_metadata_cache *)0)
+    {
+        m = metadata_lookup (io, cs->metadata, path);
+
+        if (m != (struct d9c_metadata *)0)
+        {
+            if (m->negative)
+            {
+                cs->statistics.negative_hits++;
+
+                if (on_error != (void *)0)
+                {
+                    on_error (io, "No such file or directory", aux);
+                }
+
+                return;
+            }
+
+            if (m->has_stat)
+            {
+                cs->statistics.metadata_hits++;
+
+                if (on_stat != (void *)0)
+                {
+                    on_stat (io, m->type, m->dev, m->qid, m->mode, m->atime,
+                             m->mtime, m->length, m->name, m->uid, m->gid,
+                             m->muid, m->ex, aux);
+                }
+
+                return;
+            }
+        }
+
+        cs->statistics.metadata_misses++;
+    }
+
+    if ((status = get_tag_status (d9c_walking_stat, path))
+        == (struct d9c_tag_status *)0)
+    {
+        if (on_error != (void *)0)
+        {
+            on_error (io, "Out of memory.", aux);
+        }
+
+        return;
+    }
+
+    status->on_stat  = on_stat;
+    status->on_error = on_error;
+    status->aux      = aux;
+
+    if ((m != (struct d9c_metadata *)0) && (m->fid != NO_FID_9P))
+    {
+        struct d9r_qid qid = m->qid;
+
+        status->fid = m->fid;
+        m->fid      = NO_FID_9P;
+
+        walked (io, status, &qid);
+    }
+    else
+    {
+        walk_path (io, status, path);
+    }
+}
+
 struct io *io_open_read_9p (struct d9r_io *io, const char *path)
 {
     return io_open_9p (io, path, d9c_walking_read, (const char *)0, 0);
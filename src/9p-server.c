@@ -27,6 +27,7 @@
  */
 
 #include <duat/9p-server.h>
+#include <duat/hash.h>
 #include <curie/multiplex.h>
 #include <curie/network.h>
 #include <curie/memory.h>
@@ -37,38 +38,49 @@ static void Tattach (struct d9r_io *io, int_16 tag, int_32 fid, int_32 afid,
 {
     struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
     struct dfs *fs = (struct dfs *)io->aux;
-    struct d9r_qid qid = { 0, 1, (int_64)(int_pointer)io->aux };
+    struct d9r_qid qid;
 
     if (md != (struct d9r_fid_metadata *)0)
     {
         md->aux = fs->root;
     }
 
+    dfs_qid (&(fs->root->c), &qid);
+
     d9r_reply_attach (io, tag, qid);
 }
 
-static void Twalk (struct d9r_io *io, int_16 tag, int_32 fid, int_32 afid,
-                   int_16 c, char **names)
+/* the node a fid refers to, or the root for NO_FID_9P; null for fids that
+ * haven't been attached or walked, or have been clunked since */
+static struct dfs_directory *fid_node (struct d9r_io *io, int_32 fid)
 {
-    struct dfs *fs = io->aux;
-    struct d9r_qid qid[c];
-    struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
-    struct dfs_directory *d;
+    struct d9r_fid_metadata *md;
 
-    if (md != (struct d9r_fid_metadata *)0)
+    if (fid == NO_FID_9P)
     {
-        d = md->aux;
+        return ((struct dfs *)io->aux)->root;
     }
-    else
+
+    if ((md = d9r_fid_metadata (io, fid)) == (struct d9r_fid_metadata *)0)
     {
-        d = fs->root;
+        return (struct dfs_directory *)0;
     }
 
+    return md->aux;
+}
+
+/* walks the names from *dp for as long as they exist, storing their qids;
+ * returns how many could be walked, and leaves *dp at the last one */
+static int_16 resolve
+        (struct dfs_directory **dp, int_16 c, char **names,
+         struct d9r_qid *qid)
+{
+    struct dfs_directory *d = *dp;
     int_16 i = 0;
 
     while (i < c) {
         if (d->c.type == dft_directory) {
-            struct tree_node *node;
+            struct dfs_node_common *node;
             if (names[i][0] == 0)
             {
                 goto ret;
@@ -83,25 +95,18 @@ static void Twalk (struct d9r_io *io, int_16 tag, int_32 fid, int_32 afid,
                 }
             }
 
-            node = tree_get_node_string(d->nodes, names[i]);
+            node = dfs_get_node (d, names[i]);
 
-            if (node == (struct tree_node *)0)
+            if (node == (struct dfs_node_common *)0)
             {
-                d9r_reply_error (io, tag, "No such file or directory", P9_EDONTCARE);
-                return;
+                break;
             }
 
-            if ((d = node_get_value(node)) == (struct dfs_directory *)0)
-            {
-                d9r_reply_error (io, tag, "Internal Duat VFS issue", P9_EDONTCARE);
-                return;
-            }
+            d = (struct dfs_directory *)node;
 
             ret:
 
-            qid[i].type    = 0;
-            qid[i].version = 1;
-            qid[i].path    = (int_64)(int_pointer)d;
+            dfs_qid (&(d->c), &(qid[i]));
 
             i++;
         } else {
@@ -109,12 +114,32 @@ static void Twalk (struct d9r_io *io, int_16 tag, int_32 fid, int_32 afid,
         }
     }
 
-    if ((i == 0) && (c == 1))
+    *dp = d;
+
+    return i;
+}
+
+static void Twalk (struct d9r_io *io, int_16 tag, int_32 fid, int_32 afid,
+                   int_16 c, char **names)
+{
+    struct d9r_qid qid[c];
+    struct d9r_fid_metadata *md;
+    struct dfs_directory *d = fid_node (io, fid);
+    int_16 i;
+
+    if (d == (struct dfs_directory *)0)
     {
-        d9r_reply_error (io, tag, "No such file or directory", P9_EDONTCARE);
+        if (afid != fid)
+        {
+            kill_fid (io, afid);
+        }
+
+        d9r_reply_error (io, tag, "No such file.", P9_EDONTCARE);
         return;
     }
 
+    i = resolve (&d, c, names, qid);
+
     if (i == c)
     {
         md = d9r_fid_metadata (io, afid);
@@ -129,23 +154,65 @@ static void Twalk (struct d9r_io *io, int_16 tag, int_32 fid, int_32 afid,
     d9r_reply_walk (io, tag, i, qid);
 }
 
+static void Tmultiwalk
+        (struct d9r_io *io, int_16 tag, int_32 fid, int_16 count,
+         int_16 *namec, char **names)
+{
+    struct dfs_directory *root = fid_node (io, fid);
+    int_32 total = 0, q = 0, length = 2;
+    int_16 p;
+
+    if (root == (struct dfs_directory *)0)
+    {
+        d9r_reply_error (io, tag, "No such file.", P9_EDONTCARE);
+        return;
+    }
+
+    for (p = 0; p < count; p++)
+    {
+        total += namec[p];
+    }
+
+    struct d9r_qid qid[total + 1];
+    int_16 qidc[count + 1];
+
+    for (p = 0, total = 0; p < count; p++)
+    {
+        struct dfs_directory *d = root;
+
+        qidc[p] = resolve (&d, namec[p], names + total, qid + q);
+
+        total  += namec[p];
+        q      += qidc[p];
+        length += 2 + (qidc[p] * 13);
+    }
+
+    if ((4 + 1 + 2 + length) > io->max_message_size)
+    {
+        d9r_reply_error (io, tag, "Reply would be too large.", P9_EDONTCARE);
+        return;
+    }
+
+    d9r_reply_multiwalk (io, tag, count, qidc, qid);
+}
+
 static void Tstat (struct d9r_io *io, int_16 tag, int_32 fid)
 {
     struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
     struct dfs_node_common *c = md->aux;
-    struct d9r_qid qid = { 0, 1, (int_64)(int_pointer)c };
+    struct d9r_qid qid;
     int_32 modex = 0;
     char *ex = (char *)0;
     char devbuffer[10];
 
+    dfs_qid (c, &qid);
+
     switch (c->type)
     {
         case dft_directory:
-            qid.type = QTDIR;
             modex = DMDIR;
             break;
         case dft_symlink:
-            qid.type = QTLINK;
             modex = DMSYMLINK;
             {
                 struct dfs_symlink *link = (struct dfs_symlink *)c;
@@ -225,25 +292,49 @@ static void Tstat (struct d9r_io *io, int_16 tag, int_32 fid)
     }
 
     d9r_reply_stat (io, tag, 0, 0, qid, modex | c->mode, c->atime, c->mtime,
-                    c->length, c->name, c->uid, c->gid, c->muid, ex);
+                    c->length, c->name, dfs_owner_name (c->uid),
+                    dfs_owner_name (c->gid), dfs_owner_name (c->muid), ex);
+}
+
+/* whether c is a file with a host file behind it that the other end may be
+ * told the path of; that's only for the process itself, or for the host user
+ * that owns the file, as anyone else may not be able to read it at all */
+static int local_path (struct d9r_io *io, struct dfs_node_common *c)
+{
+    char *owner;
+
+    if (!(io->extensions & D9R_EXTENSION_LOCAL) || (c->type != dft_file) ||
+        (((struct dfs_file *)c)->path == (char *)0))
+    {
+        return 0;
+    }
+
+    if (io->peer_uid == D9R_PEER_SELF)
+    {
+        return 1;
+    }
+
+    return (io->peer_uid >= 0) &&
+           ((owner = dfs_owner_name (c->uid)) != (char *)0) &&
+           (dfs_get_user (owner) == io->peer_uid);
 }
 
 static void Topen (struct d9r_io *io, int_16 tag, int_32 fid, int_8 mode)
 {
     struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
     struct dfs_node_common *c = md->aux;
-    struct d9r_qid qid = { 0, 1, (int_64)(int_pointer)c };
+    struct d9r_qid qid;
 
-    switch (c->type)
+    md->open = (char)1;
+    md->mode = mode;
+
+    dfs_qid (c, &qid);
+
+    /* the same files that Tlocal gives a path for */
+    if (local_path (io, c) &&
+        (((mode & 0x3) == P9_OREAD) || ((mode & 0x3) == P9_OREADWRITE)))
     {
-        case dft_directory:
-            qid.type = QTDIR;
-            break;
-        case dft_symlink:
-            qid.type = QTLINK;
-            break;
-        default:
-            break;
+        qid.type |= QTLOCAL;
     }
 
     d9r_reply_open (io, tag, qid, 0x1000);
@@ -254,7 +345,8 @@ static void Tcreate (struct d9r_io *io, int_16 tag, int_32 fid, char *name, int_
     struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
     struct dfs_node_common *c = md->aux;
     struct dfs_directory *d;
-    struct d9r_qid qid = { 0, 1, 2 };
+    struct dfs_node_common *n;
+    struct d9r_qid qid;
 
     if (c->type != dft_directory)
     {
@@ -268,21 +360,19 @@ static void Tcreate (struct d9r_io *io, int_16 tag, int_32 fid, char *name, int_
 
     if (perm & DMDIR)
     {
-        qid.type = QTDIR;
-        qid.path = (int_64)(int_pointer)dfs_mk_directory(d, name);
+        n = (struct dfs_node_common *)dfs_mk_directory(d, name);
     }
     else if (perm & DMSYMLINK)
     {
-        qid.type = QTLINK;
-        qid.path = (int_64)(int_pointer)dfs_mk_symlink(d, name, ext);
+        n = (struct dfs_node_common *)dfs_mk_symlink(d, name, ext);
     }
     else if (perm & DMSOCKET)
     {
-        qid.path = (int_64)(int_pointer)dfs_mk_socket(d, name);
+        n = (struct dfs_node_common *)dfs_mk_socket(d, name);
     }
     else if (perm & DMNAMEDPIPE)
     {
-        qid.path = (int_64)(int_pointer)dfs_mk_pipe(d, name);
+        n = (struct dfs_node_common *)dfs_mk_pipe(d, name);
     }
     else if (perm & DMDEVICE)
     {
@@ -313,79 +403,172 @@ static void Tcreate (struct d9r_io *io, int_16 tag, int_32 fid, char *name, int_
             i++;
         }
 
-        qid.path = (int_64)(int_pointer)dfs_mk_device
+        n = (struct dfs_node_common *)dfs_mk_device
                 (d, name,
                  (ext[0] == 'b') ? dfs_block_device : dfs_character_device,
                   majour, minor);
     }
     else
     {
-        qid.path = (int_64)(int_pointer)dfs_mk_file
+        n = (struct dfs_node_common *)dfs_mk_file
                 (d, name, (char *)0, (int_8 *)0, 0, (void *)0, (void *)0, (void *)0);
     }
 
+    if (n == (struct dfs_node_common *)0)
+    {
+        d9r_reply_error (io, tag, "Out of memory.", P9_EDONTCARE);
+        return;
+    }
+
+    dfs_qid (n, &qid);
+
     d9r_reply_create (io, tag, qid, 0x1000);
 }
 
-struct Tread_dir_map
+/* the mode bits for the node's type */
+static int_32 node_modex (struct dfs_node_common *c)
 {
-    int_32 index;
-    int_16 tag;
-    char replied;
-    struct d9r_io *io;
+    switch (c->type)
+    {
+        case dft_directory:
+            return DMDIR;
+        case dft_symlink:
+            return DMSYMLINK;
+        case dft_device:
+            return DMDEVICE;
+        case dft_socket:
+            return DMSOCKET;
+        case dft_pipe:
+            return DMNAMEDPIPE;
+        case dft_file:
+            break;
+    }
+
+    return 0;
+}
+
+static int_16 prepare_stat_buffer
+        (struct d9r_io *io, int_8 **bb, struct dfs_node_common *c, char *name)
+{
+    struct d9r_qid qid;
+
+    dfs_qid (c, &qid);
+
+    return d9r_prepare_stat_buffer
+            (io, bb, 0, 0, &qid, node_modex (c) | c->mode, c->atime,
+             c->mtime, c->length, name, dfs_owner_name (c->uid),
+             dfs_owner_name (c->gid), dfs_owner_name (c->muid), (char *)0);
+}
+
+static void Tread_dir (struct d9r_io *io, int_16 tag, struct dfs_node_common *c)
+{
+    int_8 *bb;
+    int_16 slen = prepare_stat_buffer (io, &bb, c, c->name);
+
+    d9r_reply_read (io, tag, slen, bb);
+    afree (slen, bb);
+}
+
+/**\brief Search
+ *
+ * A search started with Tfind, along with the match that didn't fit into the
+ * last read, if any.
+ */
+struct search
+{
+    struct dfs_find        *find;
+    struct dfs_node_common *held;
 };
 
-static void Tread_dir (struct tree_node *node, void *v)
+static struct memory_pool search_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct search));
+
+/* searches, by the metadata of the fid they were started for */
+static struct tree searches = TREE_INITIALISER;
+
+static struct search *fid_search (struct d9r_fid_metadata *md)
 {
-    struct Tread_dir_map *m = (struct Tread_dir_map *)v;
+    struct tree_node *n = tree_get_node (&searches, (int_pointer)md);
 
-    if (m->index == 0)
+    if (n != (struct tree_node *)0)
     {
-        struct dfs_node_common *c
-                = (struct dfs_node_common *)node_get_value (node);
+        return (struct search *)node_get_value (n);
+    }
+
+    return (struct search *)0;
+}
 
-        if (c != (struct dfs_node_common *)0)
+static void drop_search (struct d9r_fid_metadata *md)
+{
+    struct search *s = fid_search (md);
+
+    if (s != (struct search *)0)
+    {
+        dfs_find_destroy (s->find);
+        free_pool_mem (s);
+        tree_remove_node (&searches, (int_pointer)md);
+    }
+}
+
+/* fills the read with as many matches as fit */
+static void Tread_find
+        (struct d9r_io *io, int_16 tag, struct search *s, int_64 offset,
+         int_32 length)
+{
+    int_32 p = 0;
+
+    if (length > (io->max_message_size - (4 + 1 + 2 + 4)))
+    {
+        length = io->max_message_size - (4 + 1 + 2 + 4);
+    }
+
+    int_8 buffer[length + 1];
+
+    if (offset == (int_64)0)
+    {
+        dfs_find_rewind (s->find);
+        s->held = (struct dfs_node_common *)0;
+    }
+
+    while (1)
+    {
+        struct dfs_node_common *c = s->held;
+        int_8 *bb;
+        int_16 slen;
+
+        if ((c == (struct dfs_node_common *)0) &&
+            ((c = dfs_find_next (s->find)) == (struct dfs_node_common *)0))
         {
-            int_8 *bb;
-            int_16 slen = 0;
-            int_32 modex = 0;
-            struct d9r_qid qid = { 0, 1, (int_64)(int_pointer)c };
+            break;
+        }
 
-            switch (c->type)
-            {
-                case dft_directory:
-                    qid.type = QTDIR;
-                    modex = DMDIR;
-                    break;
-                case dft_symlink:
-                    qid.type = QTLINK;
-                    modex = DMSYMLINK;
-                    break;
-                case dft_device:
-                    modex = DMDEVICE;
-                    break;
-                case dft_socket:
-                    modex = DMSOCKET;
-                    break;
-                case dft_pipe:
-                    modex = DMNAMEDPIPE;
-                    break;
-                case dft_file:
-                    break;
-            }
+        slen = prepare_stat_buffer (io, &bb, c, s->find->path);
 
-            slen = d9r_prepare_stat_buffer
-                    (m->io, &bb, 0, 0, &qid, modex | c->mode, c->atime,
-                     c->mtime, c->length, c->name, c->uid, c->gid, c->muid,
-                     (char *)0);
-            d9r_reply_read (m->io, m->tag, slen, bb);
+        if ((p + slen) > length)
+        {
             afree (slen, bb);
+            s->held = c;
+            break;
+        }
 
-            m->replied = (char)1;
+        for (int_16 i = 0; i < slen; i++)
+        {
+            buffer[p + i] = bb[i];
         }
+
+        afree (slen, bb);
+        p      += slen;
+        s->held = (struct dfs_node_common *)0;
+    }
+
+    if ((p == 0) && (s->held != (struct dfs_node_common *)0))
+    {
+        d9r_reply_error (io, tag, "Read too small for the next match.",
+                         P9_EDONTCARE);
+        return;
     }
 
-    m->index--;
+    d9r_reply_read (io, tag, p, buffer);
 }
 
 static void Tread (struct d9r_io *io, int_16 tag, int_32 fid, int_64 offset, int_32 length)
@@ -398,16 +581,30 @@ static void Tread (struct d9r_io *io, int_16 tag, int_32 fid, int_64 offset, int
         case dft_directory:
             {
                 struct dfs_directory *dir = (struct dfs_directory *)c;
+                struct search *s = fid_search (md);
+
+                if (s != (struct search *)0)
+                {
+                    Tread_find (io, tag, s, offset, length);
+                    break;
+                }
+
                 if (offset == (int_64)0) md->index = 0;
 
                 if (md->index == 0)
                 {
                     int_8 *bb;
-                    struct d9r_qid qid = { QTDIR, 1, (int_64)(int_pointer)c };
-                    int_16 slen = d9r_prepare_stat_buffer
+                    struct d9r_qid qid;
+                    int_16 slen;
+
+                    dfs_qid (c, &qid);
+
+                    slen = d9r_prepare_stat_buffer
                             (io, &bb, 0, 0, &qid, DMDIR | dir->c.mode,
                              dir->c.atime, dir->c.mtime, dir->c.length, ".",
-                             dir->c.uid, dir->c.gid, dir->c.muid, (char *)0);
+                             dfs_owner_name (dir->c.uid),
+                             dfs_owner_name (dir->c.gid),
+                             dfs_owner_name (dir->c.muid), (char *)0);
                     d9r_reply_read (io, tag, slen, bb);
                     afree (slen, bb);
                 }
@@ -415,30 +612,34 @@ static void Tread (struct d9r_io *io, int_16 tag, int_32 fid, int_64 offset, int
                 {
                     int_16 slen;
                     int_8 *bb;
-                    struct d9r_qid qid = { QTDIR, 1, (int_64)(int_pointer)c };
+                    struct d9r_qid qid;
 
                     dir = dir->parent;
 
+                    dfs_qid (&(dir->c), &qid);
+
                     slen = d9r_prepare_stat_buffer
                             (io, &bb, 0, 0, &qid, DMDIR | dir->c.mode,
                              dir->c.atime, dir->c.mtime, dir->c.length, "..",
-                             dir->c.uid, dir->c.gid, dir->c.muid, (char *)0);
+                             dfs_owner_name (dir->c.uid),
+                             dfs_owner_name (dir->c.gid),
+                             dfs_owner_name (dir->c.muid), (char *)0);
                     d9r_reply_read (io, tag, slen, bb);
                     afree (slen, bb);
                 }
                 else
                 {
-                    struct Tread_dir_map m
-                            = { .tag = tag, .replied = (char)0, .io = io };
-
-                    m.index = md->index - 2;
-
-                    tree_map (dir->nodes, Tread_dir, (void *)&m);
+                    struct dfs_node_common *n =
+                            dfs_get_node_index (dir, md->index - 2);
 
-                    if (m.replied == (char)0)
+                    if (n == (struct dfs_node_common *)0)
                     {
                         d9r_reply_read (io, tag, 0, (int_8 *)0);
                     }
+                    else
+                    {
+                        Tread_dir (io, tag, n);
+                    }
                 }
 
                 (md->index)++;
@@ -468,6 +669,8 @@ static void Tread (struct d9r_io *io, int_16 tag, int_32 fid, int_64 offset, int
     }
 }
 
+/* files without a write callback take whatever is written to them but don't
+ * change, so their version stays the same as well */
 static void Twrite (struct d9r_io *io, int_16 tag, int_32 fid, int_64 offset, int_32 count, int_8 *data)
 {
     struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
@@ -481,8 +684,14 @@ static void Twrite (struct d9r_io *io, int_16 tag, int_32 fid, int_64 offset, in
 
                 if (f->on_write != (void *)0)
                 {
-                    d9r_reply_write
-                            (io, tag, f->on_write (f, offset, count, data));
+                    int_32 r = f->on_write (f, offset, count, data);
+
+                    if (r > 0)
+                    {
+                        dfs_touch (c);
+                    }
+
+                    d9r_reply_write (io, tag, r);
                     return;
                 }
             }
@@ -494,25 +703,482 @@ static void Twrite (struct d9r_io *io, int_16 tag, int_32 fid, int_64 offset, in
     d9r_reply_write (io, tag, count);
 }
 
+/* nodes can't be renamed or handed to other users, and files can only be
+ * shrunk, as their data belongs to whoever created them; as in 9P, either
+ * all of the changes are made or none are */
 static void Twstat
         (struct d9r_io *io, int_16 tag, int_32 fid, int_16 type, int_32 dev,
          struct d9r_qid qid, int_32 mode, int_32 atime, int_32 mtime,
          int_64 length, char *name, char *uid, char *gid, char *muid, char *ex)
 {
-    d9r_reply_wstat(io, tag); /* stub reply with 'yes' */
+    struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
+    struct dfs_node_common *c;
+    int_16 owner = DFS_NO_OWNER;
+    char changed = (char)0;
+
+    if ((md == (struct d9r_fid_metadata *)0) ||
+        ((c = md->aux) == (struct dfs_node_common *)0))
+    {
+        d9r_reply_error (io, tag, "No such file.", P9_EDONTCARE);
+        return;
+    }
+
+    if (((name != (char *)0) && (name[0] != (char)0)) ||
+        ((uid != (char *)0) && (uid[0] != (char)0)))
+    {
+        d9r_reply_error (io, tag, "Cannot rename or chown.", P9_EDONTCARE);
+        return;
+    }
+
+    if (length != ~(int_64)0)
+    {
+        if ((c->type != dft_file) ||
+            (((struct dfs_file *)c)->on_read != (void *)0))
+        {
+            d9r_reply_error (io, tag, "Cannot truncate this file.",
+                             P9_EDONTCARE);
+            return;
+        }
+
+        if (length > c->length)
+        {
+            d9r_reply_error (io, tag, "Cannot extend this file.",
+                             P9_EDONTCARE);
+            return;
+        }
+    }
+
+    if ((mode != ~(int_32)0) &&
+        ((mode & ~(DFSSETUID | DFSSETGID | 0777)) != node_modex (c)))
+    {
+        d9r_reply_error (io, tag, "Cannot change the file type.",
+                         P9_EDONTCARE);
+        return;
+    }
+
+    if ((gid != (char *)0) && (gid[0] != (char)0) &&
+        ((owner = dfs_owner (gid)) == DFS_NO_OWNER))
+    {
+        d9r_reply_error (io, tag, "Out of memory.", P9_EDONTCARE);
+        return;
+    }
+
+    if ((length != ~(int_64)0) && (length != c->length))
+    {
+        c->length = length;
+        changed   = (char)1;
+    }
+
+    if ((mode != ~(int_32)0) && ((int_32)c->mode != (mode & ~node_modex (c))))
+    {
+        c->mode = mode & ~node_modex (c);
+        changed = (char)1;
+    }
+
+    if ((atime != ~(int_32)0) && (c->atime != atime))
+    {
+        c->atime = atime;
+        changed  = (char)1;
+    }
+
+    if ((mtime != ~(int_32)0) && (c->mtime != mtime))
+    {
+        c->mtime = mtime;
+        changed  = (char)1;
+    }
+
+    if ((owner != DFS_NO_OWNER) && (c->gid != owner))
+    {
+        c->gid  = owner;
+        changed = (char)1;
+    }
+
+    if (changed)
+    {
+        dfs_touch (c);
+    }
+
+    d9r_reply_wstat (io, tag);
+}
+
+/* only hands out the path of files that were opened for reading on this
+ * connection, so the local access doesn't go beyond what 9P would allow */
+static void Tlocal (struct d9r_io *io, int_16 tag, int_32 fid)
+{
+    struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
+    struct dfs_file *file;
+
+    if ((md == (struct d9r_fid_metadata *)0) || !md->open ||
+        (((md->mode & 0x3) != P9_OREAD) && ((md->mode & 0x3) != P9_OREADWRITE)))
+    {
+        d9r_reply_error (io, tag, "File not open for reading.", P9_EDONTCARE);
+        return;
+    }
+
+    file = (struct dfs_file *)md->aux;
+
+    if (!local_path (io, &(file->c)))
+    {
+        d9r_reply_error (io, tag, "No local file.", P9_EDONTCARE);
+        return;
+    }
+
+    d9r_reply_local (io, tag, file->path);
+}
+
+/**\brief Hash cache size
+ *
+ * Number of Rhash results kept, each for one range of one version of a file.
+ * Sync tools hash the same files over and over, and most of them don't change
+ * in between.
+ */
+#define HASH_CACHE_SIZE 256
+
+/**\brief Hash cache entry
+ *
+ * Empty as long as the path is 0, which no node has.
+ */
+struct hash_cache_entry
+{
+    int_64  path;
+    int_32  version;
+    int_64  offset;
+    int_64  length;
+    int_32  blocksize;
+    int_16  count;
+    int_8   hash[D9R_HASH_SIZE];
+    int_32 *weak;
+    int_8  *strong;
+};
+
+static struct hash_cache_entry hash_cache[HASH_CACHE_SIZE];
+
+static void hash_cache_clear (struct hash_cache_entry *e)
+{
+    if (e->count > 0)
+    {
+        afree (e->count * sizeof (int_32), e->weak);
+        afree (e->count * D9R_HASH_SIZE, e->strong);
+    }
+
+    e->path  = 0;
+    e->count = 0;
+}
+
+/* returns the file behind fid if it's open in the given direction */
+static struct dfs_file *open_file (struct d9r_io *io, int_32 fid, char write)
+{
+    struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
+    struct dfs_file *file;
+    int_8 mode;
+
+    if ((md == (struct d9r_fid_metadata *)0) || !md->open ||
+        ((file = (struct dfs_file *)md->aux) == (struct dfs_file *)0) ||
+        (file->c.type != dft_file))
+    {
+        return (struct dfs_file *)0;
+    }
+
+    mode = md->mode & 0x3;
+
+    if ((mode != P9_OREADWRITE) &&
+        ((write && (mode != P9_OWRITE)) || (!write && (mode != P9_OREAD))))
+    {
+        return (struct dfs_file *)0;
+    }
+
+    return file;
+}
+
+/* only files with their contents in memory can be hashed right away, the
+ * others would have to be read through their callbacks first; as with Tlocal,
+ * the file has to be open for reading */
+static void Thash (struct d9r_io *io, int_16 tag, int_32 fid, int_64 offset,
+                   int_64 length, int_32 blocksize)
+{
+    struct dfs_file *file = open_file (io, fid, (char)0);
+    struct hash_cache_entry *e;
+    int_64 end;
+    int_16 count = 0;
+
+    if (file == (struct dfs_file *)0)
+    {
+        d9r_reply_error (io, tag, "File not open for reading.", P9_EDONTCARE);
+        return;
+    }
+
+    if (file->on_read != (void *)0)
+    {
+        d9r_reply_error (io, tag, "Cannot hash this file.", P9_EDONTCARE);
+        return;
+    }
+
+    if ((offset < 0) || (blocksize < 0) ||
+        ((length < 0) && (length != ~(int_64)0)))
+    {
+        d9r_reply_error (io, tag, "Invalid range.", P9_EDONTCARE);
+        return;
+    }
+
+    if (offset > file->c.length)
+    {
+        offset = file->c.length;
+    }
+
+    end = ((length == ~(int_64)0) || (length > (file->c.length - offset)))
+        ? file->c.length : (offset + length);
+    length = end - offset;
+
+    if (blocksize > 0)
+    {
+        int_64 blocks = (length + blocksize - 1) / blocksize;
+        int_32 max = (io->max_message_size - (4 + 1 + 2 + D9R_HASH_SIZE + 2))
+                   / (4 + D9R_HASH_SIZE);
+
+        count = (int_16)((blocks > max) ? max : blocks);
+    }
+
+    e = &(hash_cache[((unsigned long)(file->c.path ^ (offset * 7) ^
+                                      (length * 13) ^ blocksize))
+                     % HASH_CACHE_SIZE]);
+
+    if ((e->path != file->c.path) || (e->version != file->c.version) ||
+        (e->offset != offset) || (e->length != length) ||
+        (e->blocksize != blocksize) || (e->count != count))
+    {
+        hash_cache_clear (e);
+
+        if ((count > 0) &&
+            (((e->weak = aalloc (count * sizeof (int_32))) == (int_32 *)0) ||
+             ((e->strong = aalloc (count * D9R_HASH_SIZE)) == (int_8 *)0)))
+        {
+            if (e->weak != (int_32 *)0)
+            {
+                afree (count * sizeof (int_32), e->weak);
+            }
+
+            d9r_reply_error (io, tag, "Out of memory.", P9_EDONTCARE);
+            return;
+        }
+
+        dhash (file->data + offset, length, e->hash);
+
+        for (int_16 n = 0; n < count; n++)
+        {
+            int_64 bo = offset + ((int_64)n * blocksize);
+            int_32 bl = ((end - bo) < blocksize) ? (int_32)(end - bo)
+                                                 : blocksize;
+
+            e->weak[n] = dhash_weak (file->data + bo, bl);
+            dhash (file->data + bo, bl, e->strong + (n * D9R_HASH_SIZE));
+        }
+
+        e->path      = file->c.path;
+        e->version   = file->c.version;
+        e->offset    = offset;
+        e->length    = length;
+        e->blocksize = blocksize;
+        e->count     = count;
+    }
+
+    d9r_reply_hash (io, tag, e->hash, e->count, e->weak, e->strong);
+}
+
+/**\brief Largest amount of data passed to a write callback at a time */
+#define COPY_CHUNK_SIZE 0x100000
+
+/* the source needs its contents in memory; a destination without callbacks
+ * gets a copy of them that the VFS keeps, as long as it's the whole of its
+ * contents that are replaced, while any other goes through its write
+ * callback */
+static void Tcopy (struct d9r_io *io, int_16 tag, int_32 fid, int_64 offset,
+                   int_32 srcfid, int_64 srcoffset, int_64 length)
+{
+    struct dfs_file *source = open_file (io, srcfid, (char)0);
+    struct dfs_file *file = open_file (io, fid, (char)1);
+    int_64 count = 0;
+
+    if ((source == (struct dfs_file *)0) || (file == (struct dfs_file *)0))
+    {
+        d9r_reply_error (io, tag, "File not open.", P9_EDONTCARE);
+        return;
+    }
+
+    if (source->on_read != (void *)0)
+    {
+        d9r_reply_error (io, tag, "Cannot copy from this file.", P9_EDONTCARE);
+        return;
+    }
+
+    if ((offset < 0) || (srcoffset < 0) ||
+        ((length < 0) && (length != ~(int_64)0)))
+    {
+        d9r_reply_error (io, tag, "Invalid range.", P9_EDONTCARE);
+        return;
+    }
+
+    if (srcoffset > source->c.length)
+    {
+        srcoffset = source->c.length;
+    }
+
+    if ((length == ~(int_64)0) || (length > (source->c.length - srcoffset)))
+    {
+        length = source->c.length - srcoffset;
+    }
+
+    if ((file == source) && (offset < (srcoffset + length)) &&
+        (srcoffset < (offset + length)))
+    {
+        d9r_reply_error (io, tag, "Overlapping copy.", P9_EDONTCARE);
+        return;
+    }
+
+    if (file->on_write != (void *)0)
+    {
+        while (count < length)
+        {
+            int_32 chunk = ((length - count) > COPY_CHUNK_SIZE)
+                         ? COPY_CHUNK_SIZE : (int_32)(length - count);
+            int_32 r = file->on_write (file, offset + count, chunk,
+                                       source->data + srcoffset + count);
+
+            if (r > 0)
+            {
+                count += r;
+            }
+
+            if (r < chunk)
+            {
+                break;
+            }
+        }
+
+        if (count > 0)
+        {
+            dfs_touch (&(file->c));
+        }
+    }
+    else if ((file->on_read == (void *)0) && (offset == 0) &&
+             (length >= file->c.length))
+    {
+        if (!dfs_copy_contents (file, source, srcoffset, length))
+        {
+            d9r_reply_error (io, tag, "Out of memory.", P9_EDONTCARE);
+            return;
+        }
+
+        count = length;
+    }
+    else
+    {
+        d9r_reply_error (io, tag, "Cannot copy to this file.", P9_EDONTCARE);
+        return;
+    }
+
+    d9r_reply_copy (io, tag, count);
+}
+
+/* the search fid is only known as a directory here, which Tread treats
+ * specially as long as the search is there */
+static void Tfind
+        (struct d9r_io *io, int_16 tag, int_32 fid, int_32 newfid,
+         char *pattern, int_32 types, int_64 minlength, int_64 maxlength,
+         int_32 after, int_32 before)
+{
+    struct dfs_directory *d = fid_node (io, fid);
+    struct d9r_fid_metadata *md = d9r_fid_metadata (io, newfid);
+    struct search *s;
+
+    if (md == (struct d9r_fid_metadata *)0)
+    {
+        d9r_reply_error (io, tag, "Out of memory.", P9_EDONTCARE);
+        return;
+    }
+
+    if (d == (struct dfs_directory *)0)
+    {
+        kill_fid (io, newfid);
+        d9r_reply_error (io, tag, "No such file.", P9_EDONTCARE);
+        return;
+    }
+
+    if (d->c.type != dft_directory)
+    {
+        kill_fid (io, newfid);
+        d9r_reply_error (io, tag, "Not a directory.", P9_EDONTCARE);
+        return;
+    }
+
+    if ((s = get_pool_mem (&search_pool)) == (struct search *)0)
+    {
+        kill_fid (io, newfid);
+        d9r_reply_error (io, tag, "Out of memory.", P9_EDONTCARE);
+        return;
+    }
+
+    if ((s->find = dfs_find_create (d, pattern, types, minlength, maxlength,
+                                    after, before)) == (struct dfs_find *)0)
+    {
+        free_pool_mem (s);
+        kill_fid (io, newfid);
+        d9r_reply_error (io, tag, "Out of memory.", P9_EDONTCARE);
+        return;
+    }
+
+    s->held  = (struct dfs_node_common *)0;
+    md->aux  = d;
+    md->open = (char)1;
+    md->mode = P9_OREAD;
+
+    tree_add_node_value (&searches, (int_pointer)md, (void *)s);
+
+    d9r_reply_find (io, tag);
+}
+
+static void Tclunk (struct d9r_io *io, int_16 tag, int_32 fid)
+{
+    struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
+
+    if (md != (struct d9r_fid_metadata *)0)
+    {
+        drop_search (md);
+    }
+
+    d9r_reply_clunk (io, tag);
+}
+
+static void Tremove (struct d9r_io *io, int_16 tag, int_32 fid)
+{
+    struct d9r_fid_metadata *md = d9r_fid_metadata (io, fid);
+
+    if (md != (struct d9r_fid_metadata *)0)
+    {
+        drop_search (md);
+    }
+
+    d9r_reply_remove (io, tag);
+}
+
+static void drop_fid_search (struct tree_node *n, void *aux)
+{
+    drop_search ((struct d9r_fid_metadata *)node_get_value (n));
 }
 
 static void Cclose (struct d9r_io *io)
 {
     struct dfs *fs = (struct dfs *)io->aux;
 
+    tree_map (io->fids, drop_fid_search, (void *)0);
+
     if (fs->close != (void *)0)
     {
         fs->close (io, fs->aux);
     }
 }
 
-static void initialise_io (struct d9r_io *io, struct dfs *fs)
+static void initialise_io
+        (struct d9r_io *io, struct dfs *fs, int_32 extensions)
 {
     io->Tattach = Tattach;
     io->Twalk   = Twalk;
@@ -522,14 +1188,31 @@ static void initialise_io (struct d9r_io *io, struct dfs *fs)
     io->Tread   = Tread;
     io->Twrite  = Twrite;
     io->Twstat  = Twstat;
+    io->Tlocal  = Tlocal;
+    io->Tmultiwalk = Tmultiwalk;
+    io->Tfind   = Tfind;
+    io->Thash   = Thash;
+    io->Tcopy   = Tcopy;
+    io->Tclunk  = Tclunk;
+    io->Tremove = Tremove;
     io->close   = Cclose;
     io->aux     = (void *)fs;
 
+    /* compound requests are taken apart before they get here, so they work
+     * on any connection, as do the others that only involve the VFS */
+    io->extensions = extensions | D9R_EXTENSION_COMPOUND |
+                     D9R_EXTENSION_MULTIWALK | D9R_EXTENSION_FIND |
+                     D9R_EXTENSION_HASH | D9R_EXTENSION_COPY;
+
     multiplex_add_d9r (io, (void *)0);
 }
 
 static void on_connect(struct io *in, struct io *out, void *p) {
-    multiplex_add_d9s_io (in, out, (struct dfs *)p);
+    struct d9r_io *io = d9r_open_io(in, out);
+
+    if (io == (struct d9r_io *)0) return;
+
+    initialise_io (io, (struct dfs *)p, D9R_EXTENSION_LOCAL);
 }
 
 void multiplex_d9s ()
@@ -556,7 +1239,13 @@ void multiplex_add_d9s_io (struct io *in, struct io *out, struct dfs *fs)
 
     if (io == (struct d9r_io *)0) return;
 
-    initialise_io (io, fs);
+    /* these may well lead to another host */
+    initialise_io (io, fs, D9R_EXTENSION_COMPRESS);
+}
+
+void multiplex_add_d9s_d9r (struct d9r_io *io, struct dfs *fs)
+{
+    initialise_io (io, fs, D9R_EXTENSION_LOCAL);
 }
 
 void multiplex_add_d9s_stdio (struct dfs *fs)
@@ -565,5 +1254,5 @@ void multiplex_add_d9s_stdio (struct dfs *fs)
 
     if (io == (struct d9r_io *)0) return;
 
-    initialise_io (io, fs);
+    initialise_io (io, fs, D9R_EXTENSION_COMPRESS);
 }
@@ -31,6 +31,7 @@
 
 #include <duat/9p.h>
 #include <duat/filesystem.h>
+#include <duat/compress.h>
 #include <curie/memory.h>
 #include <curie/multiplex.h>
 
@@ -77,7 +78,35 @@ enum request_code {
     Tstat    = 124, /**< Obtain information about file or directory; request. */
     Rstat    = 125, /**< Obtain information about file or directory; reply. */
     Twstat   = 126, /**< Write information about file or directory; request.*/
-    Rwstat   = 127  /**< Write information about file or directory; reply. */
+    Rwstat   = 127, /**< Write information about file or directory; reply. */
+    Tlocal   = 150, /**< Host path of an open file; request. Only used with
+                     *   D9R_EXTENSION_LOCAL. */
+    Rlocal   = 151, /**< Host path of an open file; reply. */
+    Tcompound= 152, /**< Several requests in one message; request. Only used
+                     *   with D9R_EXTENSION_COMPOUND. */
+    Rcompound= 153, /**< Several requests in one message; reply. */
+    Tmultiwalk=154, /**< Walk many paths at once; request. Only used with
+                     *   D9R_EXTENSION_MULTIWALK. */
+    Rmultiwalk=155, /**< Walk many paths at once; reply. */
+    Tfind    = 156, /**< Search a tree; request. Only used with
+                     *   D9R_EXTENSION_FIND. */
+    Rfind    = 157, /**< Search a tree; reply. */
+    Thash    = 158, /**< Hash a file's contents; request. Only used with
+                     *   D9R_EXTENSION_HASH. */
+    Rhash    = 159, /**< Hash a file's contents; reply. */
+    Tcopy    = 160, /**< Copy between files on the server; request. Only
+                     *   used with D9R_EXTENSION_COPY. */
+    Rcopy    = 161  /**< Copy between files on the server; reply. */
+};
+
+/**\brief Compound request states
+ *
+ * Values of d9r_io.compound.
+ */
+enum compound_state {
+    cs_none    = 0, /**< Not running a Tcompound. */
+    cs_running = 1, /**< Running a Tcompound. */
+    cs_failed  = 2  /**< Running a Tcompound, and one of its requests failed. */
 };
 
 struct d9r_io *d9r_open_io (struct io *in, struct io *out) {
@@ -105,6 +134,11 @@ struct d9r_io *d9r_open_io (struct io *in, struct io *out) {
     rv->Tremove = (void *)0;
     rv->Tstat   = (void *)0;
     rv->Twstat  = (void *)0;
+    rv->Tlocal  = (void *)0;
+    rv->Tmultiwalk = (void *)0;
+    rv->Tfind   = (void *)0;
+    rv->Thash   = (void *)0;
+    rv->Tcopy   = (void *)0;
 
     rv->Rauth   = (void *)0;
     rv->Rattach = (void *)0;
@@ -119,12 +153,28 @@ struct d9r_io *d9r_open_io (struct io *in, struct io *out) {
     rv->Rremove = (void *)0;
     rv->Rstat   = (void *)0;
     rv->Rwstat  = (void *)0;
+    rv->Rlocal  = (void *)0;
+    rv->Rcompound = (void *)0;
+    rv->Rmultiwalk = (void *)0;
+    rv->Rfind   = (void *)0;
+    rv->Rhash   = (void *)0;
+    rv->Rcopy   = (void *)0;
 
     rv->close   = (void *)0;
 
     rv->aux     = (void *)0;
 
     rv->version = d9r_uninitialised;
+    rv->extensions = 0;
+    rv->peer_uid   = D9R_PEER_UNKNOWN;
+    rv->compound   = cs_none;
+    rv->compound_walk = -1;
+
+    rv->next_tag = 0;
+    rv->next_fid = 2;
+
+    rv->loopback = (struct d9r_loopback *)0;
+    rv->ring     = (struct d9r_ring *)0;
 
     in->type = iot_read;
     out->type = iot_write;
@@ -179,7 +229,22 @@ static void d9r_free_resources (struct d9r_io *io)
     free_pool_mem (io);
 }
 
+static void loopback_close (struct d9r_io *io);
+static void ring_close (struct d9r_io *io);
+
 void d9r_close_io (struct d9r_io *io) {
+    if (io->loopback != (struct d9r_loopback *)0)
+    {
+        loopback_close (io);
+        return;
+    }
+
+    if (io->ring != (struct d9r_ring *)0)
+    {
+        ring_close (io);
+        return;
+    }
+
     io_close (io->in);
     io_close (io->out);
 
@@ -188,17 +253,56 @@ void d9r_close_io (struct d9r_io *io) {
 
 void multiplex_del_d9r (struct d9r_io *io)
 {
+    if (io->loopback != (struct d9r_loopback *)0)
+    {
+        loopback_close (io);
+        return;
+    }
+
+    if (io->ring != (struct d9r_ring *)0)
+    {
+        ring_close (io);
+        return;
+    }
+
     multiplex_del_io (io->in);
     multiplex_del_io (io->out);
 
     d9r_free_resources (io);
 }
 
+static void rings_count (int *w);
+static void rings_augment (int *ws, int *w);
+static void rings_sleep ();
+
+static void mx_count (int *r, int *w)
+{
+    rings_count (w);
+}
+
+static void mx_augment (int *rs, int *r, int *ws, int *w)
+{
+    rings_augment (ws, w);
+}
+
+static void mx_callback (int *rs, int r, int *ws, int w)
+{
+    d9r_run_loopback ();
+    d9r_run_rings ();
+
+    rings_sleep ();
+}
+
 void multiplex_d9r () {
     static char installed = (char)0;
+    static struct multiplex_functions mx_functions = {
+        mx_count, mx_augment, mx_callback,
+        (struct multiplex_functions *)0
+    };
 
     if (installed == (char)0) {
         multiplex_io();
+        multiplex_add (&mx_functions);
         installed = (char)1;
     }
 }
@@ -496,10 +600,16 @@ static void kill_tag (struct d9r_io *io, int_16 tag) {
     }
 }
 
+/* both of these continue where the last search left off, so that finding a
+ * free tag or fid stays cheap with many of them in use */
+
 static int_16 find_free_tag (struct d9r_io *io) {
-    int_16 tag = 0;
+    int_16 tag = io->next_tag;
 
-    while (tree_get_node(io->tags, (int_pointer)tag) != (struct tree_node *)0) tag++;
+    while ((tag == NO_TAG_9P) ||
+           (tree_get_node(io->tags, (int_pointer)tag) != (struct tree_node *)0)) tag++;
+
+    io->next_tag = tag + 1;
 
     register_tag(io, tag);
 
@@ -507,9 +617,12 @@ static int_16 find_free_tag (struct d9r_io *io) {
 }
 
 int_32 find_free_fid (struct d9r_io *io) {
-    int_32 fid = 2;
+    int_32 fid = io->next_fid;
+
+    while ((fid < 2) || (fid == NO_FID_9P) ||
+           (tree_get_node(io->fids, (int_pointer)fid) != (struct tree_node *)0)) fid++;
 
-    while (tree_get_node(io->tags, (int_pointer)fid) != (struct tree_node *)0) fid++;
+    io->next_fid = fid + 1;
 
     return fid;
 }
@@ -636,6 +749,96 @@ struct d9r_fid_metadata *
  */
 #define VERSION_STRING_LENGTH 6
 
+/**\brief Maximum length of a version string with extensions
+ *
+ * Long enough for the protocol version and the names of all the extensions.
+ */
+#define VERSION_BUFFER        0x80
+
+/**\brief Extension names
+ *
+ * The names the D9R_EXTENSION_* flags go by in version strings.
+ */
+static const struct {
+    const char *name;
+    int_32      flag;
+} extension_names[] = {
+    { "local",    D9R_EXTENSION_LOCAL },
+    { "compound", D9R_EXTENSION_COMPOUND },
+    { "multiwalk", D9R_EXTENSION_MULTIWALK },
+    { "find",     D9R_EXTENSION_FIND },
+    { "hash",     D9R_EXTENSION_HASH },
+    { "copy",     D9R_EXTENSION_COPY },
+    { "compress", D9R_EXTENSION_COMPRESS },
+    { (const char *)0, 0 }
+};
+
+/* returns the extensions named after the '+'s in a version string */
+static int_32 parse_extensions (const char *version)
+{
+    int_32 rv = 0;
+
+    while ((*version != (char)0) && (*version != '+')) version++;
+
+    while (*version == '+')
+    {
+        version++;
+
+        for (int_32 e = 0; extension_names[e].name != (const char *)0; e++)
+        {
+            const char *n = extension_names[e].name;
+            int_32 p;
+
+            for (p = 0; (n[p] != (char)0) && (version[p] == n[p]); p++);
+
+            if ((n[p] == (char)0) &&
+                ((version[p] == (char)0) || (version[p] == '+')))
+            {
+                rv |= extension_names[e].flag;
+            }
+        }
+
+        while ((*version != (char)0) && (*version != '+')) version++;
+    }
+
+    return rv;
+}
+
+/* writes base, followed by the names of the extensions, to buffer */
+static void write_version
+        (char *buffer, const char *base, int_32 extensions)
+{
+    int_32 l = 0;
+
+    while ((base[l] != (char)0) && (l < (VERSION_BUFFER - 1)))
+    {
+        buffer[l] = base[l];
+        l++;
+    }
+
+    for (int_32 e = 0; extension_names[e].name != (const char *)0; e++)
+    {
+        const char *n = extension_names[e].name;
+        int_32 p;
+
+        if (!(extensions & extension_names[e].flag)) continue;
+
+        for (p = 0; n[p] != (char)0; p++);
+
+        if ((l + 1 + p) >= VERSION_BUFFER) break;
+
+        buffer[l] = '+';
+        l++;
+
+        for (p = 0; n[p] != (char)0; p++, l++)
+        {
+            buffer[l] = n[p];
+        }
+    }
+
+    buffer[l] = (char)0;
+}
+
 /**\brief Minimum supported message size
  *
  * 9P2000 lets the client specify a desired message size; this is the minimum
@@ -650,6 +853,71 @@ struct d9r_fid_metadata *
  */
 #define MAXMSGSIZE            0x2000
 
+/**\brief Marks a compressed Twrite or Rread payload in its count */
+#define PACKED_PAYLOAD        ((int_32)0x80000000)
+
+/**\brief Smallest payload worth compressing */
+#define COMPRESS_THRESHOLD    0x100
+
+/* compresses data into packed, which needs room for count bytes, if the
+ * connection uses compression and it saves more than the length field
+ * costs; returns the number of bytes of packed to send, or 0 */
+static int_32 pack_payload (struct d9r_io *io, int_32 count, int_8 *data,
+                            int_8 *packed) {
+    int_32 size;
+
+    if (!(io->extensions & D9R_EXTENSION_COMPRESS) ||
+        (count < COMPRESS_THRESHOLD))
+    {
+        return 0;
+    }
+
+    size = dcompress (data, count, packed, count - 8);
+
+    return (size > 0) ? (4 + size) : 0;
+}
+
+/* sends a Twrite or Rread payload, compressed if size is nonzero */
+static void collect_payload (struct io *out, int_32 count, int_8 *data,
+                             int_8 *packed, int_32 size) {
+    int_32 c;
+
+    if (size > 0)
+    {
+        c           = tolel (PACKED_PAYLOAD | size);
+        io_collect (out, (void *)&c,         4);
+        c           = tolel (count);
+        io_collect (out, (void *)&c,         4);
+        io_collect (out, (void *)packed,     size - 4);
+        return;
+    }
+
+    c               = tolel (count);
+    io_collect (out, (void *)&c,         4);
+    io_collect (out, (void *)data,       count);
+}
+
+/* decompresses a payload whose count had PACKED_PAYLOAD set; returns the
+ * size of the data put into buffer, or -1 if it's broken */
+static int unpack_payload (struct d9r_io *io, int_32 size, int_8 *data,
+                           int_8 *buffer) {
+    int_32 count;
+
+    if (!(io->extensions & D9R_EXTENSION_COMPRESS) || (size < 4) ||
+        ((count = popl ((unsigned char *)data)) < 0) ||
+        (count > MAXMSGSIZE))
+    {
+        return -1;
+    }
+
+    if (ddecompress (data + 4, size - 4, buffer, count) != count)
+    {
+        return -1;
+    }
+
+    return (int)count;
+}
+
 static void mx_on_read_9p (struct io *in, void *d) {
     struct io_element *element = (struct io_element *)d;
     int_32 cl = (in->length - in->position);
@@ -684,166 +952,770 @@ static void mx_on_close_9p (struct io *in, void *d) {
     free_pool_mem (d);
 }
 
-void multiplex_add_d9r (struct d9r_io *io, void *data) {
-    static struct memory_pool list_pool = MEMORY_POOL_INITIALISER(sizeof (struct io_element));
+/**\brief Loopback connection
+ *
+ * Two connections that are wired to each other in memory. An end only gets
+ * messages once it's been passed to multiplex_add_d9r(), and closing either
+ * end closes both, but only the next time messages are delivered, as the
+ * ends may well be closed while their messages are being parsed.
+ */
+struct d9r_loopback {
+    struct d9r_io *end[2];
+    void *data[2];
+    char active[2];
+    char closed;
+    int_64 bytes;
+    int_64 messages;
+    struct d9r_loopback *next;
+};
 
-    struct io_element *element = get_pool_mem (&list_pool);
+static struct memory_pool loopback_pool
+        = MEMORY_POOL_INITIALISER(sizeof (struct d9r_loopback));
 
-    if (element == (struct io_element *)0) return;
+static struct d9r_loopback *loopbacks = (struct d9r_loopback *)0;
 
-    element->io = io;
-    element->data = data;
+/* a connection whose buffers are only ever touched in memory */
+static struct d9r_io *memory_io (void) {
+    struct io *in = io_open_special (), *out;
+    struct d9r_io *io;
 
-    multiplex_add_io (io->in, mx_on_read_9p, mx_on_close_9p, (void *)element);
-    if (io->in != io->out)
+    if (in == (struct io *)0) return (struct d9r_io *)0;
+
+    if ((out = io_open_special ()) == (struct io *)0)
     {
-        multiplex_add_io_no_callback(io->out);
+        io_close (in);
+        return (struct d9r_io *)0;
+    }
+
+    if ((io = d9r_open_io (in, out)) == (struct d9r_io *)0)
+    {
+        io_close (in);
+        io_close (out);
+        return (struct d9r_io *)0;
     }
+
+    in->type  = iot_special_write;
+    out->type = iot_special_write;
+
+    return io;
 }
 
-/* message parser */
+void d9r_open_loopback (struct d9r_io **client, struct d9r_io **server) {
+    struct d9r_loopback *l = get_pool_mem (&loopback_pool);
 
-static unsigned int pop_message (unsigned char *b, int_32 length,
-                                 struct d9r_io *io, void *d) {
-    enum request_code code = (enum request_code)(b[4]);
-    int_16 tag = popw (b + 5);
-    int_32 i = 7;
+    *client = (struct d9r_io *)0;
+    *server = (struct d9r_io *)0;
 
-    if ((code % 2) == 1) /* Rxxx message */
+    if (l == (struct d9r_loopback *)0) return;
+
+    if ((l->end[0] = memory_io ()) == (struct d9r_io *)0)
     {
-        if ((tag != NO_TAG_9P) &&
-            d9r_tag_metadata (io, tag) == (struct d9r_tag_metadata *)0)
-        {
-            /* reply message with unknown tag, gotta be ignored. maybe killing
-               the connection might be an even better idea, but let's keep it
-               like this for the time being.
-               unfortunately, Rerror is reserved for client errors, so we can't
-               even tell the server about this issue. */
-            return length;
-        }
+        free_pool_mem (l);
+        return;
     }
 
-    switch (code) {
-        case Tversion:
-            register_tag(io, tag);
-            if (length > 13)
-            {
-                char *versionstring;
-                int_32 p;
-                int_32 msize = popl (b + 7);
+    if ((l->end[1] = memory_io ()) == (struct d9r_io *)0)
+    {
+        d9r_close_io (l->end[0]);
+        free_pool_mem (l);
+        return;
+    }
 
-                if (msize < MINMSGSIZE) msize = MINMSGSIZE;
-                if (msize > MAXMSGSIZE) msize = MAXMSGSIZE;
-                io->max_message_size = msize;
+    l->end[0]->loopback = l;
+    l->end[1]->loopback = l;
+    l->end[0]->peer_uid = D9R_PEER_SELF;
+    l->end[1]->peer_uid = D9R_PEER_SELF;
 
-                i += 4;
-                versionstring = pop_string(b, &i, length);
-                if (versionstring == (char *)0) break;
+    l->data[0]   = (void *)0;
+    l->data[1]   = (void *)0;
+    l->active[0] = (char)0;
+    l->active[1] = (char)0;
+    l->closed    = (char)0;
+    l->bytes     = 0;
+    l->messages  = 0;
 
-                for (p = 0;
-                     (p < 6) &&
-                     (versionstring[p] == VERSION_STRING_9P2000[p]);
-                     p++);
+    l->next   = loopbacks;
+    loopbacks = l;
 
-                if (p == 6) {
-                    io->version =
-                      ((versionstring[6] == '.') &&
-                       (versionstring[7] == 'u') &&
-                       (versionstring[8] == (char)0)) ?
-                            d9r_version_9p2000_dot_u :
-                            d9r_version_9p2000;
+    *client = l->end[0];
+    *server = l->end[1];
+}
 
-                    d9r_reply_version(io, tag, msize, ((io->version == d9r_version_9p2000_dot_u) ? "9P2000.u" : "9P2000"));
+static void loopback_close (struct d9r_io *io) {
+    io->loopback->closed = (char)1;
+}
 
-                    return length;
-                }
+static void loopback_free (struct d9r_loopback *l) {
+    for (int i = 0; i < 2; i++)
+    {
+        struct d9r_io *io = l->end[i];
 
-                d9r_reply_version(io, tag, msize, "unknown");
-                return length;
-            }
-            break;
+        if (l->active[i] && (io->close != (void *)0))
+        {
+            io->close (io);
+        }
 
-        case Rversion:
-            if (length > 13)
-            {
-                int_32 msize = popl (b + 7);
-                char *versionstring;
+        io_close (io->in);
+        io_close (io->out);
 
-                if (msize > MAXMSGSIZE) msize = MAXMSGSIZE;
+        d9r_free_resources (io);
+    }
 
-                io->max_message_size = msize;
+    free_pool_mem (l);
+}
 
-                i += 4;
-                versionstring = pop_string(b, &i, length);
+/* parses all complete messages in out as if they had been read by io */
+static int_32 loopback_deliver (struct io *out, struct d9r_io *io, void *d) {
+    int_32 n = 0;
 
-                if (versionstring != (char *)0) {
-                    int_32 p;
-                    for (p = 0;
-                         (p < 6) &&
-                         (versionstring[p] == VERSION_STRING_9P2000[p]);
-                         p++);
+    while ((out->length - out->position) > 6)
+    {
+        /* the buffer may move as replies are sent, so no pointers */
+        unsigned int p = out->position;
+        int_32 length = popl ((unsigned char *)(out->buffer + p));
 
-                    if (p == 6) {
-                        io->version =
-                          ((versionstring[6] == '.') &&
-                           (versionstring[7] == 'u') &&
-                           (versionstring[8] == (char)0)) ?
-                                d9r_version_9p2000_dot_u :
-                                d9r_version_9p2000;
-                    } else {
-                        io->version = d9r_uninitialised;
-                    }
-                }
-            }
+        if ((int_32)(out->length - p) < length) break;
 
-            kill_tag (io, tag);
-            return length;
+        out->position += length;
+        io->loopback->bytes += length;
+        io->loopback->messages++;
 
-        case Tauth:
-            register_tag(io, tag);
-            if (io->Tauth == (void *)0) break;
+        pop_message ((unsigned char *)(out->buffer + p), length, io, d);
+        n++;
 
-            if (length >= 15) {
-                char *uname, *aname;
+        if (io->loopback->closed) break;
+    }
 
-                int_32 afid = popl (b + 7);
-                i = 11;
+    if (out->position == out->length)
+    {
+        out->position = 0;
+        out->length   = 0;
+    }
 
-                uname = pop_string(b, &i, length);
-                if (uname == (char *)0) break;
+    return n;
+}
 
-                aname = pop_string(b, &i, length);
-                if (aname == (char *)0) break;
+int_32 d9r_run_loopback () {
+    struct d9r_loopback **p = &loopbacks;
+    int_32 n = 0;
 
-                io->Tauth(io, tag, afid, uname, aname);
+    while (*p != (struct d9r_loopback *)0)
+    {
+        struct d9r_loopback *l = *p;
 
-                return length;
-            }
-            break;
+        if (l->closed)
+        {
+            *p = l->next;
+            loopback_free (l);
+            continue;
+        }
 
-        case Rauth:
-            if (io->Rauth == (void *)0)
+        for (int i = 0; (i < 2) && !l->closed; i++)
+        {
+            if (l->active[1 - i])
             {
-                kill_tag (io, tag);
-                return length;
+                n += loopback_deliver
+                        (l->end[i]->out, l->end[1 - i], l->data[1 - i]);
             }
+        }
 
-            if (length >= 20) {
-                struct d9r_qid qid = {
-                    .type = b[7],
-                    .version = popl (b + 8),
-                    .path = popq (b + 12)
-                };
+        p = &(l->next);
+    }
 
-                io->Rauth(io, tag, qid);
-            }
+    return n;
+}
 
-            kill_tag (io, tag);
-            return length;
+int_64 d9r_loopback_bytes (struct d9r_io *io) {
+    return (io->loopback == (struct d9r_loopback *)0) ? 0
+                                                       : io->loopback->bytes;
+}
 
-        case Tattach:
-            register_tag(io, tag);
-            if (io->Tattach == (void *)0) break;
+int_64 d9r_loopback_messages (struct d9r_io *io) {
+    return (io->loopback == (struct d9r_loopback *)0)
+         ? 0 : io->loopback->messages;
+}
+
+/**\brief Shared memory ring header
+ *
+ * Precedes the data of each of the two rings of a ring connection. The
+ * positions only ever grow, and wrap around at 2^32; sleeping is set by the
+ * side reading from the ring while it may be waiting for its doorbell.
+ */
+struct d9r_ring_header {
+    volatile unsigned int head;
+    volatile unsigned int tail;
+    volatile unsigned int sleeping;
+    unsigned int reserved;
+};
+
+/**\brief Ring connection
+ *
+ * One side's view of a ring connection. Like loopbacks, these are only freed
+ * the next time messages are moved after being closed. Messages are copied
+ * out of the ring into message before they're parsed, as the other side can
+ * still write to the ring while that happens.
+ */
+struct d9r_ring {
+    struct d9r_io *io;
+    void *data;
+    struct d9r_ring_header *tx;
+    struct d9r_ring_header *rx;
+    unsigned char *tx_data;
+    unsigned char *rx_data;
+    unsigned int capacity;
+    unsigned char *message;
+    unsigned int message_size;
+    struct io *in;
+    struct io *out;
+    char active;
+    char closed;
+    struct d9r_ring *next;
+};
+
+static struct d9r_ring *rings = (struct d9r_ring *)0;
+
+struct d9r_io *d9r_open_ring
+        (struct io *in, struct io *out, void *memory, int_32 size,
+         int_8 side) {
+    static struct memory_pool pool
+            = MEMORY_POOL_INITIALISER(sizeof (struct d9r_ring));
+    unsigned int half = ((unsigned int)size / 2) & ~15;
+    unsigned char *m = (unsigned char *)memory;
+    struct d9r_ring *r;
+
+    if (size < D9R_RING_MINIMUM) return (struct d9r_io *)0;
+
+    if ((r = get_pool_mem (&pool)) == (struct d9r_ring *)0)
+    {
+        return (struct d9r_io *)0;
+    }
+
+    if ((r->io = memory_io ()) == (struct d9r_io *)0)
+    {
+        free_pool_mem (r);
+        return (struct d9r_io *)0;
+    }
+
+    /* side 0 sends on the first ring, side 1 on the second */
+    r->tx           = (struct d9r_ring_header *)(m + (side ? half : 0));
+    r->rx           = (struct d9r_ring_header *)(m + (side ? 0 : half));
+    r->tx_data      = (unsigned char *)(r->tx + 1);
+    r->rx_data      = (unsigned char *)(r->rx + 1);
+    r->capacity     = (half - sizeof (struct d9r_ring_header)) & ~3;
+    r->in           = in;
+    r->out          = out;
+    r->data         = (void *)0;
+    r->message      = (unsigned char *)0;
+    r->message_size = 0;
+    r->active       = (char)0;
+    r->closed       = (char)0;
+
+    if (in != (struct io *)0)  in->type  = iot_read;
+    if (out != (struct io *)0) out->type = iot_write;
+
+    r->io->ring = r;
+
+    r->next = rings;
+    rings   = r;
+
+    return r->io;
+}
+
+static void ring_close (struct d9r_io *io) {
+    io->ring->closed = (char)1;
+}
+
+static void ring_free (struct d9r_ring *r) {
+    struct d9r_io *io = r->io;
+
+    if (r->active && (io->close != (void *)0))
+    {
+        io->close (io);
+    }
+
+    if (r->in != (struct io *)0)
+    {
+        if (r->active) multiplex_del_io (r->in); else io_close (r->in);
+    }
+
+    if (r->out != (struct io *)0)
+    {
+        if (r->active) multiplex_del_io (r->out); else io_close (r->out);
+    }
+
+    io_close (io->in);
+    io_close (io->out);
+
+    d9r_free_resources (io);
+
+    if (r->message != (unsigned char *)0)
+    {
+        afree (r->message_size, r->message);
+    }
+
+    free_pool_mem (r);
+}
+
+/* rings the other side's doorbell, if it might be waiting for it */
+static void ring_wake (struct d9r_ring *r) {
+    __sync_synchronize ();
+
+    if (r->tx->sleeping && (r->out != (struct io *)0))
+    {
+        char c = (char)0;
+
+        r->tx->sleeping = 0;
+
+        io_write (r->out, &c, 1);
+    }
+}
+
+/* copies as many complete messages from the output buffer to the ring as will
+ * fit; records are padded to four bytes, and a zero length marks the rest of
+ * the ring as unused when a message doesn't fit before the end */
+static int_32 ring_send (struct d9r_ring *r) {
+    struct io *out = r->io->out;
+    unsigned int cap = r->capacity;
+    int_32 n = 0;
+
+    while ((out->length - out->position) > 6)
+    {
+        unsigned int p = out->position;
+        int_32 length = popl ((unsigned char *)(out->buffer + p));
+        unsigned int need = ((unsigned int)length + 3) & ~3;
+        unsigned int tail = r->tx->tail, at = tail % cap, room = cap - at;
+        unsigned int pad = (room < need) ? room : 0;
+
+        if ((int_32)(out->length - p) < length) break;
+
+        if ((cap - (tail - r->tx->head)) < (pad + need)) break;
+
+        if (pad > 0)
+        {
+            r->tx_data[at]     = 0;
+            r->tx_data[at + 1] = 0;
+            r->tx_data[at + 2] = 0;
+            r->tx_data[at + 3] = 0;
+
+            tail += pad;
+            at    = 0;
+        }
+
+        for (int_32 i = 0; i < length; i++)
+        {
+            r->tx_data[at + i] = (unsigned char)out->buffer[p + i];
+        }
+
+        __sync_synchronize ();
+
+        r->tx->tail    = tail + need;
+        out->position += length;
+        n++;
+    }
+
+    if (out->position == out->length)
+    {
+        out->position = 0;
+        out->length   = 0;
+    }
+
+    return n;
+}
+
+/* makes sure there's room for a message of the given length; rings are
+ * closed if there isn't */
+static int ring_reserve (struct d9r_ring *r, unsigned int length) {
+    unsigned int size = (r->message_size > 0) ? r->message_size : 0x2000;
+    unsigned char *message;
+
+    if (length <= r->message_size) return 1;
+
+    while (size < length) size *= 2;
+
+    if ((message = aalloc (size)) == (unsigned char *)0) return 0;
+
+    if (r->message != (unsigned char *)0)
+    {
+        afree (r->message_size, r->message);
+    }
+
+    r->message      = message;
+    r->message_size = size;
+
+    return 1;
+}
+
+/* parses the messages the other side has put in the ring; each one is copied
+ * out first, as the other side is not trusted to leave it alone until it has
+ * been handled, and the handlers re-read fields that have been checked */
+static int_32 ring_receive (struct d9r_ring *r) {
+    unsigned int cap = r->capacity;
+    int_32 n = 0;
+
+    while (!r->closed && (r->rx->tail != r->rx->head))
+    {
+        unsigned int head = r->rx->head, at = head % cap;
+        int_32 length;
+
+        __sync_synchronize ();
+
+        length = popl (r->rx_data + at);
+
+        if (length == 0)
+        {
+            r->rx->head = head + (cap - at);
+            continue;
+        }
+
+        /* the other side isn't trusted to keep to the format */
+        if ((length < 7) || ((unsigned int)length > (cap - at)) ||
+            !ring_reserve (r, (unsigned int)length))
+        {
+            r->closed = (char)1;
+            break;
+        }
+
+        for (int_32 i = 0; i < length; i++)
+        {
+            r->message[i] = r->rx_data[at + i];
+        }
+
+        /* the length may have changed since it was checked */
+        if (popl (r->message) != length)
+        {
+            r->closed = (char)1;
+            break;
+        }
+
+        pop_message (r->message, length, r->io, r->data);
+
+        __sync_synchronize ();
+
+        r->rx->head = head + (((unsigned int)length + 3) & ~3);
+        n++;
+    }
+
+    return n;
+}
+
+static int_32 ring_pass (struct d9r_ring *r) {
+    int_32 n = ring_receive (r);
+
+    n += ring_send (r);
+
+    /* wakes the other side for new messages, or for the room it was
+     * waiting for */
+    if (n > 0)
+    {
+        ring_wake (r);
+    }
+
+    return n;
+}
+
+int_32 d9r_run_rings () {
+    struct d9r_ring **p = &rings;
+    int_32 n = 0;
+
+    while (*p != (struct d9r_ring *)0)
+    {
+        struct d9r_ring *r = *p;
+
+        if (r->closed)
+        {
+            *p = r->next;
+            ring_free (r);
+            continue;
+        }
+
+        if (r->active)
+        {
+            n += ring_pass (r);
+        }
+
+        p = &(r->next);
+    }
+
+    return n;
+}
+
+/* marks a ring as sleeping before multiplex() waits, unless there's more to
+ * do; rechecking after setting the flag makes sure no message goes unnoticed
+ * between the other side's check and ours */
+static void ring_sleep (struct d9r_ring *r) {
+    while (!r->closed)
+    {
+        r->rx->sleeping = 1;
+
+        __sync_synchronize ();
+
+        if (r->rx->tail == r->rx->head) return;
+
+        r->rx->sleeping = 0;
+
+        ring_pass (r);
+    }
+}
+
+/* rings with messages that didn't fit yet have multiplex() wait for their
+ * doorbell to be writable, which it usually is right away, so the messages
+ * are retried in the next pass instead of whenever something else happens */
+static int ring_pending (struct d9r_ring *r) {
+    return r->active && !r->closed && (r->out != (struct io *)0) &&
+           (r->io->out->length > r->io->out->position);
+}
+
+static void rings_count (int *w) {
+    for (struct d9r_ring *r = rings; r != (struct d9r_ring *)0; r = r->next)
+    {
+        if (ring_pending (r)) (*w)++;
+    }
+}
+
+static void rings_augment (int *ws, int *w) {
+    for (struct d9r_ring *r = rings; r != (struct d9r_ring *)0; r = r->next)
+    {
+        if (ring_pending (r))
+        {
+            ws[*w] = r->out->fd;
+            (*w)++;
+        }
+    }
+}
+
+static void rings_sleep () {
+    for (struct d9r_ring *r = rings; r != (struct d9r_ring *)0; r = r->next)
+    {
+        if (r->active && (r->in != (struct io *)0))
+        {
+            ring_sleep (r);
+        }
+    }
+}
+
+static void ring_on_doorbell (struct io *in, void *aux) {
+    struct d9r_ring *r = (struct d9r_ring *)aux;
+
+    in->position = in->length;
+
+    r->rx->sleeping = 0;
+
+    ring_pass (r);
+}
+
+static void ring_on_doorbell_close (struct io *in, void *aux) {
+    struct d9r_ring *r = (struct d9r_ring *)aux;
+
+    r->in     = (struct io *)0;
+    r->closed = (char)1;
+}
+
+void multiplex_add_d9r (struct d9r_io *io, void *data) {
+    static struct memory_pool list_pool = MEMORY_POOL_INITIALISER(sizeof (struct io_element));
+
+    struct io_element *element;
+
+    if (io->loopback != (struct d9r_loopback *)0)
+    {
+        int i = (io->loopback->end[0] == io) ? 0 : 1;
+
+        io->loopback->data[i]   = data;
+        io->loopback->active[i] = (char)1;
+
+        return;
+    }
+
+    if (io->ring != (struct d9r_ring *)0)
+    {
+        struct d9r_ring *r = io->ring;
+
+        r->data   = data;
+        r->active = (char)1;
+
+        if (r->in != (struct io *)0)
+        {
+            multiplex_add_io (r->in, ring_on_doorbell, ring_on_doorbell_close,
+                              (void *)r);
+        }
+
+        if (r->out != (struct io *)0)
+        {
+            multiplex_add_io_no_callback (r->out);
+        }
+
+        return;
+    }
+
+    element = get_pool_mem (&list_pool);
+
+    if (element == (struct io_element *)0) return;
+
+    element->io = io;
+    element->data = data;
+
+    multiplex_add_io (io->in, mx_on_read_9p, mx_on_close_9p, (void *)element);
+    if (io->in != io->out)
+    {
+        multiplex_add_io_no_callback(io->out);
+    }
+}
+
+/* message parser */
+
+static unsigned int pop_message (unsigned char *b, int_32 length,
+                                 struct d9r_io *io, void *d) {
+    enum request_code code = (enum request_code)(b[4]);
+    int_16 tag = popw (b + 5);
+    int_32 i = 7;
+
+    if ((code % 2) == 1) /* Rxxx message */
+    {
+        if ((tag != NO_TAG_9P) &&
+            d9r_tag_metadata (io, tag) == (struct d9r_tag_metadata *)0)
+        {
+            /* reply message with unknown tag, gotta be ignored. maybe killing
+               the connection might be an even better idea, but let's keep it
+               like this for the time being.
+               unfortunately, Rerror is reserved for client errors, so we can't
+               even tell the server about this issue. */
+            return length;
+        }
+    }
+
+    switch (code) {
+        case Tversion:
+            register_tag(io, tag);
+            if (length > 13)
+            {
+                char *versionstring;
+                int_32 p;
+                int_32 msize = popl (b + 7);
+
+                if (msize < MINMSGSIZE) msize = MINMSGSIZE;
+                if (msize > MAXMSGSIZE) msize = MAXMSGSIZE;
+                io->max_message_size = msize;
+
+                i += 4;
+                versionstring = pop_string(b, &i, length);
+                if (versionstring == (char *)0) break;
+
+                for (p = 0;
+                     (p < 6) &&
+                     (versionstring[p] == VERSION_STRING_9P2000[p]);
+                     p++);
+
+                if (p == 6) {
+                    char reply[VERSION_BUFFER];
+
+                    io->version =
+                      ((versionstring[6] == '.') &&
+                       (versionstring[7] == 'u') &&
+                       ((versionstring[8] == (char)0) ||
+                        (versionstring[8] == '+'))) ?
+                            d9r_version_9p2000_dot_u :
+                            d9r_version_9p2000;
+
+                    io->extensions &= parse_extensions (versionstring);
+
+                    write_version (reply, ((io->version == d9r_version_9p2000_dot_u) ? "9P2000.u" : "9P2000"), io->extensions);
+
+                    d9r_reply_version(io, tag, msize, reply);
+
+                    return length;
+                }
+
+                io->extensions = 0;
+
+                d9r_reply_version(io, tag, msize, "unknown");
+                return length;
+            }
+            break;
+
+        case Rversion:
+            if (length > 13)
+            {
+                int_32 msize = popl (b + 7);
+                char *versionstring;
+
+                if (msize > MAXMSGSIZE) msize = MAXMSGSIZE;
+
+                io->max_message_size = msize;
+
+                i += 4;
+                versionstring = pop_string(b, &i, length);
+
+                if (versionstring != (char *)0) {
+                    int_32 p;
+                    for (p = 0;
+                         (p < 6) &&
+                         (versionstring[p] == VERSION_STRING_9P2000[p]);
+                         p++);
+
+                    if (p == 6) {
+                        io->version =
+                          ((versionstring[6] == '.') &&
+                           (versionstring[7] == 'u') &&
+                           ((versionstring[8] == (char)0) ||
+                            (versionstring[8] == '+'))) ?
+                                d9r_version_9p2000_dot_u :
+                                d9r_version_9p2000;
+
+                        io->extensions &= parse_extensions (versionstring);
+                    } else {
+                        io->version = d9r_uninitialised;
+                        io->extensions = 0;
+                    }
+                }
+            }
+
+            kill_tag (io, tag);
+            return length;
+
+        case Tauth:
+            register_tag(io, tag);
+            if (io->Tauth == (void *)0) break;
+
+            if (length >= 15) {
+                char *uname, *aname;
+
+                int_32 afid = popl (b + 7);
+                i = 11;
+
+                uname = pop_string(b, &i, length);
+                if (uname == (char *)0) break;
+
+                aname = pop_string(b, &i, length);
+                if (aname == (char *)0) break;
+
+                io->Tauth(io, tag, afid, uname, aname);
+
+                return length;
+            }
+            break;
+
+        case Rauth:
+            if (io->Rauth == (void *)0)
+            {
+                kill_tag (io, tag);
+                return length;
+            }
+
+            if (length >= 20) {
+                struct d9r_qid qid = {
+                    .type = b[7],
+                    .version = popl (b + 8),
+                    .path = popq (b + 12)
+                };
+
+                io->Rauth(io, tag, qid);
+            }
+
+            kill_tag (io, tag);
+            return length;
+
+        case Tattach:
+            register_tag(io, tag);
+            if (io->Tattach == (void *)0) break;
 
             if (length >= 19) {
                 char *uname, *aname;
@@ -1119,7 +1991,24 @@ static unsigned int pop_message (unsigned char *b, int_32 length,
                 int_32 count = popl (b + 7);
                 int_8 *data  = b + 11;
 
-                if ((11 + count) <= length) {
+                if (count & PACKED_PAYLOAD) {
+                    int_8 buffer[MAXMSGSIZE];
+                    int r;
+
+                    count &= ~PACKED_PAYLOAD;
+
+                    if ((11 + count) > length) {
+                        /* fall through to kill_tag() */
+                    } else if ((r = unpack_payload (io, count, data, buffer))
+                               < 0) {
+                        if (io->Rerror != (void *)0) {
+                            io->Rerror(io, tag, "Bad compressed data.",
+                                       P9_EDONTCARE);
+                        }
+                    } else {
+                        io->Rread(io, tag, (int_32)r, buffer);
+                    }
+                } else if ((11 + count) <= length) {
                     io->Rread(io, tag, count, data);
                 }
             }
@@ -1137,7 +2026,22 @@ static unsigned int pop_message (unsigned char *b, int_32 length,
                 int_32 count = popl (b + 19);
                 int_8 *data  = b + 23;
 
-                if ((23 + count) <= length) {
+                if (count & PACKED_PAYLOAD) {
+                    int_8 buffer[MAXMSGSIZE];
+                    int r;
+
+                    count &= ~PACKED_PAYLOAD;
+
+                    if ((23 + count) > length) {
+                        /* too short, like an uncompressed one */
+                    } else if ((r = unpack_payload (io, count, data, buffer))
+                               < 0) {
+                        d9r_reply_error (io, tag, "Bad compressed data.",
+                                         P9_EDONTCARE);
+                    } else {
+                        io->Twrite(io, tag, fid, offset, (int_32)r, buffer);
+                    }
+                } else if ((23 + count) <= length) {
                     io->Twrite(io, tag, fid, offset, count, data);
                 }
                 return length;
@@ -1180,108 +2084,389 @@ static unsigned int pop_message (unsigned char *b, int_32 length,
             }
             break;
 
-        case Rclunk:
-            if (io->Rclunk != (void *)0)
-            {
-                io->Rclunk(io, tag);
+        case Rclunk:
+            if (io->Rclunk != (void *)0)
+            {
+                io->Rclunk(io, tag);
+            }
+
+            kill_tag (io, tag);
+            return length;
+
+        case Tremove:
+            register_tag(io, tag);
+            if (length >= 11) {
+                int_32 fid = popl (b + 7);
+
+                if (io->Tremove == (void *)0)
+                {
+                    d9r_reply_remove (io, tag);
+                }
+                else
+                {
+                    io->Tremove(io, tag, fid);
+                }
+
+                kill_fid (io, fid);
+
+                return length;
+            }
+            break;
+
+        case Rremove:
+            if (io->Rremove != (void *)0)
+            {
+                io->Rremove(io, tag);
+            }
+
+            kill_tag (io, tag);
+            return length;
+
+        case Tstat:
+            register_tag(io, tag);
+            if (io->Tstat == (void *)0) break;
+
+            if (length >= 11) {
+                int_32 fid = popl (b + 7);
+
+                io->Tstat(io, tag, fid);
+
+                return length;
+            }
+            break;
+
+        case Rstat:
+            if (io->Rstat == (void *)0)
+            {
+                kill_tag (io, tag);
+                return length;
+            }
+
+            if (length >= 45) {
+                int_16 slen = popw (b + 7), type;
+                struct d9r_qid qid;
+                int_32 dev, mode, atime, mtime;
+                int_64 length;
+                char *name, *uid, *gid, *muid, *ext;
+
+                d9r_parse_stat_buffer
+                        (io, (int_32)slen, b + 9, &type, &dev, &qid, &mode,
+                         &atime, &mtime, &length, &name, &uid, &gid, &muid,
+                         &ext);
+
+                io->Rstat(io, tag, type, dev, qid, mode, atime, mtime, length,
+                          name, uid, gid, muid, ext);
+            }
+
+            kill_tag (io, tag);
+            return length;
+
+        case Twstat:
+            register_tag(io, tag);
+            if (io->Twstat == (void *)0) break;
+
+            if (length >= 49) {
+                int_16 slen = popw (b + 11), type;
+                struct d9r_qid qid;
+                int_32 fid = popl (b + 7), dev, mode, atime, mtime;
+                int_64 flength;
+                char *name, *uid, *gid, *muid, *ext;
+
+                d9r_parse_stat_buffer
+                        (io, (int_32)slen, b + 13, &type, &dev, &qid, &mode,
+                         &atime, &mtime, &flength, &name, &uid, &gid, &muid,
+                         &ext);
+
+                io->Twstat(io, tag, fid, type, dev, qid, mode, atime, mtime,
+                           flength, name, uid, gid, muid, ext);
+                return length;
+            }
+            break;
+
+        case Rwstat:
+            if (io->Rwstat != (void *)0)
+            {
+                io->Rwstat(io, tag);
+            }
+
+            kill_tag (io, tag);
+            return length;
+
+        case Tlocal:
+            register_tag(io, tag);
+            if ((io->Tlocal == (void *)0) ||
+                !(io->extensions & D9R_EXTENSION_LOCAL)) break;
+
+            if (length >= 11) {
+                int_32 fid = popl (b + 7);
+
+                io->Tlocal(io, tag, fid);
+                return length;
+            }
+            break;
+
+        case Tcompound:
+            register_tag(io, tag);
+            if (!(io->extensions & D9R_EXTENSION_COMPOUND) ||
+                (io->compound != cs_none)) break;
+
+            if (length >= 9) {
+                int_16 count = popw (b + 7), run = 0, n;
+
+                i = 9;
+                io->compound = cs_running;
+
+                for (n = 0; (n < count) && ((i + 7) <= length); n++) {
+                    unsigned char *m = b + i;
+                    int_32 mlength = popl (m);
+                    enum request_code mcode;
+
+                    if ((mlength < 7) || (mlength > (length - i))) break;
+
+                    mcode = (enum request_code)(m[4]);
+
+                    if ((mcode == Tclunk) ||
+                        ((io->compound == cs_running) && ((mcode % 2) == 0) &&
+                         (mcode != Tversion) && (mcode != Tflush) &&
+                         (mcode != Tcompound)))
+                    {
+                        /* partial walks count as failures as well */
+                        io->compound_walk = ((mcode == Twalk) && (mlength >= 17))
+                                          ? popw (m + 15) : -1;
+
+                        pop_message (m, mlength, io, d);
+
+                        io->compound_walk = -1;
+                        run++;
+                    }
+                    else
+                    {
+                        int_16 mtag = popw (m + 5);
+
+                        register_tag (io, mtag);
+                        d9r_reply_error (io, mtag,
+                                         (io->compound == cs_running)
+                                            ? "Not allowed in a compound request."
+                                            : "Earlier request failed.",
+                                         P9_EDONTCARE);
+                    }
+
+                    i += mlength;
+                }
+
+                io->compound = cs_none;
+
+                d9r_reply_compound (io, tag, run);
+                return length;
+            }
+            break;
+
+        case Tmultiwalk:
+            register_tag(io, tag);
+            if ((io->Tmultiwalk == (void *)0) ||
+                !(io->extensions & D9R_EXTENSION_MULTIWALK)) break;
+
+            if ((length >= 13) && (popw (b + 11) >= 0) &&
+                (popw (b + 11) <= ((length - 13) / 2))) {
+                int_32 fid   = popl (b + 7);
+                int_16 count = popw (b + 11), p, n, total = 0;
+                int_16 namec[count + 1];
+                char *names[((length - 13) / 2) + 1];
+
+                i = 13;
+
+                for (p = 0; p < count; p++) {
+                    if (length < (i + 2)) break;
+
+                    /* a negative count would walk backwards through names */
+                    if ((namec[p] = popw (b + i)) < 0) break;
+                    i += 2;
+
+                    for (n = 0; n < namec[p]; n++) {
+                        if ((names[total] = pop_string(b, &i, length))
+                            == (char *)0) break;
+
+                        total++;
+                    }
+
+                    if (n < namec[p]) break;
+                }
+
+                if (p < count) {
+                    d9r_reply_error (io, tag, "Malformed message.",
+                                     P9_EDONTCARE);
+                    return length;
+                }
+
+                io->Tmultiwalk(io, tag, fid, count, namec, names);
+                return length;
+            }
+            break;
+
+        case Rmultiwalk:
+            if (io->Rmultiwalk == (void *)0)
+            {
+                kill_tag (io, tag);
+                return length;
+            }
+
+            if ((length >= 9) && (popw (b + 7) >= 0) &&
+                (popw (b + 7) <= ((length - 9) / 2))) {
+                int_16 count = popw (b + 7), p, n, total = 0;
+                int_16 qidc[count + 1];
+                struct d9r_qid qid[((length - 9) / 13) + 1];
+
+                i = 9;
+
+                for (p = 0; p < count; p++) {
+                    if (length < (i + 2)) break;
+
+                    if ((qidc[p] = popw (b + i)) < 0) break;
+                    i += 2;
+
+                    if (length < (i + (qidc[p] * 13))) break;
+
+                    for (n = 0; n < qidc[p]; n++, total++, i += 13) {
+                        qid[total].type    = b[i];
+                        qid[total].version = popl (b + i + 1);
+                        qid[total].path    = popq (b + i + 5);
+                    }
+                }
+
+                if (p == count)
+                {
+                    io->Rmultiwalk(io, tag, count, qidc, qid);
+                }
             }
 
             kill_tag (io, tag);
             return length;
 
-        case Tremove:
+        case Tfind:
             register_tag(io, tag);
-            if (length >= 11) {
-                int_32 fid = popl (b + 7);
+            if ((io->Tfind == (void *)0) ||
+                !(io->extensions & D9R_EXTENSION_FIND)) break;
 
-                if (io->Tremove == (void *)0)
-                {
-                    d9r_reply_remove (io, tag);
-                }
-                else
-                {
-                    io->Tremove(io, tag, fid);
+            if (length >= 45) {
+                int_32 fid  = popl (b + 7);
+                int_32 nfid = popl (b + 11);
+                char *pattern;
+
+                i = 15;
+
+                if (((pattern = pop_string(b, &i, length)) == (char *)0) ||
+                    ((i + 28) > length)) {
+                    d9r_reply_error (io, tag, "Malformed message.",
+                                     P9_EDONTCARE);
+                    return length;
                 }
 
-                kill_fid (io, fid);
+                register_fid (io, nfid, 0, (char **)0);
 
+                io->Tfind(io, tag, fid, nfid, pattern, popl (b + i),
+                          popq (b + i + 4), popq (b + i + 12),
+                          popl (b + i + 20), popl (b + i + 24));
                 return length;
             }
             break;
 
-        case Rremove:
-            if (io->Rremove != (void *)0)
+        case Rfind:
+            if (io->Rfind != (void *)0)
             {
-                io->Rremove(io, tag);
+                io->Rfind(io, tag);
             }
 
             kill_tag (io, tag);
             return length;
 
-        case Tstat:
+        case Thash:
             register_tag(io, tag);
-            if (io->Tstat == (void *)0) break;
-
-            if (length >= 11) {
-                int_32 fid = popl (b + 7);
-
-                io->Tstat(io, tag, fid);
+            if ((io->Thash == (void *)0) ||
+                !(io->extensions & D9R_EXTENSION_HASH)) break;
 
+            if (length >= 31) {
+                io->Thash(io, tag, popl (b + 7), popq (b + 11), popq (b + 19),
+                          popl (b + 27));
                 return length;
             }
             break;
 
-        case Rstat:
-            if (io->Rstat == (void *)0)
+        case Rhash:
+            if (io->Rhash == (void *)0)
             {
                 kill_tag (io, tag);
                 return length;
             }
 
-            if (length >= 45) {
-                int_16 slen = popw (b + 7), type;
-                struct d9r_qid qid;
-                int_32 dev, mode, atime, mtime;
-                int_64 length;
-                char *name, *uid, *gid, *muid, *ext;
+            if ((length >= 41) && (popw (b + 39) >= 0) &&
+                (popw (b + 39) <= ((length - 41) / (4 + D9R_HASH_SIZE)))) {
+                int_16 count = popw (b + 39), n;
+                int_32 weak[count + 1];
+                int_8 strong[(count * D9R_HASH_SIZE) + 1];
 
-                d9r_parse_stat_buffer
-                        (io, (int_32)slen, b + 9, &type, &dev, &qid, &mode,
-                         &atime, &mtime, &length, &name, &uid, &gid, &muid,
-                         &ext);
+                for (n = 0, i = 41; n < count; n++, i += 4 + D9R_HASH_SIZE) {
+                    weak[n] = popl (b + i);
 
-                io->Rstat(io, tag, type, dev, qid, mode, atime, mtime, length,
-                          name, uid, gid, muid, ext);
+                    for (int_32 j = 0; j < D9R_HASH_SIZE; j++) {
+                        strong[(n * D9R_HASH_SIZE) + j] = (int_8)b[i + 4 + j];
+                    }
+                }
+
+                io->Rhash(io, tag, (int_8 *)(b + 7), count, weak, strong);
             }
 
             kill_tag (io, tag);
             return length;
 
-        case Twstat:
+        case Tcopy:
             register_tag(io, tag);
-            if (io->Twstat == (void *)0) break;
+            if ((io->Tcopy == (void *)0) ||
+                !(io->extensions & D9R_EXTENSION_COPY)) break;
 
-            if (length >= 49) {
-                int_16 slen = popw (b + 11), type;
-                struct d9r_qid qid;
-                int_32 fid = popl (b + 7), dev, mode, atime, mtime;
-                int_64 length;
-                char *name, *uid, *gid, *muid, *ext;
+            if (length >= 39) {
+                io->Tcopy(io, tag, popl (b + 7), popq (b + 11), popl (b + 19),
+                          popq (b + 23), popq (b + 31));
+                return length;
+            }
+            break;
 
-                d9r_parse_stat_buffer
-                        (io, (int_32)slen, b + 13, &type, &dev, &qid, &mode,
-                         &atime, &mtime, &length, &name, &uid, &gid, &muid,
-                         &ext);
+        case Rcopy:
+            if (io->Rcopy == (void *)0)
+            {
+                kill_tag (io, tag);
+                return length;
+            }
 
-                io->Twstat(io, tag, type, fid, dev, qid, mode, atime, mtime,
-                           length, name, uid, gid, muid, ext);
+            if (length >= 15) {
+                io->Rcopy(io, tag, popq (b + 7));
             }
-            break;
 
-        case Rwstat:
-            if (io->Rwstat != (void *)0)
+            kill_tag (io, tag);
+            return length;
+
+        case Rcompound:
+            if ((io->Rcompound != (void *)0) && (length >= 9))
             {
-                io->Rwstat(io, tag);
+                io->Rcompound(io, tag, popw (b + 7));
+            }
+
+            kill_tag (io, tag);
+            return length;
+
+        case Rlocal:
+            if (io->Rlocal == (void *)0)
+            {
+                kill_tag (io, tag);
+                return length;
+            }
+
+            if (length >= 9) {
+                char *path = pop_string(b, &i, length);
+
+                if (path != (char *)0)
+                {
+                    io->Rlocal(io, tag, path);
+                }
             }
 
             kill_tag (io, tag);
@@ -1332,6 +2517,11 @@ static void collect_header_reply
 int_16 d9r_version (struct d9r_io *io, int_32 msize, char *version) {
     struct io *out = io->out;
     int_16 len = 0, slen;
+    char buffer[VERSION_BUFFER];
+
+    write_version (buffer, version, io->extensions);
+    version = buffer;
+
     while (version[len]) len++;
 
     msize = tolel (msize);
@@ -1575,19 +2765,19 @@ int_16 d9r_write   (struct d9r_io *io, int_32 fid, int_64 offset,
 {
     struct io *out = io->out;
     int_16 otag = find_free_tag (io);
-    int_32 c;
+    int_8 packed[count + 1];
+    int_32 size = pack_payload (io, count, data, packed);
 
     fid       = tolel (fid);
     offset    = toleq (offset);
 
-    collect_header (out, 4 + 8 + 4 + count, Twrite, otag);
+    collect_header (out, 4 + 8 + 4 + ((size > 0) ? size : count), Twrite,
+                    otag);
 
     io_collect (out, (void *)&fid,       4);
     io_collect (out, (void *)&offset,    8);
 
-    c         = tolel (count);
-    io_collect (out, (void *)&c,         4);
-    io_collect (out, (void *)data,       count);
+    collect_payload (out, count, data, packed, size);
 
     return otag;
 }
@@ -1634,6 +2824,177 @@ int_16 d9r_flush   (struct d9r_io *io, int_16 oxtag) {
     return otag;
 }
 
+int_16 d9r_local   (struct d9r_io *io, int_32 fid)
+{
+    struct io *out = io->out;
+    int_16 otag = find_free_tag (io);
+
+    fid        = tolel (fid);
+
+    collect_header (out, 4, Tlocal, otag);
+
+    io_collect (out, (void *)&fid,       4);
+
+    return otag;
+}
+
+int_16 d9r_multiwalk
+        (struct d9r_io *io, int_32 fid, int_16 count, int_16 *namec,
+         char **names)
+{
+    struct io *out = io->out;
+    int_16 otag = find_free_tag (io), p, n, total = 0, slen;
+    int_32 length = 4 + 2;
+
+    for (p = 0; p < count; p++) {
+        length += 2;
+
+        for (n = 0; n < namec[p]; n++, total++) {
+            int_16 l = 0;
+            while (names[total][l]) l++;
+            length += 2 + l;
+        }
+    }
+
+    collect_header (out, length, Tmultiwalk, otag);
+
+    fid        = tolel (fid);
+    io_collect (out, (void *)&fid,       4);
+    slen       = tolew (count);
+    io_collect (out, (void *)&slen,      2);
+
+    for (p = 0, total = 0; p < count; p++) {
+        slen = tolew (namec[p]);
+        io_collect (out, (void *)&slen,  2);
+
+        for (n = 0; n < namec[p]; n++, total++) {
+            int_16 l = 0;
+            while (names[total][l]) l++;
+
+            slen = tolew (l);
+            io_collect (out, (void *)&slen,  2);
+            io_collect (out, names[total],   l);
+        }
+    }
+
+    return otag;
+}
+
+int_16 d9r_hash    (struct d9r_io *io, int_32 fid, int_64 offset,
+                    int_64 length, int_32 blocksize)
+{
+    struct io *out = io->out;
+    int_16 otag = find_free_tag (io);
+
+    fid         = tolel (fid);
+    offset      = toleq (offset);
+    length      = toleq (length);
+    blocksize   = tolel (blocksize);
+
+    collect_header (out, 4 + 8 + 8 + 4, Thash, otag);
+
+    io_collect (out, (void *)&fid,       4);
+    io_collect (out, (void *)&offset,    8);
+    io_collect (out, (void *)&length,    8);
+    io_collect (out, (void *)&blocksize, 4);
+
+    return otag;
+}
+
+int_16 d9r_copy    (struct d9r_io *io, int_32 fid, int_64 offset,
+                    int_32 srcfid, int_64 srcoffset, int_64 length)
+{
+    struct io *out = io->out;
+    int_16 otag = find_free_tag (io);
+
+    fid         = tolel (fid);
+    offset      = toleq (offset);
+    srcfid      = tolel (srcfid);
+    srcoffset   = toleq (srcoffset);
+    length      = toleq (length);
+
+    collect_header (out, 4 + 8 + 4 + 8 + 8, Tcopy, otag);
+
+    io_collect (out, (void *)&fid,       4);
+    io_collect (out, (void *)&offset,    8);
+    io_collect (out, (void *)&srcfid,    4);
+    io_collect (out, (void *)&srcoffset, 8);
+    io_collect (out, (void *)&length,    8);
+
+    return otag;
+}
+
+int_16 d9r_find    (struct d9r_io *io, int_32 fid, int_32 newfid,
+                    const char *pattern, int_32 types, int_64 minlength,
+                    int_64 maxlength, int_32 after, int_32 before)
+{
+    struct io *out = io->out;
+    int_16 otag = find_free_tag (io);
+    int_16 len = 0, slen;
+
+    register_fid (io, newfid, 0, (char **)0);
+
+    while (pattern[len]) len++;
+
+    collect_header (out, 4 + 4 + 2 + len + 4 + 8 + 8 + 4 + 4, Tfind, otag);
+
+    fid         = tolel (fid);
+    newfid      = tolel (newfid);
+    slen        = tolew (len);
+    types       = tolel (types);
+    minlength   = toleq (minlength);
+    maxlength   = toleq (maxlength);
+    after       = tolel (after);
+    before      = tolel (before);
+
+    io_collect (out, (void *)&fid,       4);
+    io_collect (out, (void *)&newfid,    4);
+    io_collect (out, (void *)&slen,      2);
+    io_collect (out, pattern,            len);
+    io_collect (out, (void *)&types,     4);
+    io_collect (out, (void *)&minlength, 8);
+    io_collect (out, (void *)&maxlength, 8);
+    io_collect (out, (void *)&after,     4);
+    io_collect (out, (void *)&before,    4);
+
+    return otag;
+}
+
+/* the start is kept relative to what's still waiting to be sent, as that
+ * stays put even if the buffer is compacted */
+int_32 d9r_begin_compound (struct d9r_io *io)
+{
+    struct io *out = io->out;
+    int_32 start = (int_32)(out->length - out->position);
+    int_16 otag = find_free_tag (io);
+    int_16 count = 0;
+
+    collect_header (out, 2, Tcompound, otag);
+
+    io_collect (out, (void *)&count,     2);
+
+    return start;
+}
+
+int_16 d9r_end_compound (struct d9r_io *io, int_32 start)
+{
+    struct io *out = io->out;
+    unsigned char *b = (unsigned char *)(out->buffer + out->position + start);
+    int_32 length = (int_32)(out->length - out->position) - start, i = 9;
+    int_16 count = 0;
+
+    while ((i + 4) <= length)
+    {
+        i += popl (b + i);
+        count++;
+    }
+
+    *((int_32 *)b)       = tolel (length);
+    *((int_16 *)(b + 7)) = tolew (count);
+
+    return popw (b + 5);
+}
+
 /* reply messages */
 
 void d9r_reply_version (struct d9r_io *io, int_16 tag, int_32 msize, char *version) {
@@ -1662,6 +3023,11 @@ void d9r_reply_error  (struct d9r_io *io, int_16 tag, const char *string,
     int_16 slen;
     struct io *out = io->out;
 
+    if (io->compound == cs_running)
+    {
+        io->compound = cs_failed;
+    }
+
     while (string[len]) len++;
 
     collect_header_reply (io,
@@ -1704,6 +3070,11 @@ void d9r_reply_walk   (struct d9r_io *io, int_16 tag, int_16 qidc,
 {
     struct io *out = io->out;
     int_16 i;
+    if ((io->compound == cs_running) && (qidc < io->compound_walk))
+    {
+        io->compound = cs_failed;
+    }
+
     collect_header_reply (io, 2 + qidc * 13, Rwalk, tag);
 
     tag         = tolew (qidc);
@@ -1781,13 +3152,12 @@ void d9r_reply_create (struct d9r_io *io, int_16 tag,
 void d9r_reply_read   (struct d9r_io *io, int_16 tag, int_32 count,
                            int_8 *data)
 {
-    struct io *out = io->out;
-    int_32 c;
-    collect_header_reply (io, 4 + count, Rread, tag);
+    int_8 packed[count + 1];
+    int_32 size = pack_payload (io, count, data, packed);
 
-    c              = tolel (count);
-    io_collect (out, (void *)&c,         4);
-    io_collect (out, (void *)data,       count);
+    collect_header_reply (io, 4 + ((size > 0) ? size : count), Rread, tag);
+
+    collect_payload (io->out, count, data, packed, size);
 
     kill_tag (io, tag);
 }
@@ -1812,3 +3182,93 @@ void d9r_reply_flush   (struct d9r_io *io, int_16 tag) {
 
     kill_tag (io, tag);
 }
+
+void d9r_reply_local   (struct d9r_io *io, int_16 tag, char *path) {
+    int_16 len = 0;
+    int_16 slen;
+    struct io *out = io->out;
+
+    while (path[len]) len++;
+
+    collect_header_reply (io, 2 + len, Rlocal, tag);
+
+    slen = tolew (len);
+    io_collect (out, (void *)&slen,      2);
+    io_collect (out, path,               len);
+
+    kill_tag (io, tag);
+}
+
+void d9r_reply_hash    (struct d9r_io *io, int_16 tag, int_8 *hash,
+                        int_16 count, int_32 *weak, int_8 *strong) {
+    struct io *out = io->out;
+    int_16 slen;
+
+    collect_header_reply (io, D9R_HASH_SIZE + 2 +
+                              (count * (4 + D9R_HASH_SIZE)), Rhash, tag);
+
+    io_collect (out, (void *)hash,       D9R_HASH_SIZE);
+    slen        = tolew (count);
+    io_collect (out, (void *)&slen,      2);
+
+    for (int_16 n = 0; n < count; n++) {
+        int_32 w = tolel (weak[n]);
+
+        io_collect (out, (void *)&w,     4);
+        io_collect (out, (void *)(strong + (n * D9R_HASH_SIZE)),
+                    D9R_HASH_SIZE);
+    }
+
+    kill_tag (io, tag);
+}
+
+void d9r_reply_copy    (struct d9r_io *io, int_16 tag, int_64 count) {
+    collect_header_reply (io, 8, Rcopy, tag);
+
+    count       = toleq (count);
+    io_collect (io->out, (void *)&count,     8);
+
+    kill_tag (io, tag);
+}
+
+void d9r_reply_find    (struct d9r_io *io, int_16 tag) {
+    collect_header_reply (io, 0, Rfind, tag);
+
+    kill_tag (io, tag);
+}
+
+void d9r_reply_compound (struct d9r_io *io, int_16 tag, int_16 count) {
+    collect_header_reply (io, 2, Rcompound, tag);
+
+    count       = tolew (count);
+    io_collect (io->out, (void *)&count,     2);
+
+    kill_tag (io, tag);
+}
+
+void d9r_reply_multiwalk (struct d9r_io *io, int_16 tag, int_16 count,
+                          int_16 *qidc, struct d9r_qid *qid) {
+    struct io *out = io->out;
+    int_32 length = 2;
+    int_16 p, n, total = 0, slen;
+
+    for (p = 0; p < count; p++) {
+        length += 2 + (qidc[p] * 13);
+    }
+
+    collect_header_reply (io, length, Rmultiwalk, tag);
+
+    slen        = tolew (count);
+    io_collect (out, (void *)&slen,      2);
+
+    for (p = 0; p < count; p++) {
+        slen    = tolew (qidc[p]);
+        io_collect (out, (void *)&slen,  2);
+
+        for (n = 0; n < qidc[p]; n++, total++) {
+            collect_qid (out, &(qid[total]));
+        }
+    }
+
+    kill_tag (io, tag);
+}
@@ -0,0 +1,2089 @@
+/**\file
+ * \brief Duat loopback benchmark
+ *
+ * Implements the 'duat-benchmark' programme, which runs a 9P client and a 9P
+ * server in the same process, connected with an in-process loopback, and
+ * counts how many requests of each kind they get through per second. There
+ * are no system calls involved in getting messages across, so this measures
+ * the cost of encoding, parsing and dispatching messages, and of the VFS and
+ * client code handling them.
+ *
+ * Each time messages are handed across counts as half a round trip, and the
+ * number of round trips is reported as well; multiplied by a network's round
+ * trip time, that gives the latency the requests would see over it. So are
+ * the bytes that went across, which -b can limit to that of a slow link, and
+ * the number of messages they took.
+ *
+ * \copyright
+ * Copyright (c) 2008-2014, Kyuba Project Members
+ * \copyright
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * \copyright
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * \copyright
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \see Project Documentation: http://ef.gy/documentation/duat
+ * \see Project Source Code: http://git.becquerel.org/kyuba/duat.git
+ */
+
+#include <curie/main.h>
+#include <curie/sexpr.h>
+#include <curie/memory.h>
+#include <curie/time.h>
+#include <curie/multiplex.h>
+#include <duat/9p-client.h>
+#include <duat/9p-server.h>
+#include <duat/hash.h>
+
+/**\brief Benchmark
+ *
+ * One kind of request to measure. setup() prepares the connection and sets
+ * ready once done, issue() sends one request that calls complete() once it
+ * has been answered. With compress set, the server offers
+ * D9R_EXTENSION_COMPRESS, as it would on a connection to another host.
+ */
+struct benchmark
+{
+    const char *name;
+    void (*setup) ();
+    void (*issue) ();
+    char compress;
+};
+
+/**\brief Number of files in the large test directory
+ *
+ * Big enough for the way directories are indexed to make a difference.
+ */
+#define LARGE_DIRECTORY 10000
+
+/**\brief Number of paths looked up per probe request
+ *
+ * The first half of them exist in the large test directory, the other half
+ * don't.
+ */
+#define PROBE_PATHS 100
+
+/**\brief Number of directories in the deep test tree
+ *
+ * Each is at the end of its own chain of subdirectories, and has DEEP_FILES
+ * files in it. There are fewer than the directory FID cache keeps by default.
+ */
+#define DEEP_DIRECTORIES 8
+
+/**\brief Number of files in each directory of the deep test tree */
+#define DEEP_FILES 32
+
+/**\brief Number of files in the export test directory
+ *
+ * Each of them is BLOCK_SIZE bytes long, so a single read gets all of it.
+ */
+#define EXPORT_FILES 64
+
+/**\brief Export
+ *
+ * One request of the export benchmarks: the FID of the directory being
+ * listed, the next file to read, and the number of reads and listings that
+ * have yet to finish.
+ */
+struct export
+{
+    int_32 fid;
+    int_32 next;
+    int_32 pending;
+    char   failed;
+};
+
+static struct dfs *fs               = (struct dfs *)0;
+static struct d9r_io *client        = (struct d9r_io *)0;
+static struct benchmark *current    = (struct benchmark *)0;
+static struct sexpr_io *stdio       = (struct sexpr_io *)0;
+
+static int_32 i_seconds    = 2;
+static int_32 i_depth      = 1;
+static int_32 i_link       = 0;
+static char   i_ring       = (char)0;
+static const char *i_local = (const char *)0;
+
+/**\brief Shared memory size for -r
+ *
+ * Enough for a good number of messages in flight in either direction.
+ */
+#define RING_SIZE 0x40000
+
+static char   ready        = (char)0;
+static char   failed       = (char)0;
+static char   stopping     = (char)0;
+static int_32 fid          = NO_FID_9P;
+static int_32 open_mode    = -1;
+static int_32 pending      = 0;
+static int_64 completed    = 0;
+static int_64 errors       = 0;
+static int_64 deliveries   = 0;
+static int_64 random_state = 0x2545f4914f6cdd1d;
+static struct io *local_file = (struct io *)0;
+
+static int_8  block[0x2000];
+
+/* payloads for the compression benchmarks: log lines, which compress well,
+ * random data, which doesn't, and zeroes, which compress best */
+static int_8  text_block[0x2000];
+static int_8  random_block[0x2000];
+static int_8  zero_block[0x2000];
+
+/**\brief Size of the file verified by the verify benchmarks
+ *
+ * Large enough for hashing to be the bulk of the work; the rates scale to
+ * bigger trees by their size.
+ */
+#define VERIFY_SIZE 0x100000
+
+static int_8            *verify_data = (int_8 *)0;
+static struct dfs_file  *verify_file = (struct dfs_file *)0;
+static int_8             verify_hash[DHASH_SIZE];
+
+static int_8            *copy_data   = (int_8 *)0;
+static int_32            copy_fid    = NO_FID_9P;
+static const char       *copy_target = (const char *)0;
+
+/**\brief Size of the file kept up to date by the sync benchmarks
+ *
+ * Stands in for a much larger file; only the share of it that changes
+ * between syncs matters, which is about 1%.
+ */
+#define SYNC_SIZE 0x1000000
+
+/**\brief Blocks of a sync file changed between syncs */
+#define SYNC_CHANGES ((SYNC_SIZE / 0x1000) / 100)
+
+/**\brief Bytes cut out of a sync file and put back at its end between syncs
+ */
+#define SYNC_MOVE 0x2000
+
+/**\brief Bytes the sync-shrink benchmark cuts off the end of the file */
+#define SYNC_CUT 0x1800
+
+static int_8            *sync_local  = (int_8 *)0;
+static int_8            *sync_remote = (int_8 *)0;
+static struct dfs_file  *sync_file   = (struct dfs_file *)0;
+static int_32            syncing     = 0;
+
+/**\brief Wide directory
+ *
+ * A directory with a given number of files in it, for measuring how walks
+ * scale with directory size. Only built when a benchmark needs it, as the
+ * largest takes a while and a good deal of memory.
+ */
+struct wide_directory
+{
+    const char           *name;
+    const char           *prefix;
+    int_32                entries;
+    struct dfs_directory *directory;
+};
+
+static struct wide_directory wide_directories[] =
+{
+    { "wide-1k",   "wide-1k/f",   1000,    (struct dfs_directory *)0 },
+    { "wide-100k", "wide-100k/f", 100000,  (struct dfs_directory *)0 },
+    { "wide-1m",   "wide-1m/f",   1000000, (struct dfs_directory *)0 }
+};
+
+static struct wide_directory *wide = (struct wide_directory *)0;
+
+static char        probe_names[PROBE_PATHS][32];
+static const char *probe_paths[PROBE_PATHS];
+static char        deep_names[DEEP_DIRECTORIES][32];
+
+/**\brief Largest read or write payload in a single message
+ *
+ * The message size is 0x2000 and a Twrite header takes 23 bytes.
+ */
+#define BLOCK_SIZE (0x2000 - 24)
+
+/**\brief Size of the records written by the records benchmarks */
+#define RECORD_SIZE 100
+
+/**\brief Number of records that make up one records request */
+#define RECORDS 1000
+
+static int_64 records_written = 0;
+
+/* the file the wstat benchmark shrinks, and the times it sets */
+static struct dfs_file *shrink_file = (struct dfs_file *)0;
+static int_32 wstat_mtime = 0;
+
+define_symbol (sym_error,    "error");
+define_symbol (sym_requests, "requests");
+define_symbol (sym_errors,   "errors");
+define_symbol (sym_seconds,  "seconds");
+define_symbol (sym_requests_per_second,    "requests-per-second");
+define_symbol (sym_nanoseconds_per_request, "nanoseconds-per-request");
+define_symbol (sym_round_trips, "round-trips");
+define_symbol (sym_wire_bytes,  "wire-bytes");
+define_symbol (sym_messages,    "messages");
+define_symbol (sym_peak_bytes,  "peak-bytes");
+define_symbol (sym_nodes,       "nodes");
+define_symbol (sym_directories, "directories");
+define_symbol (sym_node_bytes,  "node-bytes");
+define_symbol (sym_index_bytes, "index-bytes");
+define_symbol (sym_bytes_per_node, "bytes-per-node");
+
+static int_64 now ()
+{
+    return dt_to_unix (dt_get ());
+}
+
+/* requests are reissued from the main loop, as cache hits complete right
+ * away and would otherwise recurse */
+static void complete ()
+{
+    completed++;
+
+    if (!stopping)
+    {
+        pending++;
+    }
+}
+
+static void issue_pending ()
+{
+    while (pending > 0)
+    {
+        pending--;
+        current->issue ();
+    }
+}
+
+static void on_error (struct d9r_io *io, const char *error, void *aux)
+{
+    if (errors == 0)
+    {
+        sx_write (stdio, cons (sym_error, cons (make_string (current->name),
+                               cons (make_string (error), sx_end_of_list))));
+    }
+
+    errors++;
+
+    complete ();
+}
+
+/* streams only move along in the multiplexer, which is otherwise left alone
+ * here; pump() runs it while any of them are open */
+static int_32 streams = 0;
+
+static void stream_read (struct io *io, void *aux)
+{
+    io->position = io->length;
+}
+
+/**\brief Bytes the consumer of the stream-slow benchmark takes at a time */
+#define SLOW_READ 0x400
+
+/* the most data that was ever waiting in a slowly read stream */
+static int_64 peak = 0;
+
+/* takes a little of what's there each time it's called, so the data piles
+ * up unless read-ahead holds back */
+static void stream_read_slow (struct io *io, void *aux)
+{
+    unsigned int waiting = io->length - io->position;
+
+    if ((int_64)waiting > peak)
+    {
+        peak = waiting;
+    }
+
+    io->position += (waiting > SLOW_READ) ? SLOW_READ : waiting;
+}
+
+static void stream_close (struct io *io, void *aux)
+{
+    streams--;
+
+    complete ();
+}
+
+/* counts a stream as one request, which completes when it's closed */
+static void watch_stream
+        (struct io *io, void (*on_read) (struct io *, void *))
+{
+    if (io == (struct io *)0)
+    {
+        on_error (client, "Out of memory.", (void *)0);
+        return;
+    }
+
+    streams++;
+
+    multiplex_add_io (io, on_read, stream_close, (void *)0);
+}
+
+/* writes prefix and then n in decimal to buffer */
+static void number_name (char *buffer, const char *prefix, int_32 n)
+{
+    int_32 i = 0, j;
+
+    for (; prefix[i] != (char)0; i++)
+    {
+        buffer[i] = prefix[i];
+    }
+
+    j = i;
+
+    do
+    {
+        buffer[i] = (char)('0' + (n % 10));
+        n /= 10;
+        i++;
+    }
+    while (n > 0);
+
+    buffer[i] = (char)0;
+
+    for (i--; j < i; j++, i--)
+    {
+        char c    = buffer[j];
+        buffer[j] = buffer[i];
+        buffer[i] = c;
+    }
+}
+
+/* setup */
+
+static void setup_error (struct d9r_io *io, const char *error, void *aux)
+{
+    sx_write (stdio, cons (sym_error, cons (make_string (current->name),
+                           cons (make_string (error), sx_end_of_list))));
+
+    failed = (char)1;
+}
+
+static void setup_opened
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
+{
+    ready = (char)1;
+}
+
+static void setup_walked
+        (struct d9r_io *io, int_32 newfid, struct d9r_qid qid, void *aux)
+{
+    fid = newfid;
+
+    if (open_mode >= 0)
+    {
+        d9c_open (io, fid, (int_8)open_mode, setup_opened, setup_error, aux);
+    }
+    else
+    {
+        ready = (char)1;
+    }
+}
+
+/* walks the fid used by the benchmark to path, and opens it unless mode is
+ * negative */
+static void setup_fid (const char *path, int mode)
+{
+    open_mode = mode;
+
+    d9c_walk (client, NO_FID_9P, path, setup_walked, setup_error, (void *)0);
+}
+
+static void setup_none ()
+{
+    ready = (char)1;
+}
+
+static void setup_stat ()
+{
+    setup_fid ("bench/small", -1);
+}
+
+static void setup_read ()
+{
+    setup_fid ("bench/large", P9_OREAD);
+}
+
+static void setup_write ()
+{
+    setup_fid ("bench/scratch", P9_OWRITE);
+}
+
+static void setup_records ()
+{
+    records_written = 0;
+
+    setup_fid ("bench/log", P9_OWRITE);
+}
+
+static void setup_read_text ()
+{
+    setup_fid ("bench/text", P9_OREAD);
+}
+
+static void setup_read_random ()
+{
+    setup_fid ("bench/random", P9_OREAD);
+}
+
+static void setup_read_zero ()
+{
+    setup_fid ("bench/zero", P9_OREAD);
+}
+
+static void setup_local_found (struct d9r_io *io, const char *path, void *aux)
+{
+    if ((local_file = io_open_read (path)) == (struct io *)0)
+    {
+        setup_error (io, "Could not open local file.", aux);
+        return;
+    }
+
+    ready = (char)1;
+}
+
+static void setup_local_opened
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
+{
+    d9c_local (io, fid, setup_local_found, setup_error, aux);
+}
+
+static void setup_local_walked
+        (struct d9r_io *io, int_32 newfid, struct d9r_qid qid, void *aux)
+{
+    fid = newfid;
+
+    d9c_open (io, fid, P9_OREAD, setup_local_opened, setup_error, aux);
+}
+
+static void setup_verify ()
+{
+    setup_fid ("bench/huge", P9_OREAD);
+}
+
+static void setup_sync ()
+{
+    setup_fid ("bench/mirror", P9_OREADWRITE);
+}
+
+static void setup_shrunk (struct d9r_io *io, void *aux)
+{
+    if (shrink_file->c.length != (int_64)(sizeof (block) / 2))
+    {
+        setup_error (io, "Twstat did not truncate the file.", aux);
+        return;
+    }
+
+    ready = (char)1;
+}
+
+static void setup_shrink_walked
+        (struct d9r_io *io, int_32 newfid, struct d9r_qid qid, void *aux)
+{
+    struct d9r_qid keep = { (int_8)~0, ~(int_32)0, ~(int_64)0 };
+
+    fid = newfid;
+
+    shrink_file->c.length = sizeof (block);
+
+    d9c_wstat (io, fid, ~0, ~0, keep, ~0, ~0, ~0, sizeof (block) / 2, "", "",
+               "", "", "", setup_shrunk, setup_error, aux);
+}
+
+/* files can only be shrunk, so that is checked once over the wire before
+ * the benchmark changes nothing but the modification time */
+static void setup_wstat ()
+{
+    d9c_walk (client, NO_FID_9P, "bench/shrink", setup_shrink_walked,
+              setup_error, (void *)0);
+}
+
+/* makes d9c_sync() write the whole file, as it would without the extension */
+static void setup_sync_full ()
+{
+    client->extensions &= ~D9R_EXTENSION_HASH;
+
+    setup_sync ();
+}
+
+static void setup_copy_opened
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
+{
+    setup_fid (copy_target, P9_OWRITE);
+}
+
+static void setup_copy_walked
+        (struct d9r_io *io, int_32 newfid, struct d9r_qid qid, void *aux)
+{
+    copy_fid = newfid;
+
+    d9c_open (io, copy_fid, P9_OREAD, setup_copy_opened, setup_error, aux);
+}
+
+/* opens the source of the copies, and the target as fid */
+static void setup_copy_to (const char *source, const char *target)
+{
+    copy_target = target;
+
+    d9c_walk (client, NO_FID_9P, source, setup_copy_walked, setup_error,
+              (void *)0);
+}
+
+static void setup_copy ()
+{
+    setup_copy_to ("bench/huge", "bench/copy");
+}
+
+/* a target without callbacks gets a copy of the data that the VFS keeps */
+static void setup_copy_memory ()
+{
+    setup_copy_to ("bench/huge", "bench/clone");
+}
+
+/* which is shared rather than copied when it's copied again */
+static void setup_copy_shared ()
+{
+    setup_copy_to ("bench/clone", "bench/twin");
+}
+
+/* makes d9c_copy() read and write the data, as it would without the
+ * extension */
+static void setup_copy_stream ()
+{
+    client->extensions &= ~D9R_EXTENSION_COPY;
+
+    setup_copy ();
+}
+
+static void setup_read_local ()
+{
+    d9c_walk (client, NO_FID_9P, "host/local", setup_local_walked,
+              setup_error, (void *)0);
+}
+
+/* makes d9c_fetch() wait for each step, as it would without the extension */
+static void setup_no_compound ()
+{
+    client->extensions &= ~D9R_EXTENSION_COMPOUND;
+
+    ready = (char)1;
+}
+
+/* makes d9c_multiwalk() walk each path by itself */
+static void setup_no_multiwalk ()
+{
+    client->extensions &= ~D9R_EXTENSION_MULTIWALK;
+
+    ready = (char)1;
+}
+
+static void setup_wide (struct wide_directory *w)
+{
+    if (w->directory == (struct dfs_directory *)0)
+    {
+        char name[32];
+
+        if ((w->directory = dfs_mk_directory (fs->root, (char *)w->name))
+            == (struct dfs_directory *)0)
+        {
+            setup_error (client, "Out of memory.", (void *)0);
+            return;
+        }
+
+        dfs_hash_directory (w->directory);
+
+        for (int_32 i = 0; i < w->entries; i++)
+        {
+            number_name (name, "f", i);
+
+            if (dfs_mk_file (w->directory, name, (char *)0, block, 64,
+                             (void *)0, (void *)0, (void *)0)
+                == (struct dfs_file *)0)
+            {
+                setup_error (client, "Out of memory.", (void *)0);
+                return;
+            }
+        }
+    }
+
+    wide  = w;
+    ready = (char)1;
+}
+
+static void setup_walk_1k ()
+{
+    setup_wide (&(wide_directories[0]));
+}
+
+static void setup_walk_100k ()
+{
+    setup_wide (&(wide_directories[1]));
+}
+
+static void setup_walk_1m ()
+{
+    setup_wide (&(wide_directories[2]));
+}
+
+static void setup_no_pool ()
+{
+    d9c_set_directory_cache (client, 0);
+
+    ready = (char)1;
+}
+
+static void setup_data_cache ()
+{
+    d9c_enable_cache (client, 0x100000);
+
+    ready = (char)1;
+}
+
+static void setup_metadata_cache ()
+{
+    d9c_enable_metadata_cache (client, 3600, 3600, 1024);
+
+    ready = (char)1;
+}
+
+/* requests */
+
+static void walked
+        (struct d9r_io *io, int_32 newfid, struct d9r_qid qid, void *aux)
+{
+    d9c_clunk (io, newfid, (void *)0, (void *)0, (void *)0);
+
+    complete ();
+}
+
+static void issue_walk ()
+{
+    d9c_walk (client, NO_FID_9P, "bench/small", walked, on_error, (void *)0);
+}
+
+static void issue_walk_deep ()
+{
+    d9c_walk (client, NO_FID_9P, "bench/a/b/c/d/e/f/g/small", walked,
+              on_error, (void *)0);
+}
+
+static int_32 random_number (int_32 limit)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+
+    return (int_32)(((unsigned long long)random_state) % limit);
+}
+
+static void issue_walk_large ()
+{
+    char name[32];
+
+    number_name (name, "large/f", random_number (LARGE_DIRECTORY));
+
+    d9c_walk (client, NO_FID_9P, name, walked, on_error, (void *)0);
+}
+
+/* walks to a random file in the wide directory picked by the setup */
+static void issue_walk_wide ()
+{
+    char name[32];
+
+    number_name (name, wide->prefix, random_number (wide->entries));
+
+    d9c_walk (client, NO_FID_9P, name, walked, on_error, (void *)0);
+}
+
+static void stat_done
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
+{
+    complete ();
+}
+
+static void issue_stat ()
+{
+    d9c_stat_fid (client, fid, stat_done, on_error, (void *)0);
+}
+
+static void issue_stat_path ()
+{
+    d9c_stat (client, "bench/a/b/c/d/e/f/g/small", stat_done, on_error,
+              (void *)0);
+}
+
+static void read_done (struct d9r_io *io, int_32 count, int_8 *data, void *aux)
+{
+    complete ();
+}
+
+static void issue_read_small ()
+{
+    d9c_read (client, fid, 0, 64, read_done, on_error, (void *)0);
+}
+
+static void issue_read ()
+{
+    d9c_read (client, fid, 0, BLOCK_SIZE, read_done, on_error, (void *)0);
+}
+
+/* the same amount of data as issue_read(), but from the host file that
+ * d9c_local() pointed to; starts over at the end of the file */
+static void issue_read_local ()
+{
+    struct io *f = local_file;
+    enum io_result r = io_changes;
+
+    if (f == (struct io *)0)
+    {
+        on_error (client, "Could not open local file.", (void *)0);
+        return;
+    }
+
+    while (((f->length - f->position) < BLOCK_SIZE) && (r == io_changes))
+    {
+        r = io_read (f);
+    }
+
+    if (f->length == f->position)
+    {
+        io_close (f);
+        local_file = io_open_read (i_local);
+
+        if (r == io_unrecoverable_error)
+        {
+            on_error (client, "Could not read local file.", (void *)0);
+            return;
+        }
+    }
+    else if ((f->length - f->position) > BLOCK_SIZE)
+    {
+        f->position += BLOCK_SIZE;
+    }
+    else
+    {
+        f->position = f->length;
+    }
+
+    complete ();
+}
+
+/* the whole file, through the data cache if there is one */
+static void issue_read_stream ()
+{
+    watch_stream (io_open_read_9p (client, "bench/large"), stream_read);
+}
+
+/* the first part comes with the compound open, the rest from the host file */
+static void issue_stream_local ()
+{
+    watch_stream (io_open_read_9p (client, "host/local"), stream_read);
+}
+
+/**\brief Number of FIDs the stream-striped benchmark reads over */
+#define STRIPES 4
+
+/* a whole megabyte in one stream */
+static void issue_stream_huge ()
+{
+    watch_stream (io_open_read_9p (client, "bench/huge"), stream_read);
+}
+
+/* the same, in ranges read over STRIPES FIDs at the same time; over a
+ * loopback, this shows what splitting up and reassembling the file costs */
+static void issue_stream_striped ()
+{
+    struct d9r_io *ios[STRIPES];
+
+    for (int_32 i = 0; i < STRIPES; i++)
+    {
+        ios[i] = client;
+    }
+
+    watch_stream (io_open_striped_read_9p (ios, STRIPES, "bench/huge"),
+                  stream_read);
+}
+
+/* a whole megabyte, read by a consumer that can't keep up */
+static void issue_stream_slow ()
+{
+    watch_stream (io_open_read_9p (client, "bench/huge"), stream_read_slow);
+}
+
+/* opens and reads one of the files in the deep tree at random */
+static void issue_open_deep ()
+{
+    char name[48];
+    int_32 n = random_number (DEEP_DIRECTORIES * DEEP_FILES);
+
+    number_name (name, deep_names[n / DEEP_FILES], n % DEEP_FILES);
+
+    watch_stream (io_open_read_9p (client, name), stream_read);
+}
+
+static void issue_fetch ()
+{
+    d9c_fetch (client, "bench/small", 0, 64, read_done, on_error, (void *)0);
+}
+
+static void probe_path
+        (struct d9r_io *io, int_32 index, int_16 walked, int_16 elements,
+         struct d9r_qid qid, void *aux)
+{
+}
+
+static void probe_done (struct d9r_io *io, void *aux)
+{
+    complete ();
+}
+
+static void issue_probe ()
+{
+    d9c_multiwalk (client, NO_FID_9P, PROBE_PATHS, probe_paths, probe_path,
+                   probe_done, (void *)0);
+}
+
+static void write_done (struct d9r_io *io, int_32 count, void *aux)
+{
+    complete ();
+}
+
+static void issue_write ()
+{
+    d9c_write (client, fid, 0, BLOCK_SIZE, block, write_done, on_error,
+               (void *)0);
+}
+
+static void wstat_done (struct d9r_io *io, void *aux)
+{
+    complete ();
+}
+
+static void issue_wstat ()
+{
+    struct d9r_qid keep = { (int_8)~0, ~(int_32)0, ~(int_64)0 };
+
+    wstat_mtime++;
+
+    d9c_wstat (client, fid, ~0, ~0, keep, ~0, ~0, wstat_mtime, ~(int_64)0,
+               "", "", "", "", "", wstat_done, on_error, (void *)0);
+}
+
+static void issue_write_text ()
+{
+    d9c_write (client, fid, 0, BLOCK_SIZE, text_block, write_done, on_error,
+               (void *)0);
+}
+
+static const int_8 *record (int_32 n)
+{
+    return text_block +
+           ((n * RECORD_SIZE) % ((int_32)sizeof (text_block) - RECORD_SIZE));
+}
+
+static void records_flushed (struct d9r_io *io, const char *error, void *aux)
+{
+    /* closing the stream clunks its fid */
+    multiplex_del_io ((struct io *)aux);
+
+    streams--;
+
+    if (error != (const char *)0)
+    {
+        on_error (io, error, (void *)0);
+        return;
+    }
+
+    complete ();
+}
+
+/* RECORDS small records through a write stream, which holds on to them until
+ * they fill a whole Twrite; done once the flush has been acknowledged */
+static void issue_records ()
+{
+    struct io *stream = io_open_write_9p (client, "bench/log");
+
+    if (stream == (struct io *)0)
+    {
+        on_error (client, "Out of memory.", (void *)0);
+        return;
+    }
+
+    for (int_32 i = 0; i < RECORDS; i++)
+    {
+        io_write (stream, (const char *)record (i), RECORD_SIZE);
+    }
+
+    streams++;
+
+    d9c_flush_9p (client, stream, records_flushed, (void *)stream);
+}
+
+static void record_written (struct d9r_io *io, int_32 count, void *aux)
+{
+    records_written++;
+
+    if ((records_written % RECORDS) == 0)
+    {
+        complete ();
+    }
+}
+
+/* the same records, with a Twrite each */
+static void issue_records_direct ()
+{
+    for (int_32 i = 0; i < RECORDS; i++)
+    {
+        d9c_write (client, fid, (int_64)i * RECORD_SIZE, RECORD_SIZE,
+                   (int_8 *)record (i), record_written, on_error, (void *)0);
+    }
+}
+
+static void list_entry
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
+{
+}
+
+static void list_done (struct d9r_io *io, void *aux)
+{
+    d9c_clunk (io, (int_32)(long)aux, (void *)0, (void *)0, (void *)0);
+
+    complete ();
+}
+
+static void list_error (struct d9r_io *io, const char *error, void *aux)
+{
+    d9c_clunk (io, (int_32)(long)aux, (void *)0, (void *)0, (void *)0);
+
+    on_error (io, error, (void *)0);
+}
+
+static void list_opened
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
+{
+    d9c_readdir (io, (int_32)(long)aux, list_entry, list_done, list_error,
+                 aux);
+}
+
+static void list_walked
+        (struct d9r_io *io, int_32 newfid, struct d9r_qid qid, void *aux)
+{
+    d9c_open (io, newfid, P9_OREAD, list_opened, list_error,
+              (void *)(long)newfid);
+}
+
+static void issue_list ()
+{
+    d9c_walk (client, NO_FID_9P, "bench", list_walked, on_error, (void *)0);
+}
+
+static struct export *export_new ()
+{
+    struct export *e = aalloc (sizeof (struct export));
+
+    if (e == (struct export *)0)
+    {
+        on_error (client, "Out of memory.", (void *)0);
+        return (struct export *)0;
+    }
+
+    e->fid     = NO_FID_9P;
+    e->next    = 0;
+    e->pending = 1;
+    e->failed  = (char)0;
+
+    return e;
+}
+
+static void export_release (struct d9r_io *io, struct export *e)
+{
+    e->pending--;
+
+    if (e->pending > 0)
+    {
+        return;
+    }
+
+    if (e->fid != NO_FID_9P)
+    {
+        d9c_clunk (io, e->fid, (void *)0, (void *)0, (void *)0);
+    }
+
+    if (!e->failed)
+    {
+        complete ();
+    }
+
+    afree (sizeof (struct export), e);
+}
+
+/* the request counts as one error, however many of its parts fail */
+static void export_error (struct d9r_io *io, const char *error, void *aux)
+{
+    struct export *e = (struct export *)aux;
+
+    if (!e->failed)
+    {
+        e->failed = (char)1;
+
+        on_error (io, error, (void *)0);
+    }
+
+    export_release (io, e);
+}
+
+static void export_read
+        (struct d9r_io *io, int_32 count, int_8 *data, void *aux)
+{
+    export_release (io, (struct export *)aux);
+}
+
+/* reads each file as soon as the listing turns it up, the way d9c export
+ * overlaps its directory reads with the reads of the files in them */
+static void export_entry
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
+{
+    struct export *e = (struct export *)aux;
+    char path[64] = "export/";
+    int_32 i = 7;
+
+    for (; (name[i - 7] != (char)0) && (i < ((int_32)sizeof (path) - 1)); i++)
+    {
+        path[i] = name[i - 7];
+    }
+
+    path[i] = (char)0;
+
+    e->pending++;
+
+    d9c_fetch (io, path, 0, BLOCK_SIZE, export_read, export_error, aux);
+}
+
+static void export_listed (struct d9r_io *io, void *aux)
+{
+    export_release (io, (struct export *)aux);
+}
+
+static void export_opened
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
+{
+    struct export *e = (struct export *)aux;
+
+    d9c_readdir (io, e->fid, export_entry, export_listed, export_error, aux);
+}
+
+static void export_walked
+        (struct d9r_io *io, int_32 newfid, struct d9r_qid qid, void *aux)
+{
+    struct export *e = (struct export *)aux;
+
+    e->fid = newfid;
+
+    d9c_open (io, newfid, P9_OREAD, export_opened, export_error, aux);
+}
+
+/* lists the export directory and reads all the files in it */
+static void issue_export ()
+{
+    struct export *e = export_new ();
+
+    if (e != (struct export *)0)
+    {
+        d9c_walk (client, NO_FID_9P, "export", export_walked, export_error,
+                  (void *)e);
+    }
+}
+
+/* one file after the other, each read with a request of its own, as with a
+ * d9c cat per file; only without starting a process and attaching for each
+ * of them, so the real difference is larger still */
+static void export_cat_next
+        (struct d9r_io *io, int_32 count, int_8 *data, void *aux)
+{
+    struct export *e = (struct export *)aux;
+    char path[32];
+
+    if (e->next == EXPORT_FILES)
+    {
+        export_release (io, e);
+        return;
+    }
+
+    number_name (path, "export/f", e->next);
+    e->next++;
+
+    d9c_fetch (io, path, 0, BLOCK_SIZE, export_cat_next, export_error, aux);
+}
+
+static void issue_export_cat ()
+{
+    struct export *e = export_new ();
+
+    if (e != (struct export *)0)
+    {
+        export_cat_next (client, 0, (int_8 *)0, (void *)e);
+    }
+}
+
+static char same_hash (int_8 *a, int_8 *b)
+{
+    for (int_32 i = 0; i < DHASH_SIZE; i++)
+    {
+        if (a[i] != b[i]) return (char)0;
+    }
+
+    return (char)1;
+}
+
+static void verify_hashed
+        (struct d9r_io *io, int_8 *hash, int_16 count, int_32 *weak,
+         int_8 *strong, void *aux)
+{
+    if (!same_hash (hash, verify_hash))
+    {
+        on_error (io, "Hash mismatch.", (void *)0);
+        return;
+    }
+
+    complete ();
+}
+
+/* has the server hash the file; the result is cached there after the first
+ * time, as with a sync tool checking files that haven't changed */
+static void issue_verify ()
+{
+    d9c_hash (client, fid, 0, ~(int_64)0, 0, verify_hashed, on_error,
+              (void *)0);
+}
+
+/* the same, with the file changed every time so the server has to hash it */
+static void issue_verify_uncached ()
+{
+    dfs_touch (&(verify_file->c));
+
+    issue_verify ();
+}
+
+/**\brief Verification by reading
+ *
+ * The state of one verify-read request, which reads the file and hashes it
+ * locally.
+ */
+struct verify_read
+{
+    int_64      offset;
+    struct dhash hash;
+};
+
+static struct memory_pool verify_read_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct verify_read));
+
+static void verify_read_error (struct d9r_io *io, const char *error, void *aux)
+{
+    free_pool_mem (aux);
+
+    on_error (io, error, (void *)0);
+}
+
+static void verify_read_done
+        (struct d9r_io *io, int_32 count, int_8 *data, void *aux)
+{
+    struct verify_read *v = (struct verify_read *)aux;
+    int_8 hash[DHASH_SIZE];
+
+    dhash_update (&(v->hash), data, count);
+    v->offset += count;
+
+    if ((count > 0) && (v->offset < VERIFY_SIZE))
+    {
+        d9c_read (io, fid, v->offset, BLOCK_SIZE, verify_read_done,
+                  verify_read_error, aux);
+        return;
+    }
+
+    dhash_final (&(v->hash), hash);
+    free_pool_mem (v);
+
+    if (!same_hash (hash, verify_hash))
+    {
+        on_error (io, "Hash mismatch.", (void *)0);
+        return;
+    }
+
+    complete ();
+}
+
+static void issue_verify_read ()
+{
+    struct verify_read *v = get_pool_mem (&verify_read_pool);
+
+    if (v == (struct verify_read *)0)
+    {
+        on_error (client, "Out of memory.", (void *)0);
+        return;
+    }
+
+    v->offset = 0;
+    dhash_init (&(v->hash));
+
+    d9c_read (client, fid, 0, BLOCK_SIZE, verify_read_done, verify_read_error,
+              (void *)v);
+}
+
+static void synced (struct d9r_io *io, int_64 written, void *aux)
+{
+    syncing--;
+
+    complete ();
+}
+
+static void sync_error (struct d9r_io *io, const char *error, void *aux)
+{
+    syncing--;
+
+    on_error (io, error, aux);
+}
+
+/* changes about 1% of the local copy and brings the file up to date; the
+ * copy is only changed while no sync is reading it */
+static void issue_sync ()
+{
+    if (syncing == 0)
+    {
+        for (int_32 i = 0; i < SYNC_CHANGES; i++)
+        {
+            random_state ^= random_state << 13;
+            random_state ^= random_state >> 7;
+            random_state ^= random_state << 17;
+
+            sync_local[((unsigned long long)random_state) % SYNC_SIZE]++;
+        }
+    }
+
+    syncing++;
+
+    d9c_sync (client, fid, sync_local, SYNC_SIZE, 0, synced, sync_error,
+              (void *)0);
+}
+
+/* brings the file back to its full length, and has d9c_sync() cut it down
+ * again; fails unless the file is as short as the data afterwards */
+static void synced_shrink (struct d9r_io *io, int_64 written, void *aux)
+{
+    syncing--;
+
+    if (sync_file->c.length != (SYNC_SIZE - SYNC_CUT))
+    {
+        on_error (io, "File not truncated.", aux);
+        return;
+    }
+
+    complete ();
+}
+
+static void issue_sync_shrink ()
+{
+    if (syncing == 0)
+    {
+        sync_file->c.length = SYNC_SIZE;
+    }
+
+    syncing++;
+
+    d9c_sync (client, fid, sync_local, SYNC_SIZE - SYNC_CUT, 0, synced_shrink,
+              sync_error, (void *)0);
+}
+
+/* cuts a few blocks' worth out of the local copy and puts them back at the
+ * end, so everything after the cut moves; the blocks that moved are found
+ * by the rolling checksum and copied on the server */
+static void issue_sync_moved ()
+{
+    if (syncing == 0)
+    {
+        int_8 moved[SYNC_MOVE];
+        int_32 offset = random_number (SYNC_SIZE - SYNC_MOVE);
+
+        for (int_32 i = 0; i < SYNC_MOVE; i++)
+        {
+            moved[i] = sync_local[offset + i];
+        }
+
+        for (int_32 i = offset; i < (SYNC_SIZE - SYNC_MOVE); i++)
+        {
+            sync_local[i] = sync_local[i + SYNC_MOVE];
+        }
+
+        for (int_32 i = 0; i < SYNC_MOVE; i++)
+        {
+            sync_local[(SYNC_SIZE - SYNC_MOVE) + i] = moved[i];
+        }
+    }
+
+    syncing++;
+
+    d9c_sync (client, fid, sync_local, SYNC_SIZE, 0, synced, sync_error,
+              (void *)0);
+}
+
+static void copied (struct d9r_io *io, int_64 count, void *aux)
+{
+    if (count != VERIFY_SIZE)
+    {
+        on_error (io, "Short copy.", (void *)0);
+        return;
+    }
+
+    complete ();
+}
+
+static void issue_copy ()
+{
+    d9c_copy (client, fid, 0, copy_fid, 0, ~(int_64)0, copied, on_error,
+              (void *)0);
+}
+
+static void find_done (struct d9r_io *io, void *aux)
+{
+    complete ();
+}
+
+/* searches the whole tree, which has over ten thousand nodes, about a tenth
+ * of which match */
+static void issue_find ()
+{
+    d9c_find (client, NO_FID_9P, "f1*", D9R_FIND_FILE, 0, ~(int_64)0, 0,
+              ~(int_32)0, list_entry, find_done, on_error, (void *)0);
+}
+
+/**\brief Benchmarks
+ *
+ * Run in this order, each on a connection of its own, so that what one of
+ * them caches doesn't change the results of the others.
+ */
+static struct benchmark benchmarks[] =
+{
+    { "walk",              setup_none,            issue_walk,             0 },
+    { "walk-deep",         setup_none,            issue_walk_deep,        0 },
+    { "walk-large",        setup_none,            issue_walk_large,       0 },
+    { "walk-1k",           setup_walk_1k,         issue_walk_wide,        0 },
+    { "walk-100k",         setup_walk_100k,       issue_walk_wide,        0 },
+    { "walk-1m",           setup_walk_1m,         issue_walk_wide,        0 },
+    { "stat",              setup_stat,            issue_stat,             0 },
+    { "stat-path",         setup_none,            issue_stat_path,        0 },
+    { "stat-path-cached",  setup_metadata_cache,  issue_stat_path,        0 },
+    { "read-small",        setup_read,            issue_read_small,       0 },
+    { "read",              setup_read,            issue_read,             0 },
+    { "read-local",        setup_read_local,      issue_read_local,       0 },
+    { "stream",            setup_none,            issue_read_stream,      0 },
+    { "stream-cached",     setup_data_cache,      issue_read_stream,      0 },
+    { "stream-local",      setup_none,            issue_stream_local,     0 },
+    { "stream-huge",       setup_none,            issue_stream_huge,      0 },
+    { "stream-striped",    setup_none,            issue_stream_striped,   0 },
+    { "stream-slow",       setup_none,            issue_stream_slow,      0 },
+    { "open-deep",         setup_none,            issue_open_deep,        0 },
+    { "open-deep-no-pool", setup_no_pool,         issue_open_deep,        0 },
+    { "fetch",             setup_none,            issue_fetch,            0 },
+    { "fetch-sequential",  setup_no_compound,     issue_fetch,            0 },
+    { "probe",             setup_none,            issue_probe,            0 },
+    { "probe-walks",       setup_no_multiwalk,    issue_probe,            0 },
+    { "find",              setup_none,            issue_find,             0 },
+    { "verify",            setup_verify,          issue_verify,           0 },
+    { "verify-uncached",   setup_verify,          issue_verify_uncached,  0 },
+    { "verify-read",       setup_verify,          issue_verify_read,      0 },
+    { "sync",              setup_sync,            issue_sync,             0 },
+    { "sync-full",         setup_sync_full,       issue_sync,             0 },
+    { "sync-moved",        setup_sync,            issue_sync_moved,       0 },
+    { "sync-shrink",       setup_sync,            issue_sync_shrink,      0 },
+    { "copy",              setup_copy,            issue_copy,             0 },
+    { "copy-memory",       setup_copy_memory,     issue_copy,             0 },
+    { "copy-shared",       setup_copy_shared,     issue_copy,             0 },
+    { "copy-stream",       setup_copy_stream,     issue_copy,             0 },
+    { "write",             setup_write,           issue_write,            0 },
+    { "wstat",             setup_wstat,           issue_wstat,            0 },
+    { "records",           setup_none,            issue_records,          0 },
+    { "records-direct",    setup_records,         issue_records_direct,   0 },
+    { "read-text",         setup_read_text,       issue_read,             1 },
+    { "read-text-plain",   setup_read_text,       issue_read,             0 },
+    { "read-random",       setup_read_random,     issue_read,             1 },
+    { "read-random-plain", setup_read_random,     issue_read,             0 },
+    { "read-zero",         setup_read_zero,       issue_read,             1 },
+    { "read-zero-plain",   setup_read_zero,       issue_read,             0 },
+    { "write-text",        setup_write,           issue_write_text,       1 },
+    { "write-text-plain",  setup_write,           issue_write_text,       0 },
+    { "list",              setup_none,            issue_list,             0 },
+    { "export",            setup_none,            issue_export,           0 },
+    { "export-cat",        setup_none,            issue_export_cat,       0 },
+    { (const char *)0,     (void *)0,             (void *)0,              0 }
+};
+
+/**\brief Memory Measurement
+ *
+ * Rather than timing requests, these build a VFS of the given number of nodes
+ * and report how much memory it takes per node. They need a lot of memory and
+ * take a while to build, so they only run when named on the command line.
+ */
+struct measurement
+{
+    const char *name;
+    int_32      nodes;
+};
+
+/* files per directory in the measured trees */
+#define MEASURE_DIRECTORY 1000
+
+static struct measurement measurements[] =
+{
+    { "memory-1m",      1000000 },
+    { "memory-10m",     10000000 },
+    { (const char *)0,  0 }
+};
+
+/* connections */
+
+/* keeps the contents of the files it's used for in memory, so they can be
+ * hashed or copied */
+static int_32 sink_write
+        (struct dfs_file *f, int_64 offset, int_32 count, int_8 *data)
+{
+    return count;
+}
+
+static int_32 mirror_write
+        (struct dfs_file *f, int_64 offset, int_32 count, int_8 *data)
+{
+    if (offset >= f->c.length)
+    {
+        return 0;
+    }
+
+    if ((offset + count) > f->c.length)
+    {
+        count = (int_32)(f->c.length - offset);
+    }
+
+    for (int_32 i = 0; i < count; i++)
+    {
+        f->data[offset + i] = data[i];
+    }
+
+    return count;
+}
+
+static void on_attach (struct d9r_io *io, void *aux)
+{
+    current->setup ();
+}
+
+static void on_connection_error (struct d9r_io *io, const char *error,
+                                 void *aux)
+{
+    setup_error (io, error, aux);
+}
+
+static void on_close (struct d9r_io *io, void *aux)
+{
+    client = (struct d9r_io *)0;
+}
+
+static int_32 pump ()
+{
+    return d9r_run_loopback () + d9r_run_rings () +
+           (((streams > 0) && (multiplex () != mx_nothing_to_do)) ? 1 : 0);
+}
+
+/* delivers messages until there's nothing left to do or flag is set */
+static void run_until (char *flag)
+{
+    while (!*flag && !failed && (pump () > 0));
+}
+
+/* waits for the start of the next second, and returns it */
+static int_64 tick ()
+{
+    int_64 s = now (), n;
+
+    while ((n = now ()) == s);
+
+    return n;
+}
+
+static void run (struct benchmark *b)
+{
+    struct d9r_io *server;
+    int_64 start, end, count, elapsed, bytes, messages, t;
+    sexpr tail = sx_end_of_list;
+    char never = (char)0;
+    unsigned char *memory = (unsigned char *)0;
+
+    current   = b;
+    ready     = (char)0;
+    failed    = (char)0;
+    stopping  = (char)0;
+    fid       = NO_FID_9P;
+    pending   = 0;
+    completed = 0;
+    errors    = 0;
+    deliveries = 0;
+    peak      = 0;
+
+    if (i_ring)
+    {
+        /* the same rings two processes would share, without a doorbell */
+        client = (struct d9r_io *)0;
+        server = (struct d9r_io *)0;
+
+        if ((memory = aalloc (RING_SIZE)) != (unsigned char *)0)
+        {
+            for (int_32 i = 0; i < RING_SIZE; i++)
+            {
+                memory[i] = 0;
+            }
+
+            client = d9r_open_ring ((struct io *)0, (struct io *)0, memory,
+                                    RING_SIZE, 0);
+            server = d9r_open_ring ((struct io *)0, (struct io *)0, memory,
+                                    RING_SIZE, 1);
+        }
+
+        /* as the client is this process, it may read host files itself */
+        if (server != (struct d9r_io *)0)
+        {
+            server->peer_uid = D9R_PEER_SELF;
+        }
+
+        if ((client == (struct d9r_io *)0) || (server == (struct d9r_io *)0))
+        {
+            if (client != (struct d9r_io *)0) d9r_close_io (client);
+            if (server != (struct d9r_io *)0) d9r_close_io (server);
+
+            run_until (&never);
+
+            if (memory != (unsigned char *)0) afree (RING_SIZE, memory);
+
+            setup_error ((struct d9r_io *)0, "Out of memory.", (void *)0);
+            return;
+        }
+    }
+    else
+    {
+        d9r_open_loopback (&client, &server);
+
+        if (client == (struct d9r_io *)0)
+        {
+            setup_error ((struct d9r_io *)0, "Out of memory.", (void *)0);
+            return;
+        }
+    }
+
+    multiplex_add_d9s_d9r (server, fs);
+
+    if (b->compress)
+    {
+        server->extensions |= D9R_EXTENSION_COMPRESS;
+    }
+    multiplex_add_d9c_d9r (client, on_attach, on_connection_error, on_close,
+                           (void *)0);
+
+    run_until (&ready);
+
+    if (ready && !failed)
+    {
+        start    = tick ();
+        end      = start + i_seconds;
+        bytes    = d9r_loopback_bytes (client);
+        messages = d9r_loopback_messages (client);
+        t        = start;
+
+        pending = i_depth;
+
+        /* only look at the clock every so often, it's a system call; with a
+         * link limit, nothing more goes across once a second's worth of
+         * bytes has, until the next second */
+        do
+        {
+            for (int_32 i = 0; i < 0x100; i++)
+            {
+                issue_pending ();
+
+                if ((i_link > 0) &&
+                    ((d9r_loopback_bytes (client) - bytes) >=
+                     ((t - start + 1) * i_link)))
+                {
+                    break;
+                }
+
+                if (pump () > 0)
+                {
+                    deliveries++;
+                }
+            }
+        }
+        while ((t = now ()) < end);
+
+        count    = completed;
+        elapsed  = now () - start;
+        bytes    = d9r_loopback_bytes (client) - bytes;
+        messages = d9r_loopback_messages (client) - messages;
+        stopping = (char)1;
+
+        run_until (&never);
+
+        if (elapsed < 1) elapsed = 1;
+
+        /* only the benchmarks that read slowly have a peak to report */
+        if (peak > 0)
+        {
+            tail = cons (sym_peak_bytes, cons (make_integer (peak),
+                                               sx_end_of_list));
+        }
+
+        sx_write (stdio, cons (make_symbol (b->name),
+            cons (sym_requests, cons (make_integer (count),
+            cons (sym_errors, cons (make_integer (errors),
+            cons (sym_seconds, cons (make_integer (elapsed),
+            cons (sym_requests_per_second,
+                  cons (make_integer (count / elapsed),
+            cons (sym_nanoseconds_per_request,
+                  cons (make_integer ((count > 0) ?
+                                      ((elapsed * 1000000000) / count) : 0),
+            cons (sym_round_trips, cons (make_integer (deliveries / 2),
+            cons (sym_wire_bytes, cons (make_integer (bytes),
+            cons (sym_messages, cons (make_integer (messages),
+                  tail))))))))))))))))));
+    }
+
+    if (fid != NO_FID_9P)
+    {
+        d9c_clunk (client, fid, (void *)0, (void *)0, (void *)0);
+    }
+
+    multiplex_del_d9r (client);
+
+    if (i_ring)
+    {
+        multiplex_del_d9r (server);
+    }
+
+    run_until (&never);
+
+    if (memory != (unsigned char *)0)
+    {
+        afree (RING_SIZE, memory);
+    }
+
+    if (local_file != (struct io *)0)
+    {
+        io_close (local_file);
+        local_file = (struct io *)0;
+    }
+}
+
+/* builds a tree of files in directories of MEASURE_DIRECTORY each, in a VFS
+ * of its own; that VFS is never freed, as there's no way to */
+static void measure (struct measurement *m)
+{
+    struct dfs *mfs = dfs_create ((void *)0, (void *)0);
+    struct dfs_directory *d = (struct dfs_directory *)0;
+    struct dfs_statistics st;
+    char name[32];
+
+    if (mfs == (struct dfs *)0)
+    {
+        sx_write (stdio, cons (sym_error, cons (make_string (m->name),
+                  cons (make_string ("Out of memory."), sx_end_of_list))));
+        return;
+    }
+
+    for (int_32 i = 0; i < m->nodes; i++)
+    {
+        if ((i % MEASURE_DIRECTORY) == 0)
+        {
+            number_name (name, "d", i / MEASURE_DIRECTORY);
+
+            d = dfs_mk_directory (mfs->root, name);
+        }
+
+        number_name (name, "f", i);
+
+        if ((d == (struct dfs_directory *)0) ||
+            (dfs_mk_file (d, name, (char *)0, block, 64, (void *)0, (void *)0,
+                          (void *)0) == (struct dfs_file *)0))
+        {
+            sx_write (stdio, cons (sym_error, cons (make_string (m->name),
+                      cons (make_string ("Out of memory."), sx_end_of_list))));
+            return;
+        }
+    }
+
+    dfs_get_statistics (mfs, &st);
+
+    sx_write (stdio, cons (make_symbol (m->name),
+        cons (sym_nodes, cons (make_integer (st.nodes),
+        cons (sym_directories, cons (make_integer (st.directories),
+        cons (sym_node_bytes, cons (make_integer (st.node_bytes),
+        cons (sym_index_bytes, cons (make_integer (st.index_bytes),
+        cons (sym_bytes_per_node,
+              cons (make_integer ((st.node_bytes + st.index_bytes) /
+                                  st.nodes),
+              sx_end_of_list))))))))))));
+}
+
+/* test tree */
+
+static void make_tree ()
+{
+    struct dfs_directory *bench, *large, *deep, *export, *d;
+    struct dfs_file *clone;
+    char name[32] = "f";
+
+    fs = dfs_create ((void *)0, (void *)0);
+
+    for (int_32 i = 0; i < (int_32)sizeof (block); i++)
+    {
+        block[i] = (int_8)i;
+    }
+
+    for (int_32 i = 0, line = 0; i < (int_32)sizeof (text_block); line++)
+    {
+        const char *l = "2014-03-01 12:00:00 duat: served request ";
+
+        for (; (*l != (char)0) && (i < (int_32)sizeof (text_block)); l++, i++)
+        {
+            text_block[i] = (int_8)*l;
+        }
+
+        for (int_32 n = line; (n > 0) && (i < (int_32)sizeof (text_block));
+             n /= 10, i++)
+        {
+            text_block[i] = (int_8)('0' + (n % 10));
+        }
+
+        if (i < (int_32)sizeof (text_block))
+        {
+            text_block[i] = (int_8)'\n';
+            i++;
+        }
+    }
+
+    for (int_32 i = 0; i < (int_32)sizeof (random_block); i++)
+    {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 7;
+        random_state ^= random_state << 17;
+
+        random_block[i] = (int_8)random_state;
+        zero_block[i]   = 0;
+    }
+
+    bench = dfs_mk_directory (fs->root, "bench");
+
+    dfs_mk_file (bench, "text",    (char *)0, text_block,
+                 sizeof (text_block), (void *)0, (void *)0, (void *)0);
+    dfs_mk_file (bench, "random",  (char *)0, random_block,
+                 sizeof (random_block), (void *)0, (void *)0, (void *)0);
+    dfs_mk_file (bench, "zero",    (char *)0, zero_block,
+                 sizeof (zero_block), (void *)0, (void *)0, (void *)0);
+
+    dfs_mk_file (bench, "small",   (char *)0, block, 64, (void *)0,
+                 (void *)0, (void *)0);
+    dfs_mk_file (bench, "large",   (char *)0, block, sizeof (block),
+                 (void *)0, (void *)0, (void *)0);
+    dfs_mk_file (bench, "scratch", (char *)0, block, sizeof (block),
+                 (void *)0, (void *)0, (void *)0);
+    dfs_mk_file (bench, "log",     (char *)0, (int_8 *)0, 0, (void *)0,
+                 (void *)0, sink_write);
+
+    shrink_file = dfs_mk_file (bench, "shrink", (char *)0, block,
+                               sizeof (block), (void *)0, (void *)0,
+                               (void *)0);
+
+    for (int_32 i = 0; i < 100; i++)
+    {
+        name[1] = (char)('0' + (i / 10));
+        name[2] = (char)('0' + (i % 10));
+        name[3] = (char)0;
+
+        dfs_mk_file (bench, name, (char *)0, block, 64, (void *)0,
+                     (void *)0, (void *)0);
+    }
+
+    if ((verify_data = aalloc (VERIFY_SIZE)) != (int_8 *)0)
+    {
+        for (int_32 i = 0; i < VERIFY_SIZE; i++)
+        {
+            verify_data[i] = (int_8)((i * 7) ^ (i >> 8));
+        }
+
+        verify_file = dfs_mk_file (bench, "huge", (char *)0, verify_data,
+                                   VERIFY_SIZE, (void *)0, (void *)0,
+                                   (void *)0);
+
+        dhash (verify_data, VERIFY_SIZE, verify_hash);
+    }
+
+    if ((copy_data = aalloc (VERIFY_SIZE)) != (int_8 *)0)
+    {
+        dfs_mk_file (bench, "copy", (char *)0, copy_data, VERIFY_SIZE,
+                     (void *)0, (void *)0, mirror_write);
+    }
+
+    clone = dfs_mk_file (bench, "clone", (char *)0, (int_8 *)0, 0, (void *)0,
+                         (void *)0, (void *)0);
+    dfs_mk_file (bench, "twin", (char *)0, (int_8 *)0, 0, (void *)0,
+                 (void *)0, (void *)0);
+
+    if ((clone != (struct dfs_file *)0) &&
+        (verify_file != (struct dfs_file *)0))
+    {
+        dfs_copy_contents (clone, verify_file, 0, VERIFY_SIZE);
+    }
+
+    if (((sync_local = aalloc (SYNC_SIZE)) != (int_8 *)0) &&
+        ((sync_remote = aalloc (SYNC_SIZE)) != (int_8 *)0))
+    {
+        for (int_32 i = 0; i < SYNC_SIZE; i++)
+        {
+            sync_local[i] = sync_remote[i] = (int_8)((i * 13) ^ (i >> 12));
+        }
+
+        sync_file = dfs_mk_file (bench, "mirror", (char *)0, sync_remote,
+                                 SYNC_SIZE, (void *)0, (void *)0,
+                                 mirror_write);
+    }
+
+    d = bench;
+
+    for (char c = 'a'; c <= 'g'; c++)
+    {
+        char n[2] = { c, (char)0 };
+
+        d = dfs_mk_directory (d, n);
+    }
+
+    dfs_mk_file (d, "small", (char *)0, block, 64, (void *)0, (void *)0,
+                 (void *)0);
+
+    /* only read with d9c_local(), so it doesn't need any data */
+    dfs_mk_file (dfs_mk_directory (fs->root, "host"), "local",
+                 (char *)i_local, (int_8 *)0, 0, (void *)0, (void *)0,
+                 (void *)0);
+
+    export = dfs_mk_directory (fs->root, "export");
+
+    for (int_32 i = 0; i < EXPORT_FILES; i++)
+    {
+        number_name (name, "f", i);
+
+        dfs_mk_file (export, name, (char *)0, block, BLOCK_SIZE, (void *)0,
+                     (void *)0, (void *)0);
+    }
+
+    large = dfs_mk_directory (fs->root, "large");
+
+    for (int_32 i = 0; i < LARGE_DIRECTORY; i++)
+    {
+        number_name (name, "f", i);
+
+        dfs_mk_file (large, name, (char *)0, block, 64, (void *)0,
+                     (void *)0, (void *)0);
+    }
+
+    dfs_hash_directory (large);
+
+    for (int_32 i = 0; i < PROBE_PATHS; i++)
+    {
+        char *p = probe_names[i];
+
+        number_name (p, "large/f", (i * 2 * LARGE_DIRECTORY) / PROBE_PATHS);
+
+        probe_paths[i] = p;
+    }
+
+    deep = dfs_mk_directory (fs->root, "deep");
+
+    for (int_32 i = 0; i < DEEP_DIRECTORIES; i++)
+    {
+        char *p = deep_names[i];
+        int_32 l;
+
+        number_name (p, "d", i);
+
+        d = dfs_mk_directory (deep, p);
+
+        for (char c = 'a'; c <= 'e'; c++)
+        {
+            char n[2] = { c, (char)0 };
+
+            d = dfs_mk_directory (d, n);
+        }
+
+        for (int_32 j = 0; j < DEEP_FILES; j++)
+        {
+            number_name (name, "f", j);
+
+            dfs_mk_file (d, name, (char *)0, block, 64, (void *)0,
+                         (void *)0, (void *)0);
+        }
+
+        /* the prefix of the paths of the files in it */
+        number_name (p, "deep/d", i);
+
+        for (l = 0; p[l] != (char)0; l++);
+
+        for (const char *s = "/a/b/c/d/e/f"; *s != (char)0; s++, l++)
+        {
+            p[l] = *s;
+        }
+
+        p[l] = (char)0;
+    }
+}
+
+static int_32 parse_number (const char *s)
+{
+    int_32 n = 0;
+
+    for (; (*s >= '0') && (*s <= '9'); s++)
+    {
+        n = (n * 10) + (*s - '0');
+    }
+
+    return (n < 1) ? 1 : n;
+}
+
+static int same (const char *a, const char *b)
+{
+    while ((*a == *b) && (*a != (char)0))
+    {
+        a++;
+        b++;
+    }
+
+    return *a == *b;
+}
+
+/**\brief Main entry point
+ *
+ * Parses the command line, builds the test tree and runs the benchmarks; all
+ * of them, or the ones named on the command line. -t sets how many seconds to
+ * run each one for, -q how many requests to keep outstanding, and -r has them
+ * use a shared memory ring instead of a loopback. -l names the host file that
+ * read-local and stream-local read, which defaults to the programme itself.
+ * -b limits the loopback to that many bytes per second, to see what
+ * compression does for the effective throughput over a slow link. The memory
+ * measurements only run when named, as memory-10m needs a few gigabytes.
+ *
+ * \returns Zero on success, nonzero otherwise.
+ */
+int cmain()
+{
+    struct io *out = io_open (1);
+    char selected = (char)0;
+
+    out->type = iot_write;
+    stdio     = sx_open_o (out);
+    i_local   = curie_argv[0];
+
+    for (int i = 1; curie_argv[i] != (char *)0; i++)
+    {
+        if (curie_argv[i][0] != '-')
+        {
+            continue;
+        }
+
+        if (curie_argv[i][1] == 'r')
+        {
+            i_ring = (char)1;
+        }
+        else if (curie_argv[i + 1] != (char *)0)
+        {
+            switch (curie_argv[i][1])
+            {
+                case 't':
+                    i_seconds = parse_number (curie_argv[i + 1]);
+                    break;
+                case 'q':
+                    i_depth   = parse_number (curie_argv[i + 1]);
+                    break;
+                case 'l':
+                    i_local   = curie_argv[i + 1];
+                    break;
+                case 'b':
+                    i_link    = parse_number (curie_argv[i + 1]);
+                    break;
+            }
+
+            i++;
+        }
+    }
+
+    /* the streams' read-ahead resumes from the client's multiplexer hook */
+    multiplex_d9c ();
+
+    make_tree ();
+
+    for (int i = 1; curie_argv[i] != (char *)0; i++)
+    {
+        if (curie_argv[i][0] == '-')
+        {
+            if ((curie_argv[i][1] != 'r') && (curie_argv[i + 1] != (char *)0))
+            {
+                i++;
+            }
+
+            continue;
+        }
+
+        selected = (char)1;
+
+        for (struct benchmark *b = benchmarks; b->name != (const char *)0;
+             b++)
+        {
+            if (same (b->name, curie_argv[i]))
+            {
+                run (b);
+            }
+        }
+
+        for (struct measurement *m = measurements;
+             m->name != (const char *)0; m++)
+        {
+            if (same (m->name, curie_argv[i]))
+            {
+                measure (m);
+            }
+        }
+    }
+
+    if (!selected)
+    {
+        for (struct benchmark *b = benchmarks; b->name != (const char *)0;
+             b++)
+        {
+            run (b);
+        }
+    }
+
+    sx_close_io (stdio);
+
+    return 0;
+}
@@ -35,6 +35,8 @@
 #include <curie/sexpr.h>
 #include <curie/multiplex.h>
 #include <curie/memory.h>
+#include <curie/filesystem.h>
+#include <curie/time.h>
 #include <sievert/shell.h>
 #include <duat/9p-client.h>
 
@@ -50,15 +52,25 @@ enum op
     op_ls,    /**< List directory contents (names only) */
     op_lsd,   /**< List directory contents in greater detail */
     op_write, /**< Write to a file; uses the data you enter on stdin */
-    op_create /**< Create a file with the contents of stdin */
+    op_create,/**< Create a file with the contents of stdin */
+    op_batch, /**< Read or stat all the files named on stdin */
+    op_get,   /**< Copy a remote file or tree to the local filesystem */
+    op_put,   /**< Copy a local file or tree to the server */
+    op_export,/**< Write a remote tree to stdout as a tar archive */
+    op_find,  /**< Search a remote tree on the server */
+    op_bench  /**< Measure a server's throughput and latency */
 };
 
 static char *i_path           = (char *)0;
 static char *i_file           = (char *)0;
 static enum op i_op           = op_nop;
+static int_32 i_jobs          = 8;
+static char i_recursive       = (char)0;
 static struct io *stdout      = (struct io *)0;
 static struct io *stdin       = (struct io *)0;
 static struct sexpr_io *stdio = (struct sexpr_io *)0;
+static struct io *stderr      = (struct io *)0;
+static struct sexpr_io *errors = (struct sexpr_io *)0;
 static struct d9r_io *d9io    = (struct d9r_io *)0;
 
 /**\brief Defines sexpr symbol "sym_directory"
@@ -75,85 +87,1694 @@ define_symbol (sym_directory, "directory");
  */
 define_symbol (sym_file,      "file");
 
+/**\brief Defines sexpr symbol "sym_read"
+ *
+ * Used in batch mode, both for read requests and the results thereof.
+ */
+define_symbol (sym_read,      "read");
+
+/**\brief Defines sexpr symbol "sym_stat"
+ *
+ * Used in batch mode, both for stat requests and the results thereof.
+ */
+define_symbol (sym_stat,      "stat");
+
+/**\brief Defines sexpr symbol "sym_error"
+ *
+ * Used in batch mode to report a request that failed.
+ */
+define_symbol (sym_error,     "error");
+
+/**\brief Defines sexpr symbols for transfer statistics
+ *
+ * Used by get and put to label the figures printed once they're done.
+ */
+define_symbol (sym_files,     "files");
+define_symbol (sym_bytes,     "bytes");
+define_symbol (sym_seconds,   "seconds");
+define_symbol (sym_files_per_second, "files-per-second");
+define_symbol (sym_bytes_per_second, "bytes-per-second");
+
+/**\brief Defines sexpr symbols for benchmark results
+ *
+ * Used by bench to label its figures; latencies are in microseconds.
+ */
+define_symbol (sym_requests,  "requests");
+define_symbol (sym_errors,    "errors");
+define_symbol (sym_microseconds, "microseconds");
+define_symbol (sym_requests_per_second, "requests-per-second");
+define_symbol (sym_p50,       "p50");
+define_symbol (sym_p99,       "p99");
+define_symbol (sym_p999,      "p999");
+
 /**\brief Usage summary
  *
  * Echoed to stdout in the print_help() function when no valid operation has
  * been selected.
  */
-#define help "d9c -s <address> (read|write|create|ls|lsd) <path>\n"
+#define help "d9c -s <address> (read|write|create|ls|lsd) <path>\n"\
+             "d9c -s <address> find <path> [<pattern>]\n"\
+             "d9c -s <address> [-j <jobs>] batch\n"\
+             "d9c -s <address> [-j <jobs>] [-r] get <remote> <local>\n"\
+             "d9c -s <address> [-j <jobs>] [-r] put <local> <remote>\n"\
+             "d9c -s <address> [-j <jobs>] export <path>\n"\
+             "d9c -s <address> [-c <connections>] [-q <depth>] [-b <block>]"\
+             " [-t <seconds>] [-z <size>]\n"\
+             "    bench (read|randread|write|randwrite|stat|walk|ls) <path>\n"
+
+static int print_help ()
+{
+    struct io *out = io_open (1);
+    if (out != (struct io *)0)
+    {
+        io_write (out, help, (sizeof (help) -1));
+    }
+
+    return 1;
+}
+
+static void on_read_ls (struct io *io, void *aux)
+{
+    struct d9r_qid qid;
+    int_16 type;
+    int_32 dev, mode, atime, mtime, rp;
+    int_64 length;
+    int rd;
+    char *name, *uid, *gid, *muid, *ex;
+
+    while (((rd = (io->length - io->position)) > 0) &&
+           ((rp = d9r_parse_stat_buffer
+                      ((struct d9r_io *)aux, rd,
+                       (int_8 *)io->buffer + io->position, &type,
+                       &dev, &qid, &mode, &atime, &mtime, &length,
+                       &name, &uid, &gid, &muid, &ex)) > 0))
+    {
+        sexpr l = sx_end_of_list, o;
+
+        if (i_op == op_lsd)
+        {
+            l = cons (make_integer (length), cons (make_integer (mode),
+                      cons (make_integer (atime), cons (make_integer (mtime),
+                            cons (make_string (uid), cons (make_string (gid),
+                                  cons (make_string (muid),
+                                        sx_end_of_list)))))));
+        }
+
+        o = cons (((qid.type & QTDIR) ? sym_directory : sym_file),
+                  cons (make_string(name), l));
+
+        sx_write (stdio, o);
+
+        io->position += rp;
+    }
+}
+
+static void on_read (struct io *io, void *aux)
+{
+    io_write (stdout, io->buffer + io->position, io->length - io->position);
+    io->position = io->length;
+}
+
+static void on_read_stdin (struct io *io, void *aux)
+{
+    struct io *o = (struct io *)aux;
+
+    io_write (o, io->buffer + io->position, io->length - io->position);
+    io->position = io->length;
+}
+
+static void on_flush_stdin (struct d9r_io *io, const char *error, void *aux)
+{
+    if (error != (const char *)0)
+    {
+        sx_write (stdio, make_string (error));
+
+        cexit (3);
+    }
+
+    multiplex_del_io  (stdout);
+    multiplex_del_d9r (d9io);
+}
+
+static void on_close_stdin (struct io *io, void *aux)
+{
+    d9c_flush_9p (d9io, (struct io *)aux, on_flush_stdin, (void *)0);
+}
+
+static void on_close (struct io *io, void *aux)
+{
+    multiplex_del_io  (stdout);
+//    multiplex_del_d9r (d9io);
+    cexit(0);
+}
+
+/**\brief Job type
+ *
+ * What to do with a path named in the batch mode script, or found while
+ * copying a tree.
+ */
+enum job_type
+{
+    jt_read,     /**< Read the file's contents */
+    jt_stat,     /**< Stat the file */
+    jt_get_file, /**< Copy a remote file to a local file */
+    jt_get_dir,  /**< Create a local directory and queue its remote entries */
+    jt_put_file, /**< Copy a local file to a remote file */
+    jt_put_dir,  /**< Create a remote directory and queue its local entries */
+    jt_export_file, /**< Read a remote file into the archive */
+    jt_export_dir   /**< Queue a remote directory's entries for the archive */
+};
+
+/**\brief Job
+ *
+ * One operation in batch mode or in a tree copy, from the time it is queued
+ * until it has completed.
+ */
+struct job
+{
+    enum job_type type;
+    char       *path;
+    int_32      path_size;
+    char       *local;
+    int_32      local_size;
+    int_32      fid;
+    int_64      offset;
+    char       *data;
+    int_32      size;
+    int_32      length;
+    struct io  *file;
+    struct job *next;
+
+    /* exports only */
+    int_64      total;
+    int_64      written;
+    int_32      mode;
+    int_32      mtime;
+    char        started;
+    char        stalled;
+    char        done;
+    struct job *after;
+};
+
+static struct memory_pool job_pool = MEMORY_POOL_INITIALISER (sizeof (struct job));
+
+static struct job *jobs_head = (struct job *)0;
+static struct job *jobs_tail = (struct job *)0;
+static int_32 jobs_active    = 0;
+static char script_done      = (char)0;
+
+static int_64 copy_files     = 0;
+static int_64 copy_bytes     = 0;
+static int_64 copy_start     = 0;
+
+/* archive entries, in the order they're written out */
+static struct job *export_head = (struct job *)0;
+static struct job *export_tail = (struct job *)0;
+
+/**\brief Export read-ahead limit
+ *
+ * How much of a file that isn't being written to the archive yet an export
+ * buffers before it stops reading it.
+ */
+#define EXPORT_BUFFER 0x100000
+
+static void batch_start ();
+
+static int_64 now ()
+{
+    return dt_to_unix (dt_get ());
+}
+
+static char *copy_string (const char *s, int_32 *size)
+{
+    int_32 l = 0;
+    char *r;
+
+    while (s[l]) l++;
+
+    if ((r = aalloc (l + 1)) != (char *)0)
+    {
+        for (int_32 i = 0; i <= l; i++)
+        {
+            r[i] = s[i];
+        }
+
+        *size = l + 1;
+    }
+
+    return r;
+}
+
+/* writes a/b into buffer, which needs to be large enough for both */
+static char *join_path (char *buffer, const char *a, const char *b)
+{
+    char *c = buffer;
+
+    while (*a) *(c++) = *(a++);
+
+    if ((c > buffer) && (c[-1] != '/')) *(c++) = '/';
+
+    while (*b) *(c++) = *(b++);
+
+    *c = (char)0;
+
+    return buffer;
+}
+
+static int_32 path_length (const char *a)
+{
+    int_32 l = 0;
+
+    if (a != (const char *)0) while (a[l]) l++;
+
+    return l;
+}
+
+static struct job *job_new
+        (enum job_type type, const char *path, const char *local)
+{
+    struct job *j = get_pool_mem (&job_pool);
+
+    if (j == (struct job *)0) return (struct job *)0;
+
+    if ((j->path = copy_string (path, &(j->path_size))) == (char *)0)
+    {
+        free_pool_mem (j);
+        return (struct job *)0;
+    }
+
+    j->local = (char *)0;
+
+    if ((local != (const char *)0) &&
+        ((j->local = copy_string (local, &(j->local_size))) == (char *)0))
+    {
+        afree (j->path_size, j->path);
+        free_pool_mem (j);
+        return (struct job *)0;
+    }
+
+    j->type      = type;
+    j->fid       = NO_FID_9P;
+    j->offset    = 0;
+    j->data      = (char *)0;
+    j->size      = 0;
+    j->length    = 0;
+    j->file      = (struct io *)0;
+    j->next      = (struct job *)0;
+    j->total     = 0;
+    j->written   = 0;
+    j->mode      = 0;
+    j->mtime     = 0;
+    j->started   = (char)0;
+    j->stalled   = (char)0;
+    j->done      = (char)0;
+    j->after     = (struct job *)0;
+
+    return j;
+}
+
+static void job_queue (struct job *j)
+{
+    if (jobs_tail != (struct job *)0)
+    {
+        jobs_tail->next = j;
+    }
+    else
+    {
+        jobs_head = j;
+    }
+
+    jobs_tail = j;
+}
+
+static void job_add (enum job_type type, const char *path, const char *local)
+{
+    struct job *j = job_new (type, path, local);
+
+    if (j != (struct job *)0)
+    {
+        job_queue (j);
+    }
+}
+
+static void job_free (struct job *j)
+{
+    if (j->data != (char *)0)
+    {
+        afree (j->size, j->data);
+    }
+
+    if (j->local != (char *)0)
+    {
+        afree (j->local_size, j->local);
+    }
+
+    afree (j->path_size, j->path);
+    free_pool_mem (j);
+}
+
+static void job_finish (struct job *j)
+{
+    job_free (j);
+
+    jobs_active--;
+
+    batch_start ();
+}
+
+static void export_read
+        (struct d9r_io *io, int_32 count, int_8 *data, void *aux);
+static void job_error (struct d9r_io *io, const char *error, void *aux);
+
+static const char tar_zeroes[512];
+
+/* writes a number into a tar header field; base-256 if octal is too short */
+static void tar_number (char *field, int_32 size, int_64 value)
+{
+    if ((size < 12) || (value < (((int_64)1) << (3 * (size - 1)))))
+    {
+        field[size - 1] = (char)0;
+
+        for (int_32 i = size - 2; i >= 0; i--)
+        {
+            field[i] = (char)('0' + (value & 7));
+            value >>= 3;
+        }
+    }
+    else
+    {
+        for (int_32 i = size - 1; i > 0; i--)
+        {
+            field[i] = (char)(value & 0xff);
+            value >>= 8;
+        }
+
+        field[0] = (char)0x80;
+    }
+}
+
+static void tar_header
+        (const char *name, char type, int_32 mode, int_32 mtime, int_64 size)
+{
+    char h[512];
+    int_32 n = path_length (name), p = 0, sum = 0;
+
+    for (int_32 i = 0; i < 512; i++)
+    {
+        h[i] = (char)0;
+    }
+
+    if (n > 100)
+    {
+        /* split the name into ustar's prefix and name fields if possible */
+        for (int_32 i = n - 2; (i > 0) && (p == 0); i--)
+        {
+            if ((name[i] == '/') && (i <= 155) && ((n - i - 1) <= 100))
+            {
+                p = i;
+            }
+        }
+
+        /* ... or precede the entry with a GNU long name entry if not */
+        if (p == 0)
+        {
+            tar_header ("././@LongLink", 'L', 0, 0, n + 1);
+            io_write (stdout, name, n + 1);
+            io_write (stdout, tar_zeroes, 511 - (n % 512));
+
+            n = 100;
+        }
+        else
+        {
+            for (int_32 i = 0; i < p; i++)
+            {
+                h[345 + i] = name[i];
+            }
+
+            name += p + 1;
+            n    -= p + 1;
+        }
+    }
+
+    for (int_32 i = 0; i < n; i++)
+    {
+        h[i] = name[i];
+    }
+
+    tar_number (h + 100, 8,  mode & 07777);
+    tar_number (h + 108, 8,  0);
+    tar_number (h + 116, 8,  0);
+    tar_number (h + 124, 12, size);
+    tar_number (h + 136, 12, mtime);
+
+    h[156] = type;
+    h[257] = 'u'; h[258] = 's'; h[259] = 't'; h[260] = 'a'; h[261] = 'r';
+    h[263] = '0'; h[264] = '0';
+
+    for (int_32 i = 148; i < 156; i++)
+    {
+        h[i] = ' ';
+    }
+
+    for (int_32 i = 0; i < 512; i++)
+    {
+        sum += (unsigned char)h[i];
+    }
+
+    tar_number (h + 148, 7, sum);
+
+    io_write (stdout, h, 512);
+}
+
+/* writes file contents to the archive, up to the size given in the header */
+static void export_put (struct job *j, const char *data, int_64 count)
+{
+    if ((j->written + count) > j->total)
+    {
+        count = j->total - j->written;
+    }
+
+    if (count > 0)
+    {
+        io_write (stdout, data, (unsigned int)count);
+
+        j->written += count;
+        copy_bytes += count;
+    }
+}
+
+static void export_begin (struct job *j)
+{
+    int_32 r = path_length (i_path), n = path_length (j->path);
+    const char *name = j->path + r;
+    char d[n + 2];
+
+    while (*name == '/') name++;
+
+    j->started = (char)1;
+
+    if (j->type == jt_export_dir)
+    {
+        tar_header (join_path (d, name, ""), '5', j->mode, j->mtime, 0);
+    }
+    else
+    {
+        tar_header (name, '0', j->mode, j->mtime, j->total);
+    }
+
+    if (j->data != (char *)0)
+    {
+        export_put (j, j->data, j->length);
+
+        afree (j->size, j->data);
+
+        j->data   = (char *)0;
+        j->size   = 0;
+        j->length = 0;
+    }
+
+    if (j->stalled)
+    {
+        j->stalled = (char)0;
+
+        d9c_read (d9io, j->fid, j->offset, 0x2000, export_read, job_error,
+                  (void *)j);
+    }
+}
+
+/* writes out all entries at the head of the archive that are complete */
+static void export_flush ()
+{
+    while (export_head != (struct job *)0)
+    {
+        struct job *j = export_head;
+
+        if (!j->started)
+        {
+            export_begin (j);
+        }
+
+        if (!j->done)
+        {
+            return;
+        }
+
+        /* files that came up short are padded to the size in the header */
+        while (j->written < j->total)
+        {
+            int_64 c = j->total - j->written;
+
+            if (c > 512) c = 512;
+
+            io_write (stdout, tar_zeroes, (unsigned int)c);
+            j->written += c;
+        }
+
+        if ((j->total % 512) != 0)
+        {
+            io_write (stdout, tar_zeroes, 512 - (j->total % 512));
+        }
+
+        if (j->type == jt_export_file)
+        {
+            copy_files++;
+        }
+
+        export_head = j->after;
+
+        if (export_head == (struct job *)0)
+        {
+            export_tail = (struct job *)0;
+        }
+
+        job_free (j);
+    }
+}
+
+static void export_push (struct job *j)
+{
+    if (export_tail != (struct job *)0)
+    {
+        export_tail->after = j;
+    }
+    else
+    {
+        export_head = j;
+    }
+
+    export_tail = j;
+
+    export_flush ();
+}
+
+static void export_done (struct job *j)
+{
+    j->done = (char)1;
+
+    jobs_active--;
+
+    export_flush ();
+    batch_start ();
+}
+
+static void job_error (struct d9r_io *io, const char *error, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    if (j->fid != NO_FID_9P)
+    {
+        d9c_clunk (io, j->fid, (void *)0, (void *)0, (void *)0);
+
+        j->fid = NO_FID_9P;
+    }
+
+    if (j->file != (struct io *)0)
+    {
+        io_close (j->file);
+    }
+
+    /* exports write the archive to stdout, so errors go to stderr */
+    sx_write (((i_op == op_export) ? errors : stdio),
+              cons (sym_error, cons (make_string (j->path),
+                    cons (make_string (error), sx_end_of_list))));
+
+    /* a file that can't be read still has its place in the archive */
+    if (j->type == jt_export_file)
+    {
+        export_done (j);
+        return;
+    }
+
+    job_finish (j);
+}
+
+static void job_stat
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    sx_write (stdio, cons (sym_stat, cons (make_string (j->path),
+                cons (((qid.type & QTDIR) ? sym_directory : sym_file),
+                cons (make_integer (length), cons (make_integer (mode),
+                cons (make_integer (atime), cons (make_integer (mtime),
+                cons (make_string (uid), cons (make_string (gid),
+                cons (make_string (muid), sx_end_of_list)))))))))));
+
+    job_finish (j);
+}
+
+/* buffers data that can't be written out yet; returns 0 if out of memory */
+static int job_append (struct job *j, int_8 *data, int_32 count)
+{
+    /* keep one byte spare for the terminator */
+    if ((j->length + count) >= j->size)
+    {
+        int_32 size = (j->size == 0) ? 0x1000 : j->size;
+        char *n;
+
+        while ((j->length + count) >= size) size *= 2;
+
+        if ((n = aalloc (size)) == (char *)0)
+        {
+            return 0;
+        }
+
+        for (int_32 i = 0; i < j->length; i++)
+        {
+            n[i] = j->data[i];
+        }
+
+        if (j->data != (char *)0)
+        {
+            afree (j->size, j->data);
+        }
+
+        j->data = n;
+        j->size = size;
+    }
+
+    for (int_32 i = 0; i < count; i++)
+    {
+        j->data[j->length + i] = (char)data[i];
+    }
+
+    j->length += count;
+
+    return 1;
+}
+
+static void job_read (struct d9r_io *io, int_32 count, int_8 *data, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    if (count == 0)
+    {
+        d9c_clunk (io, j->fid, (void *)0, (void *)0, (void *)0);
+
+        if (j->file != (struct io *)0)
+        {
+            io_close (j->file);
+            copy_files++;
+        }
+        else
+        {
+            if (j->data != (char *)0)
+            {
+                j->data[j->length] = (char)0;
+            }
+
+            sx_write (stdio, cons (sym_read, cons (make_string (j->path),
+                        cons (make_string ((j->data != (char *)0) ? j->data
+                                                                  : ""),
+                              sx_end_of_list))));
+        }
+
+        job_finish (j);
+        return;
+    }
+
+    j->offset += count;
+
+    /* tree copies write the data out as it arrives */
+    if (j->file != (struct io *)0)
+    {
+        io_write (j->file, (const char *)data, count);
+        copy_bytes += count;
+
+        d9c_read (io, j->fid, j->offset, 0x2000, job_read, job_error, aux);
+        return;
+    }
+
+    if (!job_append (j, data, count))
+    {
+        job_error (io, "Out of memory.", aux);
+        return;
+    }
+
+    d9c_read (io, j->fid, j->offset, 0x2000, job_read, job_error, aux);
+}
+
+/* reads ahead of the archive, up to EXPORT_BUFFER bytes per file */
+static void export_read
+        (struct d9r_io *io, int_32 count, int_8 *data, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    if (count > 0)
+    {
+        j->offset += count;
+
+        if (j->started)
+        {
+            export_put (j, (const char *)data, count);
+        }
+        else if (!job_append (j, data, count))
+        {
+            job_error (io, "Out of memory.", aux);
+            return;
+        }
+    }
+
+    if ((count == 0) || (j->offset >= j->total))
+    {
+        d9c_clunk (io, j->fid, (void *)0, (void *)0, (void *)0);
+
+        j->fid = NO_FID_9P;
+
+        export_done (j);
+        return;
+    }
+
+    if (!j->started && (j->length >= EXPORT_BUFFER))
+    {
+        j->stalled = (char)1;
+        return;
+    }
+
+    d9c_read (io, j->fid, j->offset, 0x2000, export_read, job_error, aux);
+}
+
+/* adds an entry to the archive, and queues reading or listing it */
+static void export_entry
+        (const char *path, struct d9r_qid qid, int_32 mode, int_32 mtime,
+         int_64 length)
+{
+    struct job *j = job_new (((qid.type & QTDIR) ? jt_export_dir
+                                                 : jt_export_file),
+                             path, (const char *)0);
+
+    if (j == (struct job *)0) return;
+
+    j->mode  = mode;
+    j->mtime = mtime;
+
+    if (qid.type & QTDIR)
+    {
+        j->done = (char)1;
+
+        job_add (jt_export_dir, path, (const char *)0);
+    }
+    else
+    {
+        j->total = length;
+
+        if (length > 0)
+        {
+            job_queue (j);
+        }
+        else
+        {
+            j->done = (char)1;
+        }
+    }
+
+    export_push (j);
+}
+
+/* queues a job for each entry of a remote directory */
+static void job_entry
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
+{
+    struct job *j = (struct job *)aux;
+    int_32 n = path_length (name);
+
+    if ((name[0] == '.') &&
+        ((name[1] == (char)0) || ((name[1] == '.') && (name[2] == (char)0))))
+    {
+        return;
+    }
+
+    char r[path_length (j->path) + n + 2];
+    char l[path_length (j->local) + n + 2];
+
+    if (j->type == jt_export_dir)
+    {
+        export_entry (join_path (r, j->path, name), qid, mode, mtime, length);
+        return;
+    }
+
+    job_add (((qid.type & QTDIR) ? jt_get_dir : jt_get_file),
+             join_path (r, j->path, name), join_path (l, j->local, name));
+}
+
+static void job_listed (struct d9r_io *io, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    d9c_clunk (io, j->fid, (void *)0, (void *)0, (void *)0);
+
+    job_finish (j);
+}
+
+static void job_opened
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    if (j->type == jt_export_file)
+    {
+        d9c_read (io, j->fid, 0, 0x2000, export_read, job_error, aux);
+    }
+    else if ((j->type == jt_get_dir) || (j->type == jt_export_dir))
+    {
+        d9c_readdir (io, j->fid, job_entry, job_listed, job_error, aux);
+    }
+    else
+    {
+        d9c_read (io, j->fid, 0, 0x2000, job_read, job_error, aux);
+    }
+}
+
+static void job_walked
+        (struct d9r_io *io, int_32 fid, struct d9r_qid qid, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    j->fid = fid;
+
+    d9c_open (io, fid, P9_OREAD, job_opened, job_error, aux);
+}
+
+/* local files; this is all tree copies need from the local filesystem */
+
+static void local_mkdir (const char *path)
+{
+    mkdir_p (make_string (path));
+}
+
+/* copies path to buffer with the characters that mean something in curie's
+ * regular expressions escaped, so they only match themselves; buffer needs
+ * to have room for twice the path */
+static char *regex_quote (char *buffer, const char *path)
+{
+    char *c = buffer;
+
+    for (; *path; path++)
+    {
+        switch (*path)
+        {
+            case '.': case '*': case '+': case '?': case '|': case '^':
+            case '$': case '(': case ')': case '[': case ']': case '{':
+            case '}': case '\\':
+                *(c++) = '\\';
+                /* and then the character itself */
+            default:
+                *(c++) = *path;
+        }
+    }
+
+    *c = (char)0;
+
+    return buffer;
+}
+
+/* queues put jobs for each entry of a local directory; read_directory()
+ * takes a regular expression, so the directory's name is quoted first */
+static void local_list (struct job *j)
+{
+    int_32 n = path_length (j->local);
+    char quoted[(n * 2) + 1];
+    char rx[(n * 2) + 8];
+    sexpr l;
+
+    join_path (rx, regex_quote (quoted, j->local), "[^/]+");
+
+    for (l = read_directory (rx); consp (l); l = cdr (l))
+    {
+        sexpr e = car (l);
+        const char *local = sx_string (e), *name = local;
+
+        for (const char *c = local; *c; c++)
+        {
+            if (*c == '/') name = c + 1;
+        }
+
+        char r[path_length (j->path) + path_length (name) + 2];
+
+        job_add ((truep (filep (e)) ? jt_put_file : jt_put_dir),
+                 join_path (r, j->path, name), local);
+    }
+}
+
+/* splits a remote path into a copy of its parent and its last element */
+static const char *remote_parent (const char *path, char *parent)
+{
+    const char *name = path;
+    int_32 i, s = 0;
+
+    for (i = 0; path[i]; i++)
+    {
+        parent[i] = path[i];
+
+        if (path[i] == '/')
+        {
+            name = path + i + 1;
+            s    = i;
+        }
+    }
+
+    parent[s] = (char)0;
+
+    return name;
+}
+
+static void put_created
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    d9c_clunk (io, j->fid, (void *)0, (void *)0, (void *)0);
+
+    local_list (j);
+    job_finish (j);
+}
+
+/* the directory may well exist already, so carry on regardless */
+static void put_exists (struct d9r_io *io, const char *error, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    d9c_clunk (io, j->fid, (void *)0, (void *)0, (void *)0);
+
+    local_list (j);
+    job_finish (j);
+}
+
+static void put_walked
+        (struct d9r_io *io, int_32 fid, struct d9r_qid qid, void *aux)
+{
+    struct job *j = (struct job *)aux;
+    char parent[path_length (j->path) + 1];
+
+    j->fid = fid;
+
+    d9c_create (io, fid, remote_parent (j->path, parent), DMDIR | 0755,
+                P9_OREAD, put_created, put_exists, aux);
+}
+
+static void put_on_read (struct io *in, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    io_write (j->file, in->buffer + in->position, in->length - in->position);
+    copy_bytes += in->length - in->position;
+    in->position = in->length;
+}
+
+static void put_flushed (struct d9r_io *io, const char *error, void *aux)
+{
+    struct job *j = (struct job *)aux;
+    struct io *file = j->file;
+
+    j->file = (struct io *)0;
+
+    /* closing the stream clunks its fid */
+    multiplex_del_io (file);
+
+    if (error != (const char *)0)
+    {
+        job_error (io, error, aux);
+        return;
+    }
+
+    copy_files++;
+    job_finish (j);
+}
+
+static void put_on_close (struct io *in, void *aux)
+{
+    struct job *j = (struct job *)aux;
+
+    d9c_flush_9p (d9io, j->file, put_flushed, aux);
+}
+
+static void put_file (struct job *j)
+{
+    char parent[path_length (j->path) + 1];
+    const char *name = remote_parent (j->path, parent);
+    struct io *in = io_open_read (j->local);
+
+    if (in == (struct io *)0)
+    {
+        job_error (d9io, "Could not open local file.", (void *)j);
+        return;
+    }
+
+    if ((j->file = io_open_create_9p (d9io, parent, name, 0644))
+        == (struct io *)0)
+    {
+        io_close (in);
+        job_error (d9io, "Out of memory.", (void *)j);
+        return;
+    }
+
+    multiplex_add_io (in, put_on_read, put_on_close, (void *)j);
+}
+
+static void put_directory (struct job *j)
+{
+    char parent[path_length (j->path) + 1];
+
+    remote_parent (j->path, parent);
+
+    d9c_walk (d9io, NO_FID_9P, parent, put_walked, job_error, (void *)j);
+}
+
+/* starts queued jobs while there's room, and quits once all are done */
+static void batch_start ()
+{
+    while ((jobs_active < i_jobs) && (jobs_head != (struct job *)0))
+    {
+        struct job *j = jobs_head;
+
+        jobs_head = j->next;
+
+        if (jobs_head == (struct job *)0)
+        {
+            jobs_tail = (struct job *)0;
+        }
+
+        jobs_active++;
+
+        switch (j->type)
+        {
+            case jt_get_dir:
+                local_mkdir (j->local);
+                d9c_walk (d9io, NO_FID_9P, j->path, job_walked, job_error,
+                          (void *)j);
+                break;
+            case jt_get_file:
+                if ((j->file = io_open_create (j->local, 0644))
+                    == (struct io *)0)
+                {
+                    job_error (d9io, "Could not create local file.",
+                               (void *)j);
+                    break;
+                }
+                /* fall through */
+            case jt_read:
+            case jt_export_file:
+            case jt_export_dir:
+                d9c_walk (d9io, NO_FID_9P, j->path, job_walked, job_error,
+                          (void *)j);
+                break;
+            case jt_stat:
+                d9c_stat (d9io, j->path, job_stat, job_error, (void *)j);
+                break;
+            case jt_put_file:
+                put_file (j);
+                break;
+            case jt_put_dir:
+                put_directory (j);
+                break;
+        }
+    }
+
+    if (script_done && (jobs_active == 0) && (jobs_head == (struct job *)0))
+    {
+        if (i_op == op_export)
+        {
+            /* end of archive */
+            io_write (stdout, tar_zeroes, 512);
+            io_write (stdout, tar_zeroes, 512);
+        }
+
+        if ((i_op == op_get) || (i_op == op_put))
+        {
+            int_64 seconds = now () - copy_start;
+
+            if (seconds < 1) seconds = 1;
+
+            sx_write (stdio, cons (sym_files, cons (make_integer (copy_files),
+                        cons (sym_bytes, cons (make_integer (copy_bytes),
+                        cons (sym_seconds, cons (make_integer (seconds),
+                        cons (sym_files_per_second,
+                              cons (make_integer (copy_files / seconds),
+                        cons (sym_bytes_per_second,
+                              cons (make_integer (copy_bytes / seconds),
+                              sx_end_of_list)))))))))));
+        }
+
+        multiplex_del_io (stdout);
+        cexit (0);
+    }
+}
+
+/* plain paths and (read "path") fetch files, (stat "path") stats them */
+static void on_script (sexpr sx, struct sexpr_io *io, void *aux)
+{
+    if (eofp (sx))
+    {
+        script_done = (char)1;
+    }
+    else if (stringp (sx))
+    {
+        job_add (jt_read, sx_string (sx), (const char *)0);
+    }
+    else if (symbolp (sx))
+    {
+        job_add (jt_read, sx_symbol (sx), (const char *)0);
+    }
+    else if (consp (sx) && consp (cdr (sx)))
+    {
+        sexpr a = car (sx), p = car (cdr (sx));
+        const char *path = stringp (p) ? sx_string (p) :
+                           symbolp (p) ? sx_symbol (p) : (const char *)0;
+
+        if (path != (const char *)0)
+        {
+            if (truep (equalp (a, sym_stat)))
+            {
+                job_add (jt_stat, path, (const char *)0);
+            }
+            else if (truep (equalp (a, sym_read)))
+            {
+                job_add (jt_read, path, (const char *)0);
+            }
+        }
+    }
+
+    batch_start ();
+}
+
+/**\brief Benchmark workload
+ *
+ * What each request does in bench mode.
+ */
+enum bench_workload
+{
+    bw_none,      /**< No workload selected */
+    bw_read,      /**< Sequential reads of one file */
+    bw_randread,  /**< Block-aligned reads of one file at random offsets */
+    bw_write,     /**< Sequential writes to one file */
+    bw_randwrite, /**< Block-aligned writes to one file at random offsets */
+    bw_stat,      /**< Stat one fid over and over */
+    bw_walk,      /**< Walk to a path from the root, then clunk the fid */
+    bw_ls         /**< Walk to, open and list a directory, then clunk it */
+};
+
+/**\brief Benchmark connection
+ *
+ * One of the connections opened in bench mode, along with the fid the
+ * workload uses, if any.
+ */
+struct bench_connection
+{
+    struct d9r_io *io;
+    int_32 fid;
+    int_32 block;
+    int_64 offset;
+    int_64 length;
+};
+
+/**\brief Benchmark request
+ *
+ * One of the requests kept outstanding on a connection. Each is reissued as
+ * soon as it completes, until the run is over.
+ */
+struct bench_request
+{
+    struct bench_connection *connection;
+    int_64 start;
+    int_32 fid;
+};
+
+/**\brief Latency histogram size
+ *
+ * Latencies are sorted into buckets of 16 per power of two, so percentiles
+ * are accurate to about 6%.
+ */
+#define BENCH_BUCKETS (64 * 16)
+
+static enum bench_workload i_workload = bw_none;
+static int_32 i_connections = 1;
+static int_32 i_depth       = 1;
+static int_32 i_block       = 0x2000;
+static int_32 i_seconds     = 10;
+static int_64 i_size        = 0x4000000;
+
+static int_32 bench_ready_count  = 0;
+static int_32 bench_outstanding  = 0;
+static char   bench_stopping     = (char)0;
+static int_64 bench_start_second = 0;
+static int_64 bench_start_units  = 0;
+static int_64 bench_last_units   = 0;
+static int_64 bench_requests     = 0;
+static int_64 bench_errors       = 0;
+static int_64 bench_bytes        = 0;
+static int_64 bench_random       = 0x2545f4914f6cdd1d;
+static int_8 *bench_buffer       = (int_8 *)0;
+static int_64 bench_histogram[BENCH_BUCKETS];
+
+/* curie only converts to unix time in full seconds, so latencies are taken
+ * from the time of day in curie's own units, which are calibrated against
+ * second boundaries at both ends of the run; runs that span midnight will
+ * come out wrong */
+static int_64 bench_clock ()
+{
+    return (int_64)dt_get ().time;
+}
+
+/* waits for the start of the next second, and returns it */
+static int_64 bench_tick (int_64 *units)
+{
+    int_64 s = now (), n;
+
+    while ((n = now ()) == s);
+
+    *units = bench_clock ();
+
+    return n;
+}
+
+static int_64 bench_microseconds (int_64 units, int_64 per_second)
+{
+    return ((units / per_second) * 1000000) +
+           (((units % per_second) * 1000000) / per_second);
+}
+
+static int_32 bench_bucket (int_64 v)
+{
+    int_32 m = 0;
+
+    while ((v >> m) >= 32) m++;
+
+    return (m * 16) + (int_32)(v >> m);
+}
+
+/* returns the upper bound of the bucket that holds the given permille */
+static int_64 bench_percentile (int_32 permille)
+{
+    int_64 target = ((bench_requests * permille) + 999) / 1000, seen = 0;
+
+    for (int_32 b = 0; b < BENCH_BUCKETS; b++)
+    {
+        seen += bench_histogram[b];
+
+        if ((seen >= target) && (seen > 0))
+        {
+            int_32 m = (b < 32) ? 0 : ((b / 16) - 1);
+
+            return (((int_64)(b - (m * 16) + 1)) << m) - 1;
+        }
+    }
+
+    return 0;
+}
+
+static void bench_report ()
+{
+    int_64 units, second = bench_tick (&units), per_second, elapsed;
+
+    per_second = (units - bench_start_units) / (second - bench_start_second);
+
+    if (per_second < 1) per_second = 1;
+
+    elapsed = bench_microseconds (bench_last_units - bench_start_units,
+                                  per_second);
+
+    if (elapsed < 1) elapsed = 1;
+
+    sx_write (stdio, cons (sym_requests, cons (make_integer (bench_requests),
+        cons (sym_errors, cons (make_integer (bench_errors),
+        cons (sym_bytes, cons (make_integer (bench_bytes),
+        cons (sym_microseconds, cons (make_integer (elapsed),
+        cons (sym_requests_per_second,
+              cons (make_integer ((bench_requests * 1000000) / elapsed),
+        cons (sym_bytes_per_second,
+              cons (make_integer ((bench_bytes / elapsed) * 1000000 +
+                                  ((bench_bytes % elapsed) * 1000000) /
+                                  elapsed),
+        cons (sym_p50, cons (make_integer (bench_microseconds
+                  (bench_percentile (500), per_second)),
+        cons (sym_p99, cons (make_integer (bench_microseconds
+                  (bench_percentile (990), per_second)),
+        cons (sym_p999, cons (make_integer (bench_microseconds
+                  (bench_percentile (999), per_second)),
+              sx_end_of_list)))))))))))))))))));
+
+    multiplex_del_io (stdout);
+    cexit (0);
+}
+
+static void bench_issue (struct bench_request *r);
+
+static void bench_done (struct bench_request *r, int_32 bytes)
+{
+    int_64 t = bench_clock ();
+
+    /* the time of day wraps at midnight */
+    if (t >= r->start)
+    {
+        bench_histogram[bench_bucket (t - r->start)]++;
+    }
+
+    bench_requests++;
+    bench_bytes += bytes;
+
+    bench_issue (r);
+}
+
+static void bench_error (struct d9r_io *io, const char *error, void *aux)
+{
+    struct bench_request *r = (struct bench_request *)aux;
+
+    if (r->fid != NO_FID_9P)
+    {
+        d9c_clunk (io, r->fid, (void *)0, (void *)0, (void *)0);
+    }
+
+    /* one is enough to tell what's wrong */
+    if (bench_errors == 0)
+    {
+        sx_write (errors, cons (sym_error, cons (make_string (i_path),
+                              cons (make_string (error), sx_end_of_list))));
+    }
+
+    bench_errors++;
+
+    bench_issue (r);
+}
+
+static void bench_read (struct d9r_io *io, int_32 count, int_8 *data, void *aux)
+{
+    bench_done ((struct bench_request *)aux, count);
+}
 
-static int print_help ()
+static void bench_written (struct d9r_io *io, int_32 count, void *aux)
 {
-    struct io *out = io_open (1);
-    if (out != (struct io *)0)
+    bench_done ((struct bench_request *)aux, count);
+}
+
+static void bench_stat
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
+{
+    bench_done ((struct bench_request *)aux, 0);
+}
+
+static void bench_walked
+        (struct d9r_io *io, int_32 fid, struct d9r_qid qid, void *aux)
+{
+    d9c_clunk (io, fid, (void *)0, (void *)0, (void *)0);
+
+    bench_done ((struct bench_request *)aux, 0);
+}
+
+static void bench_entry
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
+{
+}
+
+static void bench_listed (struct d9r_io *io, void *aux)
+{
+    struct bench_request *r = (struct bench_request *)aux;
+
+    d9c_clunk (io, r->fid, (void *)0, (void *)0, (void *)0);
+
+    bench_done (r, 0);
+}
+
+static void bench_ls_opened
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
+{
+    struct bench_request *r = (struct bench_request *)aux;
+
+    d9c_readdir (io, r->fid, bench_entry, bench_listed, bench_error, aux);
+}
+
+static void bench_ls_walked
+        (struct d9r_io *io, int_32 fid, struct d9r_qid qid, void *aux)
+{
+    struct bench_request *r = (struct bench_request *)aux;
+
+    r->fid = fid;
+
+    d9c_open (io, fid, P9_OREAD, bench_ls_opened, bench_error, aux);
+}
+
+/* picks the offset of the next read or write */
+static int_64 bench_offset (struct bench_connection *c, int_64 length)
+{
+    int_64 o, blocks = length / c->block;
+
+    if (blocks < 1) blocks = 1;
+
+    if ((i_workload == bw_randread) || (i_workload == bw_randwrite))
     {
-        io_write (out, help, (sizeof (help) -1));
+        /* xorshift */
+        bench_random ^= bench_random << 13;
+        bench_random ^= bench_random >> 7;
+        bench_random ^= bench_random << 17;
+
+        return (int_64)(((unsigned long long)bench_random) % blocks) *
+               c->block;
     }
 
-    return 1;
+    o = c->offset;
+
+    c->offset += c->block;
+
+    if (c->offset >= (blocks * c->block))
+    {
+        c->offset = 0;
+    }
+
+    return o;
 }
 
-static void on_read_ls (struct io *io, void *aux)
+static void bench_issue (struct bench_request *r)
 {
-    struct d9r_qid qid;
-    int_16 type;
-    int_32 dev, mode, atime, mtime, rp;
-    int_64 length;
-    int rd;
-    char *name, *uid, *gid, *muid, *ex;
+    struct bench_connection *c = r->connection;
+    struct d9r_io *io = c->io;
 
-    while (((rd = (io->length - io->position)) > 0) &&
-           ((rp = d9r_parse_stat_buffer
-                      ((struct d9r_io *)aux, rd,
-                       (int_8 *)io->buffer + io->position, &type,
-                       &dev, &qid, &mode, &atime, &mtime, &length,
-                       &name, &uid, &gid, &muid, &ex)) > 0))
+    if (!bench_stopping && ((now () - bench_start_second) >= i_seconds))
     {
-        sexpr l = sx_end_of_list, o;
+        bench_stopping = (char)1;
+    }
 
-        if (i_op == op_lsd)
+    if (bench_stopping)
+    {
+        bench_outstanding--;
+
+        if (bench_outstanding == 0)
         {
-            l = cons (make_integer (length), cons (make_integer (mode),
-                      cons (make_integer (atime), cons (make_integer (mtime),
-                            cons (make_string (uid), cons (make_string (gid),
-                                  cons (make_string (muid),
-                                        sx_end_of_list)))))));
+            bench_last_units = bench_clock ();
+            bench_report ();
         }
 
-        o = cons (((qid.type & QTDIR) ? sym_directory : sym_file),
-                  cons (make_string(name), l));
+        return;
+    }
 
-        sx_write (stdio, o);
+    r->fid   = NO_FID_9P;
+    r->start = bench_clock ();
 
-        io->position += rp;
+    switch (i_workload)
+    {
+        case bw_read:
+        case bw_randread:
+            d9c_read (io, c->fid, bench_offset (c, c->length), c->block,
+                      bench_read, bench_error, (void *)r);
+            break;
+        case bw_write:
+        case bw_randwrite:
+            d9c_write (io, c->fid, bench_offset (c, i_size), c->block,
+                       bench_buffer, bench_written, bench_error, (void *)r);
+            break;
+        case bw_stat:
+            d9c_stat_fid (io, c->fid, bench_stat, bench_error, (void *)r);
+            break;
+        case bw_walk:
+            d9c_walk (io, NO_FID_9P, i_path, bench_walked, bench_error,
+                      (void *)r);
+            break;
+        case bw_ls:
+            d9c_walk (io, NO_FID_9P, i_path, bench_ls_walked, bench_error,
+                      (void *)r);
+            break;
+        case bw_none:
+            break;
     }
 }
 
-static void on_read (struct io *io, void *aux)
+/* starts the run once all connections are set up */
+static void bench_ready (struct bench_connection *c)
 {
-    io_write (stdout, io->buffer + io->position, io->length - io->position);
-    io->position = io->length;
+    static struct bench_connection **connections
+        = (struct bench_connection **)0;
+
+    if (connections == (struct bench_connection **)0)
+    {
+        connections = aalloc (sizeof (struct bench_connection *) *
+                              i_connections);
+    }
+
+    connections[bench_ready_count] = c;
+
+    bench_ready_count++;
+
+    if (bench_ready_count < i_connections)
+    {
+        return;
+    }
+
+    bench_start_second = bench_tick (&bench_start_units);
+
+    for (int_32 i = 0; i < i_connections; i++)
+    {
+        struct bench_request *r = aalloc (sizeof (struct bench_request) *
+                                          i_depth);
+
+        for (int_32 j = 0; j < i_depth; j++)
+        {
+            r[j].connection = connections[i];
+            bench_outstanding++;
+        }
+
+        for (int_32 j = 0; j < i_depth; j++)
+        {
+            bench_issue (r + j);
+        }
+    }
 }
 
-static void on_read_stdin (struct io *io, void *aux)
+static void bench_setup_error
+        (struct d9r_io *io, const char *error, void *aux)
 {
-    struct io *o = (struct io *)aux;
+    sx_write (stdio, cons (sym_error, cons (make_string (i_path),
+                           cons (make_string (error), sx_end_of_list))));
 
-    io_write (o, io->buffer + io->position, io->length - io->position);
-    io->position = io->length;
+    cexit (3);
 }
 
-static void on_close_stdin (struct io *io, void *aux)
+static void bench_setup_stat
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
 {
-    multiplex_del_io  (stdout);
-    multiplex_del_d9r (d9io);
+    struct bench_connection *c = (struct bench_connection *)aux;
+
+    if (length == 0)
+    {
+        bench_setup_error (io, "Nothing to read.", aux);
+        return;
+    }
+
+    c->length = length;
+
+    bench_ready (c);
 }
 
-static void on_close (struct io *io, void *aux)
+static void bench_setup_opened
+        (struct d9r_io *io, struct d9r_qid qid, int_32 iounit, void *aux)
 {
-    multiplex_del_io  (stdout);
-//    multiplex_del_d9r (d9io);
-    cexit(0);
+    struct bench_connection *c = (struct bench_connection *)aux;
+
+    if ((iounit > 0) && (c->block > iounit))
+    {
+        c->block = iounit;
+    }
+
+    if ((i_workload == bw_read) || (i_workload == bw_randread))
+    {
+        d9c_stat_fid (io, c->fid, bench_setup_stat, bench_setup_error, aux);
+    }
+    else
+    {
+        bench_ready (c);
+    }
+}
+
+static void bench_setup_walked
+        (struct d9r_io *io, int_32 fid, struct d9r_qid qid, void *aux)
+{
+    struct bench_connection *c = (struct bench_connection *)aux;
+
+    c->fid = fid;
+
+    switch (i_workload)
+    {
+        case bw_read:
+        case bw_randread:
+            d9c_open (io, fid, P9_OREAD, bench_setup_opened,
+                      bench_setup_error, aux);
+            break;
+        case bw_write:
+        case bw_randwrite:
+            d9c_open (io, fid, P9_OWRITE, bench_setup_opened,
+                      bench_setup_error, aux);
+            break;
+        default:
+            bench_ready (c);
+    }
+}
+
+static void bench_connected (struct d9r_io *io, void *aux)
+{
+    struct bench_connection *c = (struct bench_connection *)aux;
+
+    c->io     = io;
+    c->fid    = NO_FID_9P;
+    c->offset = 0;
+    c->length = 0;
+    c->block  = i_block;
+
+    /* leave room for the Tread/Rwrite header */
+    if (c->block > (io->max_message_size - 24))
+    {
+        c->block = io->max_message_size - 24;
+    }
+
+    if ((i_workload == bw_walk) || (i_workload == bw_ls))
+    {
+        bench_ready (c);
+    }
+    else
+    {
+        d9c_walk (io, NO_FID_9P, i_path, bench_setup_walked,
+                  bench_setup_error, (void *)c);
+    }
+}
+
+static void find_entry
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
+{
+    sx_write (stdio, cons (((qid.type & QTDIR) ? sym_directory : sym_file),
+                cons (make_string (name),
+                cons (make_integer (length), cons (make_integer (mode),
+                cons (make_integer (atime), cons (make_integer (mtime),
+                cons (make_string (uid), cons (make_string (gid),
+                cons (make_string (muid), sx_end_of_list))))))))));
+}
+
+static void find_done (struct d9r_io *io, void *aux)
+{
+    multiplex_del_io (stdout);
+    cexit (0);
+}
+
+static void find_error (struct d9r_io *io, const char *error, void *aux)
+{
+    sx_write (stdio, make_string (error));
+
+    cexit (3);
+}
+
+static void find_walked
+        (struct d9r_io *io, int_32 fid, struct d9r_qid qid, void *aux)
+{
+    d9c_find (io, fid, ((i_file == (char *)0) ? "" : i_file), 0, 0,
+              ~(int_64)0, 0, ~(int_32)0, find_entry, find_done, find_error,
+              (void *)0);
 }
 
 static void on_connect (struct d9r_io *io, void *aux)
@@ -181,6 +1802,33 @@ static void on_connect (struct d9r_io *io, void *aux)
             n = io_open_create_9p (io, i_path, i_file, 0666);
             multiplex_add_io (stdin, on_read_stdin, on_close_stdin, (void *)n);
             break;
+        case op_batch:
+            multiplex_add_sexpr (stdio, on_script, (void *)0);
+            break;
+        case op_get:
+            copy_start  = now ();
+            script_done = (char)1;
+            job_add ((i_recursive ? jt_get_dir : jt_get_file), i_path, i_file);
+            batch_start ();
+            break;
+        case op_put:
+            copy_start  = now ();
+            script_done = (char)1;
+            job_add ((i_recursive ? jt_put_dir : jt_put_file), i_file, i_path);
+            batch_start ();
+            break;
+        case op_bench:
+            bench_connected (io, aux);
+            break;
+        case op_export:
+            script_done = (char)1;
+            job_add (jt_export_dir, i_path, (const char *)0);
+            batch_start ();
+            break;
+        case op_find:
+            d9c_walk (io, NO_FID_9P, i_path, find_walked, find_error,
+                      (void *)0);
+            break;
         default:
             cexit (4);
     }
@@ -198,6 +1846,67 @@ static void on_d9_close (struct d9r_io *io, void *aux)
     cexit (5);
 }
 
+static void bench_start (const char *socket)
+{
+    if ((bench_buffer = aalloc (i_block)) == (int_8 *)0)
+    {
+        cexit (6);
+    }
+
+    for (int_32 i = 0; i < i_block; i++)
+    {
+        bench_buffer[i] = (int_8)i;
+    }
+
+    for (int_32 i = 0; i < i_connections; i++)
+    {
+        struct bench_connection *c = aalloc (sizeof (struct bench_connection));
+
+        if (c == (struct bench_connection *)0)
+        {
+            cexit (6);
+        }
+
+        multiplex_add_d9c_socket
+                (socket, on_connect, on_error, on_d9_close, (void *)c);
+    }
+}
+
+/* parses a command line number; anything less than one becomes one */
+static int_64 parse_number (const char *s)
+{
+    int_64 n = 0;
+
+    for (; (*s >= '0') && (*s <= '9'); s++)
+    {
+        n = (n * 10) + (*s - '0');
+    }
+
+    return (n < 1) ? 1 : n;
+}
+
+static int same (const char *a, const char *b)
+{
+    while ((*a == *b) && (*a != (char)0))
+    {
+        a++;
+        b++;
+    }
+
+    return *a == *b;
+}
+
+static enum bench_workload parse_workload (const char *w)
+{
+    return same (w, "read")      ? bw_read      :
+           same (w, "randread")  ? bw_randread  :
+           same (w, "write")     ? bw_write     :
+           same (w, "randwrite") ? bw_randwrite :
+           same (w, "stat")      ? bw_stat      :
+           same (w, "walk")      ? bw_walk      :
+           same (w, "ls")        ? bw_ls        : bw_none;
+}
+
 /**\brief Main entry point
  *
  * This is the function called by the Curie bootstrap code. It initialises the
@@ -217,8 +1926,14 @@ int cmain()
 
     stdio          = sx_open_io (stdin, stdout);
 
-    multiplex_io  ();
-    multiplex_d9c ();
+    stderr         = io_open (2);
+    stderr->type   = iot_write;
+
+    errors         = sx_open_o (stderr);
+
+    multiplex_io    ();
+    multiplex_sexpr ();
+    multiplex_d9c   ();
 
     for (int i = 1; curie_argv[i] != (char *)0; i++)
     {
@@ -237,6 +1952,52 @@ int cmain()
                             xn++;
                         }
                         break;
+                    case 'j':
+                        if (curie_argv[xn] != (char *)0)
+                        {
+                            i_jobs = (int_32)parse_number (curie_argv[xn]);
+                            xn++;
+                        }
+                        break;
+                    case 'c':
+                        if (curie_argv[xn] != (char *)0)
+                        {
+                            i_connections =
+                                (int_32)parse_number (curie_argv[xn]);
+                            xn++;
+                        }
+                        break;
+                    case 'q':
+                        if (curie_argv[xn] != (char *)0)
+                        {
+                            i_depth = (int_32)parse_number (curie_argv[xn]);
+                            xn++;
+                        }
+                        break;
+                    case 'b':
+                        if (curie_argv[xn] != (char *)0)
+                        {
+                            i_block = (int_32)parse_number (curie_argv[xn]);
+                            xn++;
+                        }
+                        break;
+                    case 't':
+                        if (curie_argv[xn] != (char *)0)
+                        {
+                            i_seconds = (int_32)parse_number (curie_argv[xn]);
+                            xn++;
+                        }
+                        break;
+                    case 'z':
+                        if (curie_argv[xn] != (char *)0)
+                        {
+                            i_size = parse_number (curie_argv[xn]);
+                            xn++;
+                        }
+                        break;
+                    case 'r':
+                        i_recursive = (char)1;
+                        break;
                     case 'h':
                     case '-':
                         return print_help ();
@@ -280,6 +2041,20 @@ int cmain()
                         break;
                     }
                     return 11;
+                case 'g':
+                    if ((op[1] == 'e') && (op[2] == 't') && (op[3] == 0))
+                    {
+                        i_op = op_get;
+                        break;
+                    }
+                    return 16;
+                case 'p':
+                    if ((op[1] == 'u') && (op[2] == 't') && (op[3] == 0))
+                    {
+                        i_op = op_put;
+                        break;
+                    }
+                    return 17;
                 case 'r':
                     if ((op[1] == 'e') && (op[2] == 'a') && (op[3] == 'd') &&
                          (op[4] == 0))
@@ -288,6 +2063,37 @@ int cmain()
                         break;
                     }
                     return 12;
+                case 'b':
+                    if ((op[1] == 'a') && (op[2] == 't') && (op[3] == 'c') &&
+                        (op[4] == 'h') && (op[5] == 0))
+                    {
+                        i_op = op_batch;
+                        break;
+                    }
+                    else
+                    if ((op[1] == 'e') && (op[2] == 'n') && (op[3] == 'c') &&
+                        (op[4] == 'h') && (op[5] == 0))
+                    {
+                        i_op = op_bench;
+                        break;
+                    }
+                    return 14;
+                case 'e':
+                    if ((op[1] == 'x') && (op[2] == 'p') && (op[3] == 'o') &&
+                        (op[4] == 'r') && (op[5] == 't') && (op[6] == 0))
+                    {
+                        i_op = op_export;
+                        break;
+                    }
+                    return 18;
+                case 'f':
+                    if ((op[1] == 'i') && (op[2] == 'n') && (op[3] == 'd') &&
+                        (op[4] == 0))
+                    {
+                        i_op = op_find;
+                        break;
+                    }
+                    return 20;
                 case 'w':
                     if ((op[1] == 'r') && (op[2] == 'i') && (op[3] == 't') &&
                         (op[4] == 'e') && (op[5] == 0))
@@ -300,24 +2106,43 @@ int cmain()
                     return 15;
             }
         }
+        else if ((i_op == op_bench) && (i_workload == bw_none))
+        {
+            if ((i_workload = parse_workload (curie_argv[i])) == bw_none)
+            {
+                return 19;
+            }
+        }
         else if (i_path == (char *)0)
         {
             i_path = curie_argv[i];
         }
-        else if ((i_op == op_create) && (i_file == (char *)0))
+        else if (((i_op == op_create) || (i_op == op_get) ||
+                  (i_op == op_put) || (i_op == op_find)) &&
+                 (i_file == (char *)0))
         {
             i_file = curie_argv[i];
         }
     }
 
-    if ((i_socket == (char *)0) || (i_op == op_nop) || (i_path == (char *)0))
+    if ((i_socket == (char *)0) || (i_op == op_nop) ||
+        ((i_path == (char *)0) && (i_op != op_batch)) ||
+        ((i_file == (char *)0) && ((i_op == op_get) || (i_op == op_put))))
     {
         return print_help ();
     }
 
-    multiplex_add_d9c_socket
-            (i_socket, on_connect, on_error, on_d9_close, (void *)0);
+    if (i_op == op_bench)
+    {
+        bench_start (i_socket);
+    }
+    else
+    {
+        multiplex_add_d9c_socket
+                (i_socket, on_connect, on_error, on_d9_close, (void *)0);
+    }
     multiplex_add_io_no_callback (stdout);
+    multiplex_add_io_no_callback (stderr);
 
     while (multiplex() == mx_ok);
 
@@ -0,0 +1,295 @@
+/**\file
+ * \brief Duat payload compression
+ *
+ * \copyright
+ * Copyright (c) 2008-2014, Kyuba Project Members
+ * \copyright
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * \copyright
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * \copyright
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \see Project Documentation: http://ef.gy/documentation/duat
+ * \see Project Source Code: http://git.becquerel.org/kyuba/duat.git
+ */
+
+#include <duat/compress.h>
+
+/**\brief Number of Bits in the Match Finder's Hash */
+#define DCOMPRESS_HASH_BITS 12
+
+/**\brief Shortest Match */
+#define DCOMPRESS_MIN_MATCH 4
+
+/**\brief Farthest a Match may be back */
+#define DCOMPRESS_MAX_OFFSET 0xffff
+
+/* the format wants the last five bytes to be literals, and no match to
+ * start in the last twelve */
+#define DCOMPRESS_LAST_LITERALS 5
+#define DCOMPRESS_MATCH_LIMIT   12
+
+static unsigned int read32 (const unsigned char *p)
+{
+    return  (unsigned int)p[0]        | ((unsigned int)p[1] << 8) |
+           ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/* writes a token's extra length bytes, if it needs any */
+static unsigned char *put_length (unsigned char *o, unsigned long n)
+{
+    for (; n >= 255; n -= 255)
+    {
+        *o = 255;
+        o++;
+    }
+
+    *o = (unsigned char)n;
+
+    return o + 1;
+}
+
+/* writes a sequence of literals followed by a match, or just the literals
+ * if length is 0; returns null if it doesn't fit */
+static unsigned char *put_sequence
+        (unsigned char *o, unsigned char *end, const unsigned char *literals,
+         unsigned long count, unsigned long offset, unsigned long length)
+{
+    unsigned char *token = o;
+    unsigned long need = 1 + count + ((count + 255 - 15) / 255) +
+                         ((length > 0) ? (2 + ((length + 255) / 255)) : 0);
+
+    if (need > (unsigned long)(end - o))
+    {
+        return (unsigned char *)0;
+    }
+
+    o++;
+
+    if (count >= 15)
+    {
+        *token = 15 << 4;
+        o = put_length (o, count - 15);
+    }
+    else
+    {
+        *token = (unsigned char)(count << 4);
+    }
+
+    for (unsigned long i = 0; i < count; i++, o++)
+    {
+        *o = literals[i];
+    }
+
+    if (length == 0)
+    {
+        return o;
+    }
+
+    o[0] = (unsigned char)(offset & 0xff);
+    o[1] = (unsigned char)(offset >> 8);
+    o += 2;
+
+    length -= DCOMPRESS_MIN_MATCH;
+
+    if (length >= 15)
+    {
+        *token |= 15;
+        o = put_length (o, length - 15);
+    }
+    else
+    {
+        *token |= (unsigned char)length;
+    }
+
+    return o;
+}
+
+int_32 dcompress (const int_8 *data, int_32 length, int_8 *out,
+                  int_32 capacity)
+{
+    const unsigned char *in = (const unsigned char *)data;
+    const unsigned char *ip = in, *anchor = in, *end = in + length;
+    unsigned char *o = (unsigned char *)out, *oend = o + capacity;
+    unsigned int table[1 << DCOMPRESS_HASH_BITS];
+
+    for (int_32 i = 0; i < (1 << DCOMPRESS_HASH_BITS); i++)
+    {
+        table[i] = 0;
+    }
+
+    if (length > DCOMPRESS_MATCH_LIMIT)
+    {
+        const unsigned char *mflimit = end - DCOMPRESS_MATCH_LIMIT;
+        const unsigned char *mlimit  = end - DCOMPRESS_LAST_LITERALS;
+
+        while (ip < mflimit)
+        {
+            unsigned int sequence = read32 (ip);
+            unsigned int h = (sequence * 2654435761U)
+                           >> (32 - DCOMPRESS_HASH_BITS);
+            const unsigned char *match = in + table[h];
+            unsigned long size = DCOMPRESS_MIN_MATCH;
+
+            /* offsets are stored plus one, so that 0 means none */
+            table[h] = (unsigned int)(ip - in) + 1;
+
+            if ((match == in) ||
+                ((unsigned long)(ip - (--match)) > DCOMPRESS_MAX_OFFSET) ||
+                (read32 (match) != sequence))
+            {
+                ip++;
+                continue;
+            }
+
+            while ((ip > anchor) && (match > in) && (ip[-1] == match[-1]))
+            {
+                ip--;
+                match--;
+                size++;
+            }
+
+            while (((ip + size) < mlimit) && (ip[size] == match[size]))
+            {
+                size++;
+            }
+
+            if ((o = put_sequence (o, oend, anchor,
+                                   (unsigned long)(ip - anchor),
+                                   (unsigned long)(ip - match), size))
+                == (unsigned char *)0)
+            {
+                return 0;
+            }
+
+            ip    += size;
+            anchor = ip;
+        }
+    }
+
+    if ((o = put_sequence (o, oend, anchor, (unsigned long)(end - anchor), 0,
+                           0)) == (unsigned char *)0)
+    {
+        return 0;
+    }
+
+    return (int_32)(o - (unsigned char *)out);
+}
+
+/* reads a token's extra length bytes; returns null if they run past end */
+static const unsigned char *get_length
+        (const unsigned char *i, const unsigned char *end, unsigned long *n)
+{
+    unsigned char b;
+
+    do
+    {
+        if (i >= end)
+        {
+            return (const unsigned char *)0;
+        }
+
+        b = *i;
+        i++;
+        *n += b;
+    }
+    while (b == 255);
+
+    return i;
+}
+
+int_32 ddecompress (const int_8 *data, int_32 length, int_8 *out,
+                    int_32 capacity)
+{
+    const unsigned char *i = (const unsigned char *)data, *end;
+    unsigned char *o = (unsigned char *)out, *oend;
+
+    /* negative sizes would put the ends before the starts, and make the
+     * bounds checks below pass for anything */
+    if ((length < 0) || (capacity < 0))
+    {
+        return 0;
+    }
+
+    end  = i + length;
+    oend = o + capacity;
+
+    while (i < end)
+    {
+        unsigned char token = *i;
+        unsigned long count = token >> 4, offset, size = token & 15;
+
+        i++;
+
+        if ((count == 15) &&
+            ((i = get_length (i, end, &count)) == (const unsigned char *)0))
+        {
+            return 0;
+        }
+
+        if ((count > (unsigned long)(end - i)) ||
+            (count > (unsigned long)(oend - o)))
+        {
+            return 0;
+        }
+
+        for (; count > 0; count--, i++, o++)
+        {
+            *o = *i;
+        }
+
+        /* the last sequence has no match */
+        if (i == end)
+        {
+            break;
+        }
+
+        if ((end - i) < 2)
+        {
+            return 0;
+        }
+
+        offset = (unsigned long)i[0] | ((unsigned long)i[1] << 8);
+        i += 2;
+
+        if ((offset == 0) ||
+            (offset > (unsigned long)(o - (unsigned char *)out)))
+        {
+            return 0;
+        }
+
+        if ((size == 15) &&
+            ((i = get_length (i, end, &size)) == (const unsigned char *)0))
+        {
+            return 0;
+        }
+
+        size += DCOMPRESS_MIN_MATCH;
+
+        if (size > (unsigned long)(oend - o))
+        {
+            return 0;
+        }
+
+        /* byte by byte, as the match may overlap what it produces */
+        for (; size > 0; size--, o++)
+        {
+            *o = *(o - offset);
+        }
+    }
+
+    return (int_32)(o - (unsigned char *)out);
+}
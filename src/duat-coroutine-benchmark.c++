@@ -0,0 +1,454 @@
+/**\file
+ * \brief Duat coroutine benchmark
+ *
+ * Implements the 'duat-coroutine-benchmark' programme, which compares the
+ * C++ coroutine bindings in duat/9p-client.hpp with the callbacks they wrap.
+ * Like duat-benchmark, it runs a 9P client and a 9P server in the same
+ * process, connected with an in-process loopback, and counts how many
+ * requests of each kind they get through per second.
+ *
+ * Each benchmark keeps the same number of requests in flight both ways:
+ * either that many coroutines on the one connection, each awaiting one
+ * request after the other, or callbacks that send the next request as soon
+ * as one has been answered. The difference is what the bindings cost: the
+ * coroutine frames, the awaitables, and copying the results out of the
+ * messages.
+ *
+ * \copyright
+ * Copyright (c) 2008-2014, Kyuba Project Members
+ * \copyright
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * \copyright
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * \copyright
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \see Project Documentation: http://ef.gy/documentation/duat
+ * \see Project Source Code: http://git.becquerel.org/kyuba/duat.git
+ */
+
+#include <curie/main.h>
+#include <curie/sexpr.h>
+#include <curie/time.h>
+#include <duat/9p-client.hpp>
+#include <duat/9p-server.h>
+
+/**\brief Benchmark
+ *
+ * One kind of request to measure, on a FID walked to path and opened with
+ * mode unless that is negative. Either issue() sends one request whose
+ * callback sends the next one, or worker() is a coroutine that keeps
+ * awaiting requests until the benchmark stops.
+ */
+struct benchmark
+{
+    const char *name;
+    const char *path;
+    int mode;
+    void (*issue) ();
+    duat::task<void> (*worker) (duat::connection);
+};
+
+/**\brief Size of the reads, the same as duat-benchmark's */
+#define BLOCK_SIZE (0x2000 - 24)
+
+static struct dfs *fs               = (struct dfs *)0;
+static struct d9r_io *client        = (struct d9r_io *)0;
+static struct sexpr_io *stdio       = (struct sexpr_io *)0;
+
+static int_32 i_seconds  = 2;
+static int_32 i_depth    = 64;
+
+static char   ready      = (char)0;
+static char   failed     = (char)0;
+static char   stopping   = (char)0;
+static int_32 fid        = NO_FID_9P;
+static int_64 completed  = 0;
+static int_64 errors     = 0;
+
+static int_8  block[0x2000];
+
+static int_64 now ()
+{
+    return dt_to_unix (dt_get ());
+}
+
+static int_64 tick ()
+{
+    int_64 s = now (), n;
+
+    while ((n = now ()) == s);
+
+    return n;
+}
+
+/* callbacks */
+
+static void issue_stat ();
+static void issue_read ();
+
+static void request_error (struct d9r_io *io, const char *error, void *aux)
+{
+    errors++;
+}
+
+static void stat_done
+        (struct d9r_io *io, int_16 type, int_32 dev, struct d9r_qid qid,
+         int_32 mode, int_32 atime, int_32 mtime, int_64 length, char *name,
+         char *uid, char *gid, char *muid, char *ex, void *aux)
+{
+    completed++;
+
+    if (!stopping)
+    {
+        issue_stat ();
+    }
+}
+
+static void issue_stat ()
+{
+    d9c_stat_fid (client, fid, stat_done, request_error, (void *)0);
+}
+
+static void read_done (struct d9r_io *io, int_32 count, int_8 *data,
+                       void *aux)
+{
+    completed++;
+
+    if (!stopping)
+    {
+        issue_read ();
+    }
+}
+
+static void issue_read ()
+{
+    d9c_read (client, fid, 0, BLOCK_SIZE, read_done, request_error,
+              (void *)0);
+}
+
+/* coroutines; a failed request ends the coroutine, as the next one would
+ * most likely fail the same way */
+
+static duat::task<void> stat_worker (duat::connection c)
+{
+    try
+    {
+        while (!stopping)
+        {
+            co_await c.stat (fid);
+            completed++;
+        }
+    }
+    catch (const duat::error &)
+    {
+        errors++;
+    }
+}
+
+static duat::task<void> read_worker (duat::connection c)
+{
+    try
+    {
+        while (!stopping)
+        {
+            co_await c.read (fid, 0, BLOCK_SIZE);
+            completed++;
+        }
+    }
+    catch (const duat::error &)
+    {
+        errors++;
+    }
+}
+
+/**\brief Benchmarks
+ *
+ * In pairs, so that each coroutine benchmark follows the callback benchmark
+ * it is to be compared with.
+ */
+static struct benchmark benchmarks[] =
+{
+    { "stat-callback",  "bench/small", -1,       issue_stat, nullptr     },
+    { "stat-coroutine", "bench/small", -1,       nullptr,    stat_worker },
+    { "read-callback",  "bench/large", P9_OREAD, issue_read, nullptr     },
+    { "read-coroutine", "bench/large", P9_OREAD, nullptr,    read_worker },
+    { nullptr,          nullptr,       0,        nullptr,    nullptr     }
+};
+
+static struct benchmark *current = (struct benchmark *)0;
+
+static void report_error (const char *error)
+{
+    sx_write (stdio, cons (make_symbol ("error"),
+                           cons (make_string (current->name),
+                           cons (make_string (error), sx_end_of_list))));
+
+    failed = (char)1;
+}
+
+/* walks the benchmark's FID, and opens it if need be */
+static duat::task<void> setup (duat::connection c)
+{
+    try
+    {
+        fid = co_await c.walk (current->path);
+
+        if (current->mode >= 0)
+        {
+            co_await c.open (fid, (int_8)current->mode);
+        }
+
+        ready = (char)1;
+    }
+    catch (const duat::error &e)
+    {
+        report_error (e.what ());
+    }
+}
+
+static void on_attach (struct d9r_io *io, void *aux)
+{
+    duat::spawn (setup (duat::connection (io)));
+}
+
+static void on_connection_error (struct d9r_io *io, const char *error,
+                                 void *aux)
+{
+    report_error (error);
+}
+
+static void on_close (struct d9r_io *io, void *aux)
+{
+    client = (struct d9r_io *)0;
+}
+
+/* delivers messages until there's nothing left to do or flag is set */
+static void run_until (char *flag)
+{
+    while (!*flag && !failed && (d9r_run_loopback () > 0));
+}
+
+static void run (struct benchmark *b)
+{
+    struct d9r_io *server;
+    char never = (char)0;
+    int_64 start, end, elapsed;
+
+    current   = b;
+    ready     = (char)0;
+    failed    = (char)0;
+    stopping  = (char)0;
+    fid       = NO_FID_9P;
+    completed = 0;
+    errors    = 0;
+
+    d9r_open_loopback (&client, &server);
+
+    if (client == (struct d9r_io *)0)
+    {
+        report_error ("Out of memory.");
+        return;
+    }
+
+    multiplex_add_d9s_d9r (server, fs);
+    multiplex_add_d9c_d9r (client, on_attach, on_connection_error, on_close,
+                           (void *)0);
+
+    run_until (&ready);
+
+    if (ready && !failed)
+    {
+        duat::connection c (client);
+
+        start = tick ();
+        end   = start + i_seconds;
+
+        for (int_32 i = 0; i < i_depth; i++)
+        {
+            if (b->worker != nullptr)
+            {
+                duat::spawn (b->worker (c));
+            }
+            else
+            {
+                b->issue ();
+            }
+        }
+
+        /* only look at the clock every so often, it's a system call */
+        do
+        {
+            for (int_32 i = 0; i < 0x100; i++)
+            {
+                d9r_run_loopback ();
+            }
+        }
+        while (now () < end);
+
+        elapsed  = now () - start;
+        stopping = (char)1;
+
+        /* lets the requests still in flight finish, and the coroutines with
+         * them */
+        run_until (&never);
+
+        if (elapsed < 1) elapsed = 1;
+
+        sx_write (stdio, cons (make_symbol (b->name),
+            cons (make_symbol ("requests"), cons (make_integer (completed),
+            cons (make_symbol ("errors"), cons (make_integer (errors),
+            cons (make_symbol ("seconds"), cons (make_integer (elapsed),
+            cons (make_symbol ("requests-per-second"),
+                  cons (make_integer (completed / elapsed),
+            cons (make_symbol ("nanoseconds-per-request"),
+                  cons (make_integer ((completed > 0) ?
+                                      ((elapsed * 1000000000) / completed)
+                                                      : 0),
+                  sx_end_of_list))))))))))));
+    }
+
+    if ((client != (struct d9r_io *)0) && (fid != NO_FID_9P))
+    {
+        d9c_clunk (client, fid, nullptr, nullptr, (void *)0);
+    }
+
+    if (client != (struct d9r_io *)0)
+    {
+        multiplex_del_d9r (client);
+    }
+
+    run_until (&never);
+}
+
+static int_32 parse_number (const char *s)
+{
+    int_32 n = 0;
+
+    for (; (*s >= '0') && (*s <= '9'); s++)
+    {
+        n = (n * 10) + (*s - '0');
+    }
+
+    return (n < 1) ? 1 : n;
+}
+
+static int same (const char *a, const char *b)
+{
+    while ((*a == *b) && (*a != (char)0))
+    {
+        a++;
+        b++;
+    }
+
+    return *a == *b;
+}
+
+static void make_tree ()
+{
+    struct dfs_directory *bench;
+
+    fs = dfs_create (nullptr, (void *)0);
+
+    for (int_32 i = 0; i < (int_32)sizeof (block); i++)
+    {
+        block[i] = (int_8)i;
+    }
+
+    bench = dfs_mk_directory (fs->root, (char *)"bench");
+
+    dfs_mk_file (bench, (char *)"small", (char *)0, block, 64, (void *)0,
+                 nullptr, nullptr);
+    dfs_mk_file (bench, (char *)"large", (char *)0, block, sizeof (block),
+                 (void *)0, nullptr, nullptr);
+}
+
+/**\brief Main entry point
+ *
+ * Parses the command line, builds the test tree and runs the benchmarks; all
+ * of them, or the ones named on the command line. -t sets how many seconds to
+ * run each one for, and -q how many requests to keep in flight, which is the
+ * number of coroutines for the coroutine benchmarks.
+ *
+ * \returns Zero on success, nonzero otherwise.
+ */
+int cmain ()
+{
+    struct io *out = io_open (1);
+    char selected = (char)0;
+
+    out->type = iot_write;
+    stdio     = sx_open_o (out);
+
+    for (int i = 1; curie_argv[i] != (char *)0; i++)
+    {
+        if (curie_argv[i][0] != '-')
+        {
+            continue;
+        }
+
+        if (curie_argv[i + 1] != (char *)0)
+        {
+            switch (curie_argv[i][1])
+            {
+                case 't':
+                    i_seconds = parse_number (curie_argv[i + 1]);
+                    break;
+                case 'q':
+                    i_depth   = parse_number (curie_argv[i + 1]);
+                    break;
+            }
+
+            i++;
+        }
+    }
+
+    make_tree ();
+
+    for (int i = 1; curie_argv[i] != (char *)0; i++)
+    {
+        if (curie_argv[i][0] == '-')
+        {
+            if (curie_argv[i + 1] != (char *)0)
+            {
+                i++;
+            }
+
+            continue;
+        }
+
+        selected = (char)1;
+
+        for (struct benchmark *b = benchmarks; b->name != nullptr; b++)
+        {
+            if (same (b->name, curie_argv[i]))
+            {
+                run (b);
+            }
+        }
+    }
+
+    if (!selected)
+    {
+        for (struct benchmark *b = benchmarks; b->name != nullptr; b++)
+        {
+            run (b);
+        }
+    }
+
+    sx_close_io (stdio);
+
+    return 0;
+}
@@ -62,17 +62,1153 @@ struct dfs *dfs_create (void (*close)(struct d9r_io *, void *), void *aux)
     return rv;
 }
 
+/* owner names */
+
+static struct tree dfs_owner_map = TREE_INITIALISER;
+static char **dfs_owner_names = (char **)0;
+static int_32 dfs_owner_count = 0;
+static int_32 dfs_owner_size = 0;
+
+int_16 dfs_owner (const char *name)
+{
+    struct tree_node *node =
+            tree_get_node_string (&dfs_owner_map, (char *)name);
+
+    if (node != (struct tree_node *)0)
+    {
+        return (int_16)(int_pointer)node_get_value (node);
+    }
+
+    if (dfs_owner_count == dfs_owner_size)
+    {
+        int_32 nsize = (dfs_owner_size == 0) ? 16 : (dfs_owner_size * 2);
+        char **nnames;
+
+        if (nsize > 0x8000) return DFS_NO_OWNER;
+
+        nnames = aalloc (nsize * sizeof (char *));
+
+        if (nnames == (char **)0) return DFS_NO_OWNER;
+
+        for (int_32 i = 0; i < dfs_owner_count; i++)
+        {
+            nnames[i] = dfs_owner_names[i];
+        }
+
+        if (dfs_owner_names != (char **)0)
+        {
+            afree (dfs_owner_size * sizeof (char *), dfs_owner_names);
+        }
+
+        dfs_owner_names = nnames;
+        dfs_owner_size  = nsize;
+    }
+
+    dfs_owner_names[dfs_owner_count] = (char *)str_immutable (name);
+    tree_add_node_string_value (&dfs_owner_map, (char *)name,
+                                (void *)(int_pointer)dfs_owner_count);
+
+    return (int_16)(dfs_owner_count++);
+}
+
+char *dfs_owner_name (int_16 id)
+{
+    if ((id < 0) || (id >= dfs_owner_count))
+    {
+        return (char *)0;
+    }
+
+    return dfs_owner_names[id];
+}
+
+/**\brief Next QID path
+ *
+ * QID paths are handed out from this counter so that they are never reused.
+ */
+static int_64 dfs_next_path = 1;
+
+void dfs_qid (struct dfs_node_common *c, struct d9r_qid *qid)
+{
+    switch (c->type)
+    {
+        case dft_directory:
+            qid->type = QTDIR;
+            break;
+        case dft_symlink:
+            qid->type = QTLINK;
+            break;
+        default:
+            qid->type = QTFILE;
+            break;
+    }
+
+    qid->version = c->version;
+    qid->path    = c->path;
+}
+
+void dfs_touch (struct dfs_node_common *c)
+{
+    c->version++;
+}
+
+static struct memory_pool dfs_extent_pool =
+        MEMORY_POOL_INITIALISER (sizeof (struct dfs_extent));
+
+static void dfs_release_extent (struct dfs_extent *e)
+{
+    if (e == (struct dfs_extent *)0) return;
+
+    e->references--;
+
+    if (e->references == 0)
+    {
+        afree (e->size, e->data);
+        free_pool_mem (e);
+    }
+}
+
+int dfs_copy_contents
+        (struct dfs_file *file, struct dfs_file *source, int_64 offset,
+         int_64 length)
+{
+    struct dfs_extent *e = source->extent;
+    int_8 *data = (int_8 *)0;
+
+    if (length == 0)
+    {
+        e = (struct dfs_extent *)0;
+    }
+    else if (e != (struct dfs_extent *)0)
+    {
+        e->references++;
+        data = source->data + offset;
+    }
+    else
+    {
+        if ((e = get_pool_mem (&dfs_extent_pool)) == (struct dfs_extent *)0)
+        {
+            return 0;
+        }
+
+        e->size = length;
+
+        if ((e->data = aalloc (e->size)) == (int_8 *)0)
+        {
+            free_pool_mem (e);
+            return 0;
+        }
+
+        for (int_64 i = 0; i < length; i++)
+        {
+            e->data[i] = source->data[offset + i];
+        }
+
+        e->references = 1;
+        data          = e->data;
+    }
+
+    dfs_release_extent (file->extent);
+
+    file->extent   = e;
+    file->data     = data;
+    file->c.length = length;
+
+    dfs_touch (&(file->c));
+
+    return 1;
+}
+
 static void initialise_dfs_node_common (struct dfs_node_common *c)
 {
+    c->path = dfs_next_path++;
+    c->version = 1;
     c->mode = 0644;
     c->atime = 1223234093; /* fairly random, and current, timestamp */
     c->mtime = 1223234093; /* fairly random, and current, timestamp */
     c->length = sizeof (*c);
-    c->uid  = "root";
-    c->gid  = "root";
-    c->muid = "root";
+    c->uid  = dfs_owner ("root");
+    c->gid  = c->uid;
+    c->muid = c->uid;
+}
+
+/**\brief Initial hash index size
+ *
+ * Number of slots a freshly created directory hash index starts out with. Must
+ * be a power of two.
+ */
+#define HASH_INITIAL_SIZE 64
+
+/* directory indices */
+
+static int_32 dfs_hash_name (const char *name)
+{
+    unsigned int h = 2166136261u; /* FNV-1a */
+
+    while (*name)
+    {
+        h ^= (unsigned char)(*name);
+        h *= 16777619u;
+        name++;
+    }
+
+    return (int_32)h;
+}
+
+static char dfs_name_equal (const char *a, const char *b)
+{
+    while ((*a) && (*a == *b))
+    {
+        a++;
+        b++;
+    }
+
+    return (char)(*a == *b);
 }
 
+/* returns the slot the name is in, or the empty slot it would go in */
+static struct dfs_hash_entry *dfs_hash_slot
+        (struct dfs_hash_index *idx, int_32 hash, const char *name)
+{
+    unsigned int mask = (unsigned int)(idx->size - 1);
+    unsigned int i = ((unsigned int)hash) & mask;
+
+    while (idx->slots[i].node != (struct dfs_node_common *)0)
+    {
+        if ((idx->slots[i].hash == hash) &&
+            dfs_name_equal (idx->slots[i].node->name, name))
+        {
+            break;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    return &(idx->slots[i]);
+}
+
+static struct dfs_hash_entry *dfs_hash_alloc_slots (int_32 size)
+{
+    struct dfs_hash_entry *slots =
+            aalloc (size * sizeof (struct dfs_hash_entry));
+
+    if (slots != (struct dfs_hash_entry *)0)
+    {
+        for (int_32 i = 0; i < size; i++)
+        {
+            slots[i].hash = 0;
+            slots[i].node = (struct dfs_node_common *)0;
+        }
+    }
+
+    return slots;
+}
+
+static int dfs_hash_grow (struct dfs_hash_index *idx)
+{
+    int_32 osize = idx->size;
+    int_32 nsize = osize * 2;
+    struct dfs_hash_entry *oslots = idx->slots;
+    struct dfs_hash_entry *nslots = dfs_hash_alloc_slots (nsize);
+
+    if (nslots == (struct dfs_hash_entry *)0) return 0;
+
+    idx->slots = nslots;
+    idx->size  = nsize;
+
+    for (int_32 i = 0; i < osize; i++)
+    {
+        if (oslots[i].node != (struct dfs_node_common *)0)
+        {
+            *dfs_hash_slot (idx, oslots[i].hash, oslots[i].node->name)
+                = oslots[i];
+        }
+    }
+
+    afree (osize * sizeof (struct dfs_hash_entry), oslots);
+
+    return 1;
+}
+
+static int dfs_hash_grow_order (struct dfs_hash_index *idx)
+{
+    int_32 nsize = idx->order_size * 2;
+    struct dfs_node_common **norder =
+            aalloc (nsize * sizeof (struct dfs_node_common *));
+
+    if (norder == (struct dfs_node_common **)0) return 0;
+
+    for (int_32 i = 0; i < idx->count; i++)
+    {
+        norder[i] = idx->order[i];
+    }
+
+    afree (idx->order_size * sizeof (struct dfs_node_common *), idx->order);
+
+    idx->order      = norder;
+    idx->order_size = nsize;
+
+    return 1;
+}
+
+/* returns 0 if the index could not be grown to take the node */
+static int dfs_hash_add
+        (struct dfs_hash_index *idx, struct dfs_node_common *node)
+{
+    int_32 hash = dfs_hash_name (node->name);
+    struct dfs_hash_entry *e;
+
+    /* keep the load factor at or below one half */
+    if ((((idx->count + 1) * 2) > idx->size) && !dfs_hash_grow (idx))
+    {
+        return 0;
+    }
+
+    e = dfs_hash_slot (idx, hash, node->name);
+
+    if (e->node != (struct dfs_node_common *)0)
+    {
+        /* a node by that name already exists; replace it in place */
+        for (int_32 i = 0; i < idx->count; i++)
+        {
+            if (idx->order[i] == e->node)
+            {
+                idx->order[i] = node;
+                break;
+            }
+        }
+
+        e->node = node;
+        return 1;
+    }
+
+    if ((idx->count == idx->order_size) && !dfs_hash_grow_order (idx))
+    {
+        return 0;
+    }
+
+    e->hash = hash;
+    e->node = node;
+
+    idx->order[idx->count] = node;
+    idx->count++;
+
+    return 1;
+}
+
+static void dfs_vector_free (struct dfs_directory *dir)
+{
+    if (dir->nodes.vector != (struct dfs_node_common **)0)
+    {
+        afree (DFS_SMALL_DIRECTORY * sizeof (struct dfs_node_common *),
+               dir->nodes.vector);
+    }
+}
+
+/* moves the nodes of a vector directory into a string tree */
+static int dfs_vector_to_tree (struct dfs_directory *dir)
+{
+    struct tree *t = tree_create ();
+
+    if (t == (struct tree *)0) return 0;
+
+    for (int_16 i = 0; i < dir->count; i++)
+    {
+        tree_add_node_string_value
+                (t, dir->nodes.vector[i]->name, (void *)dir->nodes.vector[i]);
+    }
+
+    dfs_vector_free (dir);
+
+    dir->nodes.tree = t;
+    dir->index      = dfs_index_tree;
+    dir->count      = 0;
+
+    return 1;
+}
+
+/* returns 0 if there was not enough memory to take the node */
+static int dfs_vector_add (struct dfs_directory *dir, struct dfs_node_common *node)
+{
+    for (int_16 i = 0; i < dir->count; i++)
+    {
+        if (dfs_name_equal (dir->nodes.vector[i]->name, node->name))
+        {
+            dir->nodes.vector[i] = node;
+            return 1;
+        }
+    }
+
+    if (dir->count == DFS_SMALL_DIRECTORY)
+    {
+        if (!dfs_vector_to_tree (dir)) return 0;
+
+        tree_add_node_string_value (dir->nodes.tree, node->name, (void *)node);
+        return 1;
+    }
+
+    if (dir->nodes.vector == (struct dfs_node_common **)0)
+    {
+        dir->nodes.vector =
+            aalloc (DFS_SMALL_DIRECTORY * sizeof (struct dfs_node_common *));
+
+        if (dir->nodes.vector == (struct dfs_node_common **)0) return 0;
+    }
+
+    dir->nodes.vector[dir->count] = node;
+    dir->count++;
+
+    return 1;
+}
+
+/* returns 0 if the directory's index could not take the node */
+static int dfs_add_node
+        (struct dfs_directory *dir, char *name, struct dfs_node_common *node)
+{
+    switch (dir->index)
+    {
+        case dfs_index_vector:
+            if (!dfs_vector_add (dir, node)) return 0;
+            break;
+        case dfs_index_tree:
+            tree_add_node_string_value (dir->nodes.tree, name, (void *)node);
+            break;
+        case dfs_index_hash:
+            if (!dfs_hash_add (dir->nodes.hash, node)) return 0;
+            break;
+    }
+
+    dfs_touch (&(dir->c));
+
+    return 1;
+}
+
+struct dfs_hash_migration
+{
+    struct dfs_hash_index *index;
+    char failed;
+};
+
+static void dfs_hash_add_tree_node (struct tree_node *node, void *aux)
+{
+    struct dfs_hash_migration *m = (struct dfs_hash_migration *)aux;
+    struct dfs_node_common *c =
+            (struct dfs_node_common *)node_get_value (node);
+
+    if ((c != (struct dfs_node_common *)0) && !m->failed &&
+        !dfs_hash_add (m->index, c))
+    {
+        m->failed = (char)1;
+    }
+}
+
+static void dfs_hash_free (struct dfs_hash_index *idx)
+{
+    afree (idx->size * sizeof (struct dfs_hash_entry), idx->slots);
+    afree (idx->order_size * sizeof (struct dfs_node_common *), idx->order);
+}
+
+int dfs_hash_directory (struct dfs_directory *dir)
+{
+    static struct memory_pool pool = MEMORY_POOL_INITIALISER(sizeof (struct dfs_hash_index));
+    struct dfs_hash_index *idx;
+
+    if (dir->index == dfs_index_hash) return 1;
+
+    if ((idx = get_pool_mem (&pool)) == (struct dfs_hash_index *)0)
+    {
+        return 0;
+    }
+
+    idx->size       = HASH_INITIAL_SIZE;
+    idx->count      = 0;
+    idx->order_size = HASH_INITIAL_SIZE / 2;
+    idx->slots      = dfs_hash_alloc_slots (idx->size);
+    idx->order      = aalloc (idx->order_size * sizeof (struct dfs_node_common *));
+
+    if ((idx->slots == (struct dfs_hash_entry *)0) ||
+        (idx->order == (struct dfs_node_common **)0))
+    {
+        if (idx->slots != (struct dfs_hash_entry *)0)
+        {
+            afree (idx->size * sizeof (struct dfs_hash_entry), idx->slots);
+        }
+        if (idx->order != (struct dfs_node_common **)0)
+        {
+            afree (idx->order_size * sizeof (struct dfs_node_common *),
+                   idx->order);
+        }
+
+        free_pool_mem (idx);
+        return 0;
+    }
+
+    /* the old index is only let go of once all of its nodes made it */
+    if (dir->index == dfs_index_tree)
+    {
+        struct dfs_hash_migration m = { idx, (char)0 };
+
+        tree_map (dir->nodes.tree, dfs_hash_add_tree_node, (void *)&m);
+
+        if (m.failed)
+        {
+            dfs_hash_free (idx);
+            free_pool_mem (idx);
+            return 0;
+        }
+
+        tree_destroy (dir->nodes.tree);
+    }
+    else
+    {
+        for (int_16 i = 0; i < dir->count; i++)
+        {
+            if (!dfs_hash_add (idx, dir->nodes.vector[i]))
+            {
+                dfs_hash_free (idx);
+                free_pool_mem (idx);
+                return 0;
+            }
+        }
+
+        dfs_vector_free (dir);
+        dir->count = 0;
+    }
+
+    dir->nodes.hash = idx;
+    dir->index      = dfs_index_hash;
+
+    return 1;
+}
+
+struct dfs_node_common *dfs_get_node
+        (struct dfs_directory *dir, const char *name)
+{
+    struct tree_node *node;
+
+    switch (dir->index)
+    {
+        case dfs_index_vector:
+            for (int_16 i = 0; i < dir->count; i++)
+            {
+                if (dfs_name_equal (dir->nodes.vector[i]->name, name))
+                {
+                    return dir->nodes.vector[i];
+                }
+            }
+            break;
+        case dfs_index_tree:
+            node = tree_get_node_string (dir->nodes.tree, (char *)name);
+
+            if (node != (struct tree_node *)0)
+            {
+                return (struct dfs_node_common *)node_get_value (node);
+            }
+            break;
+        case dfs_index_hash:
+            return dfs_hash_slot
+                    (dir->nodes.hash, dfs_hash_name (name), name)->node;
+    }
+
+    return (struct dfs_node_common *)0;
+}
+
+struct dfs_index_map
+{
+    int_32 index;
+    struct dfs_node_common *node;
+};
+
+static void dfs_find_index (struct tree_node *node, void *aux)
+{
+    struct dfs_index_map *m = (struct dfs_index_map *)aux;
+
+    if (m->index == 0)
+    {
+        m->node = (struct dfs_node_common *)node_get_value (node);
+    }
+
+    m->index--;
+}
+
+struct dfs_node_common *dfs_get_node_index
+        (struct dfs_directory *dir, int_32 index)
+{
+    struct dfs_index_map m = { index, (struct dfs_node_common *)0 };
+
+    if (index < 0) return (struct dfs_node_common *)0;
+
+    switch (dir->index)
+    {
+        case dfs_index_vector:
+            if (index < dir->count)
+            {
+                return dir->nodes.vector[index];
+            }
+            break;
+        case dfs_index_tree:
+            tree_map (dir->nodes.tree, dfs_find_index, (void *)&m);
+            break;
+        case dfs_index_hash:
+            if (index < dir->nodes.hash->count)
+            {
+                return dir->nodes.hash->order[index];
+            }
+            break;
+    }
+
+    return m.node;
+}
+
+/* searches */
+
+/* matches c against the character or class at *pattern, and moves past it if
+ * it matched */
+static int dfs_glob_one (const char **pattern, char c)
+{
+    const char *p = *pattern;
+
+    switch (*p)
+    {
+        case (char)0:
+            return 0;
+        case '?':
+            *pattern = p + 1;
+            return 1;
+        case '[':
+            {
+                const char *q = p + 1;
+                char negate = (char)0, matched = (char)0, first = (char)1;
+
+                if ((*q == '!') || (*q == '^'))
+                {
+                    negate = (char)1;
+                    q++;
+                }
+
+                while ((*q != (char)0) && (first || (*q != ']')))
+                {
+                    char lo = *q, hi = *q;
+
+                    if ((q[1] == '-') && (q[2] != (char)0) && (q[2] != ']'))
+                    {
+                        hi = q[2];
+                        q += 3;
+                    }
+                    else
+                    {
+                        q++;
+                    }
+
+                    if ((c >= lo) && (c <= hi)) matched = (char)1;
+
+                    first = (char)0;
+                }
+
+                /* an unterminated class is just a '[' */
+                if (*q == (char)0) break;
+
+                if (matched != negate)
+                {
+                    *pattern = q + 1;
+                    return 1;
+                }
+            }
+            return 0;
+        case '\\':
+            if (p[1] != (char)0) p++;
+            break;
+    }
+
+    if (*p == c)
+    {
+        *pattern = p + 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+int dfs_glob (const char *pattern, const char *name)
+{
+    const char *star = (const char *)0, *resume = (const char *)0;
+
+    while (*name != (char)0)
+    {
+        if (*pattern == '*')
+        {
+            pattern++;
+            star   = pattern;
+            resume = name;
+        }
+        else if (dfs_glob_one (&pattern, *name))
+        {
+            name++;
+        }
+        else if (star != (const char *)0)
+        {
+            /* let the last '*' take one more character */
+            resume++;
+            pattern = star;
+            name    = resume;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    while (*pattern == '*') pattern++;
+
+    return *pattern == (char)0;
+}
+
+static int dfs_find_match (struct dfs_find *f, struct dfs_node_common *c)
+{
+    /* the D9R_FIND_* flags are in the same order as enum dfs_node_type */
+    return ((f->types == 0) || (f->types & (1 << c->type))) &&
+           (c->length >= f->min_length) &&
+           ((f->max_length == ~(int_64)0) || (c->length <= f->max_length)) &&
+           (c->mtime >= f->after) &&
+           ((f->before == ~(int_32)0) || (c->mtime <= f->before)) &&
+           ((f->pattern[0] == (char)0) || dfs_glob (f->pattern, c->name));
+}
+
+static int dfs_find_grow (struct dfs_find *f)
+{
+    int_32 nsize = f->size * 2;
+    struct dfs_directory **ndirectories =
+            aalloc (nsize * sizeof (struct dfs_directory *));
+    int_32 *npositions = aalloc (nsize * sizeof (int_32));
+    struct dfs_node_common ***nlistings =
+            aalloc (nsize * sizeof (struct dfs_node_common **));
+    int_32 *nlisting_sizes = aalloc (nsize * sizeof (int_32));
+
+    if ((ndirectories == (struct dfs_directory **)0) ||
+        (npositions == (int_32 *)0) ||
+        (nlistings == (struct dfs_node_common ***)0) ||
+        (nlisting_sizes == (int_32 *)0))
+    {
+        if (ndirectories != (struct dfs_directory **)0)
+        {
+            afree (nsize * sizeof (struct dfs_directory *), ndirectories);
+        }
+
+        if (npositions != (int_32 *)0)
+        {
+            afree (nsize * sizeof (int_32), npositions);
+        }
+
+        if (nlistings != (struct dfs_node_common ***)0)
+        {
+            afree (nsize * sizeof (struct dfs_node_common **), nlistings);
+        }
+
+        if (nlisting_sizes != (int_32 *)0)
+        {
+            afree (nsize * sizeof (int_32), nlisting_sizes);
+        }
+
+        return 0;
+    }
+
+    for (int_32 i = 0; i < f->depth; i++)
+    {
+        ndirectories[i]   = f->directories[i];
+        npositions[i]     = f->positions[i];
+        nlistings[i]      = f->listings[i];
+        nlisting_sizes[i] = f->listing_sizes[i];
+    }
+
+    afree (f->size * sizeof (struct dfs_directory *), f->directories);
+    afree (f->size * sizeof (int_32), f->positions);
+    afree (f->size * sizeof (struct dfs_node_common **), f->listings);
+    afree (f->size * sizeof (int_32), f->listing_sizes);
+
+    f->directories   = ndirectories;
+    f->positions     = npositions;
+    f->listings      = nlistings;
+    f->listing_sizes = nlisting_sizes;
+    f->size          = nsize;
+
+    return 1;
+}
+
+struct dfs_listing_map
+{
+    struct dfs_node_common **nodes;
+    int_32 count;
+};
+
+static void dfs_count_listing (struct tree_node *node, void *aux)
+{
+    ((struct dfs_listing_map *)aux)->count++;
+}
+
+static void dfs_fill_listing (struct tree_node *node, void *aux)
+{
+    struct dfs_listing_map *m = (struct dfs_listing_map *)aux;
+
+    m->nodes[m->count] = (struct dfs_node_common *)node_get_value (node);
+    m->count++;
+}
+
+/* continues the search in dir; a tree can only be walked as a whole, so its
+ * nodes are copied out once here instead of having dfs_get_node_index() walk
+ * it for every node, which it still does if there's no memory for the copy */
+static void dfs_find_enter (struct dfs_find *f, struct dfs_directory *dir)
+{
+    struct dfs_listing_map m = { (struct dfs_node_common **)0, 0 };
+    int_32 d = f->depth;
+
+    f->directories[d]   = dir;
+    f->positions[d]     = 0;
+    f->listings[d]      = (struct dfs_node_common **)0;
+    f->listing_sizes[d] = 0;
+    f->depth++;
+
+    if (dir->index != dfs_index_tree) return;
+
+    tree_map (dir->nodes.tree, dfs_count_listing, (void *)&m);
+
+    if ((m.count == 0) ||
+        ((m.nodes = aalloc (m.count * sizeof (struct dfs_node_common *)))
+             == (struct dfs_node_common **)0))
+    {
+        return;
+    }
+
+    f->listing_sizes[d] = m.count;
+    m.count             = 0;
+
+    tree_map (dir->nodes.tree, dfs_fill_listing, (void *)&m);
+
+    f->listings[d] = m.nodes;
+}
+
+static void dfs_find_leave (struct dfs_find *f)
+{
+    int_32 d = f->depth - 1;
+
+    if (f->listings[d] != (struct dfs_node_common **)0)
+    {
+        afree (f->listing_sizes[d] * sizeof (struct dfs_node_common *),
+               f->listings[d]);
+    }
+
+    f->depth--;
+}
+
+/* the node at the current position in the directory at depth d */
+static struct dfs_node_common *dfs_find_node (struct dfs_find *f, int_32 d)
+{
+    if (f->listings[d] == (struct dfs_node_common **)0)
+    {
+        return dfs_get_node_index (f->directories[d], f->positions[d]);
+    }
+
+    return (f->positions[d] < f->listing_sizes[d])
+         ? f->listings[d][f->positions[d]] : (struct dfs_node_common *)0;
+}
+
+/* puts the path of c, which is in the innermost directory, in f->path */
+static int dfs_find_path (struct dfs_find *f, struct dfs_node_common *c)
+{
+    int_32 length = 0, p = 0;
+
+    for (int_32 i = 1; i < f->depth; i++)
+    {
+        for (char *n = f->directories[i]->c.name; *n != (char)0; n++)
+        {
+            length++;
+        }
+
+        length++;
+    }
+
+    for (char *n = c->name; *n != (char)0; n++)
+    {
+        length++;
+    }
+
+    if ((length + 1) > f->path_size)
+    {
+        char *npath = aalloc (length + 1);
+
+        if (npath == (char *)0) return 0;
+
+        if (f->path != (char *)0)
+        {
+            afree (f->path_size, f->path);
+        }
+
+        f->path      = npath;
+        f->path_size = length + 1;
+    }
+
+    for (int_32 i = 1; i < f->depth; i++)
+    {
+        for (char *n = f->directories[i]->c.name; *n != (char)0; n++)
+        {
+            f->path[p] = *n;
+            p++;
+        }
+
+        f->path[p] = '/';
+        p++;
+    }
+
+    for (char *n = c->name; *n != (char)0; n++)
+    {
+        f->path[p] = *n;
+        p++;
+    }
+
+    f->path[p] = (char)0;
+
+    return 1;
+}
+
+struct dfs_find *dfs_find_create
+        (struct dfs_directory *root, const char *pattern, int_32 types,
+         int_64 min_length, int_64 max_length, int_32 after, int_32 before)
+{
+    static struct memory_pool pool =
+            MEMORY_POOL_INITIALISER(sizeof (struct dfs_find));
+
+    struct dfs_find *f = get_pool_mem (&pool);
+    int_32 length = 0;
+
+    if (f == (struct dfs_find *)0) return (struct dfs_find *)0;
+
+    while (pattern[length] != (char)0) length++;
+
+    f->root         = root;
+    f->pattern_size = length + 1;
+    f->types        = types;
+    f->min_length   = min_length;
+    f->max_length   = max_length;
+    f->after        = after;
+    f->before       = before;
+    f->size          = 8;
+    f->depth         = 0;
+    f->path          = (char *)0;
+    f->path_size     = 0;
+    f->pattern       = aalloc (f->pattern_size);
+    f->directories   = aalloc (f->size * sizeof (struct dfs_directory *));
+    f->positions     = aalloc (f->size * sizeof (int_32));
+    f->listings      = aalloc (f->size * sizeof (struct dfs_node_common **));
+    f->listing_sizes = aalloc (f->size * sizeof (int_32));
+
+    if ((f->pattern == (char *)0) ||
+        (f->directories == (struct dfs_directory **)0) ||
+        (f->positions == (int_32 *)0) ||
+        (f->listings == (struct dfs_node_common ***)0) ||
+        (f->listing_sizes == (int_32 *)0))
+    {
+        dfs_find_destroy (f);
+        return (struct dfs_find *)0;
+    }
+
+    for (int_32 i = 0; i <= length; i++)
+    {
+        f->pattern[i] = pattern[i];
+    }
+
+    dfs_find_rewind (f);
+
+    return f;
+}
+
+struct dfs_node_common *dfs_find_next (struct dfs_find *f)
+{
+    while (f->depth > 0)
+    {
+        int_32 d = f->depth - 1;
+        struct dfs_node_common *c = dfs_find_node (f, d);
+        char match;
+
+        if (c == (struct dfs_node_common *)0)
+        {
+            dfs_find_leave (f);
+            continue;
+        }
+
+        f->positions[d]++;
+
+        /* the path only depends on the directories above the node */
+        match = dfs_find_match (f, c) && dfs_find_path (f, c);
+
+        if ((c->type == dft_directory) &&
+            ((f->depth < f->size) || dfs_find_grow (f)))
+        {
+            dfs_find_enter (f, (struct dfs_directory *)c);
+        }
+
+        if (match)
+        {
+            return c;
+        }
+    }
+
+    return (struct dfs_node_common *)0;
+}
+
+void dfs_find_rewind (struct dfs_find *f)
+{
+    while (f->depth > 0)
+    {
+        dfs_find_leave (f);
+    }
+
+    dfs_find_enter (f, f->root);
+}
+
+void dfs_find_destroy (struct dfs_find *f)
+{
+    if (f->pattern != (char *)0)
+    {
+        afree (f->pattern_size, f->pattern);
+    }
+
+    if (f->directories != (struct dfs_directory **)0)
+    {
+        afree (f->size * sizeof (struct dfs_directory *), f->directories);
+    }
+
+    if (f->positions != (int_32 *)0)
+    {
+        afree (f->size * sizeof (int_32), f->positions);
+    }
+
+    if (f->listings != (struct dfs_node_common ***)0)
+    {
+        while (f->depth > 0)
+        {
+            dfs_find_leave (f);
+        }
+
+        afree (f->size * sizeof (struct dfs_node_common **), f->listings);
+    }
+
+    if (f->listing_sizes != (int_32 *)0)
+    {
+        afree (f->size * sizeof (int_32), f->listing_sizes);
+    }
+
+    if (f->path != (char *)0)
+    {
+        afree (f->path_size, f->path);
+    }
+
+    free_pool_mem (f);
+}
+
+/* statistics */
+
+struct dfs_statistics_map
+{
+    struct dfs_statistics *st;
+    int_64 count;
+};
+
+static void dfs_node_statistics
+        (struct dfs_node_common *c, struct dfs_statistics *st);
+
+static void dfs_tree_node_statistics (struct tree_node *node, void *aux)
+{
+    struct dfs_statistics_map *m = (struct dfs_statistics_map *)aux;
+
+    m->count++;
+    dfs_node_statistics ((struct dfs_node_common *)node_get_value (node),
+                         m->st);
+}
+
+static void dfs_directory_statistics
+        (struct dfs_directory *dir, struct dfs_statistics *st);
+
+static void dfs_node_statistics
+        (struct dfs_node_common *c, struct dfs_statistics *st)
+{
+    st->nodes++;
+
+    switch (c->type)
+    {
+        case dft_directory:
+            st->node_bytes += sizeof (struct dfs_directory);
+            dfs_directory_statistics ((struct dfs_directory *)c, st);
+            break;
+        case dft_file:
+            st->node_bytes += sizeof (struct dfs_file);
+            break;
+        case dft_symlink:
+            st->node_bytes += sizeof (struct dfs_symlink);
+            break;
+        case dft_device:
+            st->node_bytes += sizeof (struct dfs_device);
+            break;
+        case dft_pipe:
+        case dft_socket:
+            st->node_bytes += sizeof (struct dfs_socket);
+            break;
+    }
+}
+
+/* tree indices are walked once, counting their nodes on the way, as
+ * dfs_get_node_index() would walk them again for every node */
+static void dfs_directory_statistics
+        (struct dfs_directory *dir, struct dfs_statistics *st)
+{
+    struct dfs_statistics_map m = { st, 0 };
+
+    st->directories++;
+
+    switch (dir->index)
+    {
+        case dfs_index_vector:
+            if (dir->nodes.vector != (struct dfs_node_common **)0)
+            {
+                st->index_bytes +=
+                    DFS_SMALL_DIRECTORY * sizeof (struct dfs_node_common *);
+            }
+
+            for (int_16 i = 0; i < dir->count; i++)
+            {
+                dfs_node_statistics (dir->nodes.vector[i], st);
+            }
+            break;
+        case dfs_index_tree:
+            tree_map (dir->nodes.tree, dfs_tree_node_statistics, (void *)&m);
+            /* key, two links and the value per node, plus the tree itself */
+            st->index_bytes += sizeof (struct tree) +
+                               m.count * (sizeof (struct tree_node) +
+                                          sizeof (void *));
+            break;
+        case dfs_index_hash:
+            st->index_bytes +=
+                sizeof (struct dfs_hash_index) +
+                dir->nodes.hash->size * sizeof (struct dfs_hash_entry) +
+                dir->nodes.hash->order_size * sizeof (struct dfs_node_common *);
+
+            for (int_32 i = 0; i < dir->nodes.hash->count; i++)
+            {
+                dfs_node_statistics (dir->nodes.hash->order[i], st);
+            }
+            break;
+    }
+}
+
+void dfs_get_statistics (struct dfs *fs, struct dfs_statistics *st)
+{
+    st->nodes       = 0;
+    st->directories = 0;
+    st->node_bytes  = 0;
+    st->index_bytes = 0;
+
+    dfs_node_statistics (&(fs->root->c), st);
+}
+
+/* node constructors */
+
 struct dfs_directory *dfs_mk_directory (struct dfs_directory *dir, char *name)
 {
     static struct memory_pool pool = MEMORY_POOL_INITIALISER(sizeof (struct dfs_directory));
@@ -81,22 +1217,24 @@ struct dfs_directory *dfs_mk_directory (struct dfs_directory *dir, char *name)
 
     if (rv == (struct dfs_directory *)0) return (struct dfs_directory *)0;
 
-    rv->nodes = tree_create();
-    if (rv->nodes == (struct tree *)0)
-    {
-        free_pool_mem (rv);
-        return (struct dfs_directory *)0;
-    }
-
     initialise_dfs_node_common(&(rv->c));
     rv->c.length = (int_64)sizeof(struct dfs_directory);
     rv->c.type = dft_directory;
     rv->c.name = (char *)str_immutable(name);
 
+    rv->nodes.vector = (struct dfs_node_common **)0;
+    rv->count        = 0;
+    rv->index        = dfs_index_vector;
+
     if (dir != (struct dfs_directory *)0)
     {
         rv->parent = dir;
-        tree_add_node_string_value (dir->nodes, name, (void *)rv);
+
+        if (!dfs_add_node (dir, name, &(rv->c)))
+        {
+            free_pool_mem (rv);
+            return (struct dfs_directory *)0;
+        }
     }
     else
     {
@@ -118,12 +1256,18 @@ struct dfs_file *dfs_mk_file (struct dfs_directory *dir, char *name, char *tfile
     rv->c.type = dft_file;
     rv->c.name = (char *)str_immutable(name);
 
+    rv->path = (tfile == (char *)0) ? (char *)0 : (char *)str_immutable(tfile);
     rv->data = tbuffer;
+    rv->extent = (struct dfs_extent *)0;
     rv->c.length = tlength;
     rv->on_read = on_read;
     rv->on_write = on_write;
 
-    tree_add_node_string_value (dir->nodes, name, (void *)rv);
+    if (!dfs_add_node (dir, name, &(rv->c)))
+    {
+        free_pool_mem (rv);
+        return (struct dfs_file *)0;
+    }
 
     return rv;
 }
@@ -141,7 +1285,11 @@ struct dfs_symlink *dfs_mk_symlink (struct dfs_directory *dir, char *name, char
     rv->c.name = (char *)str_immutable(name);
     rv->symlink = (char *)str_immutable(linkcontent);
 
-    tree_add_node_string_value (dir->nodes, name, (void *)rv);
+    if (!dfs_add_node (dir, name, &(rv->c)))
+    {
+        free_pool_mem (rv);
+        return (struct dfs_symlink *)0;
+    }
 
     return rv;
 }
@@ -161,7 +1309,11 @@ struct dfs_device *dfs_mk_device (struct dfs_directory *dir, char *name, enum df
     rv->majour = majour;
     rv->minor = minor;
 
-    tree_add_node_string_value (dir->nodes, name, (void *)rv);
+    if (!dfs_add_node (dir, name, &(rv->c)))
+    {
+        free_pool_mem (rv);
+        return (struct dfs_device *)0;
+    }
 
     return rv;
 }
@@ -178,7 +1330,11 @@ struct dfs_socket *dfs_mk_pipe (struct dfs_directory *dir, char *name)
     rv->c.type = dft_pipe;
     rv->c.name = (char *)str_immutable(name);
 
-    tree_add_node_string_value (dir->nodes, name, (void *)rv);
+    if (!dfs_add_node (dir, name, &(rv->c)))
+    {
+        free_pool_mem (rv);
+        return (struct dfs_socket *)0;
+    }
 
     return rv;
 }
@@ -195,7 +1351,11 @@ struct dfs_socket *dfs_mk_socket (struct dfs_directory *dir, char *name)
     rv->c.type = dft_socket;
     rv->c.name = (char *)str_immutable(name);
 
-    tree_add_node_string_value (dir->nodes, name, (void *)rv);
+    if (!dfs_add_node (dir, name, &(rv->c)))
+    {
+        free_pool_mem (rv);
+        return (struct dfs_socket *)0;
+    }
 
     return rv;
 }
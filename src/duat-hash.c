@@ -0,0 +1,217 @@
+/**\file
+ * \brief Duat content hashes
+ *
+ * \copyright
+ * Copyright (c) 2008-2014, Kyuba Project Members
+ * \copyright
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * \copyright
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * \copyright
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \see Project Documentation: http://ef.gy/documentation/duat
+ * \see Project Source Code: http://git.becquerel.org/kyuba/duat.git
+ */
+
+#include <duat/hash.h>
+
+/**\brief SHA-256 Round Constants */
+static const unsigned int dhash_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void dhash_block (struct dhash *h, const unsigned char *b)
+{
+    unsigned int w[64], s[8], i;
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = ((unsigned int)b[i * 4]     << 24) |
+               ((unsigned int)b[i * 4 + 1] << 16) |
+               ((unsigned int)b[i * 4 + 2] << 8)  |
+                (unsigned int)b[i * 4 + 3];
+    }
+
+    for (; i < 64; i++)
+    {
+        unsigned int s0 = ROTR (w[i - 15], 7) ^ ROTR (w[i - 15], 18) ^
+                          (w[i - 15] >> 3);
+        unsigned int s1 = ROTR (w[i - 2], 17) ^ ROTR (w[i - 2], 19) ^
+                          (w[i - 2] >> 10);
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        s[i] = h->state[i];
+    }
+
+    for (i = 0; i < 64; i++)
+    {
+        unsigned int t1 = s[7] +
+                          (ROTR (s[4], 6) ^ ROTR (s[4], 11) ^ ROTR (s[4], 25)) +
+                          ((s[4] & s[5]) ^ (~s[4] & s[6])) + dhash_k[i] + w[i];
+        unsigned int t2 = (ROTR (s[0], 2) ^ ROTR (s[0], 13) ^ ROTR (s[0], 22)) +
+                          ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+        s[7] = s[6];
+        s[6] = s[5];
+        s[5] = s[4];
+        s[4] = s[3] + t1;
+        s[3] = s[2];
+        s[2] = s[1];
+        s[1] = s[0];
+        s[0] = t1 + t2;
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        h->state[i] += s[i];
+    }
+}
+
+void dhash_init (struct dhash *h)
+{
+    h->state[0] = 0x6a09e667;
+    h->state[1] = 0xbb67ae85;
+    h->state[2] = 0x3c6ef372;
+    h->state[3] = 0xa54ff53a;
+    h->state[4] = 0x510e527f;
+    h->state[5] = 0x9b05688c;
+    h->state[6] = 0x1f83d9ab;
+    h->state[7] = 0x5be0cd19;
+    h->length   = 0;
+}
+
+void dhash_update (struct dhash *h, const int_8 *data, int_64 length)
+{
+    const unsigned char *d = (const unsigned char *)data;
+    int_32 used = (int_32)(h->length % 64);
+
+    h->length += length;
+
+    /* top up a partial block first, then hash whole blocks in place */
+    if (used > 0)
+    {
+        while ((used < 64) && (length > 0))
+        {
+            h->buffer[used] = *d;
+            used++;
+            d++;
+            length--;
+        }
+
+        if (used < 64) return;
+
+        dhash_block (h, h->buffer);
+    }
+
+    for (; length >= 64; d += 64, length -= 64)
+    {
+        dhash_block (h, d);
+    }
+
+    for (used = 0; used < length; used++)
+    {
+        h->buffer[used] = d[used];
+    }
+}
+
+void dhash_final (struct dhash *h, int_8 *digest)
+{
+    int_64 bits = h->length * 8;
+    int_32 used = (int_32)(h->length % 64), i;
+
+    h->buffer[used] = 0x80;
+    used++;
+
+    if (used > 56)
+    {
+        while (used < 64) h->buffer[used++] = 0;
+
+        dhash_block (h, h->buffer);
+        used = 0;
+    }
+
+    while (used < 56) h->buffer[used++] = 0;
+
+    for (i = 0; i < 8; i++)
+    {
+        h->buffer[56 + i] = (unsigned char)((bits >> (56 - (i * 8))) & 0xff);
+    }
+
+    dhash_block (h, h->buffer);
+
+    for (i = 0; i < 8; i++)
+    {
+        digest[i * 4]     = (int_8)((h->state[i] >> 24) & 0xff);
+        digest[i * 4 + 1] = (int_8)((h->state[i] >> 16) & 0xff);
+        digest[i * 4 + 2] = (int_8)((h->state[i] >> 8)  & 0xff);
+        digest[i * 4 + 3] = (int_8)( h->state[i]        & 0xff);
+    }
+}
+
+void dhash (const int_8 *data, int_64 length, int_8 *digest)
+{
+    struct dhash h;
+
+    dhash_init   (&h);
+    dhash_update (&h, data, length);
+    dhash_final  (&h, digest);
+}
+
+int_32 dhash_weak (const int_8 *data, int_32 length)
+{
+    const unsigned char *d = (const unsigned char *)data;
+    unsigned int a = 0, b = 0;
+
+    for (int_32 i = 0; i < length; i++)
+    {
+        a += d[i];
+        b += a;
+    }
+
+    return (int_32)(((b & 0xffff) << 16) | (a & 0xffff));
+}
+
+int_32 dhash_roll (int_32 weak, int_32 length, int_8 out, int_8 in)
+{
+    unsigned int a = ((unsigned int)weak) & 0xffff;
+    unsigned int b = (((unsigned int)weak) >> 16) & 0xffff;
+
+    a = a - (unsigned char)out + (unsigned char)in;
+    b = b - ((unsigned int)length * (unsigned char)out) + a;
+
+    return (int_32)(((b & 0xffff) << 16) | (a & 0xffff));
+}